@@ -3,14 +3,25 @@ LOCAL_PATH:= $(call my-dir)
 include $(CLEAR_VARS)
 
 BUILD_IPC-MODEMCTRL := true
+# Debug logging and hex dumps, user builds only keep errors and warnings
+ifeq ($(TARGET_BUILD_VARIANT),user)
+DEBUG := false
+else
 DEBUG := true
+endif
+# Modem and tun I/O through io_uring, needs kernel headers with linux/io_uring.h
+IO_URING := false
 
 LOCAL_MODULE := libmocha-ipc
 LOCAL_MODULE_TAGS := optional debug
 
 mocha-ipc_files := \
 	mocha-ipc/ipc.c \
+	mocha-ipc/ipc_frame.c \
+	mocha-ipc/ipc_ring.c \
+	mocha-ipc/ipc_uring.c \
 	mocha-ipc/ipc_dispatch.c \
+	mocha-ipc/ipc_capture.c \
 	mocha-ipc/misc.c \
 	mocha-ipc/util.c \
 	mocha-ipc/fm.c \
@@ -30,7 +41,9 @@ mocha-ipc_files := \
 	mocha-ipc/tapi_dmh.c \
 	mocha-ipc/tapi_config.c \
 	mocha-ipc/bt.c \
-	mocha-ipc/device/$(TARGET_DEVICE)/$(TARGET_DEVICE)_ipc.c
+	mocha-ipc/device/$(TARGET_DEVICE)/$(TARGET_DEVICE)_ipc.c \
+	mocha-ipc/device/loopback/loopback_ipc.c \
+	mocha-ipc/device/replay/replay_ipc.c
 
 
 ifeq ($(TARGET_DEVICE),jet)
@@ -47,6 +60,10 @@ ifeq ($(DEBUG),true)
 	LOCAL_CFLAGS += -DLOG_STDOUT
 endif
 
+ifeq ($(IO_URING),true)
+	LOCAL_CFLAGS += -DIPC_IO_URING
+endif
+
 LOCAL_SRC_FILES := $(mocha-ipc_files) $(device_files)
 
 LOCAL_SHARED_LIBRARIES := libutils
@@ -72,8 +89,6 @@ ifeq ($(TARGET_DEVICE),wave)
 	LOCAL_CFLAGS += -DDEVICE_WAVE
 endif
 
-DEBUG := true
-
 ifeq ($(DEBUG),true)
 	LOCAL_CFLAGS += -DDEBUG
 	LOCAL_CFLAGS += -DDEBUG_INFO
@@ -98,11 +113,63 @@ LOCAL_C_INCLUDES := $(LOCAL_PATH)/include
 
 include $(BUILD_EXECUTABLE)
 
-endif
+include $(CLEAR_VARS)
+
+LOCAL_MODULE := ipc-loopbackcp
+LOCAL_MODULE_TAGS := optional debug
+
+LOCAL_SRC_FILES := tools/loopbackcp.c
+
+LOCAL_STATIC_LIBRARIES := libmocha-ipc
+
+LOCAL_SHARED_LIBRARIES := \
+	libcutils \
+	liblog \
+	libutils
+
+LOCAL_C_INCLUDES := $(LOCAL_PATH)/include
+
+include $(BUILD_EXECUTABLE)
 
 include $(CLEAR_VARS)
 
-DEBUG := true
+LOCAL_MODULE := ipc-capconv
+LOCAL_MODULE_TAGS := optional debug
+
+LOCAL_SRC_FILES := tools/capconv.c
+
+LOCAL_STATIC_LIBRARIES := libmocha-ipc
+
+LOCAL_SHARED_LIBRARIES := \
+	libcutils \
+	liblog \
+	libutils
+
+LOCAL_C_INCLUDES := $(LOCAL_PATH)/include
+
+include $(BUILD_EXECUTABLE)
+
+include $(CLEAR_VARS)
+
+LOCAL_MODULE := ipc-replay
+LOCAL_MODULE_TAGS := optional debug
+
+LOCAL_SRC_FILES := tools/replay.c
+
+LOCAL_STATIC_LIBRARIES := libmocha-ipc
+
+LOCAL_SHARED_LIBRARIES := \
+	libcutils \
+	liblog \
+	libutils
+
+LOCAL_C_INCLUDES := $(LOCAL_PATH)/include
+
+include $(BUILD_EXECUTABLE)
+
+endif
+
+include $(CLEAR_VARS)
 
 ifeq ($(DEBUG),true)
 	LOCAL_CFLAGS += -DDEBUG
@@ -113,7 +180,14 @@ endif
 mocha-ril_files := \
 	mocha-ril/mocha-ril.c \
 	mocha-ril/client.c \
+	mocha-ril/event.c \
 	mocha-ril/ipc.c \
+	mocha-ril/ipc_tx.c \
+	mocha-ril/worker.c \
+	mocha-ril/delivery.c \
+	mocha-ril/timer.c \
+	mocha-ril/state.c \
+	mocha-ril/gso.c \
 	mocha-ril/srs.c \
 	mocha-ril/pwr.c \
 	mocha-ril/call.c \
@@ -134,12 +208,22 @@ LOCAL_STATIC_LIBRARIES := libmocha-ipc
 # for asprinf
 LOCAL_CFLAGS := -D_GNU_SOURCE
 
+# Messages above this level are compiled out, see include/types.h
+ifeq ($(DEBUG),true)
+	LOCAL_CFLAGS += -DIPC_LOG_LEVEL_MAX=4
+else
+	LOCAL_CFLAGS += -DIPC_LOG_LEVEL_MAX=1
+endif
+
 ifeq ($(TARGET_DEVICE),jet)
 	LOCAL_CFLAGS += -DDEVICE_JET
 endif
 ifeq ($(TARGET_DEVICE),wave)
 	LOCAL_CFLAGS += -DDEVICE_WAVE
 endif
+ifeq ($(IO_URING),true)
+	LOCAL_CFLAGS += -DIPC_IO_URING
+endif
 
 LOCAL_C_INCLUDES := external/bada-modemril/libmocha-ipc/include
 LOCAL_C_INCLUDES += hardware/ril/libmocha-ipc/include
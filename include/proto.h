@@ -154,6 +154,9 @@ typedef struct {
 	uint8_t netBuf[0];
 } __attribute__((__packed__)) protoTransferDataBuf;
 
+/* Where the IP packet starts in a buffer handed to proto_build_data */
+#define PROTO_DATA_HEADROOM	(IPC_FRAME_HEADROOM + sizeof(struct protoPacketHeader) + sizeof(protoTransferDataBuf))
+
 void ipc_parse_proto(struct ipc_client* client, struct modem_io *ipc_frame);
 
 void proto_send_packet(struct protoPacket* protoReq);
@@ -163,5 +166,7 @@ void proto_stop_network(protoStopNetwork* stopNetwork);
 void proto_ds_network_resp(uint8_t* buf);
 void proto_some_unload_function(uint32_t buf);
 void proto_send_data(uint16_t opMode, uint16_t protoType, uint32_t contextId, uint32_t netBufLen, uint8_t *netBuf);
+void proto_build_data(uint16_t opMode, uint16_t protoType, uint32_t contextId, uint8_t *buf, uint32_t netBufLen, struct iovec *iov);
+protoTransferDataBuf *proto_data_ind(struct modem_io *ipc_frame);
 
 #endif
@@ -25,6 +25,7 @@
 
 #include <stdint.h>
 #include <stdio.h>
+#include <sys/uio.h>
 
 #include "types.h"
 #include "util.h"
@@ -33,6 +34,8 @@ enum ipc_device_enum
 {
 	IPC_DEVICE_JET = 0,
 	IPC_DEVICE_WAVE,
+	IPC_DEVICE_LOOPBACK,
+	IPC_DEVICE_REPLAY,
 	IPC_DEVICE_LAST
 };
 
@@ -43,11 +46,72 @@ struct fifoPacketHeader
 	uint32_t datasize;
 };
 
+/* Room a sender leaves before a frame's data for the FIFO header */
+#define IPC_FRAME_HEADROOM	sizeof(struct fifoPacketHeader)
+
+/* Announces a frame split over several FIFO_PKT_FIFO_INTERNAL chunks */
+struct multiPacketHeader {
+	uint32_t command;
+	uint32_t packtLen;
+	uint32_t packetType;
+};
+
+struct ipc_frame_buf;
+
 struct modem_io {
 	uint32_t magic;
 	uint32_t cmd;
 	uint32_t datasize;
 	uint8_t *data;
+	/* Receive buffer backing data, not seen by the modem driver */
+	struct ipc_frame_buf *buf;
+};
+
+/* One frame of a batch handed to ipc_client_send_batch */
+struct ipc_frame_iov {
+	uint32_t cmd;
+	struct iovec *iov;
+	int iovcnt;
+	/* iov[0] has IPC_FRAME_HEADROOM writable bytes before it */
+	int headroom;
+};
+
+struct ipc_frame_pool_stats {
+	uint32_t size;
+	uint32_t in_use;
+	uint32_t high_water;
+	uint32_t allocs;
+	uint32_t misses;
+};
+
+struct ipc_transport_stats {
+	uint32_t read_calls;
+	uint32_t bytes;
+	uint32_t frames;
+	uint32_t resyncs;
+	uint32_t skipped;
+	uint32_t dropped;
+	uint32_t write_calls;
+	/* read/write/writev or io_uring_enter calls made for the above */
+	uint32_t syscalls;
+	int uring;
+};
+
+struct ipc_uring_stats {
+	uint32_t enters;
+	uint32_t reads;
+	uint32_t writes;
+	uint32_t read_bytes;
+	uint32_t write_bytes;
+};
+
+struct ipc_reassembly_stats {
+	uint32_t completed;
+	uint32_t dropped;
+	uint32_t oversize;
+	uint32_t last_latency_us;
+	uint32_t max_latency_us;
+	uint64_t total_latency_us;
 };
 
 enum ipc_ril_cb_type {
@@ -106,6 +170,7 @@ typedef void (*ipc_ril_cb)(void* data);
 typedef void (*ipc_client_log_handler_cb)(const char *message, void *user_data);
 
 typedef int (*ipc_io_handler_cb)(void *data, unsigned int size, void *io_data);
+typedef int (*ipc_iov_handler_cb)(struct iovec *iov, int iovcnt, void *io_data);
 typedef int (*ipc_handler_cb)(void *data);
 
 struct ipc_client;
@@ -119,6 +184,37 @@ void ipc_shutdown(void);
 void ipc_register_ril_cb(int type, ipc_ril_cb cb);
 void ipc_invoke_ril_cb(int type, void* data);
 
+/*
+ * Dispatch registry: a direct-indexed table of FIFO packet types, and for
+ * TAPI a table of functions per service. A TAPI function without its own
+ * handler goes to the handler registered for its whole service. Every
+ * entry counts its packets and the time spent in its handler.
+ */
+typedef void (*ipc_fifo_handler_cb)(struct ipc_client *client, struct modem_io *ipc_frame);
+typedef void (*ipc_tapi_service_cb)(uint16_t function, uint32_t length, uint8_t *data);
+typedef void (*ipc_tapi_handler_cb)(uint32_t length, uint8_t *data);
+
+/* FIFO entries have service and function at -1, service entries function at -1 */
+struct ipc_dispatch_stats {
+	const char *name;
+	uint32_t cmd;
+	int service;
+	int function;
+	uint32_t count;
+	uint64_t time_ns;
+};
+
+void ipc_dispatch_init(void);
+int ipc_register_fifo_handler(uint32_t cmd, ipc_fifo_handler_cb handler, const char *name);
+int ipc_register_tapi_service(uint16_t service, ipc_tapi_service_cb handler, const char *name);
+int ipc_register_tapi_handler(uint16_t service, uint16_t function, ipc_tapi_handler_cb handler, const char *name);
+int ipc_register_tapi_ril_cb(uint16_t service, uint16_t function, int type, const char *name);
+int ipc_dispatch_tapi(uint16_t service, uint16_t function, uint32_t length, uint8_t *data);
+int ipc_dispatch_get_stats(struct ipc_dispatch_stats *stats, int count);
+
+/* MOCHA_IPC_DEVICE (jet, wave, loopback or replay) overrides the detected device */
+#define IPC_DEVICE_ENV "MOCHA_IPC_DEVICE"
+
 struct ipc_client* ipc_client_new();
 struct ipc_client *ipc_client_new_for_device(int device_type);
 int ipc_client_free(struct ipc_client *client);
@@ -143,21 +239,169 @@ int ipc_client_close(struct ipc_client *client);
 int ipc_client_power_on(struct ipc_client *client);
 int ipc_client_power_off(struct ipc_client *client);
 
+/*
+ * Returns 0 when a frame was received, 1 when the data read was consumed
+ * internally (e.g. a multi-packet chunk) or, on a non-blocking client, when
+ * no complete frame is in yet, and there is nothing to dispatch.
+ */
 int ipc_client_recv(struct ipc_client *client, struct modem_io *ipc_frame);
+/* Receives up to max frames, returns how many were stored in frames */
+int ipc_client_recv_batch(struct ipc_client *client, struct modem_io *frames, int max);
+/* Non-zero when a frame is already buffered and recv won't need the fd */
+int ipc_client_recv_pending(struct ipc_client *client);
+int ipc_client_get_transport_stats(struct ipc_client *client, struct ipc_transport_stats *stats);
+int ipc_client_set_nonblocking(struct ipc_client *client);
+/* The fd to wait on before ipc_client_recv, not always the device's */
+int ipc_client_get_poll_fd(struct ipc_client *client);
+
+/* Received frames are refcounted, release them with ipc_frame_unref */
+void ipc_frame_ref(struct modem_io *frame);
+void ipc_frame_unref(struct modem_io *frame);
+/* Before ipc_client_open only */
+int ipc_client_set_frame_pool_size(struct ipc_client *client, uint32_t count);
+
+/* Frame pools for senders that build their frames in place */
+struct ipc_frame_pool;
+struct ipc_frame_pool *ipc_frame_pool_new(uint32_t count, uint32_t frame_size);
+void ipc_frame_pool_free(struct ipc_frame_pool *pool);
+int ipc_frame_alloc(struct ipc_frame_pool *pool, struct modem_io *frame, uint32_t size);
+int ipc_frame_pool_get_stats(struct ipc_frame_pool *pool, struct ipc_frame_pool_stats *stats);
+int ipc_client_get_frame_pool_stats(struct ipc_client *client, struct ipc_frame_pool_stats *stats);
+int ipc_client_set_reassembly_limit(struct ipc_client *client, uint32_t limit);
+int ipc_client_get_reassembly_stats(struct ipc_client *client, struct ipc_reassembly_stats *stats);
 
 /* Convenience functions for ipc_send */
 int ipc_client_send(struct ipc_client *client, struct modem_io *ipc_frame);
+int ipc_client_sendv(struct ipc_client *client, uint32_t cmd, struct iovec *iov, int iovcnt);
+int ipc_client_send_batch(struct ipc_client *client, struct ipc_frame_iov *frames, int count);
 void ipc_client_send_get(struct ipc_client *client, const unsigned short command, unsigned char mseq);
 void ipc_client_send_exec(struct ipc_client *client, const unsigned short command, unsigned char mseq);
 
 /* Utility functions */
+uint32_t ipc_iov_length(struct iovec *iov, int iovcnt);
+void ipc_iov_flatten(struct iovec *iov, int iovcnt, uint8_t *buf);
 void imei_bcd2ascii(char* out, const uint8_t* in);
 void imsi_bcd2ascii(char* out, const uint8_t* in, int len);
 void bcd2ascii(char* out, const uint8_t* in, int size);
 void ipc_hex_dump(struct ipc_client *client, void *data, int size);
+int ipc_hex_dump_line(char *line, const uint8_t *data, uint32_t offset, int count);
+int ipc_log_set_level(int module, int level);
+int ipc_log_set_levels(const char *spec);
 void *ipc_mtd_read(struct ipc_client *client, char *mtd_name, int size, int block_size);
 void *ipc_file_read(struct ipc_client *client, char *file_name, int size, int block_size);
 
+/*
+ * io_uring I/O, only when built with IPC_IO_URING and not turned off with
+ * MOCHA_IPC_URING=0. ipc_uring_new returns NULL when it can't be used and
+ * the caller sticks to plain syscalls.
+ */
+#define IPC_URING_ENV "MOCHA_IPC_URING"
+
+struct ipc_uring;
+
+int ipc_uring_enabled(void);
+struct ipc_uring *ipc_uring_new(int read_fd, uint32_t buf_size);
+void ipc_uring_free(struct ipc_uring *uring);
+int ipc_uring_fd(struct ipc_uring *uring);
+int ipc_uring_read(struct ipc_uring *uring, void *data, uint32_t size, int wait);
+int ipc_uring_pending(struct ipc_uring *uring);
+int ipc_uring_queue_write(struct ipc_uring *uring, int fd, struct iovec *iov, int iovcnt);
+int ipc_uring_submit(struct ipc_uring *uring);
+int ipc_uring_writev(struct ipc_uring *uring, int fd, struct iovec *iov, int iovcnt);
+int ipc_uring_get_stats(struct ipc_uring *uring, struct ipc_uring_stats *stats);
+
+/*
+ * Binary capture of every frame sent or received. A capture file is the
+ * header below followed by header.used bytes of records, each record is
+ * padded to 8 bytes and followed by caplen bytes of payload. Fields are
+ * in host byte order, tools/capconv converts to text or pcap-ng.
+ */
+#define IPC_CAPTURE_MAGIC	"MOCHACAP"
+#define IPC_CAPTURE_VERSION	1
+#define IPC_CAPTURE_SNAPLEN_ALL	0xffffffff
+/* Smallest file ipc_capture_start accepts, in empty records */
+#define IPC_CAPTURE_MIN_RECORDS	64
+
+enum ipc_capture_direction {
+	IPC_CAPTURE_TX = 0,
+	IPC_CAPTURE_RX,
+};
+
+struct ipc_capture_file_header {
+	char magic[8];
+	uint16_t version;
+	uint16_t header_size;
+	uint32_t file_size;
+	uint32_t used;
+	uint32_t records;
+	uint64_t start_ns;
+} __attribute__((__packed__));
+
+struct ipc_capture_record {
+	/* Record size including the payload and padding */
+	uint32_t length;
+	uint32_t caplen;
+	/* CLOCK_REALTIME */
+	uint64_t time_ns;
+	uint8_t direction;
+	uint8_t reserved[3];
+	/* FIFO header, datasize is the size before truncation */
+	uint32_t magic;
+	uint32_t cmd;
+	uint32_t datasize;
+} __attribute__((__packed__));
+
+struct ipc_capture_stats {
+	uint32_t records;
+	uint32_t truncated;
+	uint32_t dropped;
+	uint32_t rotations;
+	uint64_t bytes;
+};
+
+/* Checked before building a capture record, so capture costs nothing when off */
+extern volatile int ipc_capture_active;
+
+int ipc_capture_start(const char *path, uint32_t file_size, int files);
+void ipc_capture_stop(void);
+int ipc_capture_set_snaplen(int cmd, uint32_t snaplen);
+int ipc_capture_set_snaplens(const char *spec);
+void ipc_capture_frame(int direction, struct modem_io *frame);
+void ipc_capture_framev(int direction, uint32_t magic, uint32_t cmd, struct iovec *iov, int iovcnt);
+int ipc_capture_get_stats(struct ipc_capture_stats *stats);
+
+/*
+ * Replay device: received frames come from capture files, in the order
+ * given, and sent frames go nowhere but are compared with the frames the
+ * capture recorded as sent. MOCHA_IPC_REPLAY lists the captures
+ * ("path[,path...]") when ipc_replay_add_trace wasn't called before open.
+ */
+#define IPC_REPLAY_ENV "MOCHA_IPC_REPLAY"
+
+/* Hand out frames at their recorded pace rather than as fast as possible */
+#define IPC_REPLAY_REALTIME	(1 << 0)
+
+struct ipc_replay_stats {
+	uint32_t frames;
+	uint64_t bytes;
+	/* Truncated in the capture, so not replayed */
+	uint32_t skipped;
+	uint32_t tx_frames;
+	uint32_t tx_matched;
+	uint32_t tx_mismatched;
+	/* Sent beyond what the capture has, and recorded but never sent */
+	uint32_t tx_extra;
+	uint32_t tx_missing;
+	/* From the first frame handed out to the last */
+	uint64_t elapsed_ns;
+	/* IPC_REPLAY_REALTIME only, how late frames were handed out */
+	uint32_t max_lag_us;
+};
+
+int ipc_replay_add_trace(struct ipc_client *client, const char *path);
+int ipc_replay_set_flags(struct ipc_client *client, int flags);
+int ipc_replay_get_stats(struct ipc_client *client, struct ipc_replay_stats *stats);
+
 #ifndef RIL_SHLIB
 
 struct ipc_client *client;
@@ -177,6 +421,11 @@ static inline void ipc_send(struct modem_io *ipc_frame)
 	ipc_client_send(client, ipc_frame);
 }
 
+static inline void ipc_sendv(uint32_t cmd, struct iovec *iov, int iovcnt)
+{
+	ipc_client_sendv(client, cmd, iov, iovcnt);
+}
+
 static inline int ipc_modem_io(void *data, uint32_t cmd)
 {
 	return ipc_client_modem_operations(client, data, cmd);
@@ -185,6 +434,7 @@ static inline int ipc_modem_io(void *data, uint32_t cmd)
 #else
 	extern void hex_dump(void *data, int size);
 	extern void ipc_send(struct modem_io *ipc_frame);
+	extern void ipc_sendv(uint32_t cmd, struct iovec *iov, int iovcnt);
 	extern int ipc_modem_io(void *data, uint32_t cmd);
 
 #endif //RIL_SHLIB
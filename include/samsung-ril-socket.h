@@ -32,6 +32,8 @@
 
 #define SRS_CONTROL			0x01
 #define SRS_CONTROL_PING		0x0101
+/* Data is an ril.ipc.capture spec, empty to stop capturing */
+#define SRS_CONTROL_CAPTURE		0x0102
 
 #define SRS_SND				0x02
 #define SRS_SND_SET_VOLUME		0x0201
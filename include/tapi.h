@@ -45,6 +45,7 @@ struct tapiPacket {
 void ipc_parse_tapi(struct ipc_client* client, struct modem_io *ipc_frame);
 
 void tapi_init(void);
+void tapi_register(void);
 void modem_execute_tapi_init(void);
 
 void tapi_send_packet(struct tapiPacket* tapiReq);
@@ -143,6 +143,7 @@ typedef struct{
 	uint8_t emergencyCategory;
 } __attribute__((__packed__)) tapiCallSetup;
 
+void tapi_call_register(void);
 void tapi_call_parser(uint16_t tapiCallType, uint32_t tapiCallLength, uint8_t *tapiCallData);
 void tapi_call_release(uint8_t callType,uint32_t callId, uint8_t releaseCause);
 void tapi_call_answer(uint8_t callType, uint32_t callId);
@@ -103,6 +103,7 @@ typedef struct {
 } __attribute__((__packed__)) tapiNettextCallBack;
 
 
+void tapi_nettext_register(void);
 void tapi_nettext_parser(uint16_t tapiNettextType, uint32_t tapiNettextLength, uint8_t *tapiNettextData);
 
 void tapi_nettext_set_mem_available(uint32_t bMemAvail);
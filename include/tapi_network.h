@@ -150,6 +150,7 @@ typedef struct {
 	char name[64];
 } __attribute__((__packed__)) tapiNetSearchCnf;
 
+void tapi_network_register(void);
 void tapi_network_parser(uint16_t tapiNetworkType, uint32_t tapiNetworkLength, uint8_t *tapiNetworkData);
 
 
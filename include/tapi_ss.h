@@ -64,6 +64,7 @@ typedef struct {
 	char rspString[0xB8]; 
 } __attribute__((__packed__)) tapiSsResponse;
 
+void tapi_ss_register(void);
 void tapi_ss_parser(uint16_t tapiSsType, uint32_t tapiSsLength, uint8_t *tapiSsData);
 void tapi_ss_send_ussd_string_request(tapiSsSendUssd* ussd_req);
 void tapi_ss_ussd_resp(tapiSsResponse* ussd_req);
@@ -33,42 +33,85 @@
 #define LOG_FILE stderr
 #endif
 
-#ifdef RIL_SHLIB
-#define DEBUG_E(...) LOGE(__VA_ARGS__)
-#define DEBUG_W(...) LOGW(__VA_ARGS__)
-#define DEBUG_I(...) LOGI(__VA_ARGS__)
+/*
+ * Log levels. Messages above IPC_LOG_LEVEL_MAX are compiled out, the
+ * others are checked against the runtime level of their module, so a
+ * disabled message costs one compare and never formats its arguments.
+ * Per-packet messages on the data and dispatch paths use VERBOSE.
+ */
+#define IPC_LOG_NONE		-1
+#define IPC_LOG_ERROR		0
+#define IPC_LOG_WARNING		1
+#define IPC_LOG_INFO		2
+#define IPC_LOG_DEBUG		3
+#define IPC_LOG_VERBOSE		4
+
+#ifndef IPC_LOG_LEVEL_MAX
+#if defined(RIL_SHLIB)
+#define IPC_LOG_LEVEL_MAX	IPC_LOG_VERBOSE
+#elif defined(DEBUG_ERROR)
+#define IPC_LOG_LEVEL_MAX	IPC_LOG_ERROR
+#elif defined(DEBUG_WARNING)
+#define IPC_LOG_LEVEL_MAX	IPC_LOG_WARNING
+#elif defined(DEBUG_INFO)
+#define IPC_LOG_LEVEL_MAX	IPC_LOG_VERBOSE
 #else
+#define IPC_LOG_LEVEL_MAX	IPC_LOG_NONE
+#endif
+#endif
 
-#ifdef DEBUG_ERROR
-#define DEBUG_E(x, args ...) fprintf(LOG_FILE, "[%s:%u] ERROR: " \
-x, __FUNCTION__ ,__LINE__, ## args)
-#define DEBUG_W(x, args ...)
-#define DEBUG_I(x, args ...)
+/* A file picks its module by defining IPC_LOG_MODULE before any include */
+enum ipc_log_module {
+	IPC_LOG_CORE,
+	IPC_LOG_TAPI,
+	IPC_LOG_PROTO,
+	IPC_LOG_SIM,
+	IPC_LOG_MISC,
+	IPC_LOG_RIL,
+	IPC_LOG_GPRS,
+	IPC_LOG_MODULE_COUNT
+};
+
+#ifndef IPC_LOG_MODULE
+#define IPC_LOG_MODULE		IPC_LOG_CORE
+#endif
+
+extern signed char ipc_log_levels[IPC_LOG_MODULE_COUNT];
+
+#define IPC_LOG_ENABLED(module, level) \
+	((level) <= IPC_LOG_LEVEL_MAX && (level) <= ipc_log_levels[module])
+#define IPC_LOG_ON(level)	IPC_LOG_ENABLED(IPC_LOG_MODULE, level)
+
+#ifdef RIL_SHLIB
+#define IPC_LOG_PRINT_E(...) LOGE(__VA_ARGS__)
+#define IPC_LOG_PRINT_W(...) LOGW(__VA_ARGS__)
+#define IPC_LOG_PRINT_I(...) LOGI(__VA_ARGS__)
+#define IPC_LOG_PRINT_V(...) LOGV(__VA_ARGS__)
 #else
-#ifdef DEBUG_WARNING
-#define DEBUG_E(x, args ...) fprintf(LOG_FILE, "[%s:%u] ERROR: " \
+#define IPC_LOG_PRINT_E(x, args ...) fprintf(LOG_FILE, "[%s:%u] ERROR: " \
 x, __FUNCTION__ ,__LINE__, ## args)
-#define DEBUG_W(x, args ...) fprintf(LOG_FILE, "[%s:%u] WARNING: " \
+#define IPC_LOG_PRINT_W(x, args ...) fprintf(LOG_FILE, "[%s:%u] WARNING: " \
 x, __FUNCTION__ ,__LINE__, ## args)
-#define DEBUG_I(x, args ...)
-#else
-#ifdef DEBUG_INFO
-#define DEBUG_E(x, args ...) fprintf(LOG_FILE, "[%s:%u] ERROR: " \
-x, __FUNCTION__ ,__LINE__, ## args)
-#define DEBUG_W(x, args ...) fprintf(LOG_FILE, "[%s:%u] WARNING: " \
+#define IPC_LOG_PRINT_I(x, args ...) fprintf(LOG_FILE, "[%s:%u] INFO: " \
 x, __FUNCTION__ ,__LINE__, ## args)
-#define DEBUG_I(x, args ...) fprintf(LOG_FILE, "[%s:%u] INFO: " \
+#define IPC_LOG_PRINT_V(x, args ...) fprintf(LOG_FILE, "[%s:%u] VERBOSE: " \
 x, __FUNCTION__ ,__LINE__, ## args)
-#else
-#define DEBUG_E(x, args ...)
-#define DEBUG_W(x, args ...)
-#define DEBUG_I(x, args ...)
-#endif
-#endif
-#endif
-
 #endif //RIL_SHLIB
 
+#define DEBUG_E(...) do { if(IPC_LOG_ON(IPC_LOG_ERROR)) IPC_LOG_PRINT_E(__VA_ARGS__); } while(0)
+#define DEBUG_W(...) do { if(IPC_LOG_ON(IPC_LOG_WARNING)) IPC_LOG_PRINT_W(__VA_ARGS__); } while(0)
+#define DEBUG_I(...) do { if(IPC_LOG_ON(IPC_LOG_INFO)) IPC_LOG_PRINT_I(__VA_ARGS__); } while(0)
+#define DEBUG_V(...) do { if(IPC_LOG_ON(IPC_LOG_VERBOSE)) IPC_LOG_PRINT_V(__VA_ARGS__); } while(0)
+
+/* Hex dumps are DEBUG, the arguments aren't even evaluated otherwise */
+#define IPC_HEX_DUMP(data, size) \
+	do { if(IPC_LOG_ON(IPC_LOG_DEBUG)) hex_dump(data, size); } while(0)
+#define IPC_CLIENT_HEX_DUMP(client, data, size) \
+	do { if(IPC_LOG_ON(IPC_LOG_DEBUG)) ipc_hex_dump(client, data, size); } while(0)
+
+/* "[0000] " + 16 * "XX " + 2 spaces + 16 chars */
+#define IPC_HEX_LINE_SIZE	80
+
 #define MAX_SINGLE_FRAME_DATA 	0xFF4
 
 /**
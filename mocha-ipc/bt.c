@@ -20,6 +20,8 @@
  *
  */
 
+#define IPC_LOG_MODULE	IPC_LOG_MISC
+
 #include <stdlib.h>
 #include <stdio.h>
 #include <stdint.h>
@@ -49,7 +51,7 @@ void ipc_parse_bt(struct ipc_client* client, struct modem_io *ipc_frame)
 	    	break;
 	}
 	DEBUG_I("bt_packet_parser");
-	hex_dump(ipc_frame->data + sizeof(btPacketHeader), rx_header->length);
+	IPC_HEX_DUMP(ipc_frame->data + sizeof(btPacketHeader), rx_header->length);
 }
 
 void bt_addr_info(uint8_t *data)
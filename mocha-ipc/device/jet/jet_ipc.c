@@ -26,6 +26,8 @@
 #include <stdio.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <errno.h>
+#include <sys/uio.h>
 
 #include <radio.h>
 
@@ -92,6 +94,7 @@ int32_t jet_ipc_open(void *data, uint32_t size, void *io_data)
     tcsetattr(fd, TCSANOW, &termios);
 
     memcpy(io_data, &fd, sizeof(int32_t));
+    ipc_ring_reset(&((struct jet_ipc_data *) io_data)->ring);
 
     return 0;
 }
@@ -140,132 +143,91 @@ int32_t jet_ipc_power_off(void *data)
     return 0;
 }
 
-int32_t send_packet(struct ipc_client *client, struct modem_io *ipc_frame)
+int32_t jet_ipc_send(struct ipc_client *client, struct modem_io *ipc_frame)
 {
-	int32_t retval;
-    struct fifoPacketHeader *ipc;
-    uint8_t *frame;
-    uint8_t *payload;
-    int32_t frame_length;
-
-    /* Frame length: FIFO header + payload length */
-    frame_length = (sizeof(*ipc) + ipc_frame->datasize);
-
-    frame = (uint8_t*)malloc(frame_length);
-
-    /* FIFO header */
-    ipc = (struct fifoPacketHeader*)(frame);
-
-    ipc->magic = ipc_frame->magic;
-    ipc->cmd = ipc_frame->cmd;
-    ipc->datasize = ipc_frame->datasize;
-
-    /* FIFO payload */
-    payload = (frame + sizeof(*ipc));
-    memcpy(payload, ipc_frame->data, ipc_frame->datasize);
-
-	retval = client->handlers->write(frame, frame_length, client->handlers->write_data);
+    struct iovec iov;
 
-    free(frame);
+    iov.iov_base = ipc_frame->data;
+    iov.iov_len = ipc_frame->datasize;
 
-    return 0;
+    return ipc_stream_sendv(client, ipc_frame->cmd, &iov, 1);
 }
 
-int32_t jet_ipc_send(struct ipc_client *client, struct modem_io *ipc_frame)
+int32_t jet_ipc_recv(struct ipc_client *client, struct modem_io *ipc_frame)
 {
-	int32_t left_data;
-	struct modem_io multi_packet;
-	struct multiPacketHeader *multiHeader;
-
-	if (ipc_frame->datasize > MAX_SINGLE_FRAME_DATA)
-	{
-		DEBUG_I("packet to send is larger than 0x1000\n");
-
-		multi_packet.magic = 0xCAFECAFE;
-		multi_packet.cmd = FIFO_PKT_FIFO_INTERNAL;
-		multi_packet.datasize = 0x0C;
-
-		multiHeader = (struct multiPacketHeader *)malloc(sizeof(struct multiPacketHeader));
+    struct jet_ipc_data *jet_data;
+    int rc;
 
-		multiHeader->command = 0x02;
-		multiHeader->packtLen = ipc_frame->datasize;
-		multiHeader->packetType = ipc_frame->cmd;
+    jet_data = (struct jet_ipc_data *) client->handlers->read_data;
 
-		multi_packet.data = (uint8_t *)multiHeader;
-		free(multiHeader);
+    if(jet_data == NULL)
+        return -1;
 
-		send_packet(client, &multi_packet);
+    while((rc = ipc_ring_parse(&jet_data->ring, client, ipc_frame)) == 1) {
+        rc = ipc_ring_fill(&jet_data->ring, ipc_client_io_read, client);
 
-		left_data = ipc_frame->datasize;
+        /* The partial frame stays in the ring until the rest comes in */
+        if(rc < 0 && errno == EAGAIN)
+            return 1;
+        if(rc <= 0)
+            return -1;
+    }
 
-		multi_packet.data = ipc_frame->data;
+    if(rc < 0) {
+        /* Frame didn't fit and was skipped, hand back an empty frame */
+        ipc_frame->magic = 0;
+        ipc_frame->cmd = FIFO_PKT_NONE;
+        ipc_frame->datasize = 0;
+    }
 
-		while (left_data > 0)
-		{
-			if (left_data > MAX_SINGLE_FRAME_DATA)
-			{
-				multi_packet.datasize = MAX_SINGLE_FRAME_DATA;
-			}
-			else
-			{
-				multi_packet.datasize = left_data;
-			}
+    return 0;
+}
 
-			send_packet(client, &multi_packet);
+int32_t jet_ipc_recv_pending(struct ipc_client *client)
+{
+    struct jet_ipc_data *jet_data;
 
-			multi_packet.data += MAX_SINGLE_FRAME_DATA;
+    jet_data = (struct jet_ipc_data *) client->handlers->read_data;
 
-			left_data -= MAX_SINGLE_FRAME_DATA;
-		}
-	}
-	else
-	{
-		send_packet(client, ipc_frame);
-	}
+    if(jet_data == NULL)
+        return 0;
 
-	return 0;
+    return ipc_ring_pending(&jet_data->ring);
 }
 
-int32_t jet_ipc_recv(struct ipc_client *client, struct modem_io *ipc_frame)
+int32_t jet_ipc_get_stats(struct ipc_client *client, struct ipc_transport_stats *stats)
 {
-    uint8_t buf[SIZ_PACKET_HEADER];
-    uint8_t *data;
-    uint32_t frame_length;
-    struct fifoPacketHeader *ipc;
-    struct modem_io modem_packet;
-    uint32_t num_read;
-    uint32_t left;
+    struct jet_ipc_data *jet_data;
 
-    num_read = client->handlers->read((void*)buf, sizeof(buf), client->handlers->read_data);
+    jet_data = (struct jet_ipc_data *) client->handlers->read_data;
 
-    ipc = (struct fifoPacketHeader *)buf;
+    if(jet_data == NULL)
+        return -1;
 
-    if(num_read == sizeof(buf) && ipc->magic == 0xCAFECAFE) {
+    memcpy(stats, &jet_data->ring.stats, sizeof(struct ipc_transport_stats));
 
-        frame_length = ipc->datasize;
-        left = frame_length;
+    return 0;
+}
 
-        data = (uint8_t*)malloc(left);
-        num_read = client->handlers->read((void*)data, left, client->handlers->read_data);
+int32_t jet_ipc_read(void *data, uint32_t size, void *io_data)
+{
+    int32_t fd = -1;
 
-        if(num_read == left) {
-            ipc_frame->magic = ipc->magic;
-            ipc_frame->cmd = ipc->cmd;
-            ipc_frame->datasize = ipc->datasize;
+    if(io_data == NULL)
+        return -1;
 
-            ipc_frame->data = (uint8_t*)malloc(left);
-            memcpy(ipc_frame->data, data , ipc_frame->datasize);
+    fd = *((int32_t *) io_data);
 
-            return 0;
-        }
-    }
+    if(fd < 0)
+        return -1;
 
-    return 0;
+    return read(fd, data, size);
 }
 
-int32_t jet_ipc_read(void *data, uint32_t size, void *io_data)
+int32_t jet_ipc_write(void *data, uint32_t size, void *io_data)
 {
     int32_t fd = -1;
+    int32_t rc;
 
     if(io_data == NULL)
         return -1;
@@ -275,12 +237,18 @@ int32_t jet_ipc_read(void *data, uint32_t size, void *io_data)
     if(fd < 0)
         return -1;
 
-    return read(fd, data, size);
+    while((rc = write(fd, data, size)) < 0 && errno == EAGAIN) {
+        if(ipc_stream_wait_writable(fd) < 0)
+            return -1;
+    }
+
+    return rc;
 }
 
-int32_t jet_ipc_write(void *data, uint32_t size, void *io_data)
+int32_t jet_ipc_writev(struct iovec *iov, int iovcnt, void *io_data)
 {
     int32_t fd = -1;
+    int32_t rc, written = 0;
 
     if(io_data == NULL)
         return -1;
@@ -290,7 +258,27 @@ int32_t jet_ipc_write(void *data, uint32_t size, void *io_data)
     if(fd < 0)
         return -1;
 
-    return write(fd, data, size);
+    while(iovcnt > 0) {
+        rc = writev(fd, iov, iovcnt);
+        if(rc < 0 && errno == EAGAIN && ipc_stream_wait_writable(fd) == 0)
+            continue;
+        if(rc < 0)
+            return -1;
+        written += rc;
+
+        /* Short write on the tty, skip what already went out */
+        while(iovcnt > 0 && (uint32_t) rc >= iov->iov_len) {
+            rc -= iov->iov_len;
+            iov++;
+            iovcnt--;
+        }
+        if(iovcnt > 0) {
+            iov->iov_base = (uint8_t *) iov->iov_base + rc;
+            iov->iov_len -= rc;
+        }
+    }
+
+    return written;
 }
 
 int32_t jet_modem_operations(struct ipc_client *client, void *data, uint32_t cmd)
@@ -308,16 +296,19 @@ int32_t jet_modem_operations(struct ipc_client *client, void *data, uint32_t cmd
 
 void *jet_ipc_common_data_create(void)
 {
-    void *io_data;
-    int io_data_len;
+    struct jet_ipc_data *io_data;
 
-    io_data_len = sizeof(int);
-    io_data = malloc(io_data_len);
+    io_data = (struct jet_ipc_data *) malloc(sizeof(struct jet_ipc_data));
 
     if(io_data == NULL)
         return NULL;
 
-    memset(io_data, 0, io_data_len);
+    memset(io_data, 0, sizeof(struct jet_ipc_data));
+
+    if(ipc_ring_init(&io_data->ring, IPC_RING_SIZE) < 0) {
+        free(io_data);
+        return NULL;
+    }
 
     return io_data;
 }
@@ -328,6 +319,7 @@ int jet_ipc_common_data_destroy(void *io_data)
     if(io_data == NULL)
         return 0;
 
+    ipc_ring_free(&((struct jet_ipc_data *) io_data)->ring);
     free(io_data);
 
     return 0;
@@ -335,13 +327,14 @@ int jet_ipc_common_data_destroy(void *io_data)
 
 int jet_ipc_common_data_set_fd(void *io_data, int fd)
 {
-    int *common_data;
+    struct jet_ipc_data *common_data;
 
     if(io_data == NULL)
         return -1;
 
-    common_data = (int *) io_data;
-    common_data = &fd;
+    common_data = (struct jet_ipc_data *) io_data;
+    common_data->fd = fd;
+    ipc_ring_reset(&common_data->ring);
 
     return 0;
 }
@@ -365,6 +358,7 @@ struct ipc_handlers jet_default_handlers = {
     .power_off = jet_ipc_power_off,
     .read = jet_ipc_read,
     .write = jet_ipc_write,
+    .writev = jet_ipc_writev,
     .common_data = NULL,
     .common_data_create = jet_ipc_common_data_create,
     .common_data_destroy = jet_ipc_common_data_destroy,
@@ -374,7 +368,12 @@ struct ipc_handlers jet_default_handlers = {
 
 struct ipc_ops jet_ops = {
     .send = jet_ipc_send,
+    .sendv = ipc_stream_sendv,
+    .send_batch = ipc_stream_send_batch,
     .recv = jet_ipc_recv,
+    .recv_pending = jet_ipc_recv_pending,
+    .get_stats = jet_ipc_get_stats,
+    .uring = 1,
     .bootstrap = jet_modem_bootstrap,
     .modem_operations = jet_modem_operations,
 };
@@ -0,0 +1,394 @@
+/**
+ * This file is part of libmocha-ipc.
+ *
+ * Loopback transport: FIFO framing over a socket, pipe pair or pty so the
+ * whole stack can run against a userspace CP stand-in on plain Linux.
+ *
+ * libmocha-ipc is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libmocha-ipc is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with libmocha-ipc.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <termios.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/uio.h>
+
+#include <radio.h>
+
+#include "ipc_private.h"
+#include "loopback_ipc.h"
+
+#define LOG_TAG "RIL-Mocha_LoopbackIPC"
+#include <utils/Log.h>
+
+int32_t loopback_modem_bootstrap(struct ipc_client *client)
+{
+    DEBUG_I("loopback_ipc_bootstrap: nothing to do\n");
+
+    return 0;
+}
+
+int32_t loopback_modem_operations(struct ipc_client *client, void *data, uint32_t cmd)
+{
+    DEBUG_I("loopback modem_operations cmd = 0x%x ignored\n", cmd);
+
+    return 0;
+}
+
+static int32_t loopback_connect(const char *path)
+{
+    struct sockaddr_un addr;
+    int32_t fd;
+
+    if(strlen(path) >= sizeof(addr.sun_path))
+        return -1;
+
+    fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if(fd < 0)
+        return -1;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+
+    if(connect(fd, (struct sockaddr *) &addr, sizeof(addr)) < 0) {
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+int32_t loopback_ipc_open(void *data, uint32_t size, void *io_data)
+{
+    struct loopback_ipc_data *loopback_data;
+    struct termios termios;
+    struct stat st;
+    const char *endpoint;
+    int32_t fd = -1, write_fd = -1;
+
+    if(io_data == NULL)
+        return -1;
+
+    loopback_data = (struct loopback_ipc_data *) io_data;
+
+    endpoint = getenv(LOOPBACK_ENDPOINT_ENV);
+    if(endpoint == NULL || endpoint[0] == '\0')
+        endpoint = LOOPBACK_ENDPOINT_DEFAULT;
+
+    if(strncmp(endpoint, "fd:", 3) == 0) {
+        if(sscanf(endpoint + 3, "%d,%d", &fd, &write_fd) < 2)
+            write_fd = fd;
+    } else if(stat(endpoint, &st) == 0 && S_ISSOCK(st.st_mode)) {
+        fd = loopback_connect(endpoint);
+        write_fd = fd;
+    } else {
+        fd = open(endpoint, O_RDWR | O_NOCTTY);
+        write_fd = fd;
+
+        if(fd >= 0 && isatty(fd)) {
+            tcgetattr(fd, &termios);
+            cfmakeraw(&termios);
+            tcsetattr(fd, TCSANOW, &termios);
+        }
+    }
+
+    DEBUG_I("loopback endpoint %s: fd = %d/%d\n", endpoint, fd, write_fd);
+
+    if(fd < 0 || write_fd < 0)
+        return -1;
+
+    loopback_data->fd = fd;
+    loopback_data->write_fd = write_fd;
+    ipc_ring_reset(&loopback_data->ring);
+
+    return 0;
+}
+
+int32_t loopback_ipc_close(void *data, uint32_t size, void *io_data)
+{
+    struct loopback_ipc_data *loopback_data;
+
+    if(io_data == NULL)
+        return -1;
+
+    loopback_data = (struct loopback_ipc_data *) io_data;
+
+    if(loopback_data->write_fd >= 0 && loopback_data->write_fd != loopback_data->fd)
+        close(loopback_data->write_fd);
+
+    if(loopback_data->fd >= 0)
+        close(loopback_data->fd);
+
+    loopback_data->fd = -1;
+    loopback_data->write_fd = -1;
+
+    return 0;
+}
+
+int32_t loopback_ipc_power(void *data)
+{
+    return 0;
+}
+
+int32_t loopback_ipc_read(void *data, uint32_t size, void *io_data)
+{
+    struct loopback_ipc_data *loopback_data;
+    int32_t rc;
+
+    if(io_data == NULL)
+        return -1;
+
+    loopback_data = (struct loopback_ipc_data *) io_data;
+
+    if(loopback_data->fd < 0)
+        return -1;
+
+    do {
+        rc = read(loopback_data->fd, data, size);
+    } while(rc < 0 && errno == EINTR);
+
+    return rc;
+}
+
+int32_t loopback_ipc_write(void *data, uint32_t size, void *io_data)
+{
+    struct loopback_ipc_data *loopback_data;
+    int32_t rc, written = 0;
+
+    if(io_data == NULL)
+        return -1;
+
+    loopback_data = (struct loopback_ipc_data *) io_data;
+
+    if(loopback_data->write_fd < 0)
+        return -1;
+
+    while((uint32_t) written < size) {
+        rc = write(loopback_data->write_fd, (uint8_t *) data + written, size - written);
+        if(rc < 0 && errno == EINTR)
+            continue;
+        if(rc < 0 && errno == EAGAIN && ipc_stream_wait_writable(loopback_data->write_fd) == 0)
+            continue;
+        if(rc < 0)
+            return -1;
+        written += rc;
+    }
+
+    return written;
+}
+
+int32_t loopback_ipc_writev(struct iovec *iov, int iovcnt, void *io_data)
+{
+    struct loopback_ipc_data *loopback_data;
+    int32_t rc, written = 0;
+
+    if(io_data == NULL)
+        return -1;
+
+    loopback_data = (struct loopback_ipc_data *) io_data;
+
+    if(loopback_data->write_fd < 0)
+        return -1;
+
+    while(iovcnt > 0) {
+        rc = writev(loopback_data->write_fd, iov, iovcnt);
+        if(rc < 0 && errno == EINTR)
+            continue;
+        if(rc < 0 && errno == EAGAIN && ipc_stream_wait_writable(loopback_data->write_fd) == 0)
+            continue;
+        if(rc < 0)
+            return -1;
+        written += rc;
+
+        while(iovcnt > 0 && (uint32_t) rc >= iov->iov_len) {
+            rc -= iov->iov_len;
+            iov++;
+            iovcnt--;
+        }
+        if(iovcnt > 0) {
+            iov->iov_base = (uint8_t *) iov->iov_base + rc;
+            iov->iov_len -= rc;
+        }
+    }
+
+    return written;
+}
+
+int32_t loopback_ipc_send(struct ipc_client *client, struct modem_io *ipc_frame)
+{
+    struct iovec iov;
+
+    iov.iov_base = ipc_frame->data;
+    iov.iov_len = ipc_frame->datasize;
+
+    return ipc_stream_sendv(client, ipc_frame->cmd, &iov, 1);
+}
+
+int32_t loopback_ipc_recv(struct ipc_client *client, struct modem_io *ipc_frame)
+{
+    struct loopback_ipc_data *loopback_data;
+    int rc;
+
+    loopback_data = (struct loopback_ipc_data *) client->handlers->read_data;
+
+    if(loopback_data == NULL)
+        return -1;
+
+    while((rc = ipc_ring_parse(&loopback_data->ring, client, ipc_frame)) == 1) {
+        rc = ipc_ring_fill(&loopback_data->ring, ipc_client_io_read, client);
+        if(rc < 0 && errno == EAGAIN)
+            return 1;
+        if(rc <= 0)
+            return -1;
+    }
+
+    if(rc < 0) {
+        ipc_frame->magic = 0;
+        ipc_frame->cmd = FIFO_PKT_NONE;
+        ipc_frame->datasize = 0;
+    }
+
+    return 0;
+}
+
+int32_t loopback_ipc_recv_pending(struct ipc_client *client)
+{
+    struct loopback_ipc_data *loopback_data;
+
+    loopback_data = (struct loopback_ipc_data *) client->handlers->read_data;
+
+    if(loopback_data == NULL)
+        return 0;
+
+    return ipc_ring_pending(&loopback_data->ring);
+}
+
+int32_t loopback_ipc_get_stats(struct ipc_client *client, struct ipc_transport_stats *stats)
+{
+    struct loopback_ipc_data *loopback_data;
+
+    loopback_data = (struct loopback_ipc_data *) client->handlers->read_data;
+
+    if(loopback_data == NULL)
+        return -1;
+
+    memcpy(stats, &loopback_data->ring.stats, sizeof(struct ipc_transport_stats));
+
+    return 0;
+}
+
+void *loopback_ipc_common_data_create(void)
+{
+    struct loopback_ipc_data *io_data;
+
+    io_data = (struct loopback_ipc_data *) malloc(sizeof(struct loopback_ipc_data));
+
+    if(io_data == NULL)
+        return NULL;
+
+    memset(io_data, 0, sizeof(struct loopback_ipc_data));
+    io_data->fd = -1;
+    io_data->write_fd = -1;
+
+    if(ipc_ring_init(&io_data->ring, IPC_RING_SIZE) < 0) {
+        free(io_data);
+        return NULL;
+    }
+
+    return io_data;
+}
+
+int loopback_ipc_common_data_destroy(void *io_data)
+{
+    if(io_data == NULL)
+        return 0;
+
+    ipc_ring_free(&((struct loopback_ipc_data *) io_data)->ring);
+    free(io_data);
+
+    return 0;
+}
+
+/* Lets a CP stand-in hand over an accepted connection */
+int loopback_ipc_common_data_set_fd(void *io_data, int fd)
+{
+    struct loopback_ipc_data *loopback_data;
+
+    if(io_data == NULL)
+        return -1;
+
+    loopback_data = (struct loopback_ipc_data *) io_data;
+    loopback_data->fd = fd;
+    loopback_data->write_fd = fd;
+    ipc_ring_reset(&loopback_data->ring);
+
+    return 0;
+}
+
+int loopback_ipc_common_data_get_fd(void *io_data)
+{
+    if(io_data == NULL)
+        return -1;
+
+    return ((struct loopback_ipc_data *) io_data)->fd;
+}
+
+int loopback_ipc_common_data_get_write_fd(void *io_data)
+{
+    if(io_data == NULL)
+        return -1;
+
+    return ((struct loopback_ipc_data *) io_data)->write_fd;
+}
+
+struct ipc_handlers loopback_default_handlers = {
+    .open = loopback_ipc_open,
+    .close = loopback_ipc_close,
+    .power_on = loopback_ipc_power,
+    .power_off = loopback_ipc_power,
+    .read = loopback_ipc_read,
+    .write = loopback_ipc_write,
+    .writev = loopback_ipc_writev,
+    .common_data = NULL,
+    .common_data_create = loopback_ipc_common_data_create,
+    .common_data_destroy = loopback_ipc_common_data_destroy,
+    .common_data_set_fd = loopback_ipc_common_data_set_fd,
+    .common_data_get_fd = loopback_ipc_common_data_get_fd,
+    .common_data_get_write_fd = loopback_ipc_common_data_get_write_fd,
+};
+
+struct ipc_ops loopback_ops = {
+    .send = loopback_ipc_send,
+    .sendv = ipc_stream_sendv,
+    .send_batch = ipc_stream_send_batch,
+    .recv = loopback_ipc_recv,
+    .recv_pending = loopback_ipc_recv_pending,
+    .get_stats = loopback_ipc_get_stats,
+    .uring = 1,
+    .bootstrap = loopback_modem_bootstrap,
+    .modem_operations = loopback_modem_operations,
+};
+
+void loopback_ipc_register(void)
+{
+    ipc_register_device_client_handlers(IPC_DEVICE_LOOPBACK, &loopback_ops, &loopback_default_handlers);
+}
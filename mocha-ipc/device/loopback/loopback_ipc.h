@@ -0,0 +1,40 @@
+/**
+ * This file is part of libmocha-ipc.
+ *
+ * libmocha-ipc is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libmocha-ipc is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with libmocha-ipc.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef _LOOPBACK_IPC_H_
+#define _LOOPBACK_IPC_H_
+
+#include <radio.h>
+
+/*
+ * Endpoint the loopback device talks to:
+ *   fd:N      inherited socket/pty fd N, used both ways
+ *   fd:R,W    inherited pipe pair
+ *   <path>    unix socket to connect to, or a node (pty, fifo) to open
+ */
+#define LOOPBACK_ENDPOINT_ENV		"MOCHA_IPC_LOOPBACK"
+#define LOOPBACK_ENDPOINT_DEFAULT	"/tmp/mocha-ipc.sock"
+
+/* Handlers common data, fd must stay the first member */
+struct loopback_ipc_data {
+	int32_t fd;
+	int32_t write_fd;
+	struct ipc_ring ring;
+};
+
+#endif
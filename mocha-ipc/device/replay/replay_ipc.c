@@ -0,0 +1,525 @@
+/**
+ * This file is part of libmocha-ipc.
+ *
+ * Replay transport: hands out the CP to AP frames of ipc_capture files as
+ * if the modem had sent them, and checks what the stack sends back against
+ * the AP to CP frames of the same captures instead of writing them out.
+ *
+ * libmocha-ipc is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libmocha-ipc is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with libmocha-ipc.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <sys/timerfd.h>
+
+#include <radio.h>
+
+#include "ipc_private.h"
+#include "replay_ipc.h"
+
+#define LOG_TAG "RIL-Mocha_ReplayIPC"
+#include <utils/Log.h>
+
+extern struct ipc_ops replay_ops;
+
+static uint64_t replay_now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static struct replay_ipc_data *replay_data_get(struct ipc_client *client)
+{
+    if (client == NULL ||
+        client->ops != &replay_ops ||
+        client->handlers == NULL)
+        return NULL;
+
+    return (struct replay_ipc_data *) client->handlers->common_data;
+}
+
+/* Next record of the given direction at or after cursor, NULL at the end */
+static struct ipc_capture_record *replay_peek(struct replay_ipc_data *replay_data,
+                                              struct replay_cursor *cursor, int direction)
+{
+    struct ipc_capture_file_header *header;
+    struct ipc_capture_record *record;
+    struct replay_trace *trace;
+
+    while (cursor->trace < replay_data->count) {
+        trace = &replay_data->traces[cursor->trace];
+        header = (struct ipc_capture_file_header *) trace->data;
+
+        if (cursor->offset < header->header_size)
+            cursor->offset = header->header_size;
+
+        if (cursor->offset + sizeof(struct ipc_capture_record) > trace->end) {
+            cursor->trace++;
+            cursor->offset = 0;
+            continue;
+        }
+
+        record = (struct ipc_capture_record *) (trace->data + cursor->offset);
+        if (record->direction == direction)
+            return record;
+
+        cursor->offset += record->length;
+    }
+
+    return NULL;
+}
+
+static void replay_consume(struct replay_cursor *cursor, struct ipc_capture_record *record)
+{
+    cursor->offset += record->length;
+}
+
+/* Monotonic time the record is due at, 0 when it can go right away */
+static uint64_t replay_due_ns(struct replay_ipc_data *replay_data, struct ipc_capture_record *record)
+{
+    if (!(replay_data->flags & IPC_REPLAY_REALTIME) || !replay_data->started)
+        return 0;
+
+    return replay_data->start_ns + (record->time_ns - replay_data->first_ns);
+}
+
+/* Keeps the timerfd expired exactly while the next frame is due */
+static void replay_arm(struct replay_ipc_data *replay_data)
+{
+    struct ipc_capture_record *record;
+    struct itimerspec its;
+    uint64_t due;
+
+    memset(&its, 0, sizeof(its));
+
+    record = replay_peek(replay_data, &replay_data->rx, IPC_CAPTURE_RX);
+    if (record != NULL) {
+        due = replay_due_ns(replay_data, record);
+        if (due == 0)
+            due = 1;
+
+        its.it_value.tv_sec = due / 1000000000ULL;
+        its.it_value.tv_nsec = due % 1000000000ULL;
+    }
+
+    timerfd_settime(replay_data->fd, TFD_TIMER_ABSTIME, &its, NULL);
+}
+
+static int replay_load(struct replay_ipc_data *replay_data, const char *path)
+{
+    struct ipc_capture_file_header *header;
+    struct ipc_capture_record *record;
+    struct replay_trace *traces;
+    struct stat st;
+    uint8_t *data;
+    uint32_t offset, end;
+    int32_t fd, rc, n = 0;
+
+    fd = open(path, O_RDONLY);
+    if (fd < 0 || fstat(fd, &st) < 0 ||
+        st.st_size < (off_t) sizeof(struct ipc_capture_file_header)) {
+        DEBUG_E("replay: can't use capture %s\n", path);
+        if (fd >= 0)
+            close(fd);
+        return -1;
+    }
+
+    data = (uint8_t *) malloc(st.st_size);
+    if (data == NULL) {
+        close(fd);
+        return -1;
+    }
+
+    while (n < st.st_size) {
+        rc = read(fd, data + n, st.st_size - n);
+        if (rc < 0 && errno == EINTR)
+            continue;
+        if (rc <= 0)
+            break;
+        n += rc;
+    }
+
+    close(fd);
+
+    header = (struct ipc_capture_file_header *) data;
+    if (n != st.st_size ||
+        memcmp(header->magic, IPC_CAPTURE_MAGIC, sizeof(header->magic)) != 0 ||
+        header->version != IPC_CAPTURE_VERSION ||
+        header->header_size < sizeof(struct ipc_capture_file_header)) {
+        DEBUG_E("replay: %s is not a capture\n", path);
+        free(data);
+        return -1;
+    }
+
+    end = header->header_size + header->used;
+    if (end > (uint32_t) n)
+        end = n;
+
+    /* Checked once here so the cursors can walk the records blindly */
+    for (offset = header->header_size; offset + sizeof(struct ipc_capture_record) <= end; offset += record->length) {
+        record = (struct ipc_capture_record *) (data + offset);
+
+        if (record->length < sizeof(struct ipc_capture_record) ||
+            record->length > end - offset ||
+            record->caplen > record->length - sizeof(struct ipc_capture_record)) {
+            DEBUG_W("replay: %s cut short at bad record %d\n", path, offset);
+            break;
+        }
+    }
+
+    traces = (struct replay_trace *) realloc(replay_data->traces,
+        (replay_data->count + 1) * sizeof(struct replay_trace));
+    if (traces == NULL) {
+        free(data);
+        return -1;
+    }
+
+    replay_data->traces = traces;
+    replay_data->traces[replay_data->count].data = data;
+    replay_data->traces[replay_data->count].end = offset;
+    replay_data->count++;
+
+    DEBUG_I("replay: %s, %d records\n", path, header->records);
+
+    return 0;
+}
+
+int32_t replay_modem_bootstrap(struct ipc_client *client)
+{
+    return 0;
+}
+
+int32_t replay_modem_operations(struct ipc_client *client, void *data, uint32_t cmd)
+{
+    return 0;
+}
+
+int32_t replay_ipc_open(void *data, uint32_t size, void *io_data)
+{
+    struct replay_ipc_data *replay_data;
+    char paths[1024];
+    char *path, *next;
+    const char *env;
+
+    if (io_data == NULL)
+        return -1;
+
+    replay_data = (struct replay_ipc_data *) io_data;
+
+    if (replay_data->count == 0) {
+        env = getenv(IPC_REPLAY_ENV);
+        if (env == NULL || env[0] == '\0')
+            return -1;
+
+        strncpy(paths, env, sizeof(paths) - 1);
+        paths[sizeof(paths) - 1] = '\0';
+
+        for (path = strtok_r(paths, ",", &next); path != NULL; path = strtok_r(NULL, ",", &next))
+            replay_load(replay_data, path);
+
+        if (replay_data->count == 0)
+            return -1;
+    }
+
+    replay_arm(replay_data);
+
+    return 0;
+}
+
+int32_t replay_ipc_close(void *data, uint32_t size, void *io_data)
+{
+    return 0;
+}
+
+int32_t replay_ipc_power(void *data)
+{
+    return 0;
+}
+
+int32_t replay_ipc_recv(struct ipc_client *client, struct modem_io *ipc_frame)
+{
+    struct replay_ipc_data *replay_data;
+    struct ipc_capture_record *record;
+    struct timespec ts;
+    uint64_t now, due;
+
+    replay_data = (struct replay_ipc_data *) client->handlers->read_data;
+
+    if (replay_data == NULL)
+        return -1;
+
+    /* Truncated payloads would only exercise the handlers' error paths */
+    while ((record = replay_peek(replay_data, &replay_data->rx, IPC_CAPTURE_RX)) != NULL &&
+           record->caplen < record->datasize) {
+        replay_data->stats.skipped++;
+        replay_consume(&replay_data->rx, record);
+    }
+
+    if (record == NULL) {
+        replay_arm(replay_data);
+        return -1;
+    }
+
+    now = replay_now_ns();
+
+    if (!replay_data->started) {
+        replay_data->first_ns = record->time_ns;
+        replay_data->start_ns = now;
+        replay_data->started = 1;
+    }
+
+    due = replay_due_ns(replay_data, record);
+    if (due > now) {
+        ts.tv_sec = due / 1000000000ULL;
+        ts.tv_nsec = due % 1000000000ULL;
+        while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR);
+    } else if (due > 0 && (now - due) / 1000 > replay_data->stats.max_lag_us) {
+        replay_data->stats.max_lag_us = (now - due) / 1000;
+    }
+
+    if (record->datasize > IPC_FRAME_SIZE) {
+        ipc_frame_unref(ipc_frame);
+        if (ipc_frame_alloc(client->frame_pool, ipc_frame, record->datasize) < 0)
+            return -1;
+    }
+
+    ipc_frame->magic = record->magic;
+    ipc_frame->cmd = record->cmd;
+    ipc_frame->datasize = record->datasize;
+    memcpy(ipc_frame->data, record + 1, record->datasize);
+
+    replay_consume(&replay_data->rx, record);
+
+    replay_data->stats.frames++;
+    replay_data->stats.bytes += record->datasize;
+    replay_data->stats.elapsed_ns = replay_now_ns() - replay_data->start_ns;
+
+    replay_arm(replay_data);
+
+    return 0;
+}
+
+int32_t replay_ipc_recv_pending(struct ipc_client *client)
+{
+    struct replay_ipc_data *replay_data;
+    struct ipc_capture_record *record;
+
+    replay_data = (struct replay_ipc_data *) client->handlers->read_data;
+
+    if (replay_data == NULL)
+        return 0;
+
+    record = replay_peek(replay_data, &replay_data->rx, IPC_CAPTURE_RX);
+
+    return record != NULL && replay_due_ns(replay_data, record) <= replay_now_ns();
+}
+
+/* Compares the first caplen bytes the capture kept with what is being sent */
+static int replay_compare(struct ipc_capture_record *record, struct iovec *iov, int iovcnt)
+{
+    uint8_t *expected = (uint8_t *) (record + 1);
+    uint32_t left = record->caplen, n;
+    int i;
+
+    for (i = 0; i < iovcnt && left > 0; i++) {
+        n = iov[i].iov_len < left ? iov[i].iov_len : left;
+        if (memcmp(expected, iov[i].iov_base, n) != 0)
+            return -1;
+
+        expected += n;
+        left -= n;
+    }
+
+    return 0;
+}
+
+int32_t replay_ipc_sendv(struct ipc_client *client, uint32_t cmd, struct iovec *iov, int iovcnt)
+{
+    struct replay_ipc_data *replay_data;
+    struct ipc_capture_record *record;
+    uint32_t datasize;
+
+    replay_data = (struct replay_ipc_data *) client->handlers->write_data;
+
+    if (replay_data == NULL)
+        return -1;
+
+    datasize = ipc_iov_length(iov, iovcnt);
+    replay_data->stats.tx_frames++;
+
+    record = replay_peek(replay_data, &replay_data->tx, IPC_CAPTURE_TX);
+    if (record == NULL) {
+        replay_data->stats.tx_extra++;
+        return 0;
+    }
+
+    replay_consume(&replay_data->tx, record);
+
+    if (record->cmd != cmd || record->datasize != datasize ||
+        replay_compare(record, iov, iovcnt) < 0) {
+        replay_data->stats.tx_mismatched++;
+        DEBUG_W("replay: sent frame %d (cmd 0x%x, %d bytes) differs from the capture (cmd 0x%x, %d bytes)\n",
+            replay_data->stats.tx_frames, cmd, datasize, record->cmd, record->datasize);
+        return 0;
+    }
+
+    replay_data->stats.tx_matched++;
+
+    return 0;
+}
+
+int32_t replay_ipc_send(struct ipc_client *client, struct modem_io *ipc_frame)
+{
+    struct iovec iov;
+
+    iov.iov_base = ipc_frame->data;
+    iov.iov_len = ipc_frame->data != NULL ? ipc_frame->datasize : 0;
+
+    return replay_ipc_sendv(client, ipc_frame->cmd, &iov, 1);
+}
+
+void *replay_ipc_common_data_create(void)
+{
+    struct replay_ipc_data *io_data;
+
+    io_data = (struct replay_ipc_data *) calloc(1, sizeof(struct replay_ipc_data));
+
+    if (io_data == NULL)
+        return NULL;
+
+    io_data->fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (io_data->fd < 0) {
+        free(io_data);
+        return NULL;
+    }
+
+    return io_data;
+}
+
+int replay_ipc_common_data_destroy(void *io_data)
+{
+    struct replay_ipc_data *replay_data;
+    int i;
+
+    if (io_data == NULL)
+        return 0;
+
+    replay_data = (struct replay_ipc_data *) io_data;
+
+    for (i = 0; i < replay_data->count; i++)
+        free(replay_data->traces[i].data);
+
+    free(replay_data->traces);
+    close(replay_data->fd);
+    free(replay_data);
+
+    return 0;
+}
+
+int replay_ipc_common_data_set_fd(void *io_data, int fd)
+{
+    return -1;
+}
+
+int replay_ipc_common_data_get_fd(void *io_data)
+{
+    if (io_data == NULL)
+        return -1;
+
+    return ((struct replay_ipc_data *) io_data)->fd;
+}
+
+int ipc_replay_add_trace(struct ipc_client *client, const char *path)
+{
+    struct replay_ipc_data *replay_data = replay_data_get(client);
+
+    if (replay_data == NULL || path == NULL)
+        return -1;
+
+    if (replay_load(replay_data, path) < 0)
+        return -1;
+
+    replay_arm(replay_data);
+
+    return 0;
+}
+
+int ipc_replay_set_flags(struct ipc_client *client, int flags)
+{
+    struct replay_ipc_data *replay_data = replay_data_get(client);
+
+    if (replay_data == NULL)
+        return -1;
+
+    replay_data->flags = flags;
+
+    return 0;
+}
+
+int ipc_replay_get_stats(struct ipc_client *client, struct ipc_replay_stats *stats)
+{
+    struct replay_ipc_data *replay_data = replay_data_get(client);
+    struct ipc_capture_record *record;
+    struct replay_cursor cursor;
+
+    if (replay_data == NULL || stats == NULL)
+        return -1;
+
+    memcpy(stats, &replay_data->stats, sizeof(struct ipc_replay_stats));
+
+    cursor = replay_data->tx;
+    stats->tx_missing = 0;
+    while ((record = replay_peek(replay_data, &cursor, IPC_CAPTURE_TX)) != NULL) {
+        stats->tx_missing++;
+        replay_consume(&cursor, record);
+    }
+
+    return 0;
+}
+
+struct ipc_handlers replay_default_handlers = {
+    .open = replay_ipc_open,
+    .close = replay_ipc_close,
+    .power_on = replay_ipc_power,
+    .power_off = replay_ipc_power,
+    .common_data = NULL,
+    .common_data_create = replay_ipc_common_data_create,
+    .common_data_destroy = replay_ipc_common_data_destroy,
+    .common_data_set_fd = replay_ipc_common_data_set_fd,
+    .common_data_get_fd = replay_ipc_common_data_get_fd,
+};
+
+struct ipc_ops replay_ops = {
+    .send = replay_ipc_send,
+    .sendv = replay_ipc_sendv,
+    .recv = replay_ipc_recv,
+    .recv_pending = replay_ipc_recv_pending,
+    .bootstrap = replay_modem_bootstrap,
+    .modem_operations = replay_modem_operations,
+};
+
+void replay_ipc_register(void)
+{
+    ipc_register_device_client_handlers(IPC_DEVICE_REPLAY, &replay_ops, &replay_default_handlers);
+}
@@ -0,0 +1,56 @@
+/**
+ * This file is part of libmocha-ipc.
+ *
+ * libmocha-ipc is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libmocha-ipc is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with libmocha-ipc.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef _REPLAY_IPC_H_
+#define _REPLAY_IPC_H_
+
+#include <radio.h>
+
+/* A loaded capture file, records are walked in place */
+struct replay_trace {
+    uint8_t *data;
+    uint32_t end;
+};
+
+struct replay_cursor {
+    int trace;
+    uint32_t offset;
+};
+
+/* Handlers common data, fd must stay the first member */
+struct replay_ipc_data {
+    /* timerfd, expired while the next received frame is due */
+    int32_t fd;
+    int flags;
+
+    struct replay_trace *traces;
+    int count;
+
+    /* Next CP to AP record, and next AP to CP record to compare against */
+    struct replay_cursor rx;
+    struct replay_cursor tx;
+
+    /* Record and monotonic time the run started at, for IPC_REPLAY_REALTIME */
+    uint64_t first_ns;
+    uint64_t start_ns;
+    int started;
+
+    struct ipc_replay_stats stats;
+};
+
+#endif
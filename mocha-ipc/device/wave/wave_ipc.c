@@ -28,6 +28,7 @@
 #include <stdio.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <errno.h>
 #include <poll.h>
 
 #include <radio.h>
@@ -38,61 +39,6 @@
 #define LOG_TAG "RIL-Mocha_WaveIPC"
 #include <utils/Log.h>
 
-#ifdef DEBUG
-int32_t log_fd;
-#define LOG_PATH "/data/radio/ipc_log.txt"
-
-void hexdump_byte(uint8_t byte, int fd)
-{
-	char a;
-	a = (byte >> 4) & 0xF;
-	if(a < 0xA)
-		a += 0x30;
-	else
-		a += 0x37;
-	write(fd, &a, 1);
-	a = (byte >> 0) & 0xF;
-	if(a < 0xA)
-		a += 0x30;
-	else
-		a += 0x37;	
-	write(fd, &a, 1);
-	write(fd, " ", 1);
-}
-
-void log_write(int type, struct modem_io* mio, int size)
-{
-	int i;
-	char a;
-#ifndef FM_DEBUG
-	if(mio->cmd == 0x06)
-		return;
-#endif
-
-	if(type == 0)
-	{
-		write(log_fd, "tx_frame: ", 10); 
-	}
-	else if(type == 1)
-	{
-		write(log_fd, "rx_frame: ", 10); 
-	}
-	else 
-	{
-		write(log_fd, "unknown: ", 9); 
-	}
-	for(i = 0; i < 0xC; i++)
-	{
-		hexdump_byte(((uint8_t*)mio)[i], log_fd);
-	}
-	for(i = 0; i < mio->datasize; i++)
-	{
-		hexdump_byte(mio->data[i], log_fd);
-	}
-	write(log_fd, "\n", 1);
-}
-#endif
-
 int32_t wave_modem_bootstrap(struct ipc_client *client)
 {
     int32_t modemctl_fd = -1;
@@ -130,10 +76,6 @@ int32_t wave_modem_bootstrap(struct ipc_client *client)
 int32_t wave_ipc_open(void *data, uint32_t size, void *io_data)
 {
     int32_t fd = -1;
-#ifdef DEBUG
-	char buf[50];
-	sprintf(buf, "LOG START! Timestamp: %d\n", (int)time(NULL));
-#endif
 
     if(io_data == NULL)
         return -1;
@@ -141,11 +83,6 @@ int32_t wave_ipc_open(void *data, uint32_t size, void *io_data)
     fd = *((int32_t *) io_data);
 
     fd = open(MODEMPACKET_PATH, O_RDWR);
-#ifdef DEBUG
-	log_fd = open(LOG_PATH, O_RDWR | O_CREAT | O_APPEND, 0660);
-    DEBUG_I("IPC dump log filename=%s fd = 0x%x\n", LOG_PATH, log_fd);
-	write(log_fd, buf, strlen(buf));
-#endif
 
     DEBUG_I("IO filename=%s fd = 0x%x\n", MODEMPACKET_PATH, fd);
 
@@ -235,7 +172,7 @@ int32_t wave_ipc_send(struct ipc_client *client, struct modem_io *ipc_frame)
 {
 	int32_t left_data;
 	struct modem_io multi_packet;
-	struct multiPacketHeader *multiHeader;
+	struct multiPacketHeader multiHeader;
 
 	if (ipc_frame->datasize > MAX_SINGLE_FRAME_DATA)
 	{
@@ -245,15 +182,12 @@ int32_t wave_ipc_send(struct ipc_client *client, struct modem_io *ipc_frame)
 		multi_packet.cmd = FIFO_PKT_FIFO_INTERNAL;
 		multi_packet.datasize = 0x0C;
 
-		multiHeader = (struct multiPacketHeader *)malloc(sizeof(struct multiPacketHeader));
-
-		multiHeader->command = 0x02;
-		multiHeader->packtLen = ipc_frame->datasize;
-		multiHeader->packetType = ipc_frame->cmd;
+		multiHeader.command = 0x02;
+		multiHeader.packtLen = ipc_frame->datasize;
+		multiHeader.packetType = ipc_frame->cmd;
 
-		multi_packet.data = (uint8_t *)multiHeader;
+		multi_packet.data = (uint8_t *)&multiHeader;
 		send_packet(client, &multi_packet);
-		free(multiHeader);
 
 		left_data = ipc_frame->datasize;
 
@@ -285,9 +219,41 @@ int32_t wave_ipc_send(struct ipc_client *client, struct modem_io *ipc_frame)
 	return 0;
 }
 
+int32_t wave_ipc_sendv(struct ipc_client *client, uint32_t cmd, struct iovec *iov, int iovcnt)
+{
+	struct modem_io ipc_frame;
+	uint8_t frame_buf[SIZ_PACKET_FRAME];
+	int32_t rc;
+
+	ipc_frame.magic = 0xCAFECAFE;
+	ipc_frame.cmd = cmd;
+	ipc_frame.datasize = ipc_iov_length(iov, iovcnt);
+
+	/* IOCTL_MODEM_SEND wants one contiguous buffer, assemble it only once */
+	if (iovcnt == 1)
+		ipc_frame.data = (uint8_t *)iov[0].iov_base;
+	else if (ipc_frame.datasize <= sizeof(frame_buf))
+		ipc_frame.data = frame_buf;
+	else
+		ipc_frame.data = (uint8_t *)malloc(ipc_frame.datasize);
+
+	if (ipc_frame.data == NULL)
+		return -1;
+
+	if (iovcnt > 1)
+		ipc_iov_flatten(iov, iovcnt, ipc_frame.data);
+
+	rc = wave_ipc_send(client, &ipc_frame);
+
+	if (iovcnt > 1 && ipc_frame.data != frame_buf)
+		free(ipc_frame.data);
+
+	return rc;
+}
+
 int32_t wave_ipc_recv(struct ipc_client *client, struct modem_io *ipc_frame)
 {
-	ipc_frame->data = (uint8_t*)malloc(SIZ_PACKET_BUFSIZE);
+    /* data points at a pool frame of IPC_FRAME_SIZE bytes */
     return client->handlers->read((void*)ipc_frame, 0, client->handlers->read_data);
 }
 
@@ -309,12 +275,12 @@ int32_t wave_ipc_read(void *data, unsigned int size, void *io_data)
 
     rc = ioctl(fd, IOCTL_MODEM_RECV, data);
 
+    /* Non-blocking client and no frame ready yet */
+    if(rc < 0 && errno == EAGAIN)
+        return 1;
+
     if(rc < 0)
         return -1;
-	
-#ifdef DEBUG
-	log_write(1, data, size);
-#endif
 
     return 0;
 }
@@ -332,14 +298,13 @@ int32_t wave_ipc_write(void *data, unsigned int size, void *io_data)
     if(fd < 0)
         return -1;
 
-    rc = ioctl(fd, IOCTL_MODEM_SEND, data);
+    while((rc = ioctl(fd, IOCTL_MODEM_SEND, data)) < 0 && errno == EAGAIN) {
+        if(ipc_stream_wait_writable(fd) < 0)
+            return -1;
+    }
 
     if(rc < 0)
         return -1;
-		
-#ifdef DEBUG
-	log_write(0, data, size);
-#endif
 
     return 0;
 }
@@ -439,6 +404,7 @@ struct ipc_handlers wave_default_handlers = {
 
 struct ipc_ops wave_ops = {
     .send = wave_ipc_send,
+    .sendv = wave_ipc_sendv,
     .recv = wave_ipc_recv,
     .bootstrap = wave_modem_bootstrap,
     .modem_operations = wave_modem_operations,
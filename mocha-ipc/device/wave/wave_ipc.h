@@ -29,12 +29,5 @@
 #define MODEMCTL_PATH			"/dev/modem_ctl"
 #define MODEMPACKET_PATH			"/dev/modem_packet"
 
-struct multiPacketHeader {
-	uint32_t command;
-	uint32_t packtLen;
-	uint32_t packetType;
-};
-
-
 #endif
 
@@ -18,6 +18,8 @@
  * along with libmocha-ipc.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#define IPC_LOG_MODULE	IPC_LOG_MISC
+
 #include <stdlib.h>
 #include <stdio.h>
 #include <unistd.h>
@@ -245,7 +247,7 @@ void ipc_parse_drv(struct ipc_client* client, struct modem_io *ipc_frame)
 		DEBUG_I("IpcDrv Packet type 0x%X is not yet handled", rx_header->drvPacketType);
 		DEBUG_I("Frame type = 0x%x\n Frame length = 0x%x", ipc_frame->cmd, ipc_frame->datasize);
 
-		ipc_hex_dump(client, ipc_frame->data, ipc_frame->datasize);
+		IPC_CLIENT_HEX_DUMP(client, ipc_frame->data, ipc_frame->datasize);
 
 		break;
     }
@@ -255,13 +257,14 @@ void ipc_parse_drv(struct ipc_client* client, struct modem_io *ipc_frame)
 
 void drv_send_packet(uint8_t type, uint8_t *data, int32_t data_size)
 {
-	struct modem_io request;
-	request.data = malloc(data_size + sizeof(struct drvPacketHeader));
-	request.data[0] = type;
-	memcpy(request.data + 1, data, data_size);
-	request.magic = 0xCAFECAFE;
-	request.cmd = FIFO_PKT_DRV;
-	request.datasize = data_size + 1;
-	ipc_send(&request);
-	free(request.data);
+	struct drvPacketHeader header;
+	struct iovec iov[2];
+
+	header.drvPacketType = type;
+	iov[0].iov_base = &header;
+	iov[0].iov_len = sizeof(struct drvPacketHeader);
+	iov[1].iov_base = data;
+	iov[1].iov_len = data_size;
+
+	ipc_sendv(FIFO_PKT_DRV, iov, data_size ? 2 : 1);
 }
@@ -35,6 +35,8 @@
  *
  */
 
+#define IPC_LOG_MODULE	IPC_LOG_MISC
+
 #include <stdlib.h>
 #include <stdio.h>
 #include <unistd.h>
@@ -636,43 +638,27 @@ int32_t ipc_parse_fm(struct ipc_client* client, struct modem_io *ipc_frame)
 	int32_t retval;
 	struct fmRequest rx_packet;
 	struct fmResponse tx_packet;
-	struct modem_io request;
-	uint8_t *frame;
-	uint8_t *payload;
-	int32_t frame_length;
+	struct iovec iov[4];
 
 	get_request_packet(ipc_frame->data, &rx_packet);
 
 	tx_packet.header = rx_packet.header;
 	retval = fileOps[(tx_packet.header.fmPacketType + 0xEFFFFFFF)](&rx_packet, &tx_packet);
 
-    frame_length = (sizeof(struct fmPacketHeader) + tx_packet.header.packetLen);
-
-	request.magic = ipc_frame->magic;
-	request.cmd = ipc_frame->cmd;
-	request.datasize = frame_length;
-
-    frame = (uint8_t*)malloc(frame_length);
-
-    *(struct fmPacketHeader*)(frame) = tx_packet.header;
+	/* Response goes out as header, funcRet, errorVal and respBuf segments */
+	iov[0].iov_base = &tx_packet.header;
+	iov[0].iov_len = sizeof(struct fmPacketHeader);
+	iov[1].iov_base = &tx_packet.funcRet;
+	iov[1].iov_len = sizeof(tx_packet.funcRet);
+	iov[2].iov_base = &tx_packet.errorVal;
+	iov[2].iov_len = sizeof(tx_packet.errorVal);
+	iov[3].iov_base = tx_packet.respBuf;
+	iov[3].iov_len = tx_packet.header.packetLen - (sizeof(tx_packet.errorVal) + sizeof(tx_packet.funcRet));
 
-    payload = (frame + sizeof(struct fmPacketHeader));
-    *(uint32_t*)(payload) = tx_packet.funcRet;
-    payload = (payload + sizeof(tx_packet.funcRet));
-    *(uint32_t*)(payload) = tx_packet.errorVal;
-    payload = (payload + sizeof(tx_packet.errorVal));
-
-    memcpy(payload, tx_packet.respBuf, tx_packet.header.packetLen - (sizeof(tx_packet.errorVal) + sizeof(tx_packet.funcRet)));
-
-	request.data = frame;
-
-	ipc_send(&request);
+	ipc_sendv(ipc_frame->cmd, iov, iov[3].iov_len ? 4 : 3);
 
 	if(tx_packet.respBuf != NULL)
         free(tx_packet.respBuf);
 
-    if(frame != NULL)
-        free(frame);
-
     return 0;
 }
@@ -54,6 +54,8 @@ char cached_imei[33];
 
 extern void jet_ipc_register();
 extern void wave_ipc_register();
+extern void loopback_ipc_register();
+extern void replay_ipc_register();
 
 void ipc_init(void)
 {
@@ -65,11 +67,15 @@ void ipc_init(void)
 #elif defined(DEVICE_WAVE)
     wave_ipc_register();
 #endif
+    loopback_ipc_register();
+    replay_ipc_register();
 
 	for(i = 0; i < IPC_RIL_CB_LAST; i++)
 	{
 		ipc_ril_cb_map[i] = NULL;
 	}
+
+	ipc_dispatch_init();
 }
 
 void ipc_shutdown(void)
@@ -87,7 +93,7 @@ void ipc_register_ril_cb(int type, ipc_ril_cb cb)
 
 void ipc_invoke_ril_cb(int type, void* data)
 {
-	DEBUG_I("Invoking RIL callback of type %d", type);
+	DEBUG_V("Invoking RIL callback of type %d", type);
 	if(ipc_ril_cb_map[type])
 	{
 		ipc_ril_cb_map[type](data);
@@ -116,16 +122,39 @@ void ipc_client_log(struct ipc_client *client, const char *message, ...)
     char buffer[4096];
 
     va_start(args, message);
-    vsprintf(buffer, message, args);
+    vsnprintf(buffer, sizeof(buffer), message, args);
     client->log_handler(buffer, client->log_data);
     va_end(args);
 }
 
+static int ipc_device_from_env(void)
+{
+    const char *name = getenv(IPC_DEVICE_ENV);
+
+    if (name == NULL)
+        return -1;
+
+    if (strcmp(name, "jet") == 0)
+        return IPC_DEVICE_JET;
+    if (strcmp(name, "wave") == 0)
+        return IPC_DEVICE_WAVE;
+    if (strcmp(name, "loopback") == 0)
+        return IPC_DEVICE_LOOPBACK;
+    if (strcmp(name, "replay") == 0)
+        return IPC_DEVICE_REPLAY;
+
+    return -1;
+}
+
 struct ipc_client* ipc_client_new()
 {
     int device_type = -1, in_hardware = 0;
     char buf[4096];
 
+    device_type = ipc_device_from_env();
+    if (device_type >= 0)
+        return ipc_client_new_for_device(device_type);
+
     // gather device type from /proc/cpuinfo
     int fd = open("/proc/cpuinfo", O_RDONLY);
     int bytesread = read(fd, buf, 4096);
@@ -157,10 +186,11 @@ struct ipc_client* ipc_client_new_for_device(int device_type)
 {
     struct ipc_client *client;
 
-    if (device_type < 0 || device_type > IPC_DEVICE_LAST)
+    if (device_type < 0 || device_type >= IPC_DEVICE_LAST ||
+        devices[device_type].client_ops == NULL)
         return 0;
 
-    client = (struct ipc_client*) malloc(sizeof(struct ipc_client));
+    client = (struct ipc_client*) calloc(1, sizeof(struct ipc_client));
 
 	client->ops = devices[device_type].client_ops;
 
@@ -170,11 +200,18 @@ struct ipc_client* ipc_client_new_for_device(int device_type)
     if (devices[device_type].handlers != 0)
         memcpy(client->handlers, devices[device_type].handlers , sizeof(struct ipc_handlers));
 
+    client->frame_pool = ipc_frame_pool_new(IPC_FRAME_POOL_SIZE, IPC_FRAME_SIZE);
+    client->reassembly.limit = IPC_REASSEMBLY_LIMIT;
+
     return client;
 }
 
 int ipc_client_free(struct ipc_client *client)
 {
+    ipc_uring_free(client->rx_uring);
+    ipc_uring_free(client->tx_uring);
+    ipc_frame_unref(&client->reassembly.frame);
+    ipc_frame_pool_free(client->frame_pool);
     free(client->handlers);
     free(client);
     client = NULL;
@@ -342,16 +379,50 @@ int32_t ipc_client_modem_operations(struct ipc_client *client, void *data, uint3
     return client->ops->modem_operations(client, data, cmd);
 }
 
+/* Hands the transport fds to io_uring when the device and the kernel allow it */
+static void ipc_client_uring_start(struct ipc_client *client)
+{
+    int fd;
+
+    client->write_fd = -1;
+
+    if (!client->ops->uring || !ipc_uring_enabled())
+        return;
+
+    fd = ipc_client_get_handlers_common_data_fd(client);
+    if (fd < 0)
+        return;
+
+    client->write_fd = fd;
+    if (client->handlers->common_data_get_write_fd != NULL)
+        client->write_fd = client->handlers->common_data_get_write_fd(client->handlers->common_data);
+
+    client->rx_uring = ipc_uring_new_stream(fd);
+    if (client->rx_uring == NULL)
+        return;
+
+    client->tx_uring = ipc_uring_new(-1, 0);
+
+    ipc_client_log(client, "Transport I/O on io_uring\n");
+}
+
 int32_t ipc_client_open(struct ipc_client *client)
 {
-    int32_t fd;
+    int32_t rc;
 
     if (client == NULL ||
         client->handlers == NULL ||
         client->handlers->open == NULL)
         return -1;
 
-    return client->handlers->open(NULL, 0, client->handlers->open_data);
+    rc = client->handlers->open(NULL, 0, client->handlers->open_data);
+
+    if (rc == 0) {
+        client->opened = 1;
+        ipc_client_uring_start(client);
+    }
+
+    return rc;
 }
 
 int32_t ipc_client_close(struct ipc_client *client)
@@ -361,9 +432,107 @@ int32_t ipc_client_close(struct ipc_client *client)
         client->handlers->close == NULL)
         return -1;
 
+    client->opened = 0;
+
+    /* Queued reads must be gone before the fd is */
+    ipc_uring_free(client->rx_uring);
+    ipc_uring_free(client->tx_uring);
+    client->rx_uring = NULL;
+    client->tx_uring = NULL;
+
     return client->handlers->close(NULL, 0, client->handlers->close_data);
 }
 
+/*
+ * For callers that poll the fd: reads then return EAGAIN instead of
+ * waiting for more, and ipc_client_recv returns 1 with a partial frame
+ * kept in the transport buffer. Call it after ipc_client_open, a ring's
+ * fd is left as is since io_uring would fail its reads on it.
+ */
+int ipc_client_set_nonblocking(struct ipc_client *client)
+{
+    int flags;
+    int fd;
+
+    if (client == NULL)
+        return -1;
+
+    client->nonblocking = 1;
+
+    if (client->rx_uring != NULL)
+        return 0;
+
+    fd = ipc_client_get_handlers_common_data_fd(client);
+    if (fd < 0)
+        return -1;
+
+    flags = fcntl(fd, F_GETFL);
+    if (flags < 0 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) < 0)
+        return -1;
+
+    return 0;
+}
+
+int ipc_client_get_poll_fd(struct ipc_client *client)
+{
+    if (client == NULL)
+        return -1;
+
+    if (client->rx_uring != NULL)
+        return ipc_uring_fd(client->rx_uring);
+
+    return ipc_client_get_handlers_common_data_fd(client);
+}
+
+/**
+ * Transport I/O
+ *
+ * Stream transports read and write through these rather than through
+ * their handlers directly, so io_uring can stand in for the syscalls.
+ */
+
+/* ipc_io_handler_cb flavour of read, io_data is the client */
+int32_t ipc_client_io_read(void *data, uint32_t size, void *io_data)
+{
+    struct ipc_client *client = (struct ipc_client *) io_data;
+
+    if (client->rx_uring != NULL)
+        return ipc_uring_read(client->rx_uring, data, size, !client->nonblocking);
+
+    client->read_syscalls++;
+
+    return client->handlers->read(data, size, client->handlers->read_data);
+}
+
+int32_t ipc_client_io_write(struct ipc_client *client, void *data, uint32_t size)
+{
+    struct iovec iov;
+
+    client->write_calls++;
+
+    if (client->tx_uring != NULL) {
+        iov.iov_base = data;
+        iov.iov_len = size;
+        return ipc_uring_writev(client->tx_uring, client->write_fd, &iov, 1);
+    }
+
+    client->write_syscalls++;
+
+    return client->handlers->write(data, size, client->handlers->write_data);
+}
+
+int32_t ipc_client_io_writev(struct ipc_client *client, struct iovec *iov, int iovcnt)
+{
+    client->write_calls++;
+
+    if (client->tx_uring != NULL)
+        return ipc_uring_writev(client->tx_uring, client->write_fd, iov, iovcnt);
+
+    client->write_syscalls++;
+
+    return client->handlers->writev(iov, iovcnt, client->handlers->write_data);
+}
+
 int32_t ipc_client_power_on(struct ipc_client *client)
 {
 	return 0; //for jet
@@ -393,15 +562,403 @@ int32_t ipc_client_send(struct ipc_client *client, struct modem_io *ipc_frame)
         client->ops->send == NULL)
         return -1;
 
+    if (ipc_capture_active)
+        ipc_capture_frame(IPC_CAPTURE_TX, ipc_frame);
+
     return client->ops->send(client, ipc_frame);
 }
 
+int32_t ipc_client_sendv(struct ipc_client *client, uint32_t cmd, struct iovec *iov, int iovcnt)
+{
+    struct modem_io ipc_frame;
+    int32_t rc;
+
+    if (client == NULL ||
+        client->ops == NULL ||
+        iov == NULL ||
+        iovcnt <= 0 || iovcnt > IPC_MAX_IOV)
+        return -1;
+
+    if (ipc_capture_active)
+        ipc_capture_framev(IPC_CAPTURE_TX, 0xCAFECAFE, cmd, iov, iovcnt);
+
+    if (client->ops->sendv != NULL)
+        return client->ops->sendv(client, cmd, iov, iovcnt);
+
+    if (client->ops->send == NULL)
+        return -1;
+
+    /* Transport can't gather, assemble the frame once here */
+    ipc_frame.magic = 0xCAFECAFE;
+    ipc_frame.cmd = cmd;
+    ipc_frame.datasize = ipc_iov_length(iov, iovcnt);
+    ipc_frame.data = (uint8_t *) malloc(ipc_frame.datasize);
+
+    if (ipc_frame.data == NULL)
+        return -1;
+
+    ipc_iov_flatten(iov, iovcnt, ipc_frame.data);
+    rc = client->ops->send(client, &ipc_frame);
+    free(ipc_frame.data);
+
+    return rc;
+}
+
+/* Returns the number of frames sent, transports may coalesce the writes */
+int32_t ipc_client_send_batch(struct ipc_client *client, struct ipc_frame_iov *frames, int count)
+{
+    int i;
+
+    if (client == NULL ||
+        client->ops == NULL ||
+        frames == NULL ||
+        count <= 0)
+        return -1;
+
+    if (client->ops->send_batch != NULL) {
+        if (ipc_capture_active) {
+            for (i = 0; i < count; i++)
+                ipc_capture_framev(IPC_CAPTURE_TX, 0xCAFECAFE, frames[i].cmd, frames[i].iov, frames[i].iovcnt);
+        }
+
+        return client->ops->send_batch(client, frames, count);
+    }
+
+    for (i = 0; i < count; i++) {
+        if (ipc_client_sendv(client, frames[i].cmd, frames[i].iov, frames[i].iovcnt) < 0)
+            return i > 0 ? i : -1;
+    }
+
+    return count;
+}
+
+uint32_t ipc_iov_length(struct iovec *iov, int iovcnt)
+{
+    uint32_t len = 0;
+    int i;
+
+    for (i = 0; i < iovcnt; i++)
+        len += iov[i].iov_len;
+
+    return len;
+}
+
+void ipc_iov_flatten(struct iovec *iov, int iovcnt, uint8_t *buf)
+{
+    int i;
+
+    for (i = 0; i < iovcnt; i++) {
+        if (iov[i].iov_len == 0)
+            continue;
+        memcpy(buf, iov[i].iov_base, iov[i].iov_len);
+        buf += iov[i].iov_len;
+    }
+}
+
+/*
+ * Describes bytes [offset, offset + len) of the iov array with at most
+ * outcnt segments of out, without touching the data. Used to cut large
+ * frames into MAX_SINGLE_FRAME_DATA chunks. Returns the number of segments.
+ */
+int ipc_iov_slice(struct iovec *iov, int iovcnt, uint32_t offset, uint32_t len,
+                  struct iovec *out, int outcnt)
+{
+    int i, n = 0;
+    uint32_t seg_len;
+
+    for (i = 0; i < iovcnt && len > 0; i++) {
+        seg_len = iov[i].iov_len;
+
+        if (offset >= seg_len) {
+            offset -= seg_len;
+            continue;
+        }
+
+        if (n == outcnt)
+            return -1;
+
+        out[n].iov_base = (uint8_t *) iov[i].iov_base + offset;
+        out[n].iov_len = seg_len - offset;
+        if (out[n].iov_len > len)
+            out[n].iov_len = len;
+
+        len -= out[n].iov_len;
+        offset = 0;
+        n++;
+    }
+
+    return n;
+}
+
+/**
+ * Multi-packet reassembly
+ */
+
+static void ipc_reassembly_drop(struct ipc_client *client)
+{
+    struct ipc_reassembly *reassembly = &client->reassembly;
+
+    ipc_client_log(client, "Dropping multi-packet frame 0x%x: %d/%d bytes\n",
+                   reassembly->packet_type, reassembly->filled, reassembly->expected);
+
+    ipc_frame_unref(&reassembly->frame);
+    reassembly->active = 0;
+    reassembly->stats.dropped++;
+}
+
+/*
+ * The whole frame is allocated up front with a frame worth of slack, so
+ * every chunk can be received in place right after the previous one.
+ */
+static void ipc_reassembly_start(struct ipc_client *client, struct multiPacketHeader *header)
+{
+    struct ipc_reassembly *reassembly = &client->reassembly;
+
+    if (reassembly->active)
+        ipc_reassembly_drop(client);
+
+    reassembly->packet_type = header->packetType;
+    reassembly->expected = header->packtLen;
+    reassembly->filled = 0;
+    reassembly->active = 1;
+    reassembly->frame.buf = NULL;
+    reassembly->frame.data = NULL;
+    clock_gettime(CLOCK_MONOTONIC, &reassembly->start);
+
+    if (header->packtLen > reassembly->limit) {
+        ipc_client_log(client, "Multi-packet frame 0x%x too large: %d bytes\n",
+                       header->packetType, header->packtLen);
+        reassembly->stats.oversize++;
+        return;
+    }
+
+    if (ipc_frame_alloc(NULL, &reassembly->frame, header->packtLen + IPC_FRAME_SIZE) < 0) {
+        ipc_client_log(client, "Can't allocate %d bytes for multi-packet frame\n",
+                       header->packtLen);
+        reassembly->frame.buf = NULL;
+        reassembly->frame.data = NULL;
+    }
+}
+
+static void ipc_reassembly_complete(struct ipc_client *client, struct modem_io *ipc_frame)
+{
+    struct ipc_reassembly *reassembly = &client->reassembly;
+    struct timespec now;
+    uint32_t latency;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    latency = (now.tv_sec - reassembly->start.tv_sec) * 1000000 +
+              (now.tv_nsec - reassembly->start.tv_nsec) / 1000;
+
+    reassembly->stats.completed++;
+    reassembly->stats.last_latency_us = latency;
+    reassembly->stats.total_latency_us += latency;
+    if (latency > reassembly->stats.max_latency_us)
+        reassembly->stats.max_latency_us = latency;
+
+    /* Ownership of the buffer moves to the caller */
+    ipc_frame->magic = 0xCAFECAFE;
+    ipc_frame->cmd = reassembly->packet_type;
+    ipc_frame->datasize = reassembly->expected;
+    ipc_frame->data = reassembly->frame.data;
+    ipc_frame->buf = reassembly->frame.buf;
+
+    reassembly->frame.data = NULL;
+    reassembly->frame.buf = NULL;
+    reassembly->active = 0;
+}
+
+/*
+ * Receives the next chunk of the frame being assembled. Returns 1 while
+ * more chunks are expected, 0 when ipc_frame holds a frame to dispatch.
+ */
+static int32_t ipc_reassembly_recv(struct ipc_client *client, struct modem_io *ipc_frame)
+{
+    struct ipc_reassembly *reassembly = &client->reassembly;
+    struct modem_io chunk;
+    int32_t rc;
+
+    memset(&chunk, 0, sizeof(chunk));
+
+    if (reassembly->frame.buf != NULL) {
+        chunk.buf = reassembly->frame.buf;
+        chunk.data = reassembly->frame.data + reassembly->filled;
+        ipc_frame_ref(&chunk);
+    } else if (ipc_frame_alloc(client->frame_pool, &chunk, IPC_FRAME_SIZE) < 0) {
+        return -1;
+    }
+
+    rc = client->ops->recv(client, &chunk);
+
+    if (rc < 0) {
+        ipc_frame_unref(&chunk);
+        ipc_reassembly_drop(client);
+        return rc;
+    }
+
+    /* Next chunk not in yet, the sequence goes on with the next read */
+    if (rc > 0) {
+        ipc_frame_unref(&chunk);
+        return rc;
+    }
+
+    if (chunk.cmd != FIFO_PKT_FIFO_INTERNAL) {
+        /* Sequence was interrupted, the frame itself is still good */
+        ipc_reassembly_drop(client);
+        memcpy(ipc_frame, &chunk, sizeof(struct modem_io));
+        return 0;
+    }
+
+    reassembly->filled += chunk.datasize;
+    ipc_frame_unref(&chunk);
+
+    if (reassembly->filled < reassembly->expected)
+        return 1;
+
+    if (reassembly->filled > reassembly->expected || reassembly->frame.buf == NULL) {
+        ipc_reassembly_drop(client);
+        return 1;
+    }
+
+    ipc_reassembly_complete(client, ipc_frame);
+
+    return 0;
+}
+
+int ipc_client_set_reassembly_limit(struct ipc_client *client, uint32_t limit)
+{
+    if (client == NULL)
+        return -1;
+
+    client->reassembly.limit = limit;
+
+    return 0;
+}
+
+int ipc_client_get_reassembly_stats(struct ipc_client *client, struct ipc_reassembly_stats *stats)
+{
+    if (client == NULL || stats == NULL)
+        return -1;
+
+    memcpy(stats, &client->reassembly.stats, sizeof(struct ipc_reassembly_stats));
+
+    return 0;
+}
+
+/*
+ * Hands the transport a frame buffer of at least IPC_FRAME_SIZE bytes to
+ * fill in place. On success the caller owns one reference to the frame.
+ */
 int32_t ipc_client_recv(struct ipc_client *client, struct modem_io *ipc_frame)
 {
+    struct multiPacketHeader *header;
+    int32_t rc;
+
+    if (client == NULL ||
+        client->ops == NULL ||
+        client->ops->recv == NULL ||
+        ipc_frame == NULL)
+        return -1;
+
+    ipc_frame->buf = NULL;
+    ipc_frame->data = NULL;
+
+    if (client->reassembly.active) {
+        rc = ipc_reassembly_recv(client, ipc_frame);
+
+        if (rc == 0 && ipc_capture_active)
+            ipc_capture_frame(IPC_CAPTURE_RX, ipc_frame);
+
+        return rc;
+    }
+
+    if (ipc_frame_alloc(client->frame_pool, ipc_frame, IPC_FRAME_SIZE) < 0)
+        return -1;
+
+    rc = client->ops->recv(client, ipc_frame);
+
+    if (rc != 0) {
+        ipc_frame_unref(ipc_frame);
+        return rc;
+    }
+
+    header = (struct multiPacketHeader *) ipc_frame->data;
+
+    if (ipc_frame->cmd == FIFO_PKT_FIFO_INTERNAL &&
+        ipc_frame->datasize == sizeof(struct multiPacketHeader) &&
+        header->command == 0x02) {
+        ipc_reassembly_start(client, header);
+        ipc_frame_unref(ipc_frame);
+        return 1;
+    }
+
+    if (ipc_capture_active)
+        ipc_capture_frame(IPC_CAPTURE_RX, ipc_frame);
+
+    return rc;
+}
+
+int ipc_client_recv_pending(struct ipc_client *client)
+{
+    if (client == NULL ||
+        client->ops == NULL ||
+        client->ops->recv_pending == NULL)
+        return 0;
+
+    if (client->ops->recv_pending(client))
+        return 1;
+
+    /* Also flushes re-armed reads before the caller goes back to sleep */
+    return ipc_uring_pending(client->rx_uring);
+}
+
+/*
+ * Waits for the first frame only (not at all on a non-blocking client,
+ * which may return 0), then keeps going while the transport already holds
+ * complete frames, so they can be dispatched in one go.
+ */
+int ipc_client_recv_batch(struct ipc_client *client, struct modem_io *frames, int max)
+{
+    int count = 0;
+    int32_t rc;
+
+    if (frames == NULL || max <= 0)
+        return -1;
+
+    do {
+        rc = ipc_client_recv(client, &frames[count]);
+
+        if (rc < 0)
+            return count > 0 ? count : -1;
+
+        if (rc == 0)
+            count++;
+    } while (count < max && ipc_client_recv_pending(client));
+
+    return count;
+}
+
+int ipc_client_get_transport_stats(struct ipc_client *client, struct ipc_transport_stats *stats)
+{
+    struct ipc_uring_stats uring_stats;
+
     if (client == NULL ||
         client->ops == NULL ||
-        client->ops->recv == NULL)
+        client->ops->get_stats == NULL ||
+        stats == NULL)
+        return -1;
+
+    if (client->ops->get_stats(client, stats) < 0)
         return -1;
 
-    return client->ops->recv(client, ipc_frame);
+    stats->write_calls = client->write_calls;
+    stats->syscalls = client->read_syscalls + client->write_syscalls;
+    stats->uring = (client->rx_uring != NULL);
+
+    if (ipc_uring_get_stats(client->rx_uring, &uring_stats) == 0)
+        stats->syscalls += uring_stats.enters;
+    if (ipc_uring_get_stats(client->tx_uring, &uring_stats) == 0)
+        stats->syscalls += uring_stats.enters;
+
+    return 0;
 }
@@ -0,0 +1,382 @@
+/**
+ * This file is part of libmocha-ipc.
+ *
+ * libmocha-ipc is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libmocha-ipc is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with libmocha-ipc.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/mman.h>
+
+#include <radio.h>
+#include "ipc_private.h"
+
+#define LOG_TAG "RIL-Mocha-Capture"
+#include <utils/Log.h>
+
+/*
+ * Binary capture of the frames going through ipc_client_send*() and
+ * ipc_client_recv(), for Jet, Wave and loopback alike. The capture file is
+ * sized up front and mmap'd, a record is one memcpy into it and the used
+ * count in the file header is bumped after it, so there is no syscall per
+ * frame and what was captured survives a crash. When the file is full it
+ * is trimmed, rotated to <path>.1 (and so on up to <path>.<files - 1>)
+ * and a new one is started. tools/capconv.c turns captures back into the
+ * old ipc_log.txt text or into pcap-ng.
+ */
+
+struct ipc_capture {
+    pthread_mutex_t mutex;
+
+    char path[256];
+    uint32_t file_size;
+    int files;
+
+    int fd;
+    uint8_t *map;
+    struct ipc_capture_file_header *header;
+
+    /* Payload bytes kept per FIFO packet type */
+    uint32_t snaplen[256];
+    int snaplen_set;
+
+    struct ipc_capture_stats stats;
+};
+
+/* ".<n>" of a rotated capture, for any int n */
+#define IPC_CAPTURE_SUFFIX_MAX  16
+
+volatile int ipc_capture_active;
+
+static struct ipc_capture ipc_capture = {
+    .mutex = PTHREAD_MUTEX_INITIALIZER,
+    .fd = -1,
+};
+
+/* Nothing is truncated until asked for, called with the mutex held */
+static void ipc_capture_snaplen_init(struct ipc_capture *capture)
+{
+    int i;
+
+    if (capture->snaplen_set)
+        return;
+
+    for (i = 0; i < 256; i++)
+        capture->snaplen[i] = IPC_CAPTURE_SNAPLEN_ALL;
+
+    capture->snaplen_set = 1;
+}
+
+static uint64_t ipc_capture_time_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+
+    return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* Called with the mutex held */
+static void ipc_capture_close_file(struct ipc_capture *capture)
+{
+    uint32_t used;
+
+    if (capture->map == NULL)
+        return;
+
+    used = capture->header->used;
+
+    munmap(capture->map, capture->file_size);
+    capture->map = NULL;
+    capture->header = NULL;
+
+    /* Leave no zeroed tail behind for the converter */
+    ftruncate(capture->fd, sizeof(struct ipc_capture_file_header) + used);
+    close(capture->fd);
+    capture->fd = -1;
+}
+
+/* Called with the mutex held */
+static int ipc_capture_open_file(struct ipc_capture *capture)
+{
+    capture->fd = open(capture->path, O_RDWR | O_CREAT | O_TRUNC, 0660);
+    if (capture->fd < 0) {
+        LOGE("Unable to open capture file %s: %s", capture->path, strerror(errno));
+        return -1;
+    }
+
+    if (ftruncate(capture->fd, capture->file_size) < 0) {
+        LOGE("Unable to size capture file %s: %s", capture->path, strerror(errno));
+        goto error;
+    }
+
+    capture->map = mmap(NULL, capture->file_size, PROT_READ | PROT_WRITE, MAP_SHARED, capture->fd, 0);
+    if (capture->map == MAP_FAILED) {
+        LOGE("Unable to map capture file %s: %s", capture->path, strerror(errno));
+        capture->map = NULL;
+        goto error;
+    }
+
+    capture->header = (struct ipc_capture_file_header *) capture->map;
+    memcpy(capture->header->magic, IPC_CAPTURE_MAGIC, sizeof(capture->header->magic));
+    capture->header->version = IPC_CAPTURE_VERSION;
+    capture->header->header_size = sizeof(struct ipc_capture_file_header);
+    capture->header->file_size = capture->file_size;
+    capture->header->used = 0;
+    capture->header->records = 0;
+    capture->header->start_ns = ipc_capture_time_ns();
+
+    return 0;
+
+error:
+    close(capture->fd);
+    capture->fd = -1;
+    return -1;
+}
+
+/* Called with the mutex held */
+static int ipc_capture_rotate(struct ipc_capture *capture)
+{
+    char from[sizeof(capture->path) + IPC_CAPTURE_SUFFIX_MAX];
+    char to[sizeof(capture->path) + IPC_CAPTURE_SUFFIX_MAX];
+    int from_len, to_len;
+    int i;
+
+    ipc_capture_close_file(capture);
+
+    for (i = capture->files - 1; i > 0; i--) {
+        if (i > 1)
+            from_len = snprintf(from, sizeof(from), "%s.%d", capture->path, i - 1);
+        else
+            from_len = snprintf(from, sizeof(from), "%s", capture->path);
+        to_len = snprintf(to, sizeof(to), "%s.%d", capture->path, i);
+
+        if (from_len < 0 || from_len >= (int) sizeof(from) || to_len < 0 || to_len >= (int) sizeof(to)) {
+            LOGE("Capture file name %s too long to rotate", capture->path);
+            return -1;
+        }
+
+        rename(from, to);
+    }
+
+    capture->stats.rotations++;
+
+    return ipc_capture_open_file(capture);
+}
+
+/* Keeps files - 1 rotated captures of file_size bytes next to path */
+int ipc_capture_start(const char *path, uint32_t file_size, int files)
+{
+    struct ipc_capture *capture = &ipc_capture;
+    int rc;
+
+    if (path == NULL || strlen(path) >= sizeof(capture->path) ||
+        file_size < sizeof(struct ipc_capture_file_header) + IPC_CAPTURE_MIN_RECORDS * sizeof(struct ipc_capture_record))
+        return -1;
+
+    pthread_mutex_lock(&capture->mutex);
+
+    ipc_capture_active = 0;
+    ipc_capture_close_file(capture);
+
+    ipc_capture_snaplen_init(capture);
+
+    strcpy(capture->path, path);
+    capture->file_size = file_size;
+    capture->files = files > 0 ? files : 1;
+    memset(&capture->stats, 0, sizeof(capture->stats));
+
+    rc = ipc_capture_open_file(capture);
+    if (rc == 0)
+        ipc_capture_active = 1;
+
+    pthread_mutex_unlock(&capture->mutex);
+
+    return rc;
+}
+
+void ipc_capture_stop(void)
+{
+    struct ipc_capture *capture = &ipc_capture;
+
+    pthread_mutex_lock(&capture->mutex);
+
+    ipc_capture_active = 0;
+    ipc_capture_close_file(capture);
+
+    pthread_mutex_unlock(&capture->mutex);
+}
+
+/* Only the first snaplen payload bytes of cmd frames are kept, cmd < 0 sets all */
+int ipc_capture_set_snaplen(int cmd, uint32_t snaplen)
+{
+    struct ipc_capture *capture = &ipc_capture;
+    int i;
+
+    if (cmd >= 256)
+        return -1;
+
+    pthread_mutex_lock(&capture->mutex);
+
+    ipc_capture_snaplen_init(capture);
+
+    if (cmd < 0) {
+        for (i = 0; i < 256; i++)
+            capture->snaplen[i] = snaplen;
+    } else {
+        capture->snaplen[cmd] = snaplen;
+    }
+
+    pthread_mutex_unlock(&capture->mutex);
+
+    return 0;
+}
+
+/* "<cmd|all>=<bytes>,...", returns the number of bad entries */
+int ipc_capture_set_snaplens(const char *spec)
+{
+    char buffer[128];
+    char *entry, *next;
+    unsigned int snaplen;
+    int cmd;
+    int errors = 0;
+
+    if (spec == NULL)
+        return 0;
+
+    strncpy(buffer, spec, sizeof(buffer) - 1);
+    buffer[sizeof(buffer) - 1] = '\0';
+
+    for (entry = strtok_r(buffer, ",", &next); entry != NULL; entry = strtok_r(NULL, ",", &next)) {
+        if (sscanf(entry, "all=%u", &snaplen) == 1)
+            cmd = -1;
+        else if (sscanf(entry, "%i=%u", &cmd, &snaplen) != 2 || cmd < 0) {
+            errors++;
+            continue;
+        }
+
+        if (ipc_capture_set_snaplen(cmd, snaplen) < 0)
+            errors++;
+    }
+
+    return errors;
+}
+
+/* Copies up to caplen bytes out of iov into dst */
+static void ipc_capture_copy(uint8_t *dst, struct iovec *iov, int iovcnt, uint32_t caplen)
+{
+    uint32_t n;
+    int i;
+
+    for (i = 0; i < iovcnt && caplen > 0; i++) {
+        n = iov[i].iov_len < caplen ? iov[i].iov_len : caplen;
+        memcpy(dst, iov[i].iov_base, n);
+        dst += n;
+        caplen -= n;
+    }
+}
+
+void ipc_capture_framev(int direction, uint32_t magic, uint32_t cmd, struct iovec *iov, int iovcnt)
+{
+    struct ipc_capture *capture = &ipc_capture;
+    struct ipc_capture_record *record;
+    uint32_t datasize, caplen, length, room;
+
+    datasize = ipc_iov_length(iov, iovcnt);
+
+    pthread_mutex_lock(&capture->mutex);
+
+    if (!ipc_capture_active || capture->map == NULL) {
+        pthread_mutex_unlock(&capture->mutex);
+        return;
+    }
+
+    caplen = datasize;
+    if (capture->snaplen[cmd & 0xff] < caplen) {
+        caplen = capture->snaplen[cmd & 0xff];
+        capture->stats.truncated++;
+    }
+
+    /* Records are 8 byte aligned, the aligned length has to fit an empty file */
+    room = capture->file_size - sizeof(struct ipc_capture_file_header);
+    if (caplen > (room & ~7) - sizeof(struct ipc_capture_record)) {
+        caplen = (room & ~7) - sizeof(struct ipc_capture_record);
+        capture->stats.truncated++;
+    }
+
+    length = (sizeof(struct ipc_capture_record) + caplen + 7) & ~7;
+
+    if (length > room - capture->header->used &&
+        ipc_capture_rotate(capture) < 0) {
+        ipc_capture_active = 0;
+        capture->stats.dropped++;
+        pthread_mutex_unlock(&capture->mutex);
+        return;
+    }
+
+    record = (struct ipc_capture_record *) (capture->map + sizeof(struct ipc_capture_file_header) +
+        capture->header->used);
+
+    record->length = length;
+    record->caplen = caplen;
+    record->time_ns = ipc_capture_time_ns();
+    record->direction = direction;
+    memset(record->reserved, 0, sizeof(record->reserved));
+    record->magic = magic;
+    record->cmd = cmd;
+    record->datasize = datasize;
+
+    ipc_capture_copy((uint8_t *) (record + 1), iov, iovcnt, caplen);
+
+    /* Only count the record once it is complete */
+    capture->header->used += length;
+    capture->header->records++;
+
+    capture->stats.records++;
+    capture->stats.bytes += length;
+
+    pthread_mutex_unlock(&capture->mutex);
+}
+
+void ipc_capture_frame(int direction, struct modem_io *frame)
+{
+    struct iovec iov;
+
+    iov.iov_base = frame->data;
+    iov.iov_len = frame->data != NULL ? frame->datasize : 0;
+
+    ipc_capture_framev(direction, frame->magic, frame->cmd, &iov, 1);
+}
+
+int ipc_capture_get_stats(struct ipc_capture_stats *stats)
+{
+    struct ipc_capture *capture = &ipc_capture;
+
+    if (stats == NULL)
+        return -1;
+
+    pthread_mutex_lock(&capture->mutex);
+    memcpy(stats, &capture->stats, sizeof(struct ipc_capture_stats));
+    pthread_mutex_unlock(&capture->mutex);
+
+    return 0;
+}
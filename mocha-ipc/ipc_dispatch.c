@@ -21,6 +21,8 @@
 
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
+#include <time.h>
 
 #include <drv.h>
 #include <tapi.h>
@@ -35,55 +37,245 @@
 #define LOG_TAG "RIL-Mocha-IPC-PARSER"
 #include <utils/Log.h>
 
+/* FIFO types past this (the FIFO_PKT_USER range) are not dispatched */
+#define IPC_FIFO_TYPES		0x80
+#define IPC_TAPI_SERVICES	8
+#define IPC_TAPI_FUNCTIONS	0x100
+
+struct ipc_dispatch_entry {
+	const char *name;
+	ipc_fifo_handler_cb fifo;
+	ipc_tapi_service_cb service;
+	ipc_tapi_handler_cb tapi;
+	/* Forwarded as is to ipc_invoke_ril_cb when set */
+	int ril_cb;
+	int ril_cb_type;
+
+	/* Updated atomically, frames of different services dispatch concurrently */
+	uint32_t count;
+	uint64_t time_ns;
+};
+
+static struct ipc_dispatch_entry fifo_entries[IPC_FIFO_TYPES];
+static struct ipc_dispatch_entry tapi_services[IPC_TAPI_SERVICES];
+static struct ipc_dispatch_entry tapi_entries[IPC_TAPI_SERVICES][IPC_TAPI_FUNCTIONS];
+
+static uint64_t ipc_dispatch_time(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static inline int ipc_dispatch_entry_empty(struct ipc_dispatch_entry *entry)
+{
+	return entry->fifo == NULL && entry->service == NULL &&
+		entry->tapi == NULL && !entry->ril_cb;
+}
+
+static int ipc_dispatch_entry_set(struct ipc_dispatch_entry *entry, const char *name)
+{
+	if(!ipc_dispatch_entry_empty(entry))
+		DEBUG_W("Registering more than one handler for %s! Overriding it.", name);
+
+	memset(entry, 0, sizeof(struct ipc_dispatch_entry));
+	entry->name = name;
+
+	return 0;
+}
+
+int ipc_register_fifo_handler(uint32_t cmd, ipc_fifo_handler_cb handler, const char *name)
+{
+	struct ipc_dispatch_entry *entry;
+
+	if(cmd >= IPC_FIFO_TYPES)
+		return -1;
+
+	entry = &fifo_entries[cmd];
+	ipc_dispatch_entry_set(entry, name);
+	entry->fifo = handler;
+
+	return 0;
+}
+
+int ipc_register_tapi_service(uint16_t service, ipc_tapi_service_cb handler, const char *name)
+{
+	struct ipc_dispatch_entry *entry;
+
+	if(service >= IPC_TAPI_SERVICES)
+		return -1;
+
+	entry = &tapi_services[service];
+	ipc_dispatch_entry_set(entry, name);
+	entry->service = handler;
+
+	return 0;
+}
+
+int ipc_register_tapi_handler(uint16_t service, uint16_t function, ipc_tapi_handler_cb handler, const char *name)
+{
+	struct ipc_dispatch_entry *entry;
+
+	if(service >= IPC_TAPI_SERVICES || function >= IPC_TAPI_FUNCTIONS)
+		return -1;
+
+	entry = &tapi_entries[service][function];
+	ipc_dispatch_entry_set(entry, name);
+	entry->tapi = handler;
+
+	return 0;
+}
+
+/* For the many TAPI packets that are only handed over to the RIL */
+int ipc_register_tapi_ril_cb(uint16_t service, uint16_t function, int type, const char *name)
+{
+	struct ipc_dispatch_entry *entry;
+
+	if(service >= IPC_TAPI_SERVICES || function >= IPC_TAPI_FUNCTIONS)
+		return -1;
+
+	entry = &tapi_entries[service][function];
+	ipc_dispatch_entry_set(entry, name);
+	entry->ril_cb = 1;
+	entry->ril_cb_type = type;
+
+	return 0;
+}
+
+/* ipc_parse_fm's return value is of no use here */
+static void ipc_dispatch_fm(struct ipc_client *client, struct modem_io *ipc_frame)
+{
+	ipc_parse_fm(client, ipc_frame);
+}
+
+/* Registers every module of the library, called from ipc_init */
+void ipc_dispatch_init(void)
+{
+	memset(fifo_entries, 0, sizeof(fifo_entries));
+	memset(tapi_services, 0, sizeof(tapi_services));
+	memset(tapi_entries, 0, sizeof(tapi_entries));
+
+	ipc_register_fifo_handler(FIFO_PKT_SIM, ipc_parse_sim, "SIM");
+	ipc_register_fifo_handler(FIFO_PKT_PROTO, ipc_parse_proto, "PROTO");
+	ipc_register_fifo_handler(FIFO_PKT_TAPI, ipc_parse_tapi, "TAPI");
+	ipc_register_fifo_handler(FIFO_PKT_FILE, ipc_dispatch_fm, "FILE");
+	ipc_register_fifo_handler(FIFO_PKT_SOUND, ipc_parse_sound, "SOUND");
+	ipc_register_fifo_handler(FIFO_PKT_DVB_H_DebugLevel, ipc_parse_dbg_level, "DEBUG_LEVEL");
+	ipc_register_fifo_handler(FIFO_PKT_BOOT, ipc_parse_boot, "BOOT");
+	ipc_register_fifo_handler(FIFO_PKT_SYSTEM, ipc_parse_system, "SYSTEM");
+	ipc_register_fifo_handler(FIFO_PKT_DRV, ipc_parse_drv, "DRV");
+	ipc_register_fifo_handler(FIFO_PKT_DEBUG, ipc_parse_dbg, "DEBUG");
+	ipc_register_fifo_handler(FIFO_PKT_BLUETOOTH, ipc_parse_bt, "BLUETOOTH");
+
+	tapi_register();
+}
+
+/* Handler times are inclusive: TAPI's FIFO entry also counts its services */
 void ipc_dispatch(struct ipc_client *client, struct modem_io *ipc_frame)
 {
-	switch(ipc_frame->cmd)
-    {
-		case FIFO_PKT_SIM:
-			ipc_parse_sim(client, ipc_frame);
-		break;
-		case FIFO_PKT_PROTO:
-			ipc_parse_proto(client, ipc_frame);
-		break;
-        case FIFO_PKT_TAPI:
-        	ipc_parse_tapi(client, ipc_frame);
-        break;
-        case FIFO_PKT_FILE:
-        	ipc_parse_fm(client, ipc_frame);
-			/*
-        	if (ret)
-        	{
-        		modem_send_tapi_init(ipc_frame);
-        		sim_atk_open(0);
-        		sim_open_to_modem(0);
-        	}*/
-        break;
-		case FIFO_PKT_SOUND:
-            ipc_parse_sound(client, ipc_frame);
-		break;
-        case FIFO_PKT_DVB_H_DebugLevel:
-            ipc_parse_dbg_level(client, ipc_frame);
-        break;
-        case FIFO_PKT_BOOT:
-            ipc_parse_boot(client, ipc_frame);
-        break;
-		case FIFO_PKT_SYSTEM:
-			ipc_parse_system(client, ipc_frame);
-		break;
-        case FIFO_PKT_DRV:
-        	ipc_parse_drv(client, ipc_frame);
-        break;
-        case FIFO_PKT_DEBUG:
-        	ipc_parse_dbg(client, ipc_frame);
-	        break;
-        case FIFO_PKT_BLUETOOTH:
-        	ipc_parse_bt(client, ipc_frame);
- 	       break;
-        default :
-        	DEBUG_I("Packet type 0x%x not yet handled\n", ipc_frame->cmd);
-        	DEBUG_I("Frame header = 0x%x\n Frame type = 0x%x\n Frame length = 0x%x\n", 
+	struct ipc_dispatch_entry *entry;
+	uint64_t start;
+
+	if(ipc_frame->cmd >= IPC_FIFO_TYPES ||
+		ipc_dispatch_entry_empty(&fifo_entries[ipc_frame->cmd])) {
+		DEBUG_I("Packet type 0x%x not yet handled\n", ipc_frame->cmd);
+		DEBUG_I("Frame header = 0x%x\n Frame type = 0x%x\n Frame length = 0x%x\n",
 			ipc_frame->magic, ipc_frame->cmd, ipc_frame->datasize);
-        	ipc_hex_dump(client, ipc_frame->data, ipc_frame->datasize);
+		IPC_CLIENT_HEX_DUMP(client, ipc_frame->data, ipc_frame->datasize);
+		return;
+	}
+
+	entry = &fifo_entries[ipc_frame->cmd];
+
+	start = ipc_dispatch_time();
+	entry->fifo(client, ipc_frame);
+	__sync_fetch_and_add(&entry->time_ns, ipc_dispatch_time() - start);
+	__sync_fetch_and_add(&entry->count, 1);
+}
+
+/* Returns -1 when neither the function nor its service has a handler */
+int ipc_dispatch_tapi(uint16_t service, uint16_t function, uint32_t length, uint8_t *data)
+{
+	struct ipc_dispatch_entry *entry;
+	uint64_t start;
+
+	if(service >= IPC_TAPI_SERVICES)
+		return -1;
+
+	entry = NULL;
+	if(function < IPC_TAPI_FUNCTIONS)
+		entry = &tapi_entries[service][function];
+	if(entry == NULL || ipc_dispatch_entry_empty(entry))
+		entry = &tapi_services[service];
+	if(ipc_dispatch_entry_empty(entry))
+		return -1;
+
+	start = ipc_dispatch_time();
+
+	if(entry->ril_cb)
+		ipc_invoke_ril_cb(entry->ril_cb_type, (void *) data);
+	else if(entry->tapi != NULL)
+		entry->tapi(length, data);
+	else
+		entry->service(function, length, data);
+
+	__sync_fetch_and_add(&entry->time_ns, ipc_dispatch_time() - start);
+	__sync_fetch_and_add(&entry->count, 1);
+
+	return 0;
+}
+
+static int ipc_dispatch_stats_add(struct ipc_dispatch_stats *stats, int count, int used,
+	struct ipc_dispatch_entry *entry, uint32_t cmd, int service, int function)
+{
+	int i;
+
+	if(entry->count == 0)
+		return used;
+
+	/* Kept sorted by time, the cheapest entry falls off a full array */
+	for(i = used < count ? used : count - 1 ; i > 0 ; i--) {
+		if(stats[i - 1].time_ns >= entry->time_ns)
+			break;
+		stats[i] = stats[i - 1];
+	}
+
+	if(i == count - 1 && used == count && stats[i].time_ns >= entry->time_ns)
+		return used;
+
+	stats[i].name = entry->name;
+	stats[i].cmd = cmd;
+	stats[i].service = service;
+	stats[i].function = function;
+	stats[i].count = entry->count;
+	stats[i].time_ns = entry->time_ns;
+
+	return used < count ? used + 1 : used;
+}
+
+/*
+ * Fills stats with the entries that saw packets, most handler time first,
+ * and returns how many were filled.
+ */
+int ipc_dispatch_get_stats(struct ipc_dispatch_stats *stats, int count)
+{
+	int used = 0;
+	int i, j;
+
+	if(stats == NULL || count <= 0)
+		return 0;
+
+	for(i = 0 ; i < IPC_FIFO_TYPES ; i++)
+		used = ipc_dispatch_stats_add(stats, count, used, &fifo_entries[i], i, -1, -1);
+
+	for(i = 0 ; i < IPC_TAPI_SERVICES ; i++) {
+		used = ipc_dispatch_stats_add(stats, count, used, &tapi_services[i], FIFO_PKT_TAPI, i, -1);
+
+		for(j = 0 ; j < IPC_TAPI_FUNCTIONS ; j++)
+			used = ipc_dispatch_stats_add(stats, count, used, &tapi_entries[i][j], FIFO_PKT_TAPI, i, j);
+	}
 
-    }
+	return used;
 }
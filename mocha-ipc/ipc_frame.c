@@ -0,0 +1,271 @@
+/**
+ * This file is part of libmocha-ipc.
+ *
+ * Receive frame pool
+ *
+ * libmocha-ipc is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libmocha-ipc is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with libmocha-ipc.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#include <radio.h>
+
+#include "ipc_private.h"
+
+#define LOG_TAG "RIL-Mocha-IPC-FRAME"
+#include <utils/Log.h>
+
+/*
+ * Every received frame is backed by an ipc_frame_buf. Pool buffers are
+ * carved out of one allocation at client creation and recycled through a
+ * free list; when the pool runs dry (or the frame is bigger than the pool
+ * frame size) the buffer comes from the heap and is counted as a miss.
+ */
+
+struct ipc_frame_buf {
+    struct ipc_frame_pool *pool;
+    struct ipc_frame_buf *next;
+    volatile int32_t refcount;
+    uint32_t size;
+    uint8_t *data;
+};
+
+struct ipc_frame_pool {
+    pthread_mutex_t mutex;
+    struct ipc_frame_buf *free_list;
+    struct ipc_frame_buf *bufs;
+    uint8_t *storage;
+    uint32_t count;
+    uint32_t frame_size;
+    int closing;
+
+    struct ipc_frame_pool_stats stats;
+};
+
+static void ipc_frame_pool_destroy(struct ipc_frame_pool *pool)
+{
+    pthread_mutex_destroy(&pool->mutex);
+    free(pool->storage);
+    free(pool->bufs);
+    free(pool);
+}
+
+struct ipc_frame_pool *ipc_frame_pool_new(uint32_t count, uint32_t frame_size)
+{
+    struct ipc_frame_pool *pool;
+    uint32_t i;
+
+    pool = (struct ipc_frame_pool *) calloc(1, sizeof(struct ipc_frame_pool));
+    if (pool == NULL)
+        return NULL;
+
+    pool->bufs = (struct ipc_frame_buf *) calloc(count, sizeof(struct ipc_frame_buf));
+    pool->storage = (uint8_t *) malloc(count * frame_size);
+
+    if (count > 0 && (pool->bufs == NULL || pool->storage == NULL)) {
+        free(pool->bufs);
+        free(pool->storage);
+        free(pool);
+        return NULL;
+    }
+
+    pthread_mutex_init(&pool->mutex, NULL);
+    pool->count = count;
+    pool->frame_size = frame_size;
+    pool->stats.size = count;
+
+    for (i = 0; i < count; i++) {
+        pool->bufs[i].pool = pool;
+        pool->bufs[i].size = frame_size;
+        pool->bufs[i].data = pool->storage + i * frame_size;
+        pool->bufs[i].next = pool->free_list;
+        pool->free_list = &pool->bufs[i];
+    }
+
+    return pool;
+}
+
+/* Frames still referenced by handlers keep the pool alive until released */
+void ipc_frame_pool_free(struct ipc_frame_pool *pool)
+{
+    int destroy;
+
+    if (pool == NULL)
+        return;
+
+    pthread_mutex_lock(&pool->mutex);
+    pool->closing = 1;
+    destroy = (pool->stats.in_use == 0);
+    pthread_mutex_unlock(&pool->mutex);
+
+    if (destroy)
+        ipc_frame_pool_destroy(pool);
+}
+
+int ipc_frame_alloc(struct ipc_frame_pool *pool, struct modem_io *frame, uint32_t size)
+{
+    struct ipc_frame_buf *buf = NULL;
+
+    if (frame == NULL)
+        return -1;
+
+    if (pool != NULL) {
+        pthread_mutex_lock(&pool->mutex);
+        pool->stats.allocs++;
+        if (size <= pool->frame_size && pool->free_list != NULL) {
+            buf = pool->free_list;
+            pool->free_list = buf->next;
+            pool->stats.in_use++;
+            if (pool->stats.in_use > pool->stats.high_water)
+                pool->stats.high_water = pool->stats.in_use;
+        } else {
+            pool->stats.misses++;
+        }
+        pthread_mutex_unlock(&pool->mutex);
+    }
+
+    if (buf == NULL) {
+        /* Heap frame: descriptor and data in one block */
+        buf = (struct ipc_frame_buf *) malloc(sizeof(struct ipc_frame_buf) + size);
+        if (buf == NULL)
+            return -1;
+
+        buf->pool = NULL;
+        buf->size = size;
+        buf->data = (uint8_t *) (buf + 1);
+    }
+
+    buf->next = NULL;
+    buf->refcount = 1;
+
+    frame->buf = buf;
+    frame->data = buf->data;
+
+    return 0;
+}
+
+/*
+ * Makes sure frame can hold size bytes from frame->data on, swapping in a
+ * heap frame if needed. Frames pointing into the middle of a buffer (like
+ * reassembly chunks) can't be swapped and fail instead.
+ */
+int ipc_frame_reserve(struct ipc_client *client, struct modem_io *frame, uint32_t size)
+{
+    if (frame->buf != NULL &&
+        (uint32_t) (frame->buf->data + frame->buf->size - frame->data) >= size)
+        return 0;
+
+    if (frame->buf != NULL && frame->data != frame->buf->data)
+        return -1;
+
+    ipc_frame_unref(frame);
+
+    return ipc_frame_alloc(client != NULL ? client->frame_pool : NULL, frame, size);
+}
+
+void ipc_frame_ref(struct modem_io *frame)
+{
+    if (frame == NULL || frame->buf == NULL)
+        return;
+
+    __sync_add_and_fetch(&frame->buf->refcount, 1);
+}
+
+void ipc_frame_unref(struct modem_io *frame)
+{
+    struct ipc_frame_buf *buf;
+    struct ipc_frame_pool *pool;
+    int destroy = 0;
+
+    if (frame == NULL)
+        return;
+
+    buf = frame->buf;
+
+    if (buf == NULL) {
+        /* Not a pool frame, data was malloc'd by whoever built it */
+        if (frame->data != NULL)
+            free(frame->data);
+        frame->data = NULL;
+        return;
+    }
+
+    frame->buf = NULL;
+    frame->data = NULL;
+
+    if (__sync_sub_and_fetch(&buf->refcount, 1) != 0)
+        return;
+
+    pool = buf->pool;
+
+    if (pool == NULL) {
+        free(buf);
+        return;
+    }
+
+    pthread_mutex_lock(&pool->mutex);
+    buf->next = pool->free_list;
+    pool->free_list = buf;
+    pool->stats.in_use--;
+    destroy = (pool->closing && pool->stats.in_use == 0);
+    pthread_mutex_unlock(&pool->mutex);
+
+    if (destroy)
+        ipc_frame_pool_destroy(pool);
+}
+
+/*
+ * The recv path allocates from the pool without any lock of its own, so
+ * it can only be swapped while the client isn't open.
+ */
+int ipc_client_set_frame_pool_size(struct ipc_client *client, uint32_t count)
+{
+    struct ipc_frame_pool *pool;
+
+    if (client == NULL || client->opened)
+        return -1;
+
+    pool = ipc_frame_pool_new(count, IPC_FRAME_SIZE);
+    if (pool == NULL)
+        return -1;
+
+    ipc_frame_pool_free(client->frame_pool);
+    client->frame_pool = pool;
+
+    return 0;
+}
+
+int ipc_frame_pool_get_stats(struct ipc_frame_pool *pool, struct ipc_frame_pool_stats *stats)
+{
+    if (pool == NULL || stats == NULL)
+        return -1;
+
+    pthread_mutex_lock(&pool->mutex);
+    memcpy(stats, &pool->stats, sizeof(struct ipc_frame_pool_stats));
+    pthread_mutex_unlock(&pool->mutex);
+
+    return 0;
+}
+
+int ipc_client_get_frame_pool_stats(struct ipc_client *client, struct ipc_frame_pool_stats *stats)
+{
+    if (client == NULL)
+        return -1;
+
+    return ipc_frame_pool_get_stats(client->frame_pool, stats);
+}
@@ -23,13 +23,70 @@
 #ifndef __IPC_PRIVATE_H__
 #define __IPC_PRIVATE_H__
 
+#include <time.h>
+
 #include <radio.h>
 
+/* Maximum number of segments a service layer may hand to ipc_client_sendv */
+#define IPC_MAX_IOV 8
+
+/* Segments gathered into a single write by ipc_stream_send_batch */
+#define IPC_BATCH_IOV 64
+
+/* Receive frame pool defaults */
+#define IPC_FRAME_SIZE (SIZ_PACKET_BUFSIZE)
+#define IPC_FRAME_POOL_SIZE 32
+
+/* Largest multi-packet frame we agree to reassemble */
+#define IPC_REASSEMBLY_LIMIT (512 * 1024)
+
+/* Stream transports read into a ring of this many bytes */
+#define IPC_RING_SIZE (4 * SIZ_PACKET_FRAME)
+
+/* io_uring backend: SQ size, reads kept queued on a tun, writes per submit */
+#define IPC_URING_ENTRIES 64
+#define IPC_URING_READS 4
+#define IPC_URING_WRITES 16
+
+struct ipc_frame_pool;
+
+struct ipc_ring {
+    uint8_t *data;
+    uint32_t size;
+    uint32_t head;
+    uint32_t tail;
+    /* The last read came back EAGAIN and may still be queued into the tail */
+    int read_queued;
+
+    struct ipc_transport_stats stats;
+};
+
+struct ipc_reassembly {
+    /* Frame being assembled, frame.buf is NULL while discarding */
+    struct modem_io frame;
+    uint32_t packet_type;
+    uint32_t expected;
+    uint32_t filled;
+    int active;
+    struct timespec start;
+
+    uint32_t limit;
+    struct ipc_reassembly_stats stats;
+};
+
 struct ipc_ops {
     int32_t (*bootstrap)(struct ipc_client *client);
     int32_t (*modem_operations)(struct ipc_client *client, void *data, uint32_t cmd);
     int32_t (*send)(struct ipc_client *client, struct modem_io *);
+    int32_t (*sendv)(struct ipc_client *client, uint32_t cmd, struct iovec *iov, int iovcnt);
+    /* Optional, writes several frames at once */
+    int32_t (*send_batch)(struct ipc_client *client, struct ipc_frame_iov *frames, int count);
     int32_t (*recv)(struct ipc_client *client, struct modem_io *);
+    /* Optional, for transports that buffer more than one frame */
+    int32_t (*recv_pending)(struct ipc_client *client);
+    int32_t (*get_stats)(struct ipc_client *client, struct ipc_transport_stats *stats);
+    /* Transport I/O goes through ipc_client_io_*, so io_uring can take it over */
+    int uring;
 };
 
 struct ipc_handlers {
@@ -38,6 +95,8 @@ struct ipc_handlers {
     void *read_data;
     ipc_io_handler_cb write;
     void *write_data;
+    /* Optional gather write, shares write_data */
+    ipc_iov_handler_cb writev;
     ipc_io_handler_cb open;
     void *open_data;
     ipc_io_handler_cb close;
@@ -56,6 +115,8 @@ struct ipc_handlers {
     int (*common_data_destroy)(void *io_data);
     int (*common_data_set_fd)(void *io_data, int fd);
     int (*common_data_get_fd)(void *io_data);
+    /* Optional, when writes don't go to the common data fd */
+    int (*common_data_get_write_fd)(void *io_data);
 };
 
 struct ipc_client {
@@ -64,6 +125,21 @@ struct ipc_client {
 
     struct ipc_ops *ops;
     struct ipc_handlers *handlers;
+
+    struct ipc_frame_pool *frame_pool;
+    struct ipc_reassembly reassembly;
+
+    /* io_uring per direction, NULL on the plain syscall path */
+    struct ipc_uring *rx_uring;
+    struct ipc_uring *tx_uring;
+    int write_fd;
+    /* Reads return EAGAIN instead of waiting, see ipc_client_set_nonblocking */
+    int nonblocking;
+    /* Between ipc_client_open and ipc_client_close, recv may use frame_pool */
+    int opened;
+    uint32_t read_syscalls;
+    uint32_t write_calls;
+    uint32_t write_syscalls;
 };
 
 struct ipc_device_desc {
@@ -72,6 +148,28 @@ struct ipc_device_desc {
 };
 
 void ipc_client_log(struct ipc_client *client, const char *message, ...);
+
+int ipc_iov_slice(struct iovec *iov, int iovcnt, uint32_t offset, uint32_t len,
+                  struct iovec *out, int outcnt);
+
+int ipc_frame_reserve(struct ipc_client *client, struct modem_io *frame, uint32_t size);
+
+struct ipc_uring *ipc_uring_new_stream(int read_fd);
+
+int32_t ipc_client_io_read(void *data, uint32_t size, void *io_data);
+int32_t ipc_client_io_write(struct ipc_client *client, void *data, uint32_t size);
+int32_t ipc_client_io_writev(struct ipc_client *client, struct iovec *iov, int iovcnt);
+
+int ipc_ring_init(struct ipc_ring *ring, uint32_t size);
+void ipc_ring_free(struct ipc_ring *ring);
+void ipc_ring_reset(struct ipc_ring *ring);
+int ipc_ring_fill(struct ipc_ring *ring, ipc_io_handler_cb read, void *io_data);
+int ipc_ring_pending(struct ipc_ring *ring);
+int ipc_ring_parse(struct ipc_ring *ring, struct ipc_client *client, struct modem_io *ipc_frame);
+int32_t ipc_stream_sendv(struct ipc_client *client, uint32_t cmd, struct iovec *iov, int iovcnt);
+int ipc_stream_wait_writable(int fd);
+int32_t ipc_stream_send_batch(struct ipc_client *client, struct ipc_frame_iov *frames, int count);
+
 void ipc_register_device_client_handlers(int device, struct ipc_ops *client_ops,
 											struct ipc_handlers *handlers);
 
@@ -0,0 +1,375 @@
+/**
+ * This file is part of libmocha-ipc.
+ *
+ * FIFO framing for stream transports
+ *
+ * libmocha-ipc is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libmocha-ipc is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with libmocha-ipc.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <poll.h>
+#include <sys/uio.h>
+
+#include <radio.h>
+
+#include "ipc_private.h"
+
+#define LOG_TAG "RIL-Mocha-IPC-RING"
+#include <utils/Log.h>
+
+/*
+ * Stream transports (the Jet tty, loopback sockets) don't preserve frame
+ * boundaries. The ring is filled with as much as one read() returns and
+ * as many complete fifoPacketHeader frames as it holds are parsed out of
+ * it. Unconsumed bytes are moved to the front before the next read, which
+ * is cheap since that's at most one partial frame.
+ */
+
+int ipc_ring_init(struct ipc_ring *ring, uint32_t size)
+{
+    memset(ring, 0, sizeof(struct ipc_ring));
+
+    ring->data = (uint8_t *) malloc(size);
+    if (ring->data == NULL)
+        return -1;
+
+    ring->size = size;
+
+    return 0;
+}
+
+void ipc_ring_free(struct ipc_ring *ring)
+{
+    if (ring->data != NULL)
+        free(ring->data);
+
+    ring->data = NULL;
+    ring->size = 0;
+    ring->head = 0;
+    ring->tail = 0;
+}
+
+void ipc_ring_reset(struct ipc_ring *ring)
+{
+    ring->head = 0;
+    ring->tail = 0;
+    ring->read_queued = 0;
+}
+
+/*
+ * Returns bytes read, 0 on end of stream and -1 on error, with errno
+ * EAGAIN when a non-blocking fd has nothing more for now. An io_uring
+ * read is then left queued into the tail, so the data is not moved until
+ * the next read returned.
+ */
+int ipc_ring_fill(struct ipc_ring *ring, ipc_io_handler_cb read, void *io_data)
+{
+    uint32_t pending;
+    int rc;
+
+    pending = ring->tail - ring->head;
+
+    if (ring->head > 0 && (!ring->read_queued || ring->tail == ring->size)) {
+        if (pending > 0)
+            memmove(ring->data, ring->data + ring->head, pending);
+        ring->head = 0;
+        ring->tail = pending;
+    }
+
+    if (ring->tail == ring->size)
+        return -1;
+
+    rc = read(ring->data + ring->tail, ring->size - ring->tail, io_data);
+    ring->stats.read_calls++;
+
+    ring->read_queued = (rc < 0 && errno == EAGAIN);
+
+    if (rc <= 0)
+        return rc;
+
+    ring->tail += rc;
+    ring->stats.bytes += rc;
+
+    return rc;
+}
+
+/* Skips to the next candidate magic, keeping a partial one at the end */
+static void ipc_ring_resync(struct ipc_ring *ring)
+{
+    uint32_t magic = 0xCAFECAFE;
+    uint32_t skipped = 0;
+
+    ring->head++;
+    skipped++;
+
+    while (ring->tail - ring->head >= sizeof(magic) &&
+           memcmp(ring->data + ring->head, &magic, sizeof(magic)) != 0) {
+        ring->head++;
+        skipped++;
+    }
+
+    ring->stats.resyncs++;
+    ring->stats.skipped += skipped;
+}
+
+/*
+ * Returns 1 when the ring holds a complete frame at its head, resyncing
+ * past garbage on the way. Returns 0 when more data is needed.
+ */
+int ipc_ring_pending(struct ipc_ring *ring)
+{
+    struct fifoPacketHeader header;
+
+    while (ring->tail - ring->head >= sizeof(header)) {
+        memcpy(&header, ring->data + ring->head, sizeof(header));
+
+        if (header.magic != 0xCAFECAFE ||
+            header.datasize > ring->size - sizeof(header)) {
+            ipc_ring_resync(ring);
+            continue;
+        }
+
+        return (ring->tail - ring->head >= sizeof(header) + header.datasize);
+    }
+
+    return 0;
+}
+
+/* Returns 0 when a frame was copied out, 1 when more data is needed */
+int ipc_ring_parse(struct ipc_ring *ring, struct ipc_client *client, struct modem_io *ipc_frame)
+{
+    struct fifoPacketHeader header;
+
+    if (!ipc_ring_pending(ring))
+        return 1;
+
+    memcpy(&header, ring->data + ring->head, sizeof(header));
+
+    if (ipc_frame_reserve(client, ipc_frame, header.datasize) < 0) {
+        /* Can't hold it, drop the frame rather than stall the stream */
+        ring->head += sizeof(header) + header.datasize;
+        ring->stats.dropped++;
+        return -1;
+    }
+
+    ipc_frame->magic = header.magic;
+    ipc_frame->cmd = header.cmd;
+    ipc_frame->datasize = header.datasize;
+    memcpy(ipc_frame->data, ring->data + ring->head + sizeof(header), header.datasize);
+
+    ring->head += sizeof(header) + header.datasize;
+    ring->stats.frames++;
+
+    return 0;
+}
+
+/**
+ * Sending
+ */
+
+/* Writers share the fd with a non-blocking reader, wait out a full buffer */
+int ipc_stream_wait_writable(int fd)
+{
+    struct pollfd pfd;
+    int rc;
+
+    pfd.fd = fd;
+    pfd.events = POLLOUT;
+    pfd.revents = 0;
+
+    do {
+        rc = poll(&pfd, 1, -1);
+    } while (rc < 0 && errno == EINTR);
+
+    return rc > 0 && !(pfd.revents & (POLLERR | POLLHUP | POLLNVAL)) ? 0 : -1;
+}
+
+static int32_t ipc_stream_send_packet(struct ipc_client *client, uint32_t cmd, struct iovec *iov, int iovcnt)
+{
+    struct fifoPacketHeader ipc;
+    struct iovec frame_iov[IPC_MAX_IOV + 1];
+    uint8_t *frame;
+    int32_t frame_length;
+    int32_t retval;
+
+    /* FIFO header */
+    ipc.magic = 0xCAFECAFE;
+    ipc.cmd = cmd;
+    ipc.datasize = ipc_iov_length(iov, iovcnt);
+
+    frame_iov[0].iov_base = &ipc;
+    frame_iov[0].iov_len = sizeof(ipc);
+    memcpy(&frame_iov[1], iov, iovcnt * sizeof(struct iovec));
+
+    if (client->handlers->writev != NULL || client->tx_uring != NULL)
+        return ipc_client_io_writev(client, frame_iov, iovcnt + 1);
+
+    /* Custom write handler without gather support */
+    frame_length = sizeof(ipc) + ipc.datasize;
+    frame = (uint8_t*)malloc(frame_length);
+    if (frame == NULL)
+        return -1;
+
+    ipc_iov_flatten(frame_iov, iovcnt + 1, frame);
+    retval = ipc_client_io_write(client, frame, frame_length);
+    free(frame);
+
+    return retval;
+}
+
+int32_t ipc_stream_sendv(struct ipc_client *client, uint32_t cmd, struct iovec *iov, int iovcnt)
+{
+    struct multiPacketHeader multiHeader;
+    struct iovec chunk_iov[IPC_MAX_IOV];
+    struct iovec header_iov;
+    uint32_t datasize;
+    uint32_t offset;
+    uint32_t chunk_len;
+    int chunk_cnt;
+
+    datasize = ipc_iov_length(iov, iovcnt);
+
+    if (datasize <= MAX_SINGLE_FRAME_DATA) {
+        ipc_stream_send_packet(client, cmd, iov, iovcnt);
+        return 0;
+    }
+
+    DEBUG_I("packet to send is larger than 0x1000\n");
+
+    multiHeader.command = 0x02;
+    multiHeader.packtLen = datasize;
+    multiHeader.packetType = cmd;
+
+    header_iov.iov_base = &multiHeader;
+    header_iov.iov_len = sizeof(multiHeader);
+    ipc_stream_send_packet(client, FIFO_PKT_FIFO_INTERNAL, &header_iov, 1);
+
+    for (offset = 0; offset < datasize; offset += chunk_len) {
+        chunk_len = datasize - offset;
+        if (chunk_len > MAX_SINGLE_FRAME_DATA)
+            chunk_len = MAX_SINGLE_FRAME_DATA;
+
+        chunk_cnt = ipc_iov_slice(iov, iovcnt, offset, chunk_len, chunk_iov, IPC_MAX_IOV);
+        if (chunk_cnt <= 0)
+            return -1;
+
+        ipc_stream_send_packet(client, FIFO_PKT_FIFO_INTERNAL, chunk_iov, chunk_cnt);
+    }
+
+    return 0;
+}
+
+/*
+ * Writes the FIFO header into the headroom of a single segment frame, so
+ * header and data go out as one contiguous buffer. NULL if it can't.
+ */
+static struct fifoPacketHeader *ipc_stream_header_in_place(struct ipc_frame_iov *frame, uint32_t datasize)
+{
+    struct fifoPacketHeader *header;
+
+    if (!frame->headroom || frame->iovcnt != 1 || datasize > MAX_SINGLE_FRAME_DATA)
+        return NULL;
+
+    header = (struct fifoPacketHeader *) ((uint8_t *) frame->iov[0].iov_base - IPC_FRAME_HEADROOM);
+    header->magic = 0xCAFECAFE;
+    header->cmd = frame->cmd;
+    header->datasize = datasize;
+
+    return header;
+}
+
+/*
+ * Gathers back-to-back single frames into as few writev() calls as
+ * possible. Frames that need chunking go out on their own, in order.
+ * On a failed write, returns the number of frames fully written before
+ * it, -1 only when there were none.
+ */
+int32_t ipc_stream_send_batch(struct ipc_client *client, struct ipc_frame_iov *frames, int count)
+{
+    struct fifoPacketHeader headers[IPC_BATCH_IOV / 2];
+    struct fifoPacketHeader *header;
+    struct iovec batch_iov[IPC_BATCH_IOV];
+    uint32_t datasize;
+    int header_cnt = 0;
+    int iov_cnt = 0;
+    /* Frames fully written, the ones gathered after them aren't yet */
+    int sent = 0;
+    int i;
+
+    if (client->handlers->writev == NULL && client->tx_uring == NULL) {
+        for (i = 0; i < count; i++) {
+            datasize = ipc_iov_length(frames[i].iov, frames[i].iovcnt);
+            header = ipc_stream_header_in_place(&frames[i], datasize);
+
+            if (header != NULL) {
+                if (ipc_client_io_write(client, header, IPC_FRAME_HEADROOM + datasize) < 0)
+                    return i > 0 ? i : -1;
+            } else if (ipc_stream_sendv(client, frames[i].cmd, frames[i].iov, frames[i].iovcnt) < 0) {
+                return i > 0 ? i : -1;
+            }
+        }
+        return count;
+    }
+
+    for (i = 0; i < count; i++) {
+        datasize = ipc_iov_length(frames[i].iov, frames[i].iovcnt);
+
+        if (iov_cnt > 0 &&
+            (datasize > MAX_SINGLE_FRAME_DATA ||
+             iov_cnt + 1 + frames[i].iovcnt > IPC_BATCH_IOV ||
+             header_cnt == IPC_BATCH_IOV / 2)) {
+            if (ipc_client_io_writev(client, batch_iov, iov_cnt) < 0)
+                return sent > 0 ? sent : -1;
+            sent = i;
+            iov_cnt = 0;
+            header_cnt = 0;
+        }
+
+        if (datasize > MAX_SINGLE_FRAME_DATA || frames[i].iovcnt + 1 > IPC_BATCH_IOV) {
+            if (ipc_stream_sendv(client, frames[i].cmd, frames[i].iov, frames[i].iovcnt) < 0)
+                return sent > 0 ? sent : -1;
+            sent = i + 1;
+            continue;
+        }
+
+        header = ipc_stream_header_in_place(&frames[i], datasize);
+        if (header != NULL) {
+            batch_iov[iov_cnt].iov_base = header;
+            batch_iov[iov_cnt].iov_len = IPC_FRAME_HEADROOM + datasize;
+            iov_cnt++;
+            continue;
+        }
+
+        headers[header_cnt].magic = 0xCAFECAFE;
+        headers[header_cnt].cmd = frames[i].cmd;
+        headers[header_cnt].datasize = datasize;
+
+        batch_iov[iov_cnt].iov_base = &headers[header_cnt];
+        batch_iov[iov_cnt].iov_len = sizeof(struct fifoPacketHeader);
+        memcpy(&batch_iov[iov_cnt + 1], frames[i].iov, frames[i].iovcnt * sizeof(struct iovec));
+
+        iov_cnt += 1 + frames[i].iovcnt;
+        header_cnt++;
+    }
+
+    if (iov_cnt > 0 &&
+        ipc_client_io_writev(client, batch_iov, iov_cnt) < 0)
+        return sent > 0 ? sent : -1;
+
+    return count;
+}
@@ -0,0 +1,839 @@
+/**
+ * This file is part of libmocha-ipc.
+ *
+ * io_uring backend for stream transports and tun devices
+ *
+ * libmocha-ipc is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libmocha-ipc is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with libmocha-ipc.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <sys/uio.h>
+
+#include <radio.h>
+
+#include "ipc_private.h"
+
+#define LOG_TAG "RIL-Mocha-IPC-URING"
+#include <utils/Log.h>
+
+#ifdef IPC_IO_URING
+
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+/*
+ * Talks to the kernel through the raw syscalls, there is no liburing in
+ * the tree. A tun ring keeps IPC_URING_READS reads queued on its read fd,
+ * so packets are already in when the caller asks for them and one
+ * io_uring_enter both re-arms consumed reads and waits for the next
+ * completion. Each read is a whole datagram, the order they complete in
+ * doesn't matter. A stream (the modem) has a single read in flight, right
+ * into the caller's buffer: two reads on a byte stream could complete out
+ * of order. Writes are queued and submitted together as one linked chain,
+ * which keeps them in order on stream fds.
+ *
+ * A ring is not thread safe: the modem has one per direction, each used
+ * under the matching client lock, and a tun has one for the data plane.
+ */
+
+#ifndef __NR_io_uring_setup
+#define __NR_io_uring_setup 425
+#endif
+#ifndef __NR_io_uring_enter
+#define __NR_io_uring_enter 426
+#endif
+#ifndef __NR_io_uring_register
+#define __NR_io_uring_register 427
+#endif
+
+#define IPC_URING_WRITE_TAG     0x10000
+#define IPC_URING_CANCEL_TAG    0x20000
+
+enum ipc_uring_read_state {
+    IPC_URING_READ_IDLE,
+    IPC_URING_READ_QUEUED,
+    IPC_URING_READ_DONE,
+};
+
+struct ipc_uring_read {
+    uint8_t *buf;
+    int fixed;
+    struct iovec iov;
+
+    int state;
+    int32_t result;
+    uint32_t offset;
+};
+
+struct ipc_uring_write {
+    int fd;
+    struct iovec iov[IPC_MAX_IOV + 1];
+    int iovcnt;
+    uint32_t length;
+    int32_t result;
+    int done;
+};
+
+struct ipc_uring {
+    int fd;
+
+    void *sq_ptr;
+    size_t sq_len;
+    volatile unsigned *sq_head;
+    volatile unsigned *sq_tail;
+    unsigned *sq_mask;
+    unsigned *sq_array;
+    unsigned sq_entries;
+    struct io_uring_sqe *sqes;
+    size_t sqes_len;
+    unsigned to_submit;
+
+    void *cq_ptr;
+    size_t cq_len;
+    volatile unsigned *cq_head;
+    volatile unsigned *cq_tail;
+    unsigned *cq_mask;
+    struct io_uring_cqe *cqes;
+
+    int read_fd;
+    /* One read at a time, into the caller's buffer */
+    int stream;
+    uint32_t buf_size;
+    uint8_t *storage;
+    struct ipc_uring_read reads[IPC_URING_READS];
+    /* Completed reads in the order the kernel finished them */
+    int done[IPC_URING_READS];
+    int done_head;
+    int done_count;
+    int queued_reads;
+
+    struct ipc_uring_write writes[IPC_URING_WRITES];
+    int write_count;
+
+    struct ipc_uring_stats stats;
+};
+
+static int sys_io_uring_setup(unsigned entries, struct io_uring_params *p)
+{
+    return syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int sys_io_uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags)
+{
+    return syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+static int sys_io_uring_register(int fd, unsigned opcode, void *arg, unsigned nr_args)
+{
+    return syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+int ipc_uring_enabled(void)
+{
+    const char *value;
+
+    value = getenv(IPC_URING_ENV);
+
+    return (value == NULL || strcmp(value, "0") != 0);
+}
+
+static struct io_uring_sqe *ipc_uring_get_sqe(struct ipc_uring *uring)
+{
+    struct io_uring_sqe *sqe;
+    unsigned tail, index;
+
+    tail = *uring->sq_tail;
+    __sync_synchronize();
+
+    if (tail - *uring->sq_head >= uring->sq_entries)
+        return NULL;
+
+    index = tail & *uring->sq_mask;
+    sqe = &uring->sqes[index];
+    memset(sqe, 0, sizeof(struct io_uring_sqe));
+    uring->sq_array[index] = index;
+
+    __sync_synchronize();
+    *uring->sq_tail = tail + 1;
+    uring->to_submit++;
+
+    return sqe;
+}
+
+static int ipc_uring_enter(struct ipc_uring *uring, unsigned min_complete)
+{
+    int rc;
+
+    do {
+        rc = sys_io_uring_enter(uring->fd, uring->to_submit, min_complete,
+                                min_complete > 0 ? IORING_ENTER_GETEVENTS : 0);
+    } while (rc < 0 && errno == EINTR);
+
+    uring->stats.enters++;
+
+    if (rc < 0)
+        return -1;
+
+    uring->to_submit -= (unsigned) rc < uring->to_submit ? (unsigned) rc : uring->to_submit;
+
+    return 0;
+}
+
+/* Moves completions out of the CQ, returns how many were seen */
+static int ipc_uring_reap(struct ipc_uring *uring)
+{
+    struct io_uring_cqe *cqe;
+    unsigned head;
+    int count = 0;
+    int i;
+
+    head = *uring->cq_head;
+
+    while (1) {
+        __sync_synchronize();
+        if (head == *uring->cq_tail)
+            break;
+
+        cqe = &uring->cqes[head & *uring->cq_mask];
+
+        if (cqe->user_data & IPC_URING_WRITE_TAG) {
+            i = cqe->user_data & 0xffff;
+            uring->writes[i].result = cqe->res;
+            uring->writes[i].done = 1;
+        } else if (!(cqe->user_data & IPC_URING_CANCEL_TAG)) {
+            i = cqe->user_data & 0xffff;
+            uring->reads[i].result = cqe->res;
+            uring->reads[i].offset = 0;
+            uring->reads[i].state = IPC_URING_READ_DONE;
+            uring->queued_reads--;
+            uring->done[(uring->done_head + uring->done_count) % IPC_URING_READS] = i;
+            uring->done_count++;
+        }
+
+        head++;
+        count++;
+    }
+
+    __sync_synchronize();
+    *uring->cq_head = head;
+
+    return count;
+}
+
+static int ipc_uring_queue_read(struct ipc_uring *uring, int i)
+{
+    struct ipc_uring_read *read = &uring->reads[i];
+    struct io_uring_sqe *sqe;
+
+    sqe = ipc_uring_get_sqe(uring);
+    if (sqe == NULL)
+        return -1;
+
+    sqe->fd = uring->read_fd;
+    sqe->off = (uint64_t) -1;
+    sqe->user_data = i;
+
+    if (read->fixed) {
+        sqe->opcode = IORING_OP_READ_FIXED;
+        sqe->addr = (unsigned long) read->buf;
+        sqe->len = uring->buf_size;
+        sqe->buf_index = 0;
+    } else {
+        read->iov.iov_base = read->buf;
+        read->iov.iov_len = uring->buf_size;
+        sqe->opcode = IORING_OP_READV;
+        sqe->addr = (unsigned long) &read->iov;
+        sqe->len = 1;
+    }
+
+    read->state = IPC_URING_READ_QUEUED;
+    uring->queued_reads++;
+
+    return 0;
+}
+
+static int ipc_uring_map(struct ipc_uring *uring, unsigned entries)
+{
+    struct io_uring_params p;
+
+    memset(&p, 0, sizeof(p));
+
+    uring->fd = sys_io_uring_setup(entries, &p);
+    if (uring->fd < 0)
+        return -1;
+
+    uring->sq_len = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    uring->cq_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    uring->sqes_len = p.sq_entries * sizeof(struct io_uring_sqe);
+
+    uring->sq_ptr = mmap(NULL, uring->sq_len, PROT_READ | PROT_WRITE,
+                         MAP_SHARED | MAP_POPULATE, uring->fd, IORING_OFF_SQ_RING);
+    uring->cq_ptr = mmap(NULL, uring->cq_len, PROT_READ | PROT_WRITE,
+                         MAP_SHARED | MAP_POPULATE, uring->fd, IORING_OFF_CQ_RING);
+    uring->sqes = (struct io_uring_sqe *) mmap(NULL, uring->sqes_len, PROT_READ | PROT_WRITE,
+                         MAP_SHARED | MAP_POPULATE, uring->fd, IORING_OFF_SQES);
+
+    if (uring->sq_ptr == MAP_FAILED || uring->cq_ptr == MAP_FAILED || uring->sqes == MAP_FAILED)
+        return -1;
+
+    uring->sq_head = (unsigned *) ((uint8_t *) uring->sq_ptr + p.sq_off.head);
+    uring->sq_tail = (unsigned *) ((uint8_t *) uring->sq_ptr + p.sq_off.tail);
+    uring->sq_mask = (unsigned *) ((uint8_t *) uring->sq_ptr + p.sq_off.ring_mask);
+    uring->sq_array = (unsigned *) ((uint8_t *) uring->sq_ptr + p.sq_off.array);
+    uring->sq_entries = p.sq_entries;
+
+    uring->cq_head = (unsigned *) ((uint8_t *) uring->cq_ptr + p.cq_off.head);
+    uring->cq_tail = (unsigned *) ((uint8_t *) uring->cq_ptr + p.cq_off.tail);
+    uring->cq_mask = (unsigned *) ((uint8_t *) uring->cq_ptr + p.cq_off.ring_mask);
+    uring->cqes = (struct io_uring_cqe *) ((uint8_t *) uring->cq_ptr + p.cq_off.cqes);
+
+    return 0;
+}
+
+static struct ipc_uring *ipc_uring_create(int read_fd)
+{
+    struct ipc_uring *uring;
+
+    if (!ipc_uring_enabled())
+        return NULL;
+
+    uring = (struct ipc_uring *) calloc(1, sizeof(struct ipc_uring));
+    if (uring == NULL)
+        return NULL;
+
+    uring->fd = -1;
+    uring->sq_ptr = MAP_FAILED;
+    uring->cq_ptr = MAP_FAILED;
+    uring->sqes = (struct io_uring_sqe *) MAP_FAILED;
+    uring->read_fd = read_fd;
+
+    if (ipc_uring_map(uring, IPC_URING_ENTRIES) < 0) {
+        DEBUG_I("io_uring not available (%s), using plain syscalls\n", strerror(errno));
+        ipc_uring_free(uring);
+        return NULL;
+    }
+
+    return uring;
+}
+
+/* Registers region as fixed buffer 0 and marks the reads inside it */
+static void ipc_uring_register(struct ipc_uring *uring, struct iovec *region)
+{
+    int i;
+
+    if (sys_io_uring_register(uring->fd, IORING_REGISTER_BUFFERS, region, 1) < 0) {
+        DEBUG_I("io_uring buffer registration failed (%s)\n", strerror(errno));
+        return;
+    }
+
+    for (i = 0; i < IPC_URING_READS; i++)
+        uring->reads[i].fixed =
+            (uring->reads[i].buf >= (uint8_t *) region->iov_base &&
+             uring->reads[i].buf + uring->buf_size <= (uint8_t *) region->iov_base + region->iov_len);
+}
+
+static int ipc_uring_start_reads(struct ipc_uring *uring)
+{
+    int i;
+
+    for (i = 0; i < IPC_URING_READS; i++)
+        if (ipc_uring_queue_read(uring, i) < 0)
+            return -1;
+
+    return ipc_uring_enter(uring, 0);
+}
+
+/* Reads land in a buffer of our own, for tun devices */
+struct ipc_uring *ipc_uring_new(int read_fd, uint32_t buf_size)
+{
+    struct ipc_uring *uring;
+    struct iovec region;
+    int i;
+
+    uring = ipc_uring_create(read_fd);
+    if (uring == NULL || read_fd < 0)
+        return uring;
+
+    uring->buf_size = buf_size;
+    uring->storage = (uint8_t *) malloc(IPC_URING_READS * buf_size);
+    if (uring->storage == NULL) {
+        ipc_uring_free(uring);
+        return NULL;
+    }
+
+    for (i = 0; i < IPC_URING_READS; i++)
+        uring->reads[i].buf = uring->storage + i * buf_size;
+
+    region.iov_base = uring->storage;
+    region.iov_len = IPC_URING_READS * buf_size;
+    ipc_uring_register(uring, &region);
+
+    if (ipc_uring_start_reads(uring) < 0) {
+        ipc_uring_free(uring);
+        return NULL;
+    }
+
+    return uring;
+}
+
+/*
+ * For byte streams: nothing is queued up front, ipc_uring_read queues
+ * one read at a time into the buffer it is given. No fixed buffer, the
+ * caller's buffer is not ours to register.
+ */
+struct ipc_uring *ipc_uring_new_stream(int read_fd)
+{
+    struct ipc_uring *uring;
+
+    uring = ipc_uring_create(read_fd);
+    if (uring != NULL)
+        uring->stream = 1;
+
+    return uring;
+}
+
+/* Cancels queued reads and waits for them, the kernel may still be filling them */
+static void ipc_uring_cancel_reads(struct ipc_uring *uring)
+{
+    struct io_uring_sqe *sqe;
+    int tries;
+    int i;
+
+    for (i = 0; i < IPC_URING_READS; i++) {
+        if (uring->reads[i].state != IPC_URING_READ_QUEUED)
+            continue;
+
+        sqe = ipc_uring_get_sqe(uring);
+        if (sqe == NULL)
+            break;
+
+        sqe->opcode = IORING_OP_ASYNC_CANCEL;
+        sqe->fd = -1;
+        sqe->addr = i;
+        sqe->user_data = IPC_URING_CANCEL_TAG | i;
+    }
+
+    for (tries = 0; uring->queued_reads > 0 && tries < 8; tries++) {
+        if (ipc_uring_enter(uring, 1) < 0)
+            break;
+        ipc_uring_reap(uring);
+    }
+}
+
+void ipc_uring_free(struct ipc_uring *uring)
+{
+    if (uring == NULL)
+        return;
+
+    if (uring->fd >= 0 && uring->sq_ptr != MAP_FAILED && uring->queued_reads > 0)
+        ipc_uring_cancel_reads(uring);
+
+    if (uring->sqes != MAP_FAILED)
+        munmap(uring->sqes, uring->sqes_len);
+    if (uring->cq_ptr != MAP_FAILED)
+        munmap(uring->cq_ptr, uring->cq_len);
+    if (uring->sq_ptr != MAP_FAILED)
+        munmap(uring->sq_ptr, uring->sq_len);
+    if (uring->fd >= 0)
+        close(uring->fd);
+
+    if (uring->storage != NULL)
+        free(uring->storage);
+
+    free(uring);
+}
+
+int ipc_uring_fd(struct ipc_uring *uring)
+{
+    return uring != NULL ? uring->fd : -1;
+}
+
+/*
+ * Stream read: queues a read into data, unless one is queued there
+ * already, and hands its result straight back. With wait 0 the read is
+ * left queued on EAGAIN, the caller must come back with the same buffer.
+ */
+static int ipc_uring_read_stream(struct ipc_uring *uring, void *data, uint32_t size, int wait)
+{
+    struct ipc_uring_read *read = &uring->reads[0];
+    int32_t result;
+
+    while (1) {
+        if (read->state == IPC_URING_READ_IDLE) {
+            read->buf = (uint8_t *) data;
+            uring->buf_size = size;
+            if (ipc_uring_queue_read(uring, 0) < 0)
+                return -1;
+        } else if (read->state == IPC_URING_READ_QUEUED && read->buf != data) {
+            errno = EINVAL;
+            return -1;
+        }
+
+        if (read->state == IPC_URING_READ_QUEUED) {
+            if ((uring->to_submit > 0 || wait) && ipc_uring_enter(uring, wait ? 1 : 0) < 0)
+                return -1;
+            ipc_uring_reap(uring);
+        }
+
+        if (read->state != IPC_URING_READ_DONE) {
+            if (!wait) {
+                errno = EAGAIN;
+                return -1;
+            }
+            continue;
+        }
+
+        result = read->result;
+        read->state = IPC_URING_READ_IDLE;
+        uring->done_head = 0;
+        uring->done_count = 0;
+
+        /* Queued again into the same buffer */
+        if (result == -ECANCELED || result == -EINTR || result == -EAGAIN)
+            continue;
+
+        if (result <= 0) {
+            if (result < 0)
+                errno = -result;
+            return result < 0 ? -1 : 0;
+        }
+
+        uring->stats.reads++;
+        uring->stats.read_bytes += result;
+
+        return result;
+    }
+}
+
+/*
+ * Copies out data of the oldest completed read, never merging two reads
+ * so datagram boundaries (tun) are kept. Returns 0 at end of stream and
+ * -1 with errno set on error, EAGAIN when wait is 0 and nothing is in.
+ */
+int ipc_uring_read(struct ipc_uring *uring, void *data, uint32_t size, int wait)
+{
+    struct ipc_uring_read *read;
+    uint32_t length;
+    int i;
+
+    if (uring == NULL || uring->read_fd < 0) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    if (uring->stream)
+        return ipc_uring_read_stream(uring, data, size, wait);
+
+    while (1) {
+        if (uring->done_count == 0)
+            ipc_uring_reap(uring);
+
+        if (uring->done_count == 0) {
+            if (ipc_uring_enter(uring, wait ? 1 : 0) < 0)
+                return -1;
+            ipc_uring_reap(uring);
+        }
+
+        if (uring->done_count == 0) {
+            if (!wait) {
+                errno = EAGAIN;
+                return -1;
+            }
+            continue;
+        }
+
+        i = uring->done[uring->done_head];
+        read = &uring->reads[i];
+
+        if (read->result == -ECANCELED || read->result == -EINTR || read->result == -EAGAIN) {
+            uring->done_head = (uring->done_head + 1) % IPC_URING_READS;
+            uring->done_count--;
+            ipc_uring_queue_read(uring, i);
+            continue;
+        }
+
+        if (read->result <= 0) {
+            if (read->result < 0)
+                errno = -read->result;
+            return read->result < 0 ? -1 : 0;
+        }
+
+        length = read->result - read->offset;
+        if (length > size)
+            length = size;
+
+        memcpy(data, read->buf + read->offset, length);
+        read->offset += length;
+
+        uring->stats.reads++;
+        uring->stats.read_bytes += length;
+
+        if (read->offset == (uint32_t) read->result) {
+            uring->done_head = (uring->done_head + 1) % IPC_URING_READS;
+            uring->done_count--;
+            /* Submitted with the next enter */
+            ipc_uring_queue_read(uring, i);
+        }
+
+        return length;
+    }
+}
+
+/*
+ * Non-zero when a read completed, also pushes re-armed reads to the
+ * kernel. On a stream also when no read is queued: only the next
+ * ipc_uring_read queues one, until then the ring fd won't wake anybody.
+ */
+int ipc_uring_pending(struct ipc_uring *uring)
+{
+    if (uring == NULL)
+        return 0;
+
+    if (uring->to_submit > 0)
+        ipc_uring_enter(uring, 0);
+
+    if (uring->done_count == 0)
+        ipc_uring_reap(uring);
+
+    if (uring->stream && uring->read_fd >= 0)
+        return uring->reads[0].state != IPC_URING_READ_QUEUED;
+
+    return uring->done_count > 0;
+}
+
+/* The iovec array is copied, data must stay valid until ipc_uring_submit */
+int ipc_uring_queue_write(struct ipc_uring *uring, int fd, struct iovec *iov, int iovcnt)
+{
+    struct ipc_uring_write *write;
+
+    if (uring == NULL || iovcnt <= 0 || iovcnt > IPC_MAX_IOV + 1)
+        return -1;
+
+    if (uring->write_count == IPC_URING_WRITES && ipc_uring_submit(uring) < 0)
+        return -1;
+
+    write = &uring->writes[uring->write_count++];
+    write->fd = fd;
+    memcpy(write->iov, iov, iovcnt * sizeof(struct iovec));
+    write->iovcnt = iovcnt;
+    write->length = ipc_iov_length(iov, iovcnt);
+    write->result = 0;
+    write->done = 0;
+
+    return 0;
+}
+
+/* Finishes a short or cancelled write with plain writev calls */
+static int ipc_uring_write_rest(struct ipc_uring_write *write)
+{
+    struct iovec iov[IPC_MAX_IOV + 1];
+    uint32_t written;
+    int iovcnt;
+    int rc;
+
+    written = write->result > 0 ? write->result : 0;
+
+    while (written < write->length) {
+        iovcnt = ipc_iov_slice(write->iov, write->iovcnt, written,
+                               write->length - written, iov, IPC_MAX_IOV + 1);
+        if (iovcnt <= 0)
+            return -1;
+
+        rc = writev(write->fd, iov, iovcnt);
+        if (rc < 0 && errno == EINTR)
+            continue;
+        if (rc <= 0)
+            return -1;
+
+        written += rc;
+    }
+
+    return 0;
+}
+
+/*
+ * Submits the queued writes as one linked chain, together with any
+ * re-armed reads, and waits for all of them. Returns the number of
+ * writes or -1 if one of them failed.
+ */
+int ipc_uring_submit(struct ipc_uring *uring)
+{
+    struct io_uring_sqe *sqe;
+    struct ipc_uring_write *write;
+    int pending;
+    int count;
+    int rc = 0;
+    int i;
+
+    if (uring == NULL)
+        return -1;
+
+    count = uring->write_count;
+    if (count == 0)
+        return 0;
+
+    /* Reads queued before the chain stay out of it */
+    for (i = 0; i < count; i++) {
+        write = &uring->writes[i];
+
+        sqe = ipc_uring_get_sqe(uring);
+        if (sqe == NULL) {
+            if (ipc_uring_enter(uring, 0) < 0 || (sqe = ipc_uring_get_sqe(uring)) == NULL) {
+                count = i;
+                rc = -1;
+                break;
+            }
+        }
+
+        sqe->opcode = IORING_OP_WRITEV;
+        sqe->fd = write->fd;
+        sqe->off = (uint64_t) -1;
+        sqe->addr = (unsigned long) write->iov;
+        sqe->len = write->iovcnt;
+        sqe->user_data = IPC_URING_WRITE_TAG | i;
+        if (i < count - 1)
+            sqe->flags = IOSQE_IO_LINK;
+    }
+
+    pending = count;
+    while (pending > 0) {
+        if (ipc_uring_enter(uring, 1) < 0) {
+            rc = -1;
+            break;
+        }
+
+        ipc_uring_reap(uring);
+
+        pending = 0;
+        for (i = 0; i < count; i++)
+            if (!uring->writes[i].done)
+                pending++;
+    }
+
+    for (i = 0; i < count && rc == 0; i++) {
+        write = &uring->writes[i];
+
+        if (write->result != (int32_t) write->length &&
+            ipc_uring_write_rest(write) < 0)
+            rc = -1;
+
+        uring->stats.writes++;
+        uring->stats.write_bytes += write->length;
+    }
+
+    uring->write_count = 0;
+
+    return rc < 0 ? -1 : count;
+}
+
+/* Long gather lists go out as consecutive links of the same chain */
+int ipc_uring_writev(struct ipc_uring *uring, int fd, struct iovec *iov, int iovcnt)
+{
+    uint32_t length;
+    int count;
+
+    length = ipc_iov_length(iov, iovcnt);
+
+    while (iovcnt > 0) {
+        count = iovcnt > IPC_MAX_IOV + 1 ? IPC_MAX_IOV + 1 : iovcnt;
+
+        if (ipc_uring_queue_write(uring, fd, iov, count) < 0)
+            return -1;
+
+        iov += count;
+        iovcnt -= count;
+    }
+
+    if (ipc_uring_submit(uring) < 0)
+        return -1;
+
+    return length;
+}
+
+int ipc_uring_get_stats(struct ipc_uring *uring, struct ipc_uring_stats *stats)
+{
+    if (uring == NULL || stats == NULL)
+        return -1;
+
+    memcpy(stats, &uring->stats, sizeof(struct ipc_uring_stats));
+
+    return 0;
+}
+
+#else
+
+/* Built without IPC_IO_URING: every caller takes the syscall path */
+
+int ipc_uring_enabled(void)
+{
+    return 0;
+}
+
+struct ipc_uring *ipc_uring_new(int read_fd, uint32_t buf_size)
+{
+    return NULL;
+}
+
+struct ipc_uring *ipc_uring_new_stream(int read_fd)
+{
+    return NULL;
+}
+
+void ipc_uring_free(struct ipc_uring *uring)
+{
+}
+
+int ipc_uring_fd(struct ipc_uring *uring)
+{
+    return -1;
+}
+
+int ipc_uring_read(struct ipc_uring *uring, void *data, uint32_t size, int wait)
+{
+    errno = ENOSYS;
+    return -1;
+}
+
+int ipc_uring_pending(struct ipc_uring *uring)
+{
+    return 0;
+}
+
+int ipc_uring_queue_write(struct ipc_uring *uring, int fd, struct iovec *iov, int iovcnt)
+{
+    return -1;
+}
+
+int ipc_uring_submit(struct ipc_uring *uring)
+{
+    return -1;
+}
+
+int ipc_uring_writev(struct ipc_uring *uring, int fd, struct iovec *iov, int iovcnt)
+{
+    return -1;
+}
+
+int ipc_uring_get_stats(struct ipc_uring *uring, struct ipc_uring_stats *stats)
+{
+    return -1;
+}
+
+#endif
@@ -17,6 +17,8 @@
  * along with libmocha-ipc.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#define IPC_LOG_MODULE	IPC_LOG_MISC
+
 #include <stdlib.h>
 #include <stdio.h>
 #include <unistd.h>
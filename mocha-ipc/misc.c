@@ -19,6 +19,8 @@
  *
  */
 
+#define IPC_LOG_MODULE	IPC_LOG_MISC
+
 #include <stdlib.h>
 #include <stdio.h>
 
@@ -17,6 +17,8 @@
  * along with libmocha-ipc.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#define IPC_LOG_MODULE	IPC_LOG_PROTO
+
 #include <stdlib.h>
 #include <stdio.h>
 #include <unistd.h>
@@ -76,10 +78,10 @@ void ipc_parse_proto(struct ipc_client* client, struct modem_io *ipc_frame)
 			DEBUG_I("PROTO_PACKET_UPDATE_NETWORK_STATUS_IND packet received");
 			break;
 		case PROTO_PACKET_RECEIVE_DATA_IND:
-			DEBUG_I("PROTO_PACKET_RECEIVE_DATA_IND packet received");
+			DEBUG_V("PROTO_PACKET_RECEIVE_DATA_IND packet received");
 			ipc_invoke_ril_cb(PROTO_RECEIVE_DATA_IND, (void*)(ipc_frame->data + sizeof(struct protoPacketHeader)));
+			/* Packet data, no hex dump */
 			return;
-			break;
 		case PROTO_PACKET_DS_NETWORK_IND:
 			DEBUG_I("PROTO_PACKET_DS_NETWORK_IND packet received");
 			proto_ds_network_resp(ipc_frame->data + sizeof(struct protoPacketHeader));
@@ -94,28 +96,44 @@ void ipc_parse_proto(struct ipc_client* client, struct modem_io *ipc_frame)
 			DEBUG_I("Proto Packet type = 0x%x is not yet handled, len = 0x%x", rx_header->type, ipc_frame->datasize - sizeof(struct protoPacketHeader));
 			break;
 		}
-	hex_dump(ipc_frame->data + sizeof(struct protoPacketHeader), ipc_frame->datasize - sizeof(struct protoPacketHeader));
+	IPC_HEX_DUMP(ipc_frame->data + sizeof(struct protoPacketHeader), ipc_frame->datasize - sizeof(struct protoPacketHeader));
 }
 
-void proto_send_packet(struct protoPacket* protoReq)
+/*
+ * Transfer buffer of a well-formed PROTO_PACKET_RECEIVE_DATA_IND frame, NULL
+ * for any other frame. Lets a receiver take packet data off the frame
+ * stream before dispatch.
+ */
+protoTransferDataBuf *proto_data_ind(struct modem_io *ipc_frame)
 {
-	struct modem_io request;
-	
-	uint32_t bufLen = protoReq->header.len + sizeof(struct protoPacketHeader);
-	uint8_t* fifobuf = malloc(bufLen);
-	memcpy(fifobuf, protoReq, sizeof(struct protoPacketHeader));
-	if(protoReq->header.len)
-		memcpy(fifobuf + sizeof(struct protoPacketHeader), protoReq->buf, protoReq->header.len);
+	struct protoPacketHeader *rx_header;
+	protoTransferDataBuf *rcvData;
 
-	request.magic = 0xCAFECAFE;
-	request.cmd = FIFO_PKT_PROTO;
-	request.datasize = bufLen;
+	if (ipc_frame->cmd != FIFO_PKT_PROTO ||
+		ipc_frame->datasize < sizeof(struct protoPacketHeader) + sizeof(protoTransferDataBuf))
+		return NULL;
 
-	request.data = fifobuf;
+	rx_header = (struct protoPacketHeader *)(ipc_frame->data);
+	if (rx_header->type != PROTO_PACKET_RECEIVE_DATA_IND)
+		return NULL;
 
-	ipc_send(&request);
+	rcvData = (protoTransferDataBuf *)(ipc_frame->data + sizeof(struct protoPacketHeader));
+	if (rcvData->netBufLen > ipc_frame->datasize - sizeof(struct protoPacketHeader) - sizeof(protoTransferDataBuf))
+		return NULL;
 
-	free(fifobuf);
+	return rcvData;
+}
+
+void proto_send_packet(struct protoPacket* protoReq)
+{
+	struct iovec iov[2];
+
+	iov[0].iov_base = &protoReq->header;
+	iov[0].iov_len = sizeof(struct protoPacketHeader);
+	iov[1].iov_base = protoReq->buf;
+	iov[1].iov_len = protoReq->header.len;
+
+	ipc_sendv(FIFO_PKT_PROTO, iov, protoReq->header.len ? 2 : 1);
 }
 
 void proto_startup(void)
@@ -134,7 +152,7 @@ void proto_start_network(protoStartNetwork* startNetwork)
 	pkt.header.len = sizeof(protoStartNetwork);
 	pkt.buf = (uint8_t*)(startNetwork);
 	DEBUG_I("proto_start_network: size = %x; APN = %s; UserName = %s; Pass = %s", pkt.header.len, startNetwork->napAddr, startNetwork->userId, startNetwork->userPasswd);
-	hex_dump(pkt.buf , pkt.header.len);
+	IPC_HEX_DUMP(pkt.buf , pkt.header.len);
 	proto_send_packet(&pkt);
 }
 
@@ -144,7 +162,7 @@ void proto_stop_network(protoStopNetwork* stopNetwork)
 	pkt.header.type = PROTO_PACKET_STOP_NETWORK;
 	pkt.header.len = sizeof(protoStopNetwork);
 	pkt.buf = (uint8_t*)(stopNetwork);
-	hex_dump(pkt.buf , pkt.header.len);
+	IPC_HEX_DUMP(pkt.buf , pkt.header.len);
 	proto_send_packet(&pkt);
 }
 
@@ -155,7 +173,7 @@ void proto_ds_network_resp(uint8_t* buf)
 	pkt.header.len = 8;
 	pkt.buf = buf;
 	DEBUG_I("proto_ds_network_resp");
-	hex_dump(buf, 8);
+	IPC_HEX_DUMP(buf, 8);
 	proto_send_packet(&pkt);
 }
 
@@ -165,23 +183,53 @@ void proto_some_unload_function(uint32_t buf)
 	pkt.header.type = PROTO_PACKET_SOME_UNLOAD_FUNCTION;
 	pkt.header.len = 4;
 	pkt.buf = (uint8_t*)&buf;
-	hex_dump(&buf, 4);
+	IPC_HEX_DUMP(&buf, 4);
 	proto_send_packet(&pkt);
 }
 
 void proto_send_data(uint16_t opMode, uint16_t protoType, uint32_t contextId, uint32_t netBufLen, uint8_t *netBuf)
 {
-	protoTransferDataBuf* send_hdr;
-	struct protoPacket pkt;
-	pkt.header.type = PROTO_PACKET_SEND_DATA;
-	pkt.header.len = sizeof(protoTransferDataBuf) + netBufLen;
-	pkt.buf = malloc(sizeof(protoTransferDataBuf) + netBufLen);
-	send_hdr = (protoTransferDataBuf*)pkt.buf;
+	struct protoPacketHeader header;
+	protoTransferDataBuf send_hdr;
+	struct iovec iov[3];
+
+	header.type = PROTO_PACKET_SEND_DATA;
+	header.len = sizeof(protoTransferDataBuf) + netBufLen;
+	send_hdr.opMode = opMode;
+	send_hdr.protoType = protoType;
+	send_hdr.contextId = contextId;
+	send_hdr.netBufLen = netBufLen;
+
+	/* IP packet goes out straight from the caller's buffer */
+	iov[0].iov_base = &header;
+	iov[0].iov_len = sizeof(header);
+	iov[1].iov_base = &send_hdr;
+	iov[1].iov_len = sizeof(send_hdr);
+	iov[2].iov_base = netBuf;
+	iov[2].iov_len = netBufLen;
+
+	ipc_sendv(FIFO_PKT_PROTO, iov, 3);
+}
+
+/*
+ * Fills in the headers of an IP packet read to buf + PROTO_DATA_HEADROOM,
+ * iov gets the FIFO payload with IPC_FRAME_HEADROOM left in front of it.
+ */
+void proto_build_data(uint16_t opMode, uint16_t protoType, uint32_t contextId, uint8_t *buf, uint32_t netBufLen, struct iovec *iov)
+{
+	struct protoPacketHeader *header;
+	protoTransferDataBuf *send_hdr;
+
+	header = (struct protoPacketHeader *) (buf + IPC_FRAME_HEADROOM);
+	send_hdr = (protoTransferDataBuf *) (header + 1);
+
+	header->type = PROTO_PACKET_SEND_DATA;
+	header->len = sizeof(protoTransferDataBuf) + netBufLen;
 	send_hdr->opMode = opMode;
 	send_hdr->protoType = protoType;
 	send_hdr->contextId = contextId;
 	send_hdr->netBufLen = netBufLen;
-	memcpy(send_hdr->netBuf, netBuf, netBufLen);
-	proto_send_packet(&pkt);
-	free(pkt.buf);
+
+	iov->iov_base = header;
+	iov->iov_len = sizeof(struct protoPacketHeader) + header->len;
 }
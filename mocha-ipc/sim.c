@@ -21,6 +21,8 @@
  * along with libmocha-ipc.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#define IPC_LOG_MODULE	IPC_LOG_SIM
+
 #include <stdlib.h>
 #include <stdio.h>
 #include <unistd.h>
@@ -133,7 +135,7 @@ void ipc_parse_sim(struct ipc_client* client, struct modem_io *ipc_frame)
 			sim_send_oem_req(sim_packet.simBuf, simHeader->bufLen); //bounceback packet
 		}
 	}
-	ipc_hex_dump(client, ipc_frame->data, ipc_frame->datasize);
+	IPC_CLIENT_HEX_DUMP(client, ipc_frame->data, ipc_frame->datasize);
 	DEBUG_I("Leaving ipc_parse_sim");
 }
 void sim_parse_event(uint8_t* buf, uint32_t bufLen)
@@ -246,28 +248,22 @@ void sim_parse_event(uint8_t* buf, uint32_t bufLen)
 void sim_send_oem_req(uint8_t* simBuf, uint8_t simBufLen)
 {
 	//simBuf is expected to contain full oemPacket structure
-	struct modem_io request;
+	struct iovec iov[2];
 	struct simPacket sim_packet;
 	sim_packet.header.type = 0;
 	sim_packet.header.subType = ((struct oemSimPacketHeader *)(simBuf))->type;
 	sim_packet.header.bufLen = simBufLen;
 	sim_packet.simBuf = simBuf;
 
-	uint32_t bufLen = sim_packet.header.bufLen + sizeof(struct simPacketHeader);
-	uint8_t* fifobuf = malloc(bufLen);
-	memcpy(fifobuf, &sim_packet.header, sizeof(struct simPacketHeader));
-	memcpy(fifobuf + sizeof(struct simPacketHeader), sim_packet.simBuf, sim_packet.header.bufLen);
-
-	request.magic = 0xCAFECAFE;
-	request.cmd = FIFO_PKT_SIM;
-	request.datasize = bufLen;
+	iov[0].iov_base = &sim_packet.header;
+	iov[0].iov_len = sizeof(struct simPacketHeader);
+	iov[1].iov_base = sim_packet.simBuf;
+	iov[1].iov_len = sim_packet.header.bufLen;
 
-	request.data = fifobuf;
-	hex_dump(fifobuf, bufLen);
+	IPC_HEX_DUMP(&sim_packet.header, sizeof(struct simPacketHeader));
+	IPC_HEX_DUMP(sim_packet.simBuf, sim_packet.header.bufLen);
 
-	ipc_send(&request);
-
-	free(fifobuf);
+	ipc_sendv(FIFO_PKT_SIM, iov, 2);
 }
 
 void sim_send_oem_data(uint8_t hSim, uint8_t packetType, uint8_t* dataBuf, uint32_t oemBufLen)
@@ -279,15 +275,27 @@ void sim_send_oem_data(uint8_t hSim, uint8_t packetType, uint8_t* dataBuf, uint3
 	oem_header.hSim = hSim; //session id
 	oem_header.oemBufLen = oemBufLen;
 	
-	uint32_t simBufLen = oemBufLen + sizeof(struct oemSimPacketHeader) + 1; /* Looks like bug in Bada, but there's always 1 redundant, zero byte */
-	uint8_t* simBuf = malloc(simBufLen);
-	memset(simBuf, 0x00, simBufLen);
-	memcpy(simBuf, &(oem_header), sizeof(struct oemSimPacketHeader));
-	if(oemBufLen)
-		memcpy(simBuf + sizeof(struct oemSimPacketHeader), dataBuf, oemBufLen);
-	
-	sim_send_oem_req(simBuf, simBufLen);
-	free(simBuf);
+	uint8_t padding = 0x00; /* Looks like bug in Bada, but there's always 1 redundant, zero byte */
+	struct simPacketHeader header;
+	struct iovec iov[4];
+
+	header.type = 0;
+	header.subType = packetType;
+	header.bufLen = oemBufLen + sizeof(struct oemSimPacketHeader) + sizeof(padding);
+
+	iov[0].iov_base = &header;
+	iov[0].iov_len = sizeof(struct simPacketHeader);
+	iov[1].iov_base = &oem_header;
+	iov[1].iov_len = sizeof(struct oemSimPacketHeader);
+	iov[2].iov_base = dataBuf;
+	iov[2].iov_len = oemBufLen;
+	iov[3].iov_base = &padding;
+	iov[3].iov_len = sizeof(padding);
+
+	IPC_HEX_DUMP(&oem_header, sizeof(struct oemSimPacketHeader));
+	IPC_HEX_DUMP(dataBuf, oemBufLen);
+
+	ipc_sendv(FIFO_PKT_SIM, iov, 4);
 }
 
 void sim_verify_chv(uint8_t hSim, uint8_t pinType, char* pin)
@@ -375,29 +383,19 @@ void sim_open_to_modem(uint8_t hSim)
 void sim_atk_send_packet(uint32_t atkType, uint32_t atkSubType, uint32_t atkBufLen, uint8_t* atkBuf)
 {
 	DEBUG_I("Sending sim_atk_send_packet\n");
-	struct modem_io request;
-	sim_atk_packet_header* atk_header;
-	uint8_t* fifobuf;
-	uint32_t bufLen = sizeof(sim_atk_packet_header) + atkBufLen;
-
-	fifobuf = malloc(bufLen);
-	atk_header = (sim_atk_packet_header*)(fifobuf);
-
-	atk_header->atkType = atkType;
-	atk_header->atkSubType = atkSubType;
-	atk_header->atkBufLen = atkBufLen;
-
-	memcpy(fifobuf + sizeof(sim_atk_packet_header), atkBuf, atkBufLen);	
-
-	request.magic = 0xCAFECAFE;
-	request.cmd = FIFO_PKT_SIM;
-	request.datasize = bufLen;
+	sim_atk_packet_header atk_header;
+	struct iovec iov[2];
 
-	request.data = fifobuf;
+	atk_header.atkType = atkType;
+	atk_header.atkSubType = atkSubType;
+	atk_header.atkBufLen = atkBufLen;
 
-	ipc_send(&request);
+	iov[0].iov_base = &atk_header;
+	iov[0].iov_len = sizeof(sim_atk_packet_header);
+	iov[1].iov_base = atkBuf;
+	iov[1].iov_len = atkBufLen;
 
-	free(fifobuf);
+	ipc_sendv(FIFO_PKT_SIM, iov, atkBufLen ? 2 : 1);
 }
 
 void sim_status(int simCardStatus)
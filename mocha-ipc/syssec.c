@@ -18,6 +18,8 @@
  *
  */
 
+#define IPC_LOG_MODULE	IPC_LOG_MISC
+
 #include <stdlib.h>
 #include <stdio.h>
 #include <stdint.h>
@@ -41,7 +43,7 @@ void ipc_parse_syssec(struct ipc_client* client, struct modem_io *ipc_frame)
     rx_header = (struct sysSecPacketHeader*)(ipc_frame->data);
 
 	DEBUG_I("Syssec packet type = 0x%x\n  Syssec packet unk1 = 0x%X\n  packet length = 0x%X, unk2= 0x%X", rx_header->type, rx_header->unknown1, rx_header->bufLen, rx_header->unknown2);
-	ipc_hex_dump(client, ipc_frame->data, rx_header->bufLen);
+	IPC_CLIENT_HEX_DUMP(client, ipc_frame->data, rx_header->bufLen);
 	DEBUG_I("Exiting");
 }
 
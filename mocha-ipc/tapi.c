@@ -17,6 +17,8 @@
  * along with libmocha-ipc.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#define IPC_LOG_MODULE	IPC_LOG_TAPI
+
 #include <stdlib.h>
 #include <stdio.h>
 #include <unistd.h>
@@ -65,6 +67,23 @@ void tapi_init(void)
 	DEBUG_I("exit tapi_init");
 }
 
+/* Hooks the TAPI services into the dispatch registry, from ipc_dispatch_init */
+void tapi_register(void)
+{
+	ipc_register_tapi_service(TAPI_TYPE_CALL, tapi_call_parser, "TAPI_CALL");
+	ipc_register_tapi_service(TAPI_TYPE_NETTEXT, tapi_nettext_parser, "TAPI_NETTEXT");
+	ipc_register_tapi_service(TAPI_TYPE_NETWORK, tapi_network_parser, "TAPI_NETWORK");
+	ipc_register_tapi_service(TAPI_TYPE_SS, tapi_ss_parser, "TAPI_SS");
+	ipc_register_tapi_service(TAPI_TYPE_AT, tapi_at_parser, "TAPI_AT");
+	ipc_register_tapi_service(TAPI_TYPE_DMH, tapi_dmh_parser, "TAPI_DMH");
+	ipc_register_tapi_service(TAPI_TYPE_CONFIG, tapi_config_parser, "TAPI_CONFIG");
+
+	tapi_call_register();
+	tapi_nettext_register();
+	tapi_network_register();
+	tapi_ss_register();
+}
+
 void ipc_parse_tapi(struct ipc_client* client, struct modem_io *ipc_frame)
 {
 	struct tapiPacketHeader *rx_header;
@@ -78,40 +97,10 @@ void ipc_parse_tapi(struct ipc_client* client, struct modem_io *ipc_frame)
 
     rx_header = (struct tapiPacketHeader *)(ipc_frame->data);
 
-    switch (rx_header->tapiService)
-    {
-	case TAPI_TYPE_CALL:
-		DEBUG_I("Tapi call/general packet received");
-		tapi_call_parser(rx_header->tapiServiceFunction, rx_header->len, (ipc_frame->data + sizeof(struct tapiPacketHeader)));
-		break;
-	case TAPI_TYPE_NETTEXT:
-		DEBUG_I("Tapi nettext packet received");
-		tapi_nettext_parser(rx_header->tapiServiceFunction, rx_header->len, (ipc_frame->data + sizeof(struct tapiPacketHeader)));
-		break;
-	case TAPI_TYPE_NETWORK:
-		DEBUG_I("Tapi network packet received");
-		tapi_network_parser(rx_header->tapiServiceFunction, rx_header->len, (ipc_frame->data + sizeof(struct tapiPacketHeader)));
-		break;
-	case TAPI_TYPE_SS:
-		DEBUG_I("Tapi SS packet received");
-		tapi_ss_parser(rx_header->tapiServiceFunction, rx_header->len, (ipc_frame->data + sizeof(struct tapiPacketHeader)));
-		break;
-	case TAPI_TYPE_AT:
-		DEBUG_I("Tapi AT packet received");
-		tapi_at_parser(rx_header->tapiServiceFunction, rx_header->len, (ipc_frame->data + sizeof(struct tapiPacketHeader)));
-		break;
-	case TAPI_TYPE_DMH:
-		DEBUG_I("Tapi DMH packet received");
-		tapi_dmh_parser(rx_header->tapiServiceFunction, rx_header->len, (ipc_frame->data + sizeof(struct tapiPacketHeader)));
-		break;
-	case TAPI_TYPE_CONFIG:
-		DEBUG_I("Tapi Config packet received");
-		tapi_config_parser(rx_header->tapiServiceFunction, rx_header->len, (ipc_frame->data + sizeof(struct tapiPacketHeader)));
-		break;
-    default :
+	if(ipc_dispatch_tapi(rx_header->tapiService, rx_header->tapiServiceFunction, rx_header->len,
+		ipc_frame->data + sizeof(struct tapiPacketHeader)) < 0)
 		DEBUG_I("Undefined TAPI Service 0x%x received", rx_header->tapiService);
-		break;
-    }
+
 	if(rx_header->tapiService || rx_header->tapiServiceFunction)
 	{
 		*(uint32_t*)(resp_buf) = 0;
@@ -126,21 +115,12 @@ void ipc_parse_tapi(struct ipc_client* client, struct modem_io *ipc_frame)
 
 void tapi_send_packet(struct tapiPacket* tapiReq)
 {
-	struct modem_io request;
-	
-	uint32_t bufLen = tapiReq->header.len + sizeof(struct tapiPacketHeader);
-	uint8_t* fifobuf = malloc(bufLen);
-	memcpy(fifobuf, tapiReq, sizeof(struct tapiPacketHeader));
-	if(tapiReq->header.len)
-		memcpy(fifobuf + sizeof(struct tapiPacketHeader), tapiReq->buf, tapiReq->header.len);
-
-	request.magic = 0xCAFECAFE;
-	request.cmd = FIFO_PKT_TAPI;
-	request.datasize = bufLen;
-
-	request.data = fifobuf;
+	struct iovec iov[2];
 
-	ipc_send(&request);
+	iov[0].iov_base = &tapiReq->header;
+	iov[0].iov_len = sizeof(struct tapiPacketHeader);
+	iov[1].iov_base = tapiReq->buf;
+	iov[1].iov_len = tapiReq->header.len;
 
-	free(fifobuf);
+	ipc_sendv(FIFO_PKT_TAPI, iov, tapiReq->header.len ? 2 : 1);
 }
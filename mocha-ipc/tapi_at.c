@@ -19,6 +19,8 @@
  * along with libmocha-ipc.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#define IPC_LOG_MODULE	IPC_LOG_TAPI
+
 #include <stdlib.h>
 
 #include <radio.h>
@@ -46,7 +48,7 @@ void tapi_at_parser(uint16_t tapiAtType, uint32_t tapiAtLength, uint8_t *tapiAtD
     {
     default:
 		DEBUG_I("TapiAT Packet type 0x%X is not yet handled, len = 0x%x", tapiAtType, tapiAtLength);
-		hex_dump(tapiAtData, tapiAtLength);
+		IPC_HEX_DUMP(tapiAtData, tapiAtLength);
     	break;
     }
 }
@@ -21,6 +21,8 @@
  * along with libmocha-ipc.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#define IPC_LOG_MODULE	IPC_LOG_TAPI
+
 #include <stdlib.h>
 
 #include <radio.h>
@@ -35,6 +37,28 @@
  *
  */
 
+static void tapi_call_apireq(uint32_t tapiCallLength, uint8_t *tapiCallData)
+{
+	/* Confirmation of properly executed function, just drop it */
+}
+
+void tapi_call_register(void)
+{
+	ipc_register_tapi_handler(TAPI_TYPE_CALL, TAPI_CALL_APIREQ, tapi_call_apireq, "TAPI_CALL_APIREQ");
+	ipc_register_tapi_ril_cb(TAPI_TYPE_CALL, TAPI_CALL_INCOMING_IND, CALL_INCOMING_IND, "TAPI_CALL_INCOMING_IND");
+	ipc_register_tapi_ril_cb(TAPI_TYPE_CALL, TAPI_CALL_END_IND, CALL_END_IND, "TAPI_CALL_END_IND");
+	ipc_register_tapi_ril_cb(TAPI_TYPE_CALL, TAPI_CALL_SETUP_IND, CALL_SETUP_IND, "TAPI_CALL_SETUP_IND");
+	ipc_register_tapi_ril_cb(TAPI_TYPE_CALL, TAPI_CALL_ALERT_IND, CALL_ALERT, "TAPI_CALL_ALERT_IND");
+	ipc_register_tapi_ril_cb(TAPI_TYPE_CALL, TAPI_CALL_CONNECTED_IND, CALL_CONNECTED, "TAPI_CALL_CONNECTED_IND");
+	ipc_register_tapi_ril_cb(TAPI_TYPE_CALL, TAPI_CALL_START_DTMF_CNF, CALL_DTMF_START, "TAPI_CALL_START_DTMF_CNF");
+	ipc_register_tapi_ril_cb(TAPI_TYPE_CALL, TAPI_CALL_STOP_DTMF_CNF, CALL_DTMF_STOP, "TAPI_CALL_STOP_DTMF_CNF");
+	ipc_register_tapi_ril_cb(TAPI_TYPE_CALL, TAPI_CALL_HOLD_CNF, CALL_HOLD, "TAPI_CALL_HOLD_CNF");
+	ipc_register_tapi_ril_cb(TAPI_TYPE_CALL, TAPI_CALL_SWAP_CNF, CALL_SWAP, "TAPI_CALL_SWAP_CNF");
+	ipc_register_tapi_ril_cb(TAPI_TYPE_CALL, TAPI_CALL_ACTIVATE_CNF, CALL_ACTIVATE, "TAPI_CALL_ACTIVATE_CNF");
+	ipc_register_tapi_ril_cb(TAPI_TYPE_CALL, TAPI_CALL_ERROR_IND, CALL_ERROR, "TAPI_CALL_ERROR_IND");
+}
+
+/* Functions with no handler of their own */
 void tapi_call_parser(uint16_t tapiCallType, uint32_t tapiCallLength, uint8_t *tapiCallData)
 {
 	struct tapiPacket tx_packet;
@@ -47,42 +71,6 @@ void tapi_call_parser(uint16_t tapiCallType, uint32_t tapiCallLength, uint8_t *t
 	DEBUG_I("tapi_call_parser - tapiCallType: %d", tapiCallType);
 	switch(tapiCallType)
 	{
-		case TAPI_CALL_APIREQ:
-			/* Confirmation of properly executed function, just drop it */
-			break;
-		case TAPI_CALL_INCOMING_IND:
-			ipc_invoke_ril_cb(CALL_INCOMING_IND, (void*)tapiCallData);
-			break;
-		case TAPI_CALL_END_IND:
-			ipc_invoke_ril_cb(CALL_END_IND, (void*)tapiCallData);
-			break;
-		case TAPI_CALL_SETUP_IND:
-			ipc_invoke_ril_cb(CALL_SETUP_IND, (void*)tapiCallData);	
-			break;
-		case TAPI_CALL_ALERT_IND:
-			ipc_invoke_ril_cb(CALL_ALERT, (void*)tapiCallData);
-			break;
-		case TAPI_CALL_CONNECTED_IND:
-			ipc_invoke_ril_cb(CALL_CONNECTED, (void*)tapiCallData);	
-			break;
-		case TAPI_CALL_START_DTMF_CNF:
-			ipc_invoke_ril_cb(CALL_DTMF_START, (void*)tapiCallData);
-	 		break;
-		case TAPI_CALL_STOP_DTMF_CNF:
-			ipc_invoke_ril_cb(CALL_DTMF_STOP, (void*)tapiCallData);
-			break;
-		case TAPI_CALL_HOLD_CNF:
-			ipc_invoke_ril_cb(CALL_HOLD, (void*)tapiCallData);
-			break;
-		case TAPI_CALL_SWAP_CNF:
-			ipc_invoke_ril_cb(CALL_SWAP, (void*)tapiCallData);
-			break;
-		case TAPI_CALL_ACTIVATE_CNF:
-			ipc_invoke_ril_cb(CALL_ACTIVATE, (void*)tapiCallData);
-			break;
-		case TAPI_CALL_ERROR_IND:
-			ipc_invoke_ril_cb(CALL_ERROR, (void*)tapiCallData);
-			break;
 		case TAPI_CALL_CONNECTED_NUMBER_IND:
 			LOGE("TAPI_CALL_CONNECTED_NUMBER_IND: unused packet");
 			break;
@@ -96,7 +84,7 @@ void tapi_call_parser(uint16_t tapiCallType, uint32_t tapiCallLength, uint8_t *t
 			DEBUG_I("TapiCall Packet type 0x%X is not yet handled, len = 0x%x", tapiCallType, tapiCallLength);
 	    	break;
 	}
-	hex_dump(tapiCallData, tapiCallLength);
+	IPC_HEX_DUMP(tapiCallData, tapiCallLength);
 }
 
 void tapi_call_release(uint8_t callType,uint32_t callId, uint8_t releaseCause)
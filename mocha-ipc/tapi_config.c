@@ -19,6 +19,8 @@
  * along with libmocha-ipc.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#define IPC_LOG_MODULE	IPC_LOG_TAPI
+
 #include <stdlib.h>
 
 #include <radio.h>
@@ -46,7 +48,7 @@ void tapi_config_parser(uint16_t tapiConfigType, uint32_t tapiConfigLength, uint
     {
     default:
 		DEBUG_I("TapiConfig Packet type 0x%X is not yet handled, len = 0x%x", tapiConfigType, tapiConfigLength);
-		hex_dump(tapiConfigData, tapiConfigLength);
+		IPC_HEX_DUMP(tapiConfigData, tapiConfigLength);
     	break;
     }
 }
@@ -19,6 +19,8 @@
  * along with libmocha-ipc.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#define IPC_LOG_MODULE	IPC_LOG_TAPI
+
 #include <stdlib.h>
 
 #include <radio.h>
@@ -46,7 +48,7 @@ void tapi_dmh_parser(uint16_t tapiDmhType, uint32_t tapiDmhLength, uint8_t *tapi
     {
     default:
 		DEBUG_I("TapiDmh Packet type 0x%X is not yet handled, len = 0x%x", tapiDmhType, tapiDmhLength);
-		hex_dump(tapiDmhData, tapiDmhLength);
+		IPC_HEX_DUMP(tapiDmhData, tapiDmhLength);
     	break;
     }
 }
@@ -21,6 +21,8 @@
  * along with libmocha-ipc.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#define IPC_LOG_MODULE	IPC_LOG_TAPI
+
 #include <stdlib.h>
 
 #include <radio.h>
@@ -35,6 +37,15 @@
  *
  */
 
+void tapi_nettext_register(void)
+{
+	ipc_register_tapi_handler(TAPI_TYPE_NETTEXT, TAPI_NETTEXT_INCOMING,
+		tapi_nettext_incoming, "TAPI_NETTEXT_INCOMING");
+	ipc_register_tapi_ril_cb(TAPI_TYPE_NETTEXT, TAPI_NETTEXT_SEND_CALLBACK,
+		NETTEXT_SEND_CALLBACK, "TAPI_NETTEXT_SEND_CALLBACK");
+}
+
+/* Functions with no handler of their own */
 void tapi_nettext_parser(uint16_t tapiNettextType, uint32_t tapiNettextLength, uint8_t *tapiNettextData)
 {
 	struct tapiPacket tx_packet;
@@ -46,17 +57,11 @@ void tapi_nettext_parser(uint16_t tapiNettextType, uint32_t tapiNettextLength, u
 
     switch(tapiNettextType)
     {
-	case TAPI_NETTEXT_INCOMING:
-		tapi_nettext_incoming(tapiNettextLength, tapiNettextData);
-		break;	
-	case TAPI_NETTEXT_SEND_CALLBACK:
-		tapi_nettext_send_callback(tapiNettextData);
-		break;	
     	default:
 		DEBUG_I("TapiNettext packet type 0x%X is not yet handled, len = 0x%x", tapiNettextType, tapiNettextLength);
 	    	break;
     }
-    hex_dump(tapiNettextData, tapiNettextLength);
+    IPC_HEX_DUMP(tapiNettextData, tapiNettextLength);
 }
 
 void tapi_nettext_set_mem_available(uint32_t bMemAvail)
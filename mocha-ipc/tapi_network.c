@@ -20,6 +20,8 @@
  * along with libmocha-ipc.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#define IPC_LOG_MODULE	IPC_LOG_TAPI
+
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
@@ -37,6 +39,27 @@
  */
 
 
+void tapi_network_register(void)
+{
+	ipc_register_tapi_handler(TAPI_TYPE_NETWORK, TAPI_NETWORK_SET_SUBSCRIPTION_MODE,
+		tapi_network_set_subscription_mode, "TAPI_NETWORK_SET_SUBSCRIPTION_MODE");
+	ipc_register_tapi_handler(TAPI_TYPE_NETWORK, TAPI_NETWORK_SELECT_IND,
+		tapi_network_network_select_ind, "TAPI_NETWORK_SELECT_IND");
+	ipc_register_tapi_handler(TAPI_TYPE_NETWORK, TAPI_NETWORK_RADIO_INFO,
+		tapi_network_radio_info, "TAPI_NETWORK_RADIO_INFO");
+	ipc_register_tapi_handler(TAPI_TYPE_NETWORK, TAPI_NETWORK_COMMON_ERROR,
+		tapi_network_common_error, "TAPI_NETWORK_COMMON_ERROR");
+	ipc_register_tapi_handler(TAPI_TYPE_NETWORK, TAPI_NETWORK_CELL_INFO,
+		tapi_network_cell_info, "TAPI_NETWORK_CELL_INFO");
+	ipc_register_tapi_handler(TAPI_TYPE_NETWORK, TAPI_NETWORK_NITZ_INFO_IND,
+		tapi_network_nitz_info_ind, "TAPI_NETWORK_NITZ_INFO_IND");
+	ipc_register_tapi_ril_cb(TAPI_TYPE_NETWORK, TAPI_NETWORK_SEARCH_CNF,
+		NETWORK_SEARCH_CNF, "TAPI_NETWORK_SEARCH_CNF");
+	ipc_register_tapi_ril_cb(TAPI_TYPE_NETWORK, TAPI_NETWORK_SELECT_CNF,
+		NETWORK_SELECT_CNF, "TAPI_NETWORK_SELECT_CNF");
+}
+
+/* Functions with no handler of their own */
 void tapi_network_parser(uint16_t tapiNetType, uint32_t tapiNetLength, uint8_t *tapiNetData)
 {
 	struct tapiPacket tx_packet;
@@ -48,36 +71,12 @@ void tapi_network_parser(uint16_t tapiNetType, uint32_t tapiNetLength, uint8_t *
 
 	switch(tapiNetType)
 	{
-		case TAPI_NETWORK_SET_SUBSCRIPTION_MODE:
-			tapi_network_set_subscription_mode(tapiNetLength, tapiNetData);
-			break;
-		case TAPI_NETWORK_SELECT_IND:
-			tapi_network_network_select_ind(tapiNetLength, tapiNetData);
-			break;
-		case TAPI_NETWORK_RADIO_INFO:
-			tapi_network_radio_info(tapiNetLength, tapiNetData);
-			break;
-		case TAPI_NETWORK_COMMON_ERROR:
-			tapi_network_common_error(tapiNetLength, tapiNetData);
-			break;
-		case TAPI_NETWORK_CELL_INFO:
-			tapi_network_cell_info(tapiNetLength, tapiNetData);
-			break;
-		case TAPI_NETWORK_NITZ_INFO_IND:
-			tapi_network_nitz_info_ind(tapiNetLength, tapiNetData);
-			break;
-		case TAPI_NETWORK_SEARCH_CNF:
-			ipc_invoke_ril_cb(NETWORK_SEARCH_CNF, (void*)tapiNetData);
-			break;
-		case TAPI_NETWORK_SELECT_CNF:
-			ipc_invoke_ril_cb(NETWORK_SELECT_CNF, (void*)tapiNetData);
-			break;
 		default:
 			DEBUG_I("TapiNetwork packet type 0x%X is not yet handled, len = 0x%x", tapiNetType, tapiNetLength);
 			break;
 	}
 	DEBUG_I("tapi_network_parser");
-	hex_dump(tapiNetData, tapiNetLength);
+	IPC_HEX_DUMP(tapiNetData, tapiNetLength);
 }
 
 void tapi_network_init(void)
@@ -129,7 +128,7 @@ void tapi_network_select(tapiNetSearchCnf* net_select)
 	pkt.header.tapiService = TAPI_TYPE_NETWORK;
 	pkt.header.tapiServiceFunction = TAPI_NETWORK_SELECT;
 	pkt.buf = (uint8_t*)(net_select);
-	hex_dump(pkt.buf , pkt.header.len);
+	IPC_HEX_DUMP(pkt.buf , pkt.header.len);
 	tapi_send_packet(&pkt);
 }
 
@@ -140,7 +139,7 @@ void tapi_network_reselect(uint8_t mode)
 	pkt.header.tapiService = TAPI_TYPE_NETWORK;
 	pkt.header.tapiServiceFunction = TAPI_NETWORK_RESELECT;
 	pkt.buf = &mode;
-	hex_dump(pkt.buf , pkt.header.len);
+	IPC_HEX_DUMP(pkt.buf , pkt.header.len);
 	tapi_send_packet(&pkt);
 }
 
@@ -161,7 +160,7 @@ void tapi_set_selection_mode(uint8_t mode)
 	pkt.header.tapiService = TAPI_TYPE_NETWORK;	
 	pkt.header.tapiServiceFunction = TAPI_NETWORK_SET_SELECTION_MODE;
 	pkt.buf = &mode;
-	hex_dump(pkt.buf , pkt.header.len);
+	IPC_HEX_DUMP(pkt.buf , pkt.header.len);
 	tapi_send_packet(&pkt);
 }
 
@@ -19,6 +19,8 @@
  * along with libmocha-ipc.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#define IPC_LOG_MODULE	IPC_LOG_TAPI
+
 #include <radio.h>
 #include <tapi.h>
 #include <tapi_ss.h>
@@ -31,6 +33,14 @@
  *
  */
 
+void tapi_ss_register(void)
+{
+	ipc_register_tapi_ril_cb(TAPI_TYPE_SS, TAPI_SS_USSD_CNF, SS_USSD_CALLBACK, "TAPI_SS_USSD_CNF");
+	ipc_register_tapi_ril_cb(TAPI_TYPE_SS, TAPI_SS_USSD_IND, SS_USSD_CALLBACK, "TAPI_SS_USSD_IND");
+	ipc_register_tapi_ril_cb(TAPI_TYPE_SS, TAPI_SS_COMMON_ERROR_IND, SS_ERROR, "TAPI_SS_COMMON_ERROR_IND");
+}
+
+/* Functions with no handler of their own */
 void tapi_ss_parser(uint16_t tapiSsType, uint32_t tapiSsLength, uint8_t *tapiSsData)
 {
 	struct tapiPacket tx_packet;
@@ -42,20 +52,11 @@ void tapi_ss_parser(uint16_t tapiSsType, uint32_t tapiSsLength, uint8_t *tapiSsD
 
 	switch(tapiSsType)
 	{
-	case TAPI_SS_USSD_CNF:
-		tapi_ss_ussd_callback(tapiSsData);
-	    	break;
-	case TAPI_SS_USSD_IND:
-		tapi_ss_ussd_callback(tapiSsData);
-	    	break;
-	case TAPI_SS_COMMON_ERROR_IND:
-		tapi_ss_error(tapiSsData);
-	    	break;	
 	default:
 	    	break;
     }
 	DEBUG_I("Tapi SS type = 0x%x\n tapiSsLength = 0x%x", tapiSsType, tapiSsLength);
-	hex_dump(tapiSsData, tapiSsLength);
+	IPC_HEX_DUMP(tapiSsData, tapiSsLength);
 }
 
 void tapi_ss_send_ussd_string_request(tapiSsSendUssd* ussd_req)
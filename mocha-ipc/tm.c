@@ -18,6 +18,8 @@
  * along with libmocha-ipc.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#define IPC_LOG_MODULE	IPC_LOG_MISC
+
 #include <stdlib.h>
 #include <stdio.h>
 #include <unistd.h>
@@ -49,16 +51,17 @@ void ipc_parse_tm(struct ipc_client* client, struct modem_io *ipc_frame)
 
 void tm_send_packet(uint8_t group, uint8_t type, uint8_t *data, int32_t data_size)
 {
-	struct modem_io pkt;
-	pkt.data = malloc(data_size + sizeof(struct tm_tx_packet_header));	
-	pkt.data[0] = group;
-	pkt.data[1] = type;
-	memcpy(pkt.data + 2, data, data_size);
-	pkt.magic = 0xCAFECAFE;
-	pkt.cmd = FIFO_PKT_TESTMODE;
-	pkt.datasize = data_size + 2;
-	ipc_send(&pkt);
-	free(pkt.data);
+	struct tm_tx_packet_header header;
+	struct iovec iov[2];
+
+	header.group = group;
+	header.type = type;
+	iov[0].iov_base = &header;
+	iov[0].iov_len = sizeof(header);
+	iov[1].iov_base = data;
+	iov[1].iov_len = data_size;
+
+	ipc_sendv(FIFO_PKT_TESTMODE, iov, data_size ? 2 : 1);
 }
 
 void ipc_send_rcv_tm()
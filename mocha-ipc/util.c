@@ -19,6 +19,7 @@
  */
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <stdint.h>
 #include <string.h>
 #include <fcntl.h>
@@ -84,57 +85,148 @@ void bcd2ascii(char* out, const uint8_t* in, int size)
 	}
 	out[outi] = 0x00; //terminate string with null
 }
-void ipc_hex_dump(struct ipc_client *client, void *data, int size)
+/**
+ * Logging
+ */
+
+/* Hex dumps stay on in debug builds, per-packet messages don't */
+signed char ipc_log_levels[IPC_LOG_MODULE_COUNT] = {
+    IPC_LOG_DEBUG, IPC_LOG_DEBUG, IPC_LOG_DEBUG, IPC_LOG_DEBUG,
+    IPC_LOG_DEBUG, IPC_LOG_DEBUG, IPC_LOG_DEBUG,
+};
+
+static const char *ipc_log_module_names[IPC_LOG_MODULE_COUNT] = {
+    [IPC_LOG_CORE] = "core",
+    [IPC_LOG_TAPI] = "tapi",
+    [IPC_LOG_PROTO] = "proto",
+    [IPC_LOG_SIM] = "sim",
+    [IPC_LOG_MISC] = "misc",
+    [IPC_LOG_RIL] = "ril",
+    [IPC_LOG_GPRS] = "gprs",
+};
+
+int ipc_log_set_level(int module, int level)
 {
-    /* dumps size bytes of *data to stdout. Looks like:
-* [0000] 75 6E 6B 6E 6F 77 6E 20
-* 30 FF 00 00 00 00 39 00 unknown 0.....9.
-* (in a single line of course)
-*/
-
-    unsigned char *p = data;
-    unsigned char c;
-    int n;
-    char bytestr[4] = {0};
-    char addrstr[10] = {0};
-    char hexstr[ 16*3 + 5] = {0};
-    char charstr[16*1 + 5] = {0};
-    for(n=1;n<=size;n++) {
-        if (n%16 == 1) {
-            /* store address for this line */
-            snprintf(addrstr, sizeof(addrstr), "%.4x",
-               ((unsigned int)p-(unsigned int)data) );
-        }
+    int i;
+
+    if (level < IPC_LOG_NONE || level > IPC_LOG_VERBOSE)
+        return -1;
+
+    if (module < 0) {
+        for (i = 0; i < IPC_LOG_MODULE_COUNT; i++)
+            ipc_log_levels[i] = level;
+        return 0;
+    }
+
+    if (module >= IPC_LOG_MODULE_COUNT)
+        return -1;
 
-        c = *p;
-        if (isalnum(c) == 0) {
-            c = '.';
+    ipc_log_levels[module] = level;
+
+    return 0;
+}
+
+/* "<module|all>=<level>,...", returns the number of bad entries */
+int ipc_log_set_levels(const char *spec)
+{
+    char buffer[128];
+    char *entry, *next, *value;
+    int module, level;
+    int errors = 0;
+
+    if (spec == NULL)
+        return 0;
+
+    strncpy(buffer, spec, sizeof(buffer) - 1);
+    buffer[sizeof(buffer) - 1] = '\0';
+
+    for (entry = strtok_r(buffer, ",", &next); entry != NULL; entry = strtok_r(NULL, ",", &next)) {
+        value = strchr(entry, '=');
+        if (value == NULL) {
+            errors++;
+            continue;
+        }
+        *value++ = '\0';
+
+        if (strcmp(entry, "all") == 0) {
+            module = -1;
+        } else {
+            for (module = 0; module < IPC_LOG_MODULE_COUNT; module++)
+                if (strcmp(entry, ipc_log_module_names[module]) == 0)
+                    break;
+            if (module == IPC_LOG_MODULE_COUNT) {
+                errors++;
+                continue;
+            }
         }
 
-        /* store hex str (for left side) */
-        snprintf(bytestr, sizeof(bytestr), "%02X ", *p);
-        strncat(hexstr, bytestr, sizeof(hexstr)-strlen(hexstr)-1);
-
-        /* store char str (for right side) */
-        snprintf(bytestr, sizeof(bytestr), "%c", c);
-        strncat(charstr, bytestr, sizeof(charstr)-strlen(charstr)-1);
-
-        if(n%16 == 0) {
-            /* line completed */
-            ipc_client_log(client, "[%4.4s] %-50.50s %s", addrstr, hexstr, charstr);
-            hexstr[0] = 0;
-            charstr[0] = 0;
-        } else if(n%8 == 0) {
-            /* half line: add whitespaces */
-            strncat(hexstr, " ", sizeof(hexstr)-strlen(hexstr)-1);
-            strncat(charstr, " ", sizeof(charstr)-strlen(charstr)-1);
+        level = atoi(value);
+        if (ipc_log_set_level(module, level) < 0)
+            errors++;
+    }
+
+    return errors;
+}
+
+static const char ipc_hex_digits[] = "0123456789ABCDEF";
+
+/*
+ * Formats up to 16 bytes as one hex dump line, like:
+ * [0010] 75 6E 6B 6E 6F 77 6E 20  30 FF 00 00 00 00 39 00  unknown0.....9.
+ * line must hold IPC_HEX_LINE_SIZE bytes. Returns the line length.
+ */
+int ipc_hex_dump_line(char *line, const uint8_t *data, uint32_t offset, int count)
+{
+    char *p = line;
+    uint8_t c;
+    int i;
+
+    if (count > 16)
+        count = 16;
+
+    *p++ = '[';
+    *p++ = ipc_hex_digits[(offset >> 12) & 0xf];
+    *p++ = ipc_hex_digits[(offset >> 8) & 0xf];
+    *p++ = ipc_hex_digits[(offset >> 4) & 0xf];
+    *p++ = ipc_hex_digits[offset & 0xf];
+    *p++ = ']';
+    *p++ = ' ';
+
+    for (i = 0; i < 16; i++) {
+        if (i == 8)
+            *p++ = ' ';
+
+        if (i < count) {
+            *p++ = ipc_hex_digits[data[i] >> 4];
+            *p++ = ipc_hex_digits[data[i] & 0xf];
+        } else {
+            *p++ = ' ';
+            *p++ = ' ';
         }
-        p++; /* next byte */
+        *p++ = ' ';
     }
 
-    if (strlen(hexstr) > 0) {
-        /* print rest of buffer if not empty */
-        ipc_client_log(client, "[%4.4s] %-50.50s %s\n", addrstr, hexstr, charstr);
+    *p++ = ' ';
+
+    for (i = 0; i < count; i++) {
+        c = data[i];
+        *p++ = ((c >= '0' && c <= '9') || (c >= 'A' && c <= 'Z') || (c >= 'a' && c <= 'z')) ? c : '.';
+    }
+
+    *p = '\0';
+
+    return p - line;
+}
+
+void ipc_hex_dump(struct ipc_client *client, void *data, int size)
+{
+    char line[IPC_HEX_LINE_SIZE];
+    uint8_t *p = data;
+    int offset;
+
+    for (offset = 0; offset < size; offset += 16) {
+        ipc_hex_dump_line(line, p + offset, offset, size - offset);
+        ipc_client_log(client, "%s\n", line);
     }
 }
 
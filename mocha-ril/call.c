@@ -22,6 +22,8 @@
  */
 
 #define LOG_TAG "RIL-Mocha-CALL"
+#define IPC_LOG_MODULE	IPC_LOG_RIL
+
 #include <time.h>
 #include <utils/Log.h>
 
@@ -368,24 +370,28 @@ error:
 
 void ril_request_get_current_calls(RIL_Token t)
 {
+	struct ril_state_snapshot snapshot;
 	int i, j;
 
 	RIL_Call **calls = NULL;
 	j = 0;
+
+	ril_state_get(&snapshot);
+
 	for (i = 0; i < MAX_CALLS; i++) {
-		if(ril_data.calls[i] == NULL || ril_data.calls[i]->callId == 0xFFFFFFFF)
+		if(snapshot.calls[i].callId == 0xFFFFFFFF)
 			continue;
 		RIL_Call *call = (RIL_Call *) malloc(sizeof(RIL_Call));
-		call->state = ril_data.calls[i]->call_state;
+		call->state = snapshot.calls[i].call_state;
 		call->index = i + 1;
-		call->toa = (strlen(ril_data.calls[i]->number) > 0 && ril_data.calls[i]->number[0] == '+') ? 145 : 129;
+		call->toa = (strlen(snapshot.calls[i].number) > 0 && snapshot.calls[i].number[0] == '+') ? 145 : 129;
 		call->isMpty = 0;
-		call->isMT = ril_data.calls[i]->bMT;
+		call->isMT = snapshot.calls[i].bMT;
 		call->als = 0;
 		call->isVoice  = 1;
 		call->isVoicePrivacy = 0;
-		call->number = ril_data.calls[i]->number;
-		call->numberPresentation = (strlen(ril_data.calls[i]->number) > 0) ? 0 : 2;
+		call->number = snapshot.calls[i].number;
+		call->numberPresentation = (strlen(snapshot.calls[i].number) > 0) ? 0 : 2;
 		call->name = NULL;
 		call->namePresentation = 2;
 		call->uusInfo = NULL;
@@ -640,6 +646,7 @@ void ril_request_dtmf_start(RIL_Token t, void *data, int length)
 	tapi_start_dtmf(activeCall->callId, tone);
 
 	ril_data.tokens.dtmf_start = t;
+	ril_request_deadline(t, RIL_TIMEOUT_DTMF_MS, RIL_E_GENERIC_FAILURE, &ril_data.tokens.dtmf_start);
 
 	return;
 
@@ -660,6 +667,10 @@ void ril_request_dtmf_stop(RIL_Token t)
 	tapi_stop_dtmf(activeCall->callId);
 
 	ril_data.tokens.dtmf_stop = t;
+	ril_request_deadline(t, RIL_TIMEOUT_DTMF_MS, RIL_E_GENERIC_FAILURE, &ril_data.tokens.dtmf_stop);
+
+	return;
+
 error:
 	LOGE("%s: Error!", __func__);
 	ril_request_complete(t, RIL_E_GENERIC_FAILURE, NULL, 0);
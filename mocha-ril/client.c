@@ -43,8 +43,11 @@ struct ril_client *ril_client_new(struct ril_client_funcs *client_funcs)
 	if(client_funcs->destroy)
 		ril_client->funcs.destroy = client_funcs->destroy;
 
-	if(client_funcs->read_loop)
-		ril_client->funcs.read_loop = client_funcs->read_loop;
+	if(client_funcs->attach)
+		ril_client->funcs.attach = client_funcs->attach;
+
+	if(client_funcs->detach)
+		ril_client->funcs.detach = client_funcs->detach;
 
 	pthread_mutex_init(&(ril_client->mutex), NULL);
 
@@ -117,75 +120,58 @@ int ril_client_destroy(struct ril_client *client)
 	return 0;
 }
 
-void *ril_client_thread(void *data)
+/*
+ * Registers the client with the reactor, which replaces the per-client
+ * read loop thread.
+ */
+int ril_client_start(struct ril_client *client, struct ril_reactor *reactor)
 {
-	struct ril_client *client;
 	int rc;
-	int c;
-
-	if(data == NULL) {
-		LOGE("Data passed to thread is NULL!");
-
-		return 0;
-	}
-
-	client = (struct ril_client *) data;
-
-	for(c = 5 ; c > 0 ; c--) {
-		client->state = RIL_CLIENT_READY;
-
-		rc = client->funcs.read_loop(client);
-
-		if(rc < 0) {
-			client->state = RIL_CLIENT_ERROR;
-
-			LOGE("There was an error with the read loop! Trying to destroy and recreate client object");
 
-			ril_client_destroy(client);
-			ril_client_create(client);
-
-			continue;
-		} else {
-			client->state = RIL_CLIENT_CREATED;
-
-			LOGD("read loop ended with no error!");
-			break;
-		}
-	}
-
-	if(c == 0) {
-		LOGE("FATAL: Main loop failed too many times.");
-	}
+	if(client->funcs.attach == NULL)
+		return -1;
 
-	// We are destroying everything here
+	client->reactor = reactor;
 
-	rc = ril_client_destroy(client);
+	rc = client->funcs.attach(client, reactor);
 	if(rc < 0) {
-		LOGE("RIL client destroy failed!");
+		LOGE("RIL client attach failed!");
+		client->state = RIL_CLIENT_ERROR;
+		return -1;
 	}
 
-	rc = ril_client_free(client);
-	if(rc < 0) {
-		LOGE("RIL client free failed!");
-	}
+	client->state = RIL_CLIENT_READY;
 
 	return 0;
 }
 
-int ril_client_thread_start(struct ril_client *client)
+/*
+ * Called from a client's event callback when its I/O failed: tears the
+ * client down and brings it up again, giving up after too many failures.
+ * The caller must not touch the client's data afterwards.
+ */
+void ril_client_recover(struct ril_client *client)
 {
-	pthread_attr_t attr;
 	int rc;
 
-	pthread_attr_init(&attr);
-	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
-	
-	rc = pthread_create(&(client->thread), &attr, ril_client_thread, (void *) client);
+	client->state = RIL_CLIENT_ERROR;
 
-	if(rc != 0) {
-		LOGE("pthread creation failed");
-		return -1;
+	if(client->funcs.detach)
+		client->funcs.detach(client);
+
+	if(++client->failures >= 5) {
+		LOGE("FATAL: Client failed too many times.");
+		ril_client_destroy(client);
+		return;
 	}
 
-	return 0;
+	LOGE("There was an error with the client! Trying to destroy and recreate client object");
+
+	ril_client_destroy(client);
+
+	rc = ril_client_create(client);
+	if(rc < 0)
+		return;
+
+	ril_client_start(client, client->reactor);
 }
@@ -0,0 +1,642 @@
+/**
+ * This file is part of mocha-ril.
+ *
+ * mocha-ril is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * mocha-ril is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with mocha-ril.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <time.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define LOG_TAG "RIL-Mocha-Delivery"
+#include <utils/Log.h>
+
+#include "mocha-ril.h"
+
+/*
+ * Responses and unsolicited messages for RILJ go through one FIFO queue,
+ * drained by a thread of its own, so a slow rild socket write no longer
+ * stalls the workers dispatching modem frames. One queue and one thread
+ * keep the order per token and per unsolicited type. The thread takes
+ * everything queued at wake-up, and producers only signal it when it is
+ * waiting.
+ *
+ * Handlers free or reuse what they pass as soon as they return, so the
+ * payload is deep-copied into an arena owned by the queued entry. How to
+ * copy depends on the response layout rild expects for that request.
+ *
+ * An unsolicited message that only tells the current state replaces one
+ * of the same type that wasn't delivered yet.
+ */
+
+enum ril_delivery_format {
+	RIL_FORMAT_RAW,
+	RIL_FORMAT_STRING,
+	RIL_FORMAT_STRINGS,
+	RIL_FORMAT_CALLS,
+	RIL_FORMAT_DATA_CALLS,
+	RIL_FORMAT_CARD_STATUS,
+	RIL_FORMAT_SMS_RESPONSE,
+	RIL_FORMAT_SIM_IO,
+};
+
+struct ril_delivery_queue {
+	struct ril_delivery *head;
+	struct ril_delivery *tail;
+
+	pthread_mutex_t mutex;
+	pthread_cond_t work;
+	pthread_cond_t done;
+	pthread_t thread;
+	int running;
+	int waiting;
+	int busy;
+
+	struct ril_delivery_stats stats;
+};
+
+static struct ril_delivery_queue ril_delivery_queue = {
+	.mutex = PTHREAD_MUTEX_INITIALIZER,
+	.work = PTHREAD_COND_INITIALIZER,
+	.done = PTHREAD_COND_INITIALIZER,
+};
+
+static uint64_t ril_delivery_time_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/**
+ * Arena
+ */
+
+static void *ril_arena_alloc(struct ril_arena_chunk **arena, size_t size)
+{
+	struct ril_arena_chunk *chunk;
+	size_t chunk_size;
+	void *p;
+
+	/* Keep every pointer in the copies aligned */
+	size = (size + sizeof(void *) - 1) & ~(sizeof(void *) - 1);
+
+	chunk = *arena;
+	if(chunk == NULL || chunk->size - chunk->used < size) {
+		chunk_size = size > RIL_ARENA_CHUNK_SIZE ? size : RIL_ARENA_CHUNK_SIZE;
+
+		chunk = malloc(sizeof(struct ril_arena_chunk) + chunk_size);
+		if(chunk == NULL)
+			return NULL;
+
+		chunk->next = *arena;
+		chunk->size = chunk_size;
+		chunk->used = 0;
+		*arena = chunk;
+	}
+
+	p = chunk->data + chunk->used;
+	chunk->used += size;
+
+	return p;
+}
+
+static char *ril_arena_strdup(struct ril_arena_chunk **arena, const char *s)
+{
+	char *p;
+	size_t length;
+
+	if(s == NULL)
+		return NULL;
+
+	length = strlen(s) + 1;
+
+	p = ril_arena_alloc(arena, length);
+	if(p != NULL)
+		memcpy(p, s, length);
+
+	return p;
+}
+
+static void ril_arena_free(struct ril_arena_chunk *arena)
+{
+	struct ril_arena_chunk *next;
+
+	while(arena != NULL) {
+		next = arena->next;
+		free(arena);
+		arena = next;
+	}
+}
+
+/**
+ * Payload copies
+ */
+
+static enum ril_delivery_format ril_delivery_format(enum ril_delivery_type type, int id)
+{
+	if(type == RIL_DELIVERY_UNSOLICITED) {
+		switch(id) {
+			case RIL_UNSOL_RESPONSE_NEW_SMS:
+			case RIL_UNSOL_RESPONSE_NEW_SMS_STATUS_REPORT:
+			case RIL_UNSOL_NITZ_TIME_RECEIVED:
+				return RIL_FORMAT_STRING;
+			case RIL_UNSOL_ON_USSD:
+				return RIL_FORMAT_STRINGS;
+			case RIL_UNSOL_DATA_CALL_LIST_CHANGED:
+				return RIL_FORMAT_DATA_CALLS;
+			default:
+				return RIL_FORMAT_RAW;
+		}
+	}
+
+	switch(id) {
+		case RIL_REQUEST_GET_IMSI:
+		case RIL_REQUEST_GET_IMEI:
+		case RIL_REQUEST_GET_IMEISV:
+		case RIL_REQUEST_BASEBAND_VERSION:
+			return RIL_FORMAT_STRING;
+		case RIL_REQUEST_VOICE_REGISTRATION_STATE:
+		case RIL_REQUEST_DATA_REGISTRATION_STATE:
+		case RIL_REQUEST_OPERATOR:
+		case RIL_REQUEST_QUERY_AVAILABLE_NETWORKS:
+			return RIL_FORMAT_STRINGS;
+		case RIL_REQUEST_GET_CURRENT_CALLS:
+			return RIL_FORMAT_CALLS;
+		case RIL_REQUEST_SETUP_DATA_CALL:
+		case RIL_REQUEST_DATA_CALL_LIST:
+			return RIL_FORMAT_DATA_CALLS;
+		case RIL_REQUEST_GET_SIM_STATUS:
+			return RIL_FORMAT_CARD_STATUS;
+		case RIL_REQUEST_SEND_SMS:
+		case RIL_REQUEST_SEND_SMS_EXPECT_MORE:
+			return RIL_FORMAT_SMS_RESPONSE;
+		case RIL_REQUEST_SIM_IO:
+			return RIL_FORMAT_SIM_IO;
+		default:
+			return RIL_FORMAT_RAW;
+	}
+}
+
+/* Only state notifications, never SMS, USSD or ring events */
+static int ril_delivery_supersedes(int unsol)
+{
+	switch(unsol) {
+		case RIL_UNSOL_RESPONSE_RADIO_STATE_CHANGED:
+		case RIL_UNSOL_RESPONSE_CALL_STATE_CHANGED:
+		case RIL_UNSOL_RESPONSE_VOICE_NETWORK_STATE_CHANGED:
+		case RIL_UNSOL_RESPONSE_SIM_STATUS_CHANGED:
+		case RIL_UNSOL_SIGNAL_STRENGTH:
+		case RIL_UNSOL_DATA_CALL_LIST_CHANGED:
+			return 1;
+		default:
+			return 0;
+	}
+}
+
+static void *ril_delivery_copy_raw(struct ril_arena_chunk **arena, void *data, size_t length)
+{
+	void *p;
+
+	p = ril_arena_alloc(arena, length);
+	if(p != NULL)
+		memcpy(p, data, length);
+
+	return p;
+}
+
+/* Some callers pass strlen() as length, keep the terminator anyway */
+static void *ril_delivery_copy_string(struct ril_arena_chunk **arena, void *data, size_t length)
+{
+	char *p;
+
+	length = strnlen((char *) data, length);
+
+	p = ril_arena_alloc(arena, length + 1);
+	if(p != NULL) {
+		memcpy(p, data, length);
+		p[length] = '\0';
+	}
+
+	return p;
+}
+
+static void *ril_delivery_copy_strings(struct ril_arena_chunk **arena, void *data, size_t length)
+{
+	char **strings = (char **) data;
+	char **p;
+	size_t i;
+
+	p = ril_arena_alloc(arena, length);
+	if(p == NULL)
+		return NULL;
+
+	for(i = 0 ; i < length / sizeof(char *) ; i++)
+		p[i] = ril_arena_strdup(arena, strings[i]);
+
+	return p;
+}
+
+static void *ril_delivery_copy_calls(struct ril_arena_chunk **arena, void *data, size_t length)
+{
+	RIL_Call **calls = (RIL_Call **) data;
+	RIL_Call **p;
+	RIL_UUS_Info *uus_info;
+	size_t i;
+
+	p = ril_arena_alloc(arena, length);
+	if(p == NULL)
+		return NULL;
+
+	for(i = 0 ; i < length / sizeof(RIL_Call *) ; i++) {
+		p[i] = ril_delivery_copy_raw(arena, calls[i], sizeof(RIL_Call));
+		if(p[i] == NULL)
+			return NULL;
+
+		p[i]->number = ril_arena_strdup(arena, calls[i]->number);
+		p[i]->name = ril_arena_strdup(arena, calls[i]->name);
+
+		if(calls[i]->uusInfo != NULL) {
+			uus_info = ril_delivery_copy_raw(arena, calls[i]->uusInfo, sizeof(RIL_UUS_Info));
+			if(uus_info != NULL && uus_info->uusData != NULL)
+				uus_info->uusData = ril_delivery_copy_raw(arena, uus_info->uusData, uus_info->uusLength);
+			p[i]->uusInfo = uus_info;
+		}
+	}
+
+	return p;
+}
+
+static void *ril_delivery_copy_data_calls(struct ril_arena_chunk **arena, void *data, size_t length)
+{
+	RIL_Data_Call_Response_v6 *p;
+	size_t i;
+
+	p = ril_delivery_copy_raw(arena, data, length);
+	if(p == NULL)
+		return NULL;
+
+	for(i = 0 ; i < length / sizeof(RIL_Data_Call_Response_v6) ; i++) {
+		p[i].type = ril_arena_strdup(arena, p[i].type);
+		p[i].ifname = ril_arena_strdup(arena, p[i].ifname);
+		p[i].addresses = ril_arena_strdup(arena, p[i].addresses);
+		p[i].dnses = ril_arena_strdup(arena, p[i].dnses);
+		p[i].gateways = ril_arena_strdup(arena, p[i].gateways);
+	}
+
+	return p;
+}
+
+static void *ril_delivery_copy_card_status(struct ril_arena_chunk **arena, void *data, size_t length)
+{
+	RIL_CardStatus_v6 *p;
+	int i;
+
+	if(length < sizeof(RIL_CardStatus_v6))
+		return ril_delivery_copy_raw(arena, data, length);
+
+	p = ril_delivery_copy_raw(arena, data, length);
+	if(p == NULL)
+		return NULL;
+
+	for(i = 0 ; i < p->num_applications && i < RIL_CARD_MAX_APPS ; i++) {
+		p->applications[i].aid_ptr = ril_arena_strdup(arena, p->applications[i].aid_ptr);
+		p->applications[i].app_label_ptr = ril_arena_strdup(arena, p->applications[i].app_label_ptr);
+	}
+
+	return p;
+}
+
+static void *ril_delivery_copy_sms_response(struct ril_arena_chunk **arena, void *data, size_t length)
+{
+	RIL_SMS_Response *p;
+
+	p = ril_delivery_copy_raw(arena, data, length);
+	if(p != NULL && length >= sizeof(RIL_SMS_Response))
+		p->ackPDU = ril_arena_strdup(arena, p->ackPDU);
+
+	return p;
+}
+
+static void *ril_delivery_copy_sim_io(struct ril_arena_chunk **arena, void *data, size_t length)
+{
+	RIL_SIM_IO_Response *p;
+
+	p = ril_delivery_copy_raw(arena, data, length);
+	if(p != NULL && length >= sizeof(RIL_SIM_IO_Response))
+		p->simResponse = ril_arena_strdup(arena, p->simResponse);
+
+	return p;
+}
+
+static int ril_delivery_copy(struct ril_delivery *delivery, int id, void *data, size_t length)
+{
+	void *p;
+
+	delivery->data = NULL;
+	delivery->length = length;
+	delivery->arena = NULL;
+
+	if(data == NULL)
+		return 0;
+
+	switch(ril_delivery_format(delivery->type, id)) {
+		case RIL_FORMAT_STRING:
+			p = ril_delivery_copy_string(&delivery->arena, data, length);
+			break;
+		case RIL_FORMAT_STRINGS:
+			p = ril_delivery_copy_strings(&delivery->arena, data, length);
+			break;
+		case RIL_FORMAT_CALLS:
+			p = ril_delivery_copy_calls(&delivery->arena, data, length);
+			break;
+		case RIL_FORMAT_DATA_CALLS:
+			p = ril_delivery_copy_data_calls(&delivery->arena, data, length);
+			break;
+		case RIL_FORMAT_CARD_STATUS:
+			p = ril_delivery_copy_card_status(&delivery->arena, data, length);
+			break;
+		case RIL_FORMAT_SMS_RESPONSE:
+			p = ril_delivery_copy_sms_response(&delivery->arena, data, length);
+			break;
+		case RIL_FORMAT_SIM_IO:
+			p = ril_delivery_copy_sim_io(&delivery->arena, data, length);
+			break;
+		case RIL_FORMAT_RAW:
+		default:
+			p = ril_delivery_copy_raw(&delivery->arena, data, length);
+			break;
+	}
+
+	if(p == NULL) {
+		ril_arena_free(delivery->arena);
+		delivery->arena = NULL;
+		return -1;
+	}
+
+	delivery->data = p;
+
+	return 0;
+}
+
+static void ril_delivery_free(struct ril_delivery *delivery)
+{
+	ril_arena_free(delivery->arena);
+	free(delivery);
+}
+
+/**
+ * Queue
+ */
+
+static void ril_delivery_send(struct ril_delivery *delivery)
+{
+	if(delivery->type == RIL_DELIVERY_COMPLETE)
+		ril_data.env->OnRequestComplete(delivery->token, delivery->error, delivery->data, delivery->length);
+	else
+		ril_data.env->OnUnsolicitedResponse(delivery->unsol, delivery->data, delivery->length);
+}
+
+/* Drops an undelivered unsolicited of the same type, called with the mutex held */
+static void ril_delivery_supersede(struct ril_delivery_queue *queue, int unsol)
+{
+	struct ril_delivery *delivery;
+	struct ril_delivery *prev = NULL;
+
+	for(delivery = queue->head ; delivery != NULL ; prev = delivery, delivery = delivery->next) {
+		if(delivery->type != RIL_DELIVERY_UNSOLICITED || delivery->unsol != unsol)
+			continue;
+
+		if(prev == NULL)
+			queue->head = delivery->next;
+		else
+			prev->next = delivery->next;
+
+		if(queue->tail == delivery)
+			queue->tail = prev;
+
+		ril_delivery_free(delivery);
+
+		queue->stats.superseded++;
+		queue->stats.depth--;
+		return;
+	}
+}
+
+static void ril_delivery_queue_entry(struct ril_delivery *delivery)
+{
+	struct ril_delivery_queue *queue = &ril_delivery_queue;
+
+	delivery->next = NULL;
+	delivery->queued_us = ril_delivery_time_us();
+
+	pthread_mutex_lock(&queue->mutex);
+
+	if(!queue->running) {
+		pthread_mutex_unlock(&queue->mutex);
+		ril_delivery_send(delivery);
+		ril_delivery_free(delivery);
+		return;
+	}
+
+	if(delivery->type == RIL_DELIVERY_UNSOLICITED && ril_delivery_supersedes(delivery->unsol))
+		ril_delivery_supersede(queue, delivery->unsol);
+
+	if(queue->tail == NULL)
+		queue->head = delivery;
+	else
+		queue->tail->next = delivery;
+	queue->tail = delivery;
+
+	queue->stats.queued++;
+	queue->stats.depth++;
+	if(queue->stats.depth > queue->stats.max_depth)
+		queue->stats.max_depth = queue->stats.depth;
+
+	if(queue->waiting)
+		pthread_cond_signal(&queue->work);
+
+	pthread_mutex_unlock(&queue->mutex);
+}
+
+void ril_delivery_complete(RIL_Token t, RIL_Errno e, int request, void *data, size_t length)
+{
+	struct ril_delivery *delivery;
+
+	delivery = calloc(1, sizeof(struct ril_delivery));
+	if(delivery == NULL)
+		goto inline_send;
+
+	delivery->type = RIL_DELIVERY_COMPLETE;
+	delivery->token = t;
+	delivery->error = e;
+
+	if(ril_delivery_copy(delivery, request, data, length) < 0) {
+		free(delivery);
+		goto inline_send;
+	}
+
+	ril_delivery_queue_entry(delivery);
+	return;
+
+inline_send:
+	LOGE("%s: Unable to copy the response, completing inline", __func__);
+	ril_data.env->OnRequestComplete(t, e, data, length);
+}
+
+void ril_delivery_unsolicited(int unsol, void *data, size_t length)
+{
+	struct ril_delivery *delivery;
+
+	delivery = calloc(1, sizeof(struct ril_delivery));
+	if(delivery == NULL)
+		goto inline_send;
+
+	delivery->type = RIL_DELIVERY_UNSOLICITED;
+	delivery->unsol = unsol;
+
+	if(ril_delivery_copy(delivery, unsol, data, length) < 0) {
+		free(delivery);
+		goto inline_send;
+	}
+
+	ril_delivery_queue_entry(delivery);
+	return;
+
+inline_send:
+	LOGE("%s: Unable to copy unsolicited %d, sending inline", __func__, unsol);
+	ril_data.env->OnUnsolicitedResponse(unsol, data, length);
+}
+
+static void *ril_delivery_thread(void *data)
+{
+	struct ril_delivery_queue *queue = (struct ril_delivery_queue *) data;
+	struct ril_delivery *batch;
+	struct ril_delivery *next;
+	uint32_t latency;
+	uint32_t max_latency = 0;
+	uint32_t count;
+
+	while(1) {
+		pthread_mutex_lock(&queue->mutex);
+
+		queue->busy = 0;
+		if(max_latency > queue->stats.max_latency_us)
+			queue->stats.max_latency_us = max_latency;
+		pthread_cond_broadcast(&queue->done);
+
+		queue->waiting = 1;
+		while(queue->running && queue->head == NULL)
+			pthread_cond_wait(&queue->work, &queue->mutex);
+		queue->waiting = 0;
+
+		if(!queue->running && queue->head == NULL) {
+			pthread_mutex_unlock(&queue->mutex);
+			break;
+		}
+
+		batch = queue->head;
+		queue->head = NULL;
+		queue->tail = NULL;
+		queue->stats.depth = 0;
+		queue->stats.wakeups++;
+		queue->busy = 1;
+
+		pthread_mutex_unlock(&queue->mutex);
+
+		count = 0;
+		max_latency = 0;
+
+		while(batch != NULL) {
+			next = batch->next;
+
+			latency = (uint32_t) (ril_delivery_time_us() - batch->queued_us);
+			if(latency > max_latency)
+				max_latency = latency;
+
+			ril_delivery_send(batch);
+			ril_delivery_free(batch);
+
+			count++;
+			batch = next;
+		}
+
+		__sync_fetch_and_add(&queue->stats.delivered, count);
+	}
+
+	return NULL;
+}
+
+int ril_delivery_start(void)
+{
+	struct ril_delivery_queue *queue = &ril_delivery_queue;
+	int rc;
+
+	pthread_mutex_lock(&queue->mutex);
+	queue->running = 1;
+	pthread_mutex_unlock(&queue->mutex);
+
+	rc = pthread_create(&queue->thread, NULL, ril_delivery_thread, (void *) queue);
+	if(rc != 0) {
+		LOGE("Unable to start the delivery thread, delivering inline");
+		pthread_mutex_lock(&queue->mutex);
+		queue->running = 0;
+		pthread_mutex_unlock(&queue->mutex);
+		return -1;
+	}
+
+	return 0;
+}
+
+/* Everything queued so far is still delivered */
+void ril_delivery_stop(void)
+{
+	struct ril_delivery_queue *queue = &ril_delivery_queue;
+
+	pthread_mutex_lock(&queue->mutex);
+	if(!queue->running) {
+		pthread_mutex_unlock(&queue->mutex);
+		return;
+	}
+	queue->running = 0;
+	pthread_cond_signal(&queue->work);
+	pthread_mutex_unlock(&queue->mutex);
+
+	pthread_join(queue->thread, NULL);
+}
+
+/* Waits until everything queued so far was handed to rild */
+void ril_delivery_flush(void)
+{
+	struct ril_delivery_queue *queue = &ril_delivery_queue;
+
+	pthread_mutex_lock(&queue->mutex);
+	if(queue->running && !pthread_equal(queue->thread, pthread_self())) {
+		while(queue->head != NULL || queue->busy)
+			pthread_cond_wait(&queue->done, &queue->mutex);
+	}
+	pthread_mutex_unlock(&queue->mutex);
+}
+
+void ril_delivery_get_stats(struct ril_delivery_stats *stats)
+{
+	struct ril_delivery_queue *queue = &ril_delivery_queue;
+
+	pthread_mutex_lock(&queue->mutex);
+	memcpy(stats, &queue->stats, sizeof(struct ril_delivery_stats));
+	pthread_mutex_unlock(&queue->mutex);
+}
@@ -0,0 +1,76 @@
+/**
+ * This file is part of mocha-ril.
+ *
+ * mocha-ril is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * mocha-ril is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with mocha-ril.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef _SAMSUNG_RIL_DELIVERY_H_
+#define _SAMSUNG_RIL_DELIVERY_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <pthread.h>
+
+#include <telephony/ril.h>
+
+/* Smallest arena chunk, most responses fit in one */
+#define RIL_ARENA_CHUNK_SIZE	512
+
+/* Owns every copy made for one delivery, freed in one go */
+struct ril_arena_chunk {
+	struct ril_arena_chunk *next;
+	size_t size;
+	size_t used;
+	uint8_t data[];
+};
+
+enum ril_delivery_type {
+	RIL_DELIVERY_COMPLETE,
+	RIL_DELIVERY_UNSOLICITED,
+};
+
+struct ril_delivery {
+	struct ril_delivery *next;
+	enum ril_delivery_type type;
+
+	RIL_Token token;
+	RIL_Errno error;
+	int unsol;
+
+	void *data;
+	size_t length;
+	struct ril_arena_chunk *arena;
+
+	uint64_t queued_us;
+};
+
+struct ril_delivery_stats {
+	uint32_t queued;
+	uint32_t delivered;
+	uint32_t superseded;
+	uint32_t wakeups;
+	uint32_t depth;
+	uint32_t max_depth;
+	uint32_t max_latency_us;
+};
+
+int ril_delivery_start(void);
+void ril_delivery_stop(void);
+void ril_delivery_flush(void);
+void ril_delivery_complete(RIL_Token t, RIL_Errno e, int request, void *data, size_t length);
+void ril_delivery_unsolicited(int unsol, void *data, size_t length);
+void ril_delivery_get_stats(struct ril_delivery_stats *stats);
+
+#endif
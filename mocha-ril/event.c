@@ -0,0 +1,350 @@
+/**
+ * This file is part of mocha-ril.
+ *
+ * mocha-ril is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * mocha-ril is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with mocha-ril.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+
+#define LOG_TAG "RIL-Mocha-Event"
+#include <utils/Log.h>
+
+#include "mocha-ril.h"
+
+/*
+ * One epoll set for the IPC device, the SRS sockets and any timer or
+ * wake-up the RIL needs, instead of a select() thread for each. The GPRS
+ * data plane runs a second reactor of its own for the tun fds.
+ * Events are level-triggered. What one epoll_wait returns is dispatched
+ * highest priority first, so modem frames are handled before SRS
+ * traffic that became ready at the same time.
+ */
+
+static int ril_event_register(struct ril_reactor *reactor, struct ril_event *event,
+	enum ril_event_type type, int fd, uint32_t events, int priority,
+	ril_event_cb callback, void *data)
+{
+	struct epoll_event epoll_event;
+
+	if(reactor == NULL || event == NULL || fd < 0)
+		return -1;
+
+	event->reactor = reactor;
+	event->type = type;
+	event->fd = fd;
+	event->priority = priority;
+	event->callback = callback;
+	event->data = data;
+
+	memset(&epoll_event, 0, sizeof(epoll_event));
+	epoll_event.events = events;
+	epoll_event.data.ptr = event;
+
+	if(epoll_ctl(reactor->epoll_fd, EPOLL_CTL_ADD, fd, &epoll_event) < 0) {
+		LOGE("Unable to add fd %d to the reactor: %s", fd, strerror(errno));
+		event->reactor = NULL;
+		return -1;
+	}
+
+	return 0;
+}
+
+int ril_event_add(struct ril_reactor *reactor, struct ril_event *event, int fd,
+	uint32_t events, int priority, ril_event_cb callback, void *data)
+{
+	return ril_event_register(reactor, event, RIL_EVENT_FD, fd, events, priority, callback, data);
+}
+
+/* Safe from any thread, including from a callback of the same reactor */
+int ril_event_del(struct ril_event *event)
+{
+	struct ril_reactor *reactor;
+	int i;
+
+	if(event == NULL || event->reactor == NULL)
+		return 0;
+
+	reactor = event->reactor;
+
+	pthread_mutex_lock(&reactor->mutex);
+
+	epoll_ctl(reactor->epoll_fd, EPOLL_CTL_DEL, event->fd, NULL);
+	reactor->deletions++;
+
+	for(i = 0 ; i < reactor->ready_count ; i++)
+		if(reactor->ready[i].event == event)
+			reactor->ready[i].event = NULL;
+
+	if(event->type != RIL_EVENT_FD)
+		close(event->fd);
+
+	event->reactor = NULL;
+	event->fd = -1;
+
+	pthread_mutex_unlock(&reactor->mutex);
+
+	return 0;
+}
+
+int ril_event_timer_add(struct ril_reactor *reactor, struct ril_event *event,
+	int priority, ril_event_cb callback, void *data)
+{
+	int fd;
+
+	fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+	if(fd < 0) {
+		LOGE("Unable to create timerfd: %s", strerror(errno));
+		return -1;
+	}
+
+	if(ril_event_register(reactor, event, RIL_EVENT_TIMER, fd, EPOLLIN, priority, callback, data) < 0) {
+		close(fd);
+		return -1;
+	}
+
+	return 0;
+}
+
+/* A zero timeout disarms the timer, a zero interval makes it one-shot */
+int ril_event_timer_set(struct ril_event *event, unsigned int timeout_ms, unsigned int interval_ms)
+{
+	struct itimerspec spec;
+
+	if(event == NULL || event->type != RIL_EVENT_TIMER || event->fd < 0)
+		return -1;
+
+	memset(&spec, 0, sizeof(spec));
+	spec.it_value.tv_sec = timeout_ms / 1000;
+	spec.it_value.tv_nsec = (timeout_ms % 1000) * 1000000;
+	spec.it_interval.tv_sec = interval_ms / 1000;
+	spec.it_interval.tv_nsec = (interval_ms % 1000) * 1000000;
+
+	return timerfd_settime(event->fd, 0, &spec, NULL);
+}
+
+int ril_event_notify_add(struct ril_reactor *reactor, struct ril_event *event,
+	int priority, ril_event_cb callback, void *data)
+{
+	int fd;
+
+	fd = eventfd(0, EFD_NONBLOCK);
+	if(fd < 0) {
+		LOGE("Unable to create eventfd: %s", strerror(errno));
+		return -1;
+	}
+
+	if(ril_event_register(reactor, event, RIL_EVENT_NOTIFY, fd, EPOLLIN, priority, callback, data) < 0) {
+		close(fd);
+		return -1;
+	}
+
+	return 0;
+}
+
+int ril_event_notify(struct ril_event *event)
+{
+	uint64_t value = 1;
+
+	if(event == NULL || event->type != RIL_EVENT_NOTIFY || event->fd < 0)
+		return -1;
+
+	if(write(event->fd, &value, sizeof(value)) != sizeof(value))
+		return -1;
+
+	return 0;
+}
+
+/**
+ * Reactor
+ */
+
+int ril_reactor_init(struct ril_reactor *reactor)
+{
+	memset(reactor, 0, sizeof(struct ril_reactor));
+
+	reactor->epoll_fd = epoll_create(RIL_REACTOR_EVENTS);
+	if(reactor->epoll_fd < 0) {
+		LOGE("Unable to create epoll set: %s", strerror(errno));
+		return -1;
+	}
+
+	pthread_mutex_init(&reactor->mutex, NULL);
+
+	/* Only there to break epoll_wait when stopping */
+	if(ril_event_notify_add(reactor, &reactor->wake, RIL_EVENT_PRIORITY_HIGH, NULL, NULL) < 0) {
+		pthread_mutex_destroy(&reactor->mutex);
+		close(reactor->epoll_fd);
+		return -1;
+	}
+
+	return 0;
+}
+
+void ril_reactor_free(struct ril_reactor *reactor)
+{
+	ril_event_del(&reactor->wake);
+	pthread_mutex_destroy(&reactor->mutex);
+	close(reactor->epoll_fd);
+	reactor->epoll_fd = -1;
+}
+
+/* Sorts the round into reactor->ready, called with the mutex held */
+static void ril_reactor_queue(struct ril_reactor *reactor, struct epoll_event *events, int count)
+{
+	struct ril_event *event;
+	int i, j;
+
+	reactor->ready_count = 0;
+
+	for(i = 0 ; i < count ; i++) {
+		event = (struct ril_event *) events[i].data.ptr;
+
+		for(j = reactor->ready_count ; j > 0 ; j--) {
+			if(reactor->ready[j - 1].event->priority >= event->priority)
+				break;
+			reactor->ready[j] = reactor->ready[j - 1];
+		}
+
+		reactor->ready[j].event = event;
+		reactor->ready[j].events = events[i].events;
+		reactor->ready_count++;
+	}
+}
+
+static void ril_reactor_dispatch(struct ril_reactor *reactor)
+{
+	struct ril_event *event;
+	ril_event_cb callback;
+	uint64_t value;
+	uint32_t events;
+	void *data;
+	int fd;
+	int i;
+
+	for(i = 0 ; i < reactor->ready_count ; i++) {
+		pthread_mutex_lock(&reactor->mutex);
+
+		event = reactor->ready[i].event;
+		if(event == NULL) {
+			pthread_mutex_unlock(&reactor->mutex);
+			continue;
+		}
+
+		fd = event->fd;
+		events = reactor->ready[i].events;
+		callback = event->callback;
+		data = event->data;
+
+		if(event->type != RIL_EVENT_FD)
+			read(fd, &value, sizeof(value));
+
+		pthread_mutex_unlock(&reactor->mutex);
+
+		if(callback != NULL)
+			callback(fd, events, data);
+	}
+
+	pthread_mutex_lock(&reactor->mutex);
+	reactor->ready_count = 0;
+	pthread_mutex_unlock(&reactor->mutex);
+}
+
+int ril_reactor_run(struct ril_reactor *reactor)
+{
+	struct epoll_event events[RIL_REACTOR_EVENTS];
+	uint32_t deletions;
+	int count;
+
+	while(reactor->running) {
+		pthread_mutex_lock(&reactor->mutex);
+		deletions = reactor->deletions;
+		pthread_mutex_unlock(&reactor->mutex);
+
+		count = epoll_wait(reactor->epoll_fd, events, RIL_REACTOR_EVENTS, -1);
+
+		if(count < 0) {
+			if(errno == EINTR)
+				continue;
+
+			LOGE("epoll_wait failed: %s", strerror(errno));
+			return -1;
+		}
+
+		pthread_mutex_lock(&reactor->mutex);
+
+		/* Something may have been freed meanwhile, ask again */
+		if(deletions != reactor->deletions) {
+			pthread_mutex_unlock(&reactor->mutex);
+			continue;
+		}
+
+		ril_reactor_queue(reactor, events, count);
+
+		reactor->stats.wakeups++;
+		reactor->stats.events += count;
+		if((uint32_t) count > reactor->stats.max_batch)
+			reactor->stats.max_batch = count;
+
+		pthread_mutex_unlock(&reactor->mutex);
+
+		ril_reactor_dispatch(reactor);
+	}
+
+	LOGD("Reactor stopped: %d events in %d wakeups, at most %d at once",
+		reactor->stats.events, reactor->stats.wakeups, reactor->stats.max_batch);
+
+	return 0;
+}
+
+static void *ril_reactor_thread(void *data)
+{
+	ril_reactor_run((struct ril_reactor *) data);
+
+	return NULL;
+}
+
+int ril_reactor_start(struct ril_reactor *reactor)
+{
+	int rc;
+
+	reactor->running = 1;
+
+	rc = pthread_create(&reactor->thread, NULL, ril_reactor_thread, (void *) reactor);
+	if(rc != 0) {
+		LOGE("Unable to start the reactor thread");
+		reactor->running = 0;
+		return -1;
+	}
+
+	return 0;
+}
+
+void ril_reactor_stop(struct ril_reactor *reactor)
+{
+	if(!reactor->running)
+		return;
+
+	reactor->running = 0;
+	ril_event_notify(&reactor->wake);
+
+	if(pthread_equal(reactor->thread, pthread_self()))
+		pthread_detach(reactor->thread);
+	else
+		pthread_join(reactor->thread, NULL);
+}
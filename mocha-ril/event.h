@@ -0,0 +1,105 @@
+/**
+ * This file is part of mocha-ril.
+ *
+ * mocha-ril is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * mocha-ril is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with mocha-ril.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef _SAMSUNG_RIL_EVENT_H_
+#define _SAMSUNG_RIL_EVENT_H_
+
+#include <stdint.h>
+#include <pthread.h>
+#include <sys/epoll.h>
+
+/* Readiness events handled per epoll_wait round */
+#define RIL_REACTOR_EVENTS	32
+
+/* Higher priority events of a round are dispatched first */
+enum ril_event_priority {
+	RIL_EVENT_PRIORITY_LOW		= 0,
+	RIL_EVENT_PRIORITY_NORMAL	= 1,
+	RIL_EVENT_PRIORITY_HIGH		= 2,
+};
+
+enum ril_event_type {
+	RIL_EVENT_FD,
+	RIL_EVENT_TIMER,	/* timerfd, owned and drained by the reactor */
+	RIL_EVENT_NOTIFY,	/* eventfd, owned and drained by the reactor */
+};
+
+/*
+ * Callbacks get a copy of the fd and data taken when the event was
+ * dequeued, not the event itself: the event may be deleted and freed by
+ * another thread while its callback runs, so callbacks must look their
+ * object up again under its own lock before touching it.
+ */
+typedef void (*ril_event_cb)(int fd, uint32_t events, void *data);
+
+struct ril_reactor;
+
+struct ril_event {
+	struct ril_reactor *reactor;
+	enum ril_event_type type;
+	int fd;
+	int priority;
+	ril_event_cb callback;
+	void *data;
+};
+
+struct ril_reactor_stats {
+	uint32_t wakeups;
+	uint32_t events;
+	uint32_t max_batch;
+};
+
+struct ril_reactor_ready {
+	struct ril_event *event;
+	uint32_t events;
+};
+
+struct ril_reactor {
+	int epoll_fd;
+	struct ril_event wake;
+	int running;
+	pthread_t thread;
+	pthread_mutex_t mutex;
+
+	/* Current round, sorted by priority. Deleted events are cleared */
+	struct ril_reactor_ready ready[RIL_REACTOR_EVENTS];
+	int ready_count;
+
+	/* Bumped by every delete so an in-flight epoll_wait result is redone */
+	uint32_t deletions;
+
+	struct ril_reactor_stats stats;
+};
+
+int ril_reactor_init(struct ril_reactor *reactor);
+void ril_reactor_free(struct ril_reactor *reactor);
+int ril_reactor_run(struct ril_reactor *reactor);
+int ril_reactor_start(struct ril_reactor *reactor);
+void ril_reactor_stop(struct ril_reactor *reactor);
+
+int ril_event_add(struct ril_reactor *reactor, struct ril_event *event, int fd,
+	uint32_t events, int priority, ril_event_cb callback, void *data);
+int ril_event_del(struct ril_event *event);
+int ril_event_timer_add(struct ril_reactor *reactor, struct ril_event *event,
+	int priority, ril_event_cb callback, void *data);
+int ril_event_timer_set(struct ril_event *event, unsigned int timeout_ms, unsigned int interval_ms);
+int ril_event_notify_add(struct ril_reactor *reactor, struct ril_event *event,
+	int priority, ril_event_cb callback, void *data);
+int ril_event_notify(struct ril_event *event);
+
+#endif
@@ -21,7 +21,14 @@
  *
  */
 
+#define IPC_LOG_MODULE	IPC_LOG_GPRS
+
 #include <pthread.h>
+#include <time.h>
+#include <fcntl.h>
+#include <sys/resource.h>
+#include <sys/uio.h>
+#include <sys/ioctl.h>
 
 #include <netinet/in.h>
 #include <arpa/inet.h>
@@ -46,6 +53,55 @@ extern int ifc_configure(const char *ifname,
 	in_addr_t dns1,
 	in_addr_t dns2);
 
+#define GPRS_TUNNEL_MTU		1500
+/* Packets read off one tun per wakeup before the other tunnels get a turn */
+#define GPRS_TUNNEL_BURST	64
+/* Enough for a full uplink queue plus the packets being read and written */
+#define GPRS_UPLINK_FRAMES	(IPC_TX_QUEUE_SIZE + 4)
+
+/* Uplink packets are read into these, behind room for the frame headers */
+static struct ipc_frame_pool *gprs_uplink_pool;
+
+/*
+ * The packet paths find running tunnels here, by cid, and never take the
+ * GPRS subsystem lock: a PDP context being set up (ifc_configure can take
+ * a while) doesn't stall the packets of the others. Starting and stopping
+ * a tunnel takes the lock for writing, which also waits for the downlink
+ * packets in flight on it. Uplink and downlink of one tunnel run on
+ * different threads and share its uring and counters, so each also takes
+ * the tunnel's own lock. Sending uplink frames can wait for room in the
+ * modem queue, while the modem reader wants both locks for the downlink,
+ * so the uplink lets go of them around the send and marks the tunnel
+ * busy instead.
+ */
+static pthread_rwlock_t gprs_tunnels_lock = PTHREAD_RWLOCK_INITIALIZER;
+static struct ril_gprs_connection *gprs_tunnels[MAX_CONNECTIONS];
+
+/*
+ * The same tunnels hashed by contextId for the downlink, open addressing
+ * with linear probing. Rebuilt whenever a tunnel starts or stops, which
+ * is rare next to the packets looking it up.
+ */
+#define GPRS_CONTEXT_BITS	3
+#define GPRS_CONTEXT_SLOTS	(1 << GPRS_CONTEXT_BITS)
+
+static struct ril_gprs_connection *gprs_contexts[GPRS_CONTEXT_SLOTS];
+
+/* Under the GPRS subsystem lock, GPRS never takes RIL_LOCK */
+static int gprs_last_failed_cid;
+
+/* Only the modem reader updates them */
+static struct gprs_downlink_stats gprs_downlink_stats;
+
+/*
+ * All the tun fds are polled by one data plane thread of their own, away
+ * from the modem and SRS reactor. It runs only while a tunnel does, so
+ * with no data call there is no thread and nothing wakes up. Started and
+ * stopped by the control plane, under the GPRS subsystem lock.
+ */
+static struct ril_reactor gprs_reactor;
+static int gprs_reactor_tunnels;
+
 struct in_addr htoina(uint32_t addr)
 {
 	struct in_addr ret;
@@ -76,66 +132,621 @@ uint8_t data_call_type_to_proto_type(char* type)
 		return PROTO_TYPE_NONE;
 }
 
-void *gprs_tunneling_thread(void *data)
+/* Voluntary and involuntary context switches of the whole RIL process */
+static long gprs_context_switches(void)
+{
+	struct rusage usage;
+
+	if (getrusage(RUSAGE_SELF, &usage) < 0)
+		return 0;
+
+	return usage.ru_nvcsw + usage.ru_nivcsw;
+}
+
+static uint64_t gprs_thread_cpu_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+
+	return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int gprs_tunnel_fd(struct ril_gprs_connection *gprs_connection)
+{
+	if (gprs_connection->uring != NULL)
+		return ipc_uring_fd(gprs_connection->uring);
+
+	return gprs_connection->iface;
+}
+
+/* Called with gprs_tunnels_lock held */
+static struct ril_gprs_connection *gprs_tunnel_find_cid(int cid)
+{
+	if (cid < 1 || cid > MAX_CONNECTIONS)
+		return NULL;
+
+	return gprs_tunnels[cid - 1];
+}
+
+static int gprs_context_slot(uint32_t contextId)
+{
+	return (contextId * 2654435761U) >> (32 - GPRS_CONTEXT_BITS);
+}
+
+/* Called with gprs_tunnels_lock held for writing */
+static void gprs_contexts_rebuild(void)
+{
+	int slot;
+	int i;
+
+	memset(gprs_contexts, 0, sizeof(gprs_contexts));
+
+	for (i = 0 ; i < MAX_CONNECTIONS ; i++) {
+		if (gprs_tunnels[i] == NULL)
+			continue;
+
+		slot = gprs_context_slot(gprs_tunnels[i]->contextId);
+		while (gprs_contexts[slot] != NULL)
+			slot = (slot + 1) & (GPRS_CONTEXT_SLOTS - 1);
+
+		gprs_contexts[slot] = gprs_tunnels[i];
+	}
+}
+
+/* Called with gprs_tunnels_lock held */
+static struct ril_gprs_connection *gprs_tunnel_find_contextId(uint32_t contextId)
+{
+	int slot;
+
+	slot = gprs_context_slot(contextId);
+	while (gprs_contexts[slot] != NULL) {
+		if (gprs_contexts[slot]->contextId == contextId)
+			return gprs_contexts[slot];
+
+		slot = (slot + 1) & (GPRS_CONTEXT_SLOTS - 1);
+	}
+
+	return NULL;
+}
+
+/*
+ * The tun fd is polled by the data plane reactor. The connection can be stopped
+ * while the event is queued, so look it up again by cid in the tunnel
+ * table before reading. The fd is non-blocking and each wakeup drains up
+ * to GPRS_TUNNEL_BURST packets. With io_uring, the ring fd is polled instead and every
+ * completed read is one packet.
+ *
+ * Packets are read into a pooled frame at PROTO_DATA_HEADROOM, the proto
+ * and FIFO headers are then filled in in front of them and the frame is
+ * handed to the writer as is. On an IFF_VNET_HDR tun, whatever of a super
+ * packet doesn't fit the frame goes on in gso_buf.
+ */
+static int gprs_tunnel_read(struct ril_gprs_connection *gprs_connection, int fd,
+	struct modem_io *frame, struct virtio_net_hdr *hdr)
 {
+	struct iovec iov[3];
 	int n;
-	uint8_t buf[1500]; //MTU is 1500
-	ril_gprs_connection *gprs_connection = (ril_gprs_connection *)data;
-    fd_set fds;
-	struct timeval select_timeout;
 
-	LOGD("%s: Thread initialized for connection cid %d, contextId %d on %s", __func__, 
+	if (ipc_frame_alloc(gprs_uplink_pool, frame, PROTO_DATA_HEADROOM + GPRS_TUNNEL_MTU) < 0)
+		return -1;
+
+	if (gprs_connection->vnet_hdr) {
+		iov[0].iov_base = hdr;
+		iov[0].iov_len = sizeof(struct virtio_net_hdr);
+		iov[1].iov_base = frame->data + PROTO_DATA_HEADROOM;
+		iov[1].iov_len = GPRS_TUNNEL_MTU;
+		iov[2].iov_base = gprs_connection->gso_buf + GPRS_TUNNEL_MTU;
+		iov[2].iov_len = GSO_MAX_SIZE - GPRS_TUNNEL_MTU;
+
+		n = readv(fd, iov, 3) - (int) sizeof(struct virtio_net_hdr);
+		gprs_connection->syscalls++;
+	} else if (gprs_connection->uring == NULL) {
+		n = read(fd, frame->data + PROTO_DATA_HEADROOM, GPRS_TUNNEL_MTU);
+		gprs_connection->syscalls++;
+	} else {
+		n = ipc_uring_read(gprs_connection->uring, frame->data + PROTO_DATA_HEADROOM, GPRS_TUNNEL_MTU, 0);
+	}
+
+	if (n <= 0)
+		ipc_frame_unref(frame);
+
+	return n;
+}
+
+static void gprs_tunnel_send(struct ril_gprs_connection *gprs_connection, struct modem_io *frame, int n)
+{
+	struct iovec iov;
+
+	gprs_connection->up_packets++;
+
+	proto_build_data(PROTO_OPMODE_PS, gprs_connection->type, gprs_connection->contextId,
+		frame->data, n, &iov);
+	frame->data = iov.iov_base;
+	frame->datasize = iov.iov_len;
+
+	ipc_send_frame(FIFO_PKT_PROTO, frame);
+}
+
+/*
+ * Cuts a super packet down to the modem MTU, the first segment goes in
+ * the frame it was read into and the others in new ones. Plain packets
+ * only get their checksum completed.
+ */
+static void gprs_tunnel_segment(struct ril_gprs_connection *gprs_connection, struct modem_io *frame,
+	struct virtio_net_hdr *hdr, int n)
+{
+	struct gso_segmenter gso;
+	uint8_t *packet;
+	uint32_t length;
+	int segments;
+
+	packet = frame->data + PROTO_DATA_HEADROOM;
+
+	/* The segments are written over the frame, the packet goes in one piece */
+	if (hdr->gso_type != VIRTIO_NET_HDR_GSO_NONE) {
+		memcpy(gprs_connection->gso_buf, packet, n < GPRS_TUNNEL_MTU ? n : GPRS_TUNNEL_MTU);
+		packet = gprs_connection->gso_buf;
+	}
+
+	segments = gso_segment_start(&gso, hdr, packet, n, GPRS_TUNNEL_MTU);
+	if (segments == 0) {
+		gprs_tunnel_send(gprs_connection, frame, n);
+		return;
+	} else if (segments < 0) {
+		ipc_frame_unref(frame);
+		return;
+	}
+
+	gprs_connection->gso_packets++;
+
+	while ((length = gso_segment_next(&gso, frame->data + PROTO_DATA_HEADROOM)) > 0) {
+		gprs_connection->gso_segments++;
+		gprs_tunnel_send(gprs_connection, frame, length);
+
+		/* Out of frames, TCP sends the rest again */
+		if (gso.offset < gso.length &&
+			ipc_frame_alloc(gprs_uplink_pool, frame, PROTO_DATA_HEADROOM + GPRS_TUNNEL_MTU) < 0)
+			break;
+	}
+}
+
+static void gprs_tunnel_event(int fd, uint32_t events, void *data)
+{
+	struct ril_gprs_connection *gprs_connection;
+	struct virtio_net_hdr hdr;
+	struct modem_io frame;
+	uint64_t cpu_ns;
+	int n, i;
+
+	pthread_rwlock_rdlock(&gprs_tunnels_lock);
+
+	gprs_connection = gprs_tunnel_find_cid((int) (intptr_t) data);
+	if (gprs_connection == NULL || gprs_tunnel_fd(gprs_connection) != fd) {
+		pthread_rwlock_unlock(&gprs_tunnels_lock);
+		return;
+	}
+
+	pthread_mutex_lock(&gprs_connection->tunnel_lock);
+	gprs_connection->uplink_busy = 1;
+	pthread_mutex_unlock(&gprs_connection->tunnel_lock);
+
+	pthread_rwlock_unlock(&gprs_tunnels_lock);
+
+	/* Only this thread touches the uplink counters and gso_buf */
+	cpu_ns = gprs_thread_cpu_ns();
+	gprs_connection->up_wakeups++;
+
+	for (i = 0 ; i < GPRS_TUNNEL_BURST ; i++) {
+		pthread_mutex_lock(&gprs_connection->tunnel_lock);
+		n = gprs_tunnel_read(gprs_connection, fd, &frame, &hdr);
+		pthread_mutex_unlock(&gprs_connection->tunnel_lock);
+
+		if (n <= 0)
+			break;
+
+		gprs_connection->up_bytes += n;
+
+		if (gprs_connection->vnet_hdr)
+			gprs_tunnel_segment(gprs_connection, &frame, &hdr, n);
+		else
+			gprs_tunnel_send(gprs_connection, &frame, n);
+	}
+
+	gprs_connection->up_cpu_ns += gprs_thread_cpu_ns() - cpu_ns;
+
+	pthread_mutex_lock(&gprs_connection->tunnel_lock);
+	gprs_connection->uplink_busy = 0;
+	pthread_cond_broadcast(&gprs_connection->uplink_done);
+	pthread_mutex_unlock(&gprs_connection->tunnel_lock);
+}
+
+static int gprs_reactor_get(void)
+{
+	if (gprs_reactor_tunnels > 0) {
+		gprs_reactor_tunnels++;
+		return 0;
+	}
+
+	if (ril_reactor_init(&gprs_reactor) < 0)
+		return -1;
+
+	if (ril_reactor_start(&gprs_reactor) < 0) {
+		ril_reactor_free(&gprs_reactor);
+		return -1;
+	}
+
+	gprs_reactor_tunnels = 1;
+
+	return 0;
+}
+
+/* The thread is woken through the reactor's eventfd and joined */
+static void gprs_reactor_put(void)
+{
+	if (gprs_reactor_tunnels <= 0 || --gprs_reactor_tunnels > 0)
+		return;
+
+	ril_reactor_stop(&gprs_reactor);
+	ril_reactor_free(&gprs_reactor);
+}
+
+int gprs_tunnel_start(struct ril_gprs_connection *gprs_connection)
+{
+	int flags;
+
+	LOGD("%s: Tunneling connection cid %d, contextId %d on %s", __func__,
 		gprs_connection->cid, gprs_connection->contextId, gprs_connection->ifname);
-	while(1)
-	{		
-		pthread_mutex_lock(&gprs_connection->mutex);
-		FD_ZERO(&fds);
-		FD_SET(gprs_connection->iface, &fds);
-		select_timeout.tv_sec = 0;
-		select_timeout.tv_usec = 300000; //300ms select timeout
-		select(gprs_connection->iface+1, &fds, NULL, NULL, &select_timeout);
-		if(gprs_connection->thread_state == 2)
-		{			
-			pthread_mutex_unlock(&gprs_connection->mutex);
-			pthread_exit(NULL);
-			return NULL;
+
+	gprs_connection->up_bytes = 0;
+	gprs_connection->down_bytes = 0;
+	gprs_connection->syscalls = 0;
+	gprs_connection->switches = gprs_context_switches();
+	gprs_connection->up_cpu_ns = 0;
+	gprs_connection->up_packets = 0;
+	gprs_connection->up_wakeups = 0;
+	gprs_connection->gso_packets = 0;
+	gprs_connection->gso_segments = 0;
+	gprs_connection->gro_packets = 0;
+	gprs_connection->gro_segments = 0;
+
+	/* Shared by all the tunnels and kept for good, frames may still be queued */
+	if (gprs_uplink_pool == NULL)
+		gprs_uplink_pool = ipc_frame_pool_new(GPRS_UPLINK_FRAMES, PROTO_DATA_HEADROOM + GPRS_TUNNEL_MTU);
+
+	if (gprs_connection->vnet_hdr) {
+		gprs_connection->gso_buf = malloc(GSO_MAX_SIZE);
+		gro_init(&gprs_connection->gro, malloc(GSO_MAX_SIZE));
+		if (gprs_connection->gso_buf == NULL || gprs_connection->gro.buf == NULL) {
+			LOGE("%s: Couldn't allocate the GSO buffers of %s", __func__, gprs_connection->ifname);
+			return -1;
 		}
-		if(FD_ISSET(gprs_connection->iface, &fds)) {
-			n = read(gprs_connection->iface, buf, 1500);
-			RIL_LOCK();
-			LOGD("%s: Tunneling %d bytes of the net frame from %s to CP", __func__, n, gprs_connection->ifname);
-			proto_send_data(PROTO_OPMODE_PS, gprs_connection->type, gprs_connection->contextId, n, buf);
-			RIL_UNLOCK();
-		}		
-		pthread_mutex_unlock(&gprs_connection->mutex);
+	} else if (ipc_uring_enabled()) {
+		/* The ring reads and writes plain packets, no vnet header */
+		gprs_connection->uring = ipc_uring_new(gprs_connection->iface, GPRS_TUNNEL_MTU);
 	}
+
+	/* Ring reads would fail with EAGAIN instead of waiting for a packet */
+	if (gprs_connection->uring == NULL) {
+		flags = fcntl(gprs_connection->iface, F_GETFL);
+		if (flags < 0 || fcntl(gprs_connection->iface, F_SETFL, flags | O_NONBLOCK) < 0) {
+			LOGE("%s: Couldn't make %s non-blocking", __func__, gprs_connection->ifname);
+			return -1;
+		}
+	}
+
+	if (gprs_reactor_get() < 0) {
+		LOGE("%s: Couldn't start the data plane thread", __func__);
+		return -1;
+	}
+	gprs_connection->tunneling = 1;
+
+	pthread_rwlock_wrlock(&gprs_tunnels_lock);
+	gprs_tunnels[gprs_connection->cid - 1] = gprs_connection;
+	gprs_contexts_rebuild();
+	pthread_rwlock_unlock(&gprs_tunnels_lock);
+
+	return ril_event_add(&gprs_reactor, &gprs_connection->event, gprs_tunnel_fd(gprs_connection),
+		EPOLLIN, RIL_EVENT_PRIORITY_LOW, gprs_tunnel_event, (void *) (intptr_t) gprs_connection->cid);
 }
 
-int gprs_start_tunneling_thread(struct ril_gprs_connection *gprs_connection)
+void gprs_tunnel_stop(struct ril_gprs_connection *gprs_connection)
 {
-	pthread_attr_t attr;
-	int rd;
+	struct ipc_uring_stats stats;
+	struct ipc_frame_pool_stats pool_stats;
+	uint32_t bytes;
+	uint32_t syscalls;
+	long switches;
+
+	/* Once out of the table, no packet path can get to the connection */
+	pthread_rwlock_wrlock(&gprs_tunnels_lock);
+	if (gprs_tunnel_find_cid(gprs_connection->cid) == gprs_connection) {
+		gprs_tunnels[gprs_connection->cid - 1] = NULL;
+		gprs_contexts_rebuild();
+	}
+	pthread_rwlock_unlock(&gprs_tunnels_lock);
 
-	pthread_attr_init(&attr);
-	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
-	rd = pthread_create(&gprs_connection->thread, &attr, gprs_tunneling_thread, (void *) gprs_connection);
-	if(rd == 0)
-	{
-		gprs_connection->thread_state = 1;
+	ril_event_del(&gprs_connection->event);
+
+	/* An uplink wakeup may still be sending from it */
+	pthread_mutex_lock(&gprs_connection->tunnel_lock);
+	while (gprs_connection->uplink_busy)
+		pthread_cond_wait(&gprs_connection->uplink_done, &gprs_connection->tunnel_lock);
+	pthread_mutex_unlock(&gprs_connection->tunnel_lock);
+
+	if (gprs_connection->tunneling) {
+		gprs_connection->tunneling = 0;
+		gprs_reactor_put();
 	}
-	return rd;
+
+	syscalls = gprs_connection->syscalls;
+	if (ipc_uring_get_stats(gprs_connection->uring, &stats) == 0)
+		syscalls += stats.enters;
+
+	bytes = gprs_connection->up_bytes + gprs_connection->down_bytes;
+	switches = gprs_context_switches() - gprs_connection->switches;
+
+	if (bytes > 0)
+		LOGD("%s: %s moved %u up, %u down: %u syscalls/MB, %ld context switches/MB%s", __func__,
+			gprs_connection->ifname, gprs_connection->up_bytes, gprs_connection->down_bytes,
+			(uint32_t) ((uint64_t) syscalls * 1048576 / bytes), (long) ((int64_t) switches * 1048576 / bytes),
+			gprs_connection->uring != NULL ? " (io_uring)" : "");
+
+	if (gprs_connection->up_bytes > 0 && ipc_frame_pool_get_stats(gprs_uplink_pool, &pool_stats) == 0)
+		LOGD("%s: %s uplink took %u us CPU/MB, %u packets in %u wakeups, %u of %u frames off the pool", __func__,
+			gprs_connection->ifname, (uint32_t) (gprs_connection->up_cpu_ns * 1048576 / gprs_connection->up_bytes / 1000),
+			gprs_connection->up_packets, gprs_connection->up_wakeups, pool_stats.misses, pool_stats.allocs);
+
+	if (gprs_connection->vnet_hdr && bytes > 0)
+		LOGD("%s: %s cut %u super packets into %u segments up, coalesced %u segments into %u down", __func__,
+			gprs_connection->ifname, gprs_connection->gso_packets, gprs_connection->gso_segments,
+			gprs_connection->gro_segments, gprs_connection->gro_packets);
+
+	free(gprs_connection->gso_buf);
+	gprs_connection->gso_buf = NULL;
+	free(gprs_connection->gro.buf);
+	gprs_connection->gro.buf = NULL;
+
+	ipc_uring_free(gprs_connection->uring);
+	gprs_connection->uring = NULL;
+	gprs_connection->up_bytes = 0;
+	gprs_connection->down_bytes = 0;
 }
 
-int gprs_stop_tunneling_thread(struct ril_gprs_connection *gprs_connection)
+/* Called with the tunnel lock held */
+static int gprs_downlink_write_vnet(struct ril_gprs_connection *gprs_connection,
+	struct virtio_net_hdr *hdr, uint8_t *packet, uint32_t length)
 {
-	if(gprs_connection->thread_state == 1)
-	{
-		gprs_connection->thread_state = 2;
-		pthread_mutex_lock(&gprs_connection->mutex);
-		pthread_mutex_unlock(&gprs_connection->mutex);
+	struct iovec iov[2];
+	int n;
+
+	iov[0].iov_base = hdr;
+	iov[0].iov_len = sizeof(struct virtio_net_hdr);
+	iov[1].iov_base = packet;
+	iov[1].iov_len = length;
+
+	n = writev(gprs_connection->iface, iov, 2);
+	gprs_connection->syscalls++;
+	if (n != (int) (sizeof(struct virtio_net_hdr) + length)) {
+		LOGE("%s: Wrote %d/%d bytes of the net frame into %s", __func__, n,
+			(int) (sizeof(struct virtio_net_hdr) + length), gprs_connection->ifname);
+		return -1;
+	}
+
+	return 0;
+}
+
+/* Writes the segments coalesced so far as one super packet */
+static void gprs_downlink_gro_flush(struct ril_gprs_connection *gprs_connection)
+{
+	struct virtio_net_hdr hdr;
+	uint32_t segments;
+	uint32_t length;
+
+	segments = gprs_connection->gro.segments;
+
+	length = gro_finish(&gprs_connection->gro, &hdr);
+	if (length == 0)
+		return;
+
+	if (segments > 1) {
+		gprs_connection->gro_packets++;
+		gprs_connection->gro_segments += segments;
+	}
+
+	gprs_downlink_write_vnet(gprs_connection, &hdr, gprs_connection->gro.buf, length);
+}
+
+/*
+ * TCP segments that follow each other in a flow are put together before
+ * they go to an IFF_VNET_HDR tun, anything else flushes them and is
+ * written on its own. Called with the tunnel lock held.
+ */
+static int gprs_downlink_coalesce(struct ril_gprs_connection *gprs_connection,
+	uint8_t *packet, uint32_t length)
+{
+	struct virtio_net_hdr hdr;
+
+	if (gro_append(&gprs_connection->gro, packet, length) == 0)
 		return 0;
+
+	gprs_downlink_gro_flush(gprs_connection);
+
+	if (gro_append(&gprs_connection->gro, packet, length) == 0)
+		return 0;
+
+	memset(&hdr, 0, sizeof(hdr));
+
+	return gprs_downlink_write_vnet(gprs_connection, &hdr, packet, length);
+}
+
+/*
+ * Submits the downlink packets queued for a batch of modem frames, one
+ * io_uring_enter per tunnel instead of a write per packet, and writes out
+ * what was coalesced. Called with gprs_tunnels_lock held, before the
+ * frames holding the data go away.
+ */
+static void gprs_downlink_flush(void)
+{
+	struct ril_gprs_connection *gprs_connection;
+	int i;
+
+	for (i = 0 ; i < MAX_CONNECTIONS ; i++) {
+		gprs_connection = gprs_tunnels[i];
+		if (gprs_connection == NULL)
+			continue;
+
+		pthread_mutex_lock(&gprs_connection->tunnel_lock);
+		if (gprs_connection->vnet_hdr)
+			gprs_downlink_gro_flush(gprs_connection);
+		else if (gprs_connection->uring != NULL && ipc_uring_submit(gprs_connection->uring) < 0)
+			LOGE("%s: Writing to %s failed", __func__, gprs_connection->ifname);
+		pthread_mutex_unlock(&gprs_connection->tunnel_lock);
+	}
+}
+
+/*
+ * Writes one downlink packet to its tun, called with gprs_tunnels_lock
+ * held. Returns 1 when the write was queued on the ring and the frame has
+ * to stay around until gprs_downlink_flush, 0 when it's done, -1 when the
+ * packet was dropped.
+ */
+static int gprs_downlink_packet(protoTransferDataBuf *rcvData)
+{
+	struct ril_gprs_connection *gprs_connection;
+	struct iovec iov;
+	int rc = 0;
+	int n;
+
+	gprs_connection = gprs_tunnel_find_contextId(rcvData->contextId);
+	if (gprs_connection == NULL || gprs_connection->iface < 0)
+		return -1;
+
+	pthread_mutex_lock(&gprs_connection->tunnel_lock);
+
+	gprs_connection->down_bytes += rcvData->netBufLen;
+
+	/* Coalesced packets are copied, the frame can go right away */
+	if (gprs_connection->vnet_hdr) {
+		rc = gprs_downlink_coalesce(gprs_connection, rcvData->netBuf, rcvData->netBufLen);
+		goto unlock;
+	}
+
+	if (gprs_connection->uring != NULL) {
+		iov.iov_base = rcvData->netBuf;
+		iov.iov_len = rcvData->netBufLen;
+		if (ipc_uring_queue_write(gprs_connection->uring, gprs_connection->iface, &iov, 1) == 0) {
+			rc = 1;
+			goto unlock;
+		}
+	}
+
+	n = write(gprs_connection->iface, rcvData->netBuf, rcvData->netBufLen);
+	gprs_connection->syscalls++;
+	if (n != (int) rcvData->netBufLen) {
+		LOGE("%s: Wrote %d/%d bytes of the net frame into %s", __func__, n, rcvData->netBufLen, gprs_connection->ifname);
+		rc = -1;
+	}
+
+unlock:
+	pthread_mutex_unlock(&gprs_connection->tunnel_lock);
+
+	return rc;
+}
+
+/* Submits the queued writes and lets go of the frames behind them */
+static int gprs_downlink_release(struct modem_io *held, int count)
+{
+	int i;
+
+	gprs_downlink_flush();
+
+	for (i = 0 ; i < count ; i++)
+		ipc_frame_unref(&held[i]);
+
+	return 0;
+}
+
+static uint64_t gprs_time_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/*
+ * Downlink fast path, run by the modem reader on every received batch
+ * before it goes to the workers. Data indications are taken out and
+ * written straight to their tun, they never reach the GPRS worker nor the
+ * RIL callbacks. The other frames are moved up in place, in order, and
+ * their count is returned. received_us is taken by the reader before it
+ * reads the batch, the latency accounted runs from there to the tun write.
+ */
+int gprs_downlink_queue(struct modem_io *frames, int count, uint64_t received_us)
+{
+	struct modem_io held[IPC_RECV_BATCH];
+	protoTransferDataBuf *rcvData;
+	uint32_t latency;
+	uint64_t now_us;
+	int packets = 0;
+	int held_count = 0;
+	int left = 0;
+	int rc;
+	int i;
+
+	pthread_rwlock_rdlock(&gprs_tunnels_lock);
+
+	for (i = 0 ; i < count ; i++) {
+		rcvData = proto_data_ind(&frames[i]);
+		if (rcvData == NULL) {
+			frames[left++] = frames[i];
+			continue;
+		}
+
+		rc = gprs_downlink_packet(rcvData);
+		if (rc < 0) {
+			gprs_downlink_stats.dropped++;
+		} else {
+			gprs_downlink_stats.bytes += rcvData->netBufLen;
+			packets++;
+		}
+
+		if (rc > 0)
+			held[held_count++] = frames[i];
+		else
+			ipc_frame_unref(&frames[i]);
+
+		if (held_count == IPC_RECV_BATCH)
+			held_count = gprs_downlink_release(held, held_count);
+	}
+
+	if (packets > 0)
+		gprs_downlink_release(held, held_count);
+
+	pthread_rwlock_unlock(&gprs_tunnels_lock);
+
+	if (packets > 0) {
+		now_us = gprs_time_us();
+		latency = (uint32_t) (now_us - received_us);
+
+		if (gprs_downlink_stats.packets == 0)
+			gprs_downlink_stats.first_us = received_us;
+		gprs_downlink_stats.last_us = now_us;
+
+		gprs_downlink_stats.packets += packets;
+		gprs_downlink_stats.total_latency_us += (uint64_t) latency * packets;
+		if (latency > gprs_downlink_stats.max_latency_us)
+			gprs_downlink_stats.max_latency_us = latency;
 	}
-	return -1;
+
+	return left;
+}
+
+void gprs_downlink_get_stats(struct gprs_downlink_stats *stats)
+{
+	memcpy(stats, &gprs_downlink_stats, sizeof(struct gprs_downlink_stats));
 }
 
 int ril_gprs_connection_register(int cid)
@@ -150,7 +761,8 @@ int ril_gprs_connection_register(int cid)
 
 	gprs_connection->cid = cid;
 	gprs_connection->iface = -1;
-	pthread_mutex_init(&gprs_connection->mutex, NULL);
+	pthread_mutex_init(&gprs_connection->tunnel_lock, NULL);
+	pthread_cond_init(&gprs_connection->uplink_done, NULL);
 
 	list_end = ril_data.gprs_connections;
 	while (list_end != NULL && list_end->next != NULL)
@@ -171,8 +783,9 @@ void ril_gprs_connection_unregister(struct ril_gprs_connection *gprs_connection)
 	if (gprs_connection == NULL)
 		return;
 
-	gprs_stop_tunneling_thread(gprs_connection);
-	pthread_mutex_destroy(&gprs_connection->mutex);
+	gprs_tunnel_stop(gprs_connection);
+	pthread_cond_destroy(&gprs_connection->uplink_done);
+	pthread_mutex_destroy(&gprs_connection->tunnel_lock);
 	memset(gprs_connection, 0, sizeof(struct ril_gprs_connection));
 	free(gprs_connection);
 	
@@ -229,6 +842,69 @@ list_continue:
 	return NULL;
 }
 
+struct ril_gprs_connection *ril_gprs_connection_find_token(RIL_Token t)
+{
+	struct ril_gprs_connection *gprs_connection;
+	struct list_head *list;
+
+	list = ril_data.gprs_connections;
+	while (list != NULL) {
+		gprs_connection = (struct ril_gprs_connection *) list->data;
+		if (gprs_connection == NULL)
+			goto list_continue;
+
+		if (gprs_connection->token == t)
+			return gprs_connection;
+
+list_continue:
+		list = list->next;
+	}
+
+	return NULL;
+}
+
+/*
+ * With RIL_GPRS_VNET_HDR_PROPERTY set, the kernel is told it can hand over
+ * TCP (and UDP, where it knows how) super packets with partial checksums.
+ * Falls back to a plain tun if it won't.
+ */
+static int gprs_tunnel_offload(int fd)
+{
+	unsigned int offload;
+
+	offload = TUN_F_CSUM | TUN_F_TSO4 | TUN_F_TSO6 | TUN_F_TSO_ECN;
+
+#if defined(TUN_F_USO4) && defined(VIRTIO_NET_HDR_GSO_UDP_L4)
+	if (ioctl(fd, TUNSETOFFLOAD, offload | TUN_F_USO4 | TUN_F_USO6) == 0)
+		return 0;
+#endif
+
+	return ioctl(fd, TUNSETOFFLOAD, offload);
+}
+
+static int gprs_tunnel_alloc(struct ril_gprs_connection *gprs_connection)
+{
+	char value[PROPERTY_VALUE_MAX];
+	int fd;
+
+	gprs_connection->vnet_hdr = 0;
+
+	property_get(RIL_GPRS_VNET_HDR_PROPERTY, value, "0");
+	if (strcmp(value, "1") == 0) {
+		fd = tun_alloc(gprs_connection->ifname, IFF_TUN | IFF_NO_PI | IFF_VNET_HDR);
+		if (fd >= 0 && gprs_tunnel_offload(fd) == 0) {
+			gprs_connection->vnet_hdr = 1;
+			return fd;
+		}
+
+		LOGE("%s: No offloads on %s, using a plain tun", __func__, gprs_connection->ifname);
+		if (fd >= 0)
+			close(fd);
+	}
+
+	return tun_alloc(gprs_connection->ifname, IFF_TUN | IFF_NO_PI);
+}
+
 struct ril_gprs_connection *ril_gprs_connection_start(void)
 {
 	struct ril_gprs_connection *gprs_connection;
@@ -267,7 +943,7 @@ list_continue:
 
 	gprs_connection = ril_gprs_connection_find_cid(cid);
 	asprintf(&gprs_connection->ifname, "tun%d", cid - 1);
-	gprs_connection->iface = tun_alloc(gprs_connection->ifname, IFF_TUN | IFF_NO_PI);
+	gprs_connection->iface = gprs_tunnel_alloc(gprs_connection);
 	if(gprs_connection->iface < 0)
 	{
 		LOGE("Couldn't create interface %s, errno: %d", gprs_connection->ifname, errno);
@@ -286,6 +962,8 @@ void ril_gprs_connection_stop(struct ril_gprs_connection *gprs_connection)
 	if (gprs_connection == NULL)
 		return;
 
+	gprs_tunnel_stop(gprs_connection);
+
 	if (gprs_connection->iface >= 0)
 		close(gprs_connection->iface);
 	if (gprs_connection->ifname != NULL)
@@ -294,6 +972,24 @@ void ril_gprs_connection_stop(struct ril_gprs_connection *gprs_connection)
 	ril_gprs_connection_unregister(gprs_connection);
 }
 
+/*
+ * Stops the network context, with no connection waiting for the answer:
+ * ipc_proto_stop_network_cnf won't find one and drops it.
+ */
+static void ril_gprs_context_stop(uint16_t type, uint32_t contextId)
+{
+	protoStopNetwork stop_network;
+
+	LOGD("Stopping orphaned network context %d", contextId);
+
+	memset(&stop_network, 0, sizeof(stop_network));
+	stop_network.opMode = PROTO_OPMODE_PS;
+	stop_network.protoType = type;
+	stop_network.contextId = contextId;
+
+	proto_stop_network(&stop_network);
+}
+
 #define IN_ADDR_FMT(ip) ((uint8_t*)&ip.s_addr)[0], ((uint8_t*)&ip.s_addr)[1], ((uint8_t*)&ip.s_addr)[2], ((uint8_t*)&ip.s_addr)[3] 
 
 void ipc_proto_start_network_cnf(void* data)
@@ -308,6 +1004,9 @@ void ipc_proto_start_network_cnf(void* data)
 
 	if (!gprs_connection) {
 		LOGE("Unable to find GPRS connection, aborting");
+		/* Setup timed out: close the context the modem opened after all */
+		if (netCnf->error == 0)
+			ril_gprs_context_stop(netCnf->protoType, netCnf->contextId);
 		return;
 	}
 	gprs_connection->contextId = netCnf->contextId;
@@ -317,7 +1016,7 @@ void ipc_proto_start_network_cnf(void* data)
 		//FIXME: add conversion for error
 		LOGE("There was an error, aborting port list complete");
 		gprs_connection->fail_cause = PDP_FAIL_ERROR_UNSPECIFIED;
-		ril_data.state.gprs_last_failed_cid = gprs_connection->cid;
+		gprs_last_failed_cid = gprs_connection->cid;
 		ril_request_complete(gprs_connection->token, RIL_E_GENERIC_FAILURE, NULL, 0);
 		gprs_connection->token = 0;
 		ril_gprs_connection_stop(gprs_connection); /* We can't rely on RILJ calling last_fail_cause */
@@ -330,12 +1029,12 @@ void ipc_proto_start_network_cnf(void* data)
 	// FIXME: subnet isn't reliable!
 	gprs_connection->prefix_len = 32;
 
-	if(gprs_start_tunneling_thread(gprs_connection) != 0)
+	if(gprs_tunnel_start(gprs_connection) != 0)
 	{
 		//TODO: Close proto on CP side
-		LOGE("Couldn't start the tunneling thread");
+		LOGE("Couldn't start tunneling");
 		gprs_connection->fail_cause = PDP_FAIL_ERROR_UNSPECIFIED;
-		ril_data.state.gprs_last_failed_cid = gprs_connection->cid;
+		gprs_last_failed_cid = gprs_connection->cid;
 		ril_request_complete(gprs_connection->token, RIL_E_GENERIC_FAILURE, NULL, 0);
 		gprs_connection->token = 0;
 		ril_gprs_connection_stop(gprs_connection); /* We can't rely on RILJ calling last_fail_cause */
@@ -349,7 +1048,7 @@ void ipc_proto_start_network_cnf(void* data)
 		//TODO: Close proto on CP side
 		LOGE("Couldn't ifc_configure on %s, errno: %d (check system logcat)", gprs_connection->ifname, errno);
 		gprs_connection->fail_cause = PDP_FAIL_ERROR_UNSPECIFIED;
-		ril_data.state.gprs_last_failed_cid = gprs_connection->cid;
+		gprs_last_failed_cid = gprs_connection->cid;
 		ril_request_complete(gprs_connection->token, RIL_E_GENERIC_FAILURE, NULL, 0);
 		gprs_connection->token = 0;
 		ril_gprs_connection_stop(gprs_connection); /* We can't rely on RILJ calling last_fail_cause */
@@ -426,19 +1125,33 @@ void ipc_proto_stop_network_cnf(void* data)
 	ril_unsol_data_call_list_changed(0);
 }
 
-void ipc_proto_receive_data_ind(void* data)
+/*
+ * Setup or deactivate deadline: the connection goes away with the request,
+ * so a late START_NETWORK_CNF can't bind to it. The modem's context, if
+ * it opens one after all, is closed when that CNF comes in, until then
+ * there is no contextId to stop.
+ */
+static void ril_gprs_data_call_expire(RIL_Token t)
 {
-	int n;
-	struct ril_gprs_connection *gprs_connection = NULL;
-	protoTransferDataBuf* rcvData = (protoTransferDataBuf*)data;
-	gprs_connection = ril_gprs_connection_find_contextId(rcvData->contextId);
-	if(!gprs_connection || gprs_connection->iface < 0)
-	{
-		LOGE("%s: Couldn't find gprs_connection context or tun fd is invalid!", __func__);
+	struct ril_gprs_connection *gprs_connection;
+	int active;
+
+	gprs_connection = ril_gprs_connection_find_token(t);
+	if (gprs_connection == NULL)
 		return;
+
+	gprs_connection->token = 0;
+	active = (gprs_connection->contextId != 0xFFFFFFFF);
+
+	LOGE("Data call on cid %d timed out, dropping it", gprs_connection->cid);
+
+	/* A late STOP_NETWORK_CNF for a deactivate finds nothing and is dropped */
+	ril_gprs_connection_stop(gprs_connection);
+
+	if (active) {
+		ril_data.data_call_count--;
+		ril_unsol_data_call_list_changed(0);
 	}
-	n = write(gprs_connection->iface, rcvData->netBuf, rcvData->netBufLen);
-	LOGD("%s: Wrote %d/%d bytes of the net frame into %s", __func__, n, rcvData->netBufLen, gprs_connection->ifname);
 }
 
 void ril_request_setup_data_call(RIL_Token t, void *data, int length)
@@ -479,6 +1192,7 @@ void ril_request_setup_data_call(RIL_Token t, void *data, int length)
 	}
 	gprs_connection->token = t;
 	gprs_connection->contextId = 0xFFFFFFFF;
+	ril_request_deadline_call(t, RIL_TIMEOUT_DATA_CALL_MS, RIL_E_GENERIC_FAILURE, ril_gprs_data_call_expire);
 
 	start_network = (protoStartNetwork *)calloc(1, sizeof(protoStartNetwork));
 
@@ -552,6 +1266,7 @@ void ril_request_deactivate_data_call(RIL_Token t, void *data, int length)
 	return;
 	}
 	gprs_connection->token = t;
+	ril_request_deadline_call(t, RIL_TIMEOUT_DATA_CALL_MS, RIL_E_GENERIC_FAILURE, ril_gprs_data_call_expire);
 
 	stop_network = (protoStopNetwork *)calloc(1, sizeof(protoStopNetwork));
 
@@ -573,7 +1288,7 @@ void ril_request_last_data_call_fail_cause(RIL_Token t)
 	int last_failed_cid;
 	int fail_cause;
 
-	last_failed_cid = ril_data.state.gprs_last_failed_cid;
+	last_failed_cid = gprs_last_failed_cid;
 
 	if (!last_failed_cid) {
 		LOGE("No GPRS connection was reported to have failed");
@@ -597,7 +1312,7 @@ fail_cause_unspecified:
 	fail_cause = PDP_FAIL_ERROR_UNSPECIFIED;
 
 fail_cause_return:
-	ril_data.state.gprs_last_failed_cid = 0;
+	gprs_last_failed_cid = 0;
 
 	ril_request_complete(t, RIL_E_SUCCESS, &fail_cause, sizeof(fail_cause));
 }
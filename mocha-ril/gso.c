@@ -0,0 +1,444 @@
+/**
+ * This file is part of mocha-ril.
+ *
+ * mocha-ril is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * mocha-ril is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with mocha-ril.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <string.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+
+#include "gso.h"
+
+#define GSO_TCP_FIN	0x01
+#define GSO_TCP_PSH	0x08
+#define GSO_TCP_ACK	0x10
+#define GSO_TCP_CWR	0x80
+
+/*
+ * Ones' complement sum in host order, 32 bits at a time into a 64 bit
+ * accumulator so carries only need folding once at the end. The odd
+ * trailing byte counts as the high byte of a word in network order.
+ */
+static uint64_t gso_sum(const uint8_t *data, uint32_t length, uint64_t sum)
+{
+	uint32_t word;
+	uint16_t half = 0;
+
+	while(length >= 4) {
+		memcpy(&word, data, 4);
+		sum += word;
+		data += 4;
+		length -= 4;
+	}
+
+	if(length >= 2) {
+		memcpy(&half, data, 2);
+		sum += half;
+		data += 2;
+		length -= 2;
+	}
+
+	if(length > 0) {
+		half = 0;
+		memcpy(&half, data, 1);
+		sum += half;
+	}
+
+	return sum;
+}
+
+static uint16_t gso_fold(uint64_t sum)
+{
+	while(sum >> 16)
+		sum = (sum & 0xffff) + (sum >> 16);
+
+	return (uint16_t) sum;
+}
+
+static uint64_t gso_pseudo_sum(const uint8_t *ip, int ipv6, uint8_t protocol, uint32_t length)
+{
+	uint64_t sum;
+
+	if(ipv6)
+		sum = gso_sum(ip + 8, 32, 0);
+	else
+		sum = gso_sum(ip + 12, 8, 0);
+
+	return sum + htons(protocol) + htons((uint16_t) length);
+}
+
+static uint16_t gso_get16(const uint8_t *data)
+{
+	uint16_t value;
+
+	memcpy(&value, data, 2);
+
+	return ntohs(value);
+}
+
+static void gso_put16(uint8_t *data, uint16_t value)
+{
+	value = htons(value);
+	memcpy(data, &value, 2);
+}
+
+static uint32_t gso_get32(const uint8_t *data)
+{
+	uint32_t value;
+
+	memcpy(&value, data, 4);
+
+	return ntohl(value);
+}
+
+static void gso_put32(uint8_t *data, uint32_t value)
+{
+	value = htonl(value);
+	memcpy(data, &value, 4);
+}
+
+static void gso_ipv4_checksum(uint8_t *ip, uint32_t ip_length)
+{
+	uint16_t check;
+
+	memset(ip + 10, 0, 2);
+	check = ~gso_fold(gso_sum(ip, ip_length, 0));
+	memcpy(ip + 10, &check, 2);
+}
+
+/*
+ * Fills in the IP and transport header lengths of a packet, 0 if it's
+ * not TCP or UDP over IPv4 or IPv6 without extension headers.
+ */
+static int gso_parse(const uint8_t *packet, uint32_t length, uint32_t *ip_length,
+	uint32_t *header_length, int *ipv6, uint8_t *protocol)
+{
+	uint32_t l4_length;
+
+	if(length < 20)
+		return 0;
+
+	switch(packet[0] >> 4) {
+		case 4:
+			*ipv6 = 0;
+			*ip_length = (packet[0] & 0x0f) * 4;
+			*protocol = packet[9];
+			if(*ip_length < 20)
+				return 0;
+			break;
+		case 6:
+			*ipv6 = 1;
+			*ip_length = 40;
+			if(length < 40)
+				return 0;
+			*protocol = packet[6];
+			break;
+		default:
+			return 0;
+	}
+
+	switch(*protocol) {
+		case IPPROTO_TCP:
+			if(length < *ip_length + 20)
+				return 0;
+			l4_length = (packet[*ip_length + 12] >> 4) * 4;
+			if(l4_length < 20)
+				return 0;
+			break;
+		case IPPROTO_UDP:
+			l4_length = 8;
+			break;
+		default:
+			return 0;
+	}
+
+	*header_length = *ip_length + l4_length;
+
+	return length >= *header_length;
+}
+
+/*
+ * Gets a packet read off the tun ready to go to the modem. Returns 0 when
+ * it can go as is, its checksum completed if the kernel left it partial,
+ * the number of segments to get with gso_segment_next when it's a super
+ * packet, -1 when it has to be dropped.
+ */
+int gso_segment_start(struct gso_segmenter *gso, struct virtio_net_hdr *hdr,
+	uint8_t *packet, uint32_t length, uint32_t mtu)
+{
+	uint32_t start, offset;
+	uint16_t check;
+	uint8_t protocol;
+	int udp;
+
+	memset(gso, 0, sizeof(struct gso_segmenter));
+
+	if(hdr->gso_type == VIRTIO_NET_HDR_GSO_NONE) {
+		if(length > mtu)
+			return -1;
+
+		if(!(hdr->flags & VIRTIO_NET_HDR_F_NEEDS_CSUM))
+			return 0;
+
+		start = hdr->csum_start;
+		offset = hdr->csum_offset;
+		if(start + offset + 2 > length)
+			return -1;
+
+		/* The field already holds the pseudo header sum */
+		check = ~gso_fold(gso_sum(packet + start, length - start, 0));
+		if(check == 0 && offset == 6)
+			check = 0xffff;
+		memcpy(packet + start + offset, &check, 2);
+
+		return 0;
+	}
+
+	switch(hdr->gso_type & ~VIRTIO_NET_HDR_GSO_ECN) {
+		case VIRTIO_NET_HDR_GSO_TCPV4:
+		case VIRTIO_NET_HDR_GSO_TCPV6:
+			udp = 0;
+			break;
+#ifdef VIRTIO_NET_HDR_GSO_UDP_L4
+		case VIRTIO_NET_HDR_GSO_UDP_L4:
+			udp = 1;
+			break;
+#endif
+		default:
+			return -1;
+	}
+
+	if(!gso_parse(packet, length, &gso->ip_length, &gso->header_length, &gso->ipv6, &protocol) ||
+	   protocol != (udp ? IPPROTO_UDP : IPPROTO_TCP) || gso->header_length >= mtu)
+		return -1;
+
+	gso->packet = packet;
+	gso->length = length;
+	gso->udp = udp;
+	gso->mss = mtu - gso->header_length;
+	if(hdr->gso_size > 0 && hdr->gso_size < gso->mss)
+		gso->mss = hdr->gso_size;
+	gso->offset = gso->header_length;
+
+	return (length - gso->header_length + gso->mss - 1) / gso->mss;
+}
+
+/* Writes the next segment to out, returns its length or 0 when done */
+uint32_t gso_segment_next(struct gso_segmenter *gso, uint8_t *out)
+{
+	uint32_t payload, total, l4_length;
+	uint8_t *l4;
+	uint16_t check;
+	uint8_t flags;
+
+	if(gso->offset >= gso->length)
+		return 0;
+
+	payload = gso->length - gso->offset;
+	if(payload > gso->mss)
+		payload = gso->mss;
+	total = gso->header_length + payload;
+	l4_length = total - gso->ip_length;
+
+	memcpy(out, gso->packet, gso->header_length);
+	memcpy(out + gso->header_length, gso->packet + gso->offset, payload);
+
+	if(gso->ipv6) {
+		gso_put16(out + 4, (uint16_t) l4_length);
+	} else {
+		gso_put16(out + 2, (uint16_t) total);
+		gso_put16(out + 4, gso_get16(gso->packet + 4) + gso->index);
+		gso_ipv4_checksum(out, gso->ip_length);
+	}
+
+	l4 = out + gso->ip_length;
+
+	if(gso->udp) {
+		gso_put16(l4 + 4, (uint16_t) l4_length);
+		memset(l4 + 6, 0, 2);
+	} else {
+		gso_put32(l4 + 4, gso_get32(gso->packet + gso->ip_length + 4) + (gso->offset - gso->header_length));
+
+		flags = l4[13];
+		if(gso->offset + payload < gso->length)
+			flags &= ~(GSO_TCP_FIN | GSO_TCP_PSH);
+		if(gso->index > 0)
+			flags &= ~GSO_TCP_CWR;
+		l4[13] = flags;
+
+		memset(l4 + 16, 0, 2);
+	}
+
+	check = ~gso_fold(gso_pseudo_sum(out, gso->ipv6, gso->udp ? IPPROTO_UDP : IPPROTO_TCP, l4_length) +
+		gso_sum(l4, l4_length, 0));
+	if(check == 0 && gso->udp)
+		check = 0xffff;
+	memcpy(l4 + (gso->udp ? 6 : 16), &check, 2);
+
+	gso->offset += payload;
+	gso->index++;
+
+	return total;
+}
+
+void gro_init(struct gro *gro, uint8_t *buf)
+{
+	memset(gro, 0, sizeof(struct gro));
+	gro->buf = buf;
+}
+
+/*
+ * Plain ACK segments with data, over IPv4 without options or fragments
+ * or over IPv6 without extension headers
+ */
+static int gro_candidate(const uint8_t *packet, uint32_t *length, uint32_t *ip_length,
+	uint32_t *header_length, int *ipv6)
+{
+	uint32_t ip_total;
+	uint8_t protocol;
+	uint8_t flags;
+
+	if(!gso_parse(packet, *length, ip_length, header_length, ipv6, &protocol) ||
+	   protocol != IPPROTO_TCP)
+		return 0;
+
+	if(*ipv6) {
+		ip_total = 40 + gso_get16(packet + 4);
+	} else {
+		if(*ip_length != 20 || (gso_get16(packet + 6) & 0x3fff) != 0)
+			return 0;
+		ip_total = gso_get16(packet + 2);
+	}
+
+	/* Anything the modem padded the packet with goes */
+	if(ip_total > *length || ip_total <= *header_length)
+		return 0;
+	*length = ip_total;
+
+	flags = packet[*ip_length + 13];
+
+	return (flags & GSO_TCP_ACK) && !(flags & ~(GSO_TCP_ACK | GSO_TCP_PSH));
+}
+
+/*
+ * Takes a downlink packet into the super packet being built, starting one
+ * if there's none. Returns -1 if it can't be merged, the caller then
+ * sends what gro_finish gives and tries again, or sends the packet alone.
+ */
+int gro_append(struct gro *gro, const uint8_t *packet, uint32_t length)
+{
+	uint32_t ip_length, header_length, payload;
+	const uint8_t *tcp, *merged_tcp;
+	int ipv6;
+
+	if(!gro_candidate(packet, &length, &ip_length, &header_length, &ipv6))
+		return -1;
+
+	payload = length - header_length;
+	tcp = packet + ip_length;
+
+	if(gro->length == 0) {
+		memcpy(gro->buf, packet, length);
+		gro->length = length;
+		gro->ip_length = ip_length;
+		gro->header_length = header_length;
+		gro->ipv6 = ipv6;
+		gro->mss = payload;
+		gro->segments = 1;
+		gro->next_seq = gso_get32(tcp + 4) + payload;
+		gro->closed = (tcp[13] & GSO_TCP_PSH) != 0;
+		return 0;
+	}
+
+	if(gro->closed || gro->segments >= GRO_MAX_SEGMENTS || ipv6 != gro->ipv6 ||
+	   header_length != gro->header_length || payload > gro->mss ||
+	   gro->length + payload > GSO_MAX_SIZE)
+		return -1;
+
+	/* Same addresses, TOS/traffic class, TTL and DF */
+	if(ipv6) {
+		if(memcmp(packet, gro->buf, 4) != 0 || packet[7] != gro->buf[7] ||
+		   memcmp(packet + 8, gro->buf + 8, 32) != 0)
+			return -1;
+	} else {
+		if(packet[1] != gro->buf[1] || packet[6] != gro->buf[6] || packet[8] != gro->buf[8] ||
+		   memcmp(packet + 12, gro->buf + 12, 8) != 0)
+			return -1;
+	}
+
+	/* Same ports, ack, window and options, and right after the last one */
+	merged_tcp = gro->buf + ip_length;
+	if(memcmp(tcp, merged_tcp, 4) != 0 || memcmp(tcp + 8, merged_tcp + 8, 4) != 0 ||
+	   memcmp(tcp + 14, merged_tcp + 14, 2) != 0 ||
+	   memcmp(tcp + 20, merged_tcp + 20, header_length - ip_length - 20) != 0 ||
+	   gso_get32(tcp + 4) != gro->next_seq)
+		return -1;
+
+	memcpy(gro->buf + gro->length, packet + header_length, payload);
+	gro->length += payload;
+	gro->next_seq += payload;
+	gro->segments++;
+
+	if(payload < gro->mss)
+		gro->closed = 1;
+	if(tcp[13] & GSO_TCP_PSH) {
+		gro->buf[ip_length + 13] |= GSO_TCP_PSH;
+		gro->closed = 1;
+	}
+
+	return 0;
+}
+
+/*
+ * Ends the super packet and fills in the vnet header for it, returns its
+ * length in gro->buf or 0 if there was none. A merged packet goes with a
+ * partial checksum, the kernel never needs to check it or segments it
+ * again itself.
+ */
+uint32_t gro_finish(struct gro *gro, struct virtio_net_hdr *hdr)
+{
+	uint32_t length, l4_length;
+	uint16_t check;
+
+	memset(hdr, 0, sizeof(struct virtio_net_hdr));
+
+	length = gro->length;
+	gro->length = 0;
+
+	if(length == 0 || gro->segments == 1)
+		return length;
+
+	l4_length = length - gro->ip_length;
+
+	if(gro->ipv6) {
+		gso_put16(gro->buf + 4, (uint16_t) l4_length);
+	} else {
+		gso_put16(gro->buf + 2, (uint16_t) length);
+		gso_ipv4_checksum(gro->buf, gro->ip_length);
+	}
+
+	check = gso_fold(gso_pseudo_sum(gro->buf, gro->ipv6, IPPROTO_TCP, l4_length));
+	memcpy(gro->buf + gro->ip_length + 16, &check, 2);
+
+	hdr->flags = VIRTIO_NET_HDR_F_NEEDS_CSUM;
+	hdr->gso_type = gro->ipv6 ? VIRTIO_NET_HDR_GSO_TCPV6 : VIRTIO_NET_HDR_GSO_TCPV4;
+	hdr->gso_size = gro->mss;
+	hdr->hdr_len = gro->header_length;
+	hdr->csum_start = gro->ip_length;
+	hdr->csum_offset = 16;
+
+	return length;
+}
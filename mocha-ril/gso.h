@@ -0,0 +1,74 @@
+/**
+ * This file is part of mocha-ril.
+ *
+ * mocha-ril is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * mocha-ril is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with mocha-ril.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef _SAMSUNG_RIL_GSO_H_
+#define _SAMSUNG_RIL_GSO_H_
+
+#include <stdint.h>
+#include <linux/virtio_net.h>
+
+/*
+ * Segmentation and coalescing for tun devices opened with IFF_VNET_HDR.
+ * Every packet on such a tun comes with a struct virtio_net_hdr, in host
+ * byte order. The kernel hands over TCP (and UDP, where supported) super
+ * packets with a partial checksum, gso_segment cuts them down to the
+ * modem MTU. The other way, gro_append merges back to back segments of a
+ * TCP flow and gro_finish turns them into one super packet for the
+ * kernel to take in a single write.
+ */
+
+/* Largest super packet, IP header included */
+#define GSO_MAX_SIZE		65535
+/* Segments merged into one super packet at most */
+#define GRO_MAX_SEGMENTS	64
+
+struct gso_segmenter {
+	uint8_t *packet;
+	uint32_t length;
+	uint32_t ip_length;
+	uint32_t header_length;
+	int ipv6;
+	int udp;
+	uint32_t mss;
+
+	uint32_t offset;
+	uint32_t index;
+};
+
+struct gro {
+	uint8_t *buf;
+	uint32_t length;
+	uint32_t ip_length;
+	uint32_t header_length;
+	int ipv6;
+	uint32_t mss;
+	uint32_t segments;
+	uint32_t next_seq;
+	/* A short or PSH segment ends the super packet */
+	int closed;
+};
+
+int gso_segment_start(struct gso_segmenter *gso, struct virtio_net_hdr *hdr,
+	uint8_t *packet, uint32_t length, uint32_t mtu);
+uint32_t gso_segment_next(struct gso_segmenter *gso, uint8_t *out);
+
+void gro_init(struct gro *gro, uint8_t *buf);
+int gro_append(struct gro *gro, const uint8_t *packet, uint32_t length);
+uint32_t gro_finish(struct gro *gro, struct virtio_net_hdr *hdr);
+
+#endif
@@ -19,6 +19,10 @@
  *
  */
 
+#include <time.h>
+
+#include <cutils/properties.h>
+
 #define LOG_TAG "RIL-Mocha-IPC"
 #include <utils/Log.h>
 
@@ -34,108 +38,278 @@ void ipc_log_handler(const char *message, void *user_data)
 	LOGD("ipc: %s", message);
 }
 
+/*
+ * Returns the ipc_client with the given direction locked, or NULL when the
+ * client is being (re)created or destroyed. client->data can't go away
+ * while either lock is held since ipc_destroy takes both first.
+ */
+static struct ipc_client *ipc_client_lock(struct ril_client *client, int tx)
+{
+	struct ipc_client_data *client_data;
+
+	if(client == NULL)
+		return NULL;
+
+	RIL_CLIENT_LOCK(client);
+
+	client_data = (struct ipc_client_data *) client->data;
+
+	if(client_data == NULL || client_data->ipc_client == NULL || client_data->closing) {
+		RIL_CLIENT_UNLOCK(client);
+		return NULL;
+	}
+
+	pthread_mutex_lock(tx ? &client_data->tx_mutex : &client_data->rx_mutex);
+
+	RIL_CLIENT_UNLOCK(client);
+
+	return client_data->ipc_client;
+}
+
+struct ipc_client *ipc_client_rx_lock(struct ril_client *client)
+{
+	return ipc_client_lock(client, 0);
+}
+
+void ipc_client_rx_unlock(struct ril_client *client)
+{
+	pthread_mutex_unlock(&((struct ipc_client_data *) client->data)->rx_mutex);
+}
+
+struct ipc_client *ipc_client_tx_lock(struct ril_client *client)
+{
+	return ipc_client_lock(client, 1);
+}
+
+void ipc_client_tx_unlock(struct ril_client *client)
+{
+	pthread_mutex_unlock(&((struct ipc_client_data *) client->data)->tx_mutex);
+}
+
 /**
  * IPC main frame type
  */
 
 void ipc_send(struct modem_io *request)
+{
+	struct iovec iov;
+
+	iov.iov_base = request->data;
+	iov.iov_len = request->datasize;
+
+	ipc_sendv(request->cmd, &iov, 1);
+}
+
+/* Frames are queued for the writer thread, written inline only without one */
+void ipc_sendv(uint32_t cmd, struct iovec *iov, int iovcnt)
 {
 	struct ipc_client *ipc_client;
-	if(ril_data.ipc_packet_client == NULL) {
-		LOGE("ipc_packet_client is null, aborting!");
+
+	if(ipc_tx_queue_frame(cmd, iov, iovcnt) == 0)
+		return;
+
+	ipc_client = ipc_client_tx_lock(ril_data.ipc_packet_client);
+
+	if(ipc_client == NULL) {
+		LOGE("ipc_packet_client is not ready, aborting!");
 		return;
 	}
 
-	if(ril_data.ipc_packet_client->data == NULL) {
-		LOGE("ipc_packet_client data is null, aborting!");
+	ipc_client_sendv(ipc_client, cmd, iov, iovcnt);
+	ipc_client_tx_unlock(ril_data.ipc_packet_client);
+}
+
+/*
+ * Sends a frame built in a pooled buffer with IPC_FRAME_HEADROOM free bytes
+ * in front of frame->data, so the FIFO header goes in there. The frame's
+ * reference is consumed.
+ */
+void ipc_send_frame(uint32_t cmd, struct modem_io *frame)
+{
+	struct ipc_client *ipc_client;
+	struct ipc_frame_iov frame_iov;
+	struct iovec iov;
+
+	if(ipc_tx_queue_buffer(cmd, frame) == 0)
+		return;
+
+	ipc_client = ipc_client_tx_lock(ril_data.ipc_packet_client);
+
+	if(ipc_client == NULL) {
+		LOGE("ipc_packet_client is not ready, aborting!");
+		ipc_frame_unref(frame);
 		return;
 	}
 
-	ipc_client = ((struct ipc_client_data *) ril_data.ipc_packet_client->data)->ipc_client;
+	iov.iov_base = frame->data;
+	iov.iov_len = frame->datasize;
+
+	frame_iov.cmd = cmd;
+	frame_iov.iov = &iov;
+	frame_iov.iovcnt = 1;
+	frame_iov.headroom = 1;
+
+	ipc_client_send_batch(ipc_client, &frame_iov, 1);
+	ipc_client_tx_unlock(ril_data.ipc_packet_client);
 
-	RIL_CLIENT_LOCK(ril_data.ipc_packet_client);
-	ipc_client_send(ipc_client, request);
-	RIL_CLIENT_UNLOCK(ril_data.ipc_packet_client);
+	ipc_frame_unref(frame);
 }
 
 int ipc_modem_io(void *data, uint32_t cmd)
 {
 	int retval;
 	struct ipc_client *ipc_client;
-	if(ril_data.ipc_packet_client == NULL) {
-		LOGE("ipc_packet_client is null, aborting!");
-		return -1;
-	}
 
-	if(ril_data.ipc_packet_client->data == NULL) {
-		LOGE("ipc_packet_client data is null, aborting!");
+	/* Keep ioctls ordered after the frames queued before them */
+	ipc_tx_flush();
+
+	ipc_client = ipc_client_tx_lock(ril_data.ipc_packet_client);
+
+	if(ipc_client == NULL) {
+		LOGE("ipc_packet_client is not ready, aborting!");
 		return -1;
 	}
 
-	ipc_client = ((struct ipc_client_data *) ril_data.ipc_packet_client->data)->ipc_client;
-
-	RIL_CLIENT_LOCK(ril_data.ipc_packet_client);
 	retval = ipc_client_modem_operations(ipc_client, data, cmd);
-	RIL_CLIENT_UNLOCK(ril_data.ipc_packet_client);
+	ipc_client_tx_unlock(ril_data.ipc_packet_client);
 
 	return retval;
 }
 
-int ipc_read_loop(struct ril_client *client)
+static uint64_t ipc_time_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/*
+ * Called by the reactor when the modem fd is readable. The client is
+ * non-blocking, a frame only partly in is kept in the transport buffer
+ * and the reactor goes back to its other fds until the rest comes in.
+ * Frames left in the transport buffer won't make the fd readable again,
+ * so keep going until it's drained. Frames are handed to the subsystem
+ * workers while the receive lock is still held, so once ipc_destroy got
+ * that lock every frame of the client is queued and ril_workers_flush
+ * covers them all.
+ */
+static void ipc_read_event(int fd, uint32_t events, void *data)
 {
-    struct modem_io resp;
+	struct ril_client *client = (struct ril_client *) data;
+	struct modem_io frames[IPC_RECV_BATCH];
 	struct ipc_client *ipc_client;
-	int ipc_client_fd;
-	fd_set fds;
+	uint64_t received_us;
+	int pending;
+	int count;
 
-	if(client == NULL) {
-		LOGE("client is NULL, aborting!");
-		return -1;
+	if(events & (EPOLLERR | EPOLLHUP)) {
+		LOGE("IPC fd %d hung up, aborting!", fd);
+		ril_client_recover(client);
+		return;
 	}
 
-	if(client->data == NULL) {
-		LOGE("client data is NULL, aborting!");
-		return -1;
-	}
+	do {
+		ipc_client = ipc_client_rx_lock(client);
 
-	ipc_client = ((struct ipc_client_data *) client->data)->ipc_client;
-	ipc_client_fd = ((struct ipc_client_data *) client->data)->ipc_client_fd;
+		if(ipc_client == NULL)
+			return;
 
-	FD_ZERO(&fds);
-	FD_SET(ipc_client_fd, &fds);
+		/* Before the read, for the downlink latency */
+		received_us = ipc_time_us();
 
-	LOGI("Starting read loop, fd = %d", ipc_client_fd);
+		count = ipc_client_recv_batch(ipc_client, frames, IPC_RECV_BATCH);
+		pending = ipc_client_recv_pending(ipc_client);
 
-	while(1) {
-		if(ipc_client_fd < 0) {
-			LOGE("IPC client fd is negative, aborting!");
-			return -1;
+		if(count > 0)
+			ril_workers_queue(ipc_client, frames, count, received_us);
+
+		ipc_client_rx_unlock(client);
+
+		if(count < 0) {
+			LOGE("IPC recv failed, aborting!");
+			ril_client_recover(client);
+			return;
 		}
+	} while(pending);
+}
 
-		select(FD_SETSIZE, &fds, NULL, NULL, NULL);
-
-		if(FD_ISSET(ipc_client_fd, &fds)) {
-			RIL_CLIENT_LOCK(client);
-			if(ipc_client_recv(ipc_client, &resp) < 0) {
-				RIL_CLIENT_UNLOCK(client);
-				LOGE("IPC recv failed, aborting!");
-				return -1;
-			}
-			RIL_CLIENT_UNLOCK(client);
-			
-			RIL_LOCK();
-			ipc_dispatch(ipc_client, &resp);			
-			RIL_UNLOCK();
-			
-			if(resp.data != NULL)
-				free(resp.data);
+/*
+ * Starts, restarts or (with an empty spec) stops the frame capture, see
+ * IPC_CAPTURE_PROPERTY for the spec.
+ */
+int ipc_capture_configure(const char *spec)
+{
+	char name[PROPERTY_VALUE_MAX];
+	char path[sizeof(IPC_CAPTURE_DIR) + PROPERTY_VALUE_MAX];
+	unsigned int size_kb = IPC_CAPTURE_SIZE_DEFAULT;
+	int files = IPC_CAPTURE_FILES_DEFAULT;
+	char *p;
+
+	if(spec == NULL || spec[0] == '\0') {
+		ipc_capture_stop();
+		LOGI("IPC capture stopped");
+		return 0;
+	}
+
+	strncpy(name, spec, sizeof(name) - 1);
+	name[sizeof(name) - 1] = '\0';
+
+	p = strchr(name, ',');
+	if(p != NULL) {
+		*p++ = '\0';
+		if(sscanf(p, "%u,%d", &size_kb, &files) < 1) {
+			LOGE("Bad IPC capture spec: %s", spec);
+			return -1;
 		}
 	}
-	LOGI("Exiting read loop");
+
+	/* A plain file name in IPC_CAPTURE_DIR, never a path */
+	if(name[0] == '\0' || strchr(name, '/') != NULL || strstr(name, "..") != NULL) {
+		LOGE("Bad IPC capture file name: %s", name);
+		return -1;
+	}
+
+	snprintf(path, sizeof(path), "%s/%s", IPC_CAPTURE_DIR, name);
+
+	if(ipc_capture_start(path, size_kb * 1024, files) < 0) {
+		LOGE("Unable to start IPC capture to %s", path);
+		return -1;
+	}
+
+	LOGI("IPC capture to %s, %d files of %dKiB", path, files, size_kb);
 
 	return 0;
 }
 
+int ipc_attach(struct ril_client *client, struct ril_reactor *reactor)
+{
+	struct ipc_client_data *client_data;
+	int fd;
+
+	if(client == NULL || client->data == NULL)
+		return -1;
+
+	client_data = (struct ipc_client_data *) client->data;
+
+	/* The io_uring fd when completions stand in for readiness */
+	fd = ipc_client_get_poll_fd(client_data->ipc_client);
+
+	LOGI("Attaching IPC client, fd = %d", fd);
+
+	return ril_event_add(reactor, &client_data->event, fd,
+		EPOLLIN, RIL_EVENT_PRIORITY_HIGH, ipc_read_event, (void *) client);
+}
+
+int ipc_detach(struct ril_client *client)
+{
+	if(client == NULL || client->data == NULL)
+		return 0;
+
+	return ril_event_del(&((struct ipc_client_data *) client->data)->event);
+}
+
 int ipc_create(struct ril_client *client)
 {
 	struct ipc_client_data *client_object;
@@ -146,7 +320,10 @@ int ipc_create(struct ril_client *client)
 	client_object = malloc(sizeof(struct ipc_client_data));
 	memset(client_object, 0, sizeof(struct ipc_client_data));
 	client_object->ipc_client_fd = -1;
+	pthread_mutex_init(&client_object->rx_mutex, NULL);
+	pthread_mutex_init(&client_object->tx_mutex, NULL);
 
+	RIL_CLIENT_LOCK(client);
 	client->data = client_object;
 
 	ipc_client = (struct ipc_client *) client_object->ipc_client;
@@ -156,6 +333,7 @@ int ipc_create(struct ril_client *client)
 
 	if(ipc_client == NULL) {
 		LOGE("Client creation failed!");
+		RIL_CLIENT_UNLOCK(client);
 		return -1;
 	}
 
@@ -166,6 +344,7 @@ int ipc_create(struct ril_client *client)
 
 	if(rc < 0) {
 		LOGE("Setting log handler failed!");
+		RIL_CLIENT_UNLOCK(client);
 		return -1;
 	}
 
@@ -176,6 +355,7 @@ int ipc_create(struct ril_client *client)
 
 	if(rc < 0) {
 		LOGE("Creating handlers common data failed!");
+		RIL_CLIENT_UNLOCK(client);
 		return -1;
 	}
 
@@ -184,12 +364,21 @@ int ipc_create(struct ril_client *client)
 
 	if(rc < 0) {
 		LOGE("Modem bootstrap failed!");
+		RIL_CLIENT_UNLOCK(client);
 		return -1;
 	}
 
 	LOGD("Client open...");
 	if(ipc_client_open(ipc_client)) {
 		LOGE("%s: failed to open ipc client", __FUNCTION__);
+		RIL_CLIENT_UNLOCK(client);
+		return -1;
+	}
+
+	/* The reactor thread must never wait in read() */
+	if(ipc_client_set_nonblocking(ipc_client) < 0) {
+		LOGE("%s: failed to make ipc client non-blocking", __FUNCTION__);
+		RIL_CLIENT_UNLOCK(client);
 		return -1;
 	}
 
@@ -199,10 +388,13 @@ int ipc_create(struct ril_client *client)
 
 	if(ipc_client_fd < 0) {
 		LOGE("%s: client_fd is negative, aborting", __FUNCTION__);
+		RIL_CLIENT_UNLOCK(client);
 		return -1;
 	}
 
 
+	RIL_CLIENT_UNLOCK(client);
+
 	LOGD("IPC client done");
 
 	return 0;
@@ -210,6 +402,18 @@ int ipc_create(struct ril_client *client)
 
 int ipc_destroy(struct ril_client *client)
 {
+	struct ipc_frame_pool_stats stats;
+	struct ipc_transport_stats transport_stats;
+	struct ipc_tx_stats tx_stats;
+	struct ipc_dispatch_stats dispatch_stats[IPC_DISPATCH_STATS];
+	struct ril_delivery_stats delivery_stats;
+	struct ipc_capture_stats capture_stats;
+	struct ril_request_stats request_stats;
+	struct ril_state_stats state_stats;
+	struct gprs_downlink_stats downlink_stats;
+	int count;
+	int i;
+	struct ipc_client_data *client_data;
 	struct ipc_client *ipc_client;
 	int ipc_client_fd;
 	int rc;
@@ -221,26 +425,119 @@ int ipc_destroy(struct ril_client *client)
 		return 0;
 	}
 
-	if(client->data == NULL) {
+	RIL_CLIENT_LOCK(client);
+
+	client_data = (struct ipc_client_data *) client->data;
+
+	if(client_data == NULL || client_data->closing) {
+		RIL_CLIENT_UNLOCK(client);
 		LOGE("client data was already destroyed");
 		return 0;
 	}
 
-	ipc_client_fd = ((struct ipc_client_data *) client->data)->ipc_client_fd;
+	/*
+	 * Lockers take rx_mutex or tx_mutex before they let go of the client
+	 * lock, so from here on nobody new gets in and the ones inside just
+	 * have to finish.
+	 */
+	client_data->closing = 1;
 
-	if(ipc_client_fd)
-		close(ipc_client_fd);
+	RIL_CLIENT_UNLOCK(client);
+
+	ril_event_del(&client_data->event);
+
+	/*
+	 * Wait for the reader and the writer to be out of the client, without
+	 * the client lock. The fd is non-blocking, so the reader doesn't sit
+	 * in read() for long.
+	 */
+	pthread_mutex_lock(&client_data->rx_mutex);
+	pthread_mutex_lock(&client_data->tx_mutex);
+	pthread_mutex_unlock(&client_data->tx_mutex);
+	pthread_mutex_unlock(&client_data->rx_mutex);
+
+	RIL_CLIENT_LOCK(client);
+	client->data = NULL;
+	RIL_CLIENT_UNLOCK(client);
 
-	ipc_client = ((struct ipc_client_data *) client->data)->ipc_client;
+	/*
+	 * Queued frames still point to the client. Nobody can reach it
+	 * anymore, so the workers can send (and fail) without deadlocking.
+	 */
+	ril_workers_flush();
+
+	/* And what they answered went out, before the stats below */
+	ril_delivery_flush();
+
+	/* Unreachable now, so it's torn down without any lock */
+	ipc_client_fd = client_data->ipc_client_fd;
+	ipc_client = client_data->ipc_client;
 
 	if(ipc_client != NULL) {
-		ipc_client_destroy_handlers_common_data(ipc_client);
+		if(ipc_client_get_frame_pool_stats(ipc_client, &stats) == 0)
+			LOGD("Frame pool: size %d, high-water %d, misses %d/%d",
+				stats.size, stats.high_water, stats.misses, stats.allocs);
+
+		if(ipc_client_get_transport_stats(ipc_client, &transport_stats) == 0)
+			LOGD("Transport: %d frames in %d reads, %d resyncs (%d bytes skipped)",
+				transport_stats.frames, transport_stats.read_calls,
+				transport_stats.resyncs, transport_stats.skipped);
+
+		ipc_tx_get_stats(&tx_stats);
+		LOGD("TX queue: %d batches", tx_stats.batches);
+		for(i = 0 ; i < IPC_TX_CLASS_COUNT ; i++)
+			LOGD("TX class %d: %d frames, max depth %d, %d full waits, max delay %dus",
+				i, tx_stats.classes[i].written, tx_stats.classes[i].max_depth,
+				tx_stats.classes[i].full_waits, tx_stats.classes[i].max_latency_us);
+
+		count = ipc_dispatch_get_stats(dispatch_stats, IPC_DISPATCH_STATS);
+		for(i = 0 ; i < count ; i++)
+			LOGD("Dispatch %s: %d packets, %lluus", dispatch_stats[i].name, dispatch_stats[i].count,
+				(unsigned long long) dispatch_stats[i].time_ns / 1000);
+
+		ril_workers_log_stats();
+
+		gprs_downlink_get_stats(&downlink_stats);
+		if(downlink_stats.packets > 0)
+			LOGD("Downlink: %d packets (%llu bytes), %d dropped, %d packets/s, latency avg %dus, max %dus",
+				downlink_stats.packets, (unsigned long long) downlink_stats.bytes, downlink_stats.dropped,
+				downlink_stats.last_us > downlink_stats.first_us ? (uint32_t) ((uint64_t) downlink_stats.packets * 1000000 / (downlink_stats.last_us - downlink_stats.first_us)) : 0,
+				(uint32_t) (downlink_stats.total_latency_us / downlink_stats.packets), downlink_stats.max_latency_us);
+
+		ril_delivery_get_stats(&delivery_stats);
+		LOGD("Delivery: %d queued, %d superseded, %d delivered in %d wakeups, max depth %d, max %dus",
+			delivery_stats.queued, delivery_stats.superseded, delivery_stats.delivered,
+			delivery_stats.wakeups, delivery_stats.max_depth, delivery_stats.max_latency_us);
+
+		ril_request_get_stats(&request_stats);
+		LOGD("Requests: %d pending, at most %d, %d ids skipped, %d deadlines, %d timeouts",
+			request_stats.pending, request_stats.max_pending, request_stats.id_skips,
+			request_stats.deadlines, request_stats.timeouts);
+		for(i = 0 ; i < RIL_REQUEST_TIMEOUT_TYPES ; i++)
+			if(request_stats.timeouts_by_request[i] > 0)
+				LOGD("Request %d: %d timeouts", i, request_stats.timeouts_by_request[i]);
+
+		ril_state_get_stats(&state_stats);
+		LOGD("State: %d snapshots published, %d read retries",
+			state_stats.publishes, state_stats.retries);
+
+		if(ipc_capture_get_stats(&capture_stats) == 0 && capture_stats.records > 0)
+			LOGD("Capture: %d records (%llu bytes), %d truncated, %d dropped, %d rotations",
+				capture_stats.records, (unsigned long long) capture_stats.bytes,
+				capture_stats.truncated, capture_stats.dropped, capture_stats.rotations);
+
 		ipc_client_power_off(ipc_client);
 		ipc_client_close(ipc_client);
+		ipc_client_destroy_handlers_common_data(ipc_client);
 		ipc_client_free(ipc_client);
+	} else if(ipc_client_fd >= 0) {
+		close(ipc_client_fd);
 	}
 
-	free(client->data);
+	pthread_mutex_destroy(&client_data->tx_mutex);
+	pthread_mutex_destroy(&client_data->rx_mutex);
+
+	free(client_data);
 
 	return 0;
 }
@@ -249,5 +546,6 @@ int ipc_destroy(struct ril_client *client)
 struct ril_client_funcs ipc_client_funcs = {
 	.create = ipc_create,
 	.destroy = ipc_destroy,
-	.read_loop = ipc_read_loop,
+	.attach = ipc_attach,
+	.detach = ipc_detach,
 };
@@ -33,15 +33,95 @@
 #define ipc_send_exec(command, mseq) \
 	ipc_send(command, IPC_TYPE_EXEC, NULL, 0, mseq)
 
+/* Frames received per receive lock, then queued to the subsystem workers */
+#define IPC_RECV_BATCH	16
+
+/* Most expensive packet types logged when the client goes away */
+#define IPC_DISPATCH_STATS	8
+
+/* Outgoing frame queue, see ipc_tx.c. Queue size must be a power of two */
+#define IPC_TX_QUEUE_SIZE	128
+#define IPC_TX_INLINE_SIZE	256
+#define IPC_TX_BATCH		16
+
+#define IPC_TX_TAPI_SERVICES	8
+
+/* "call,control,bulk" frames per scheduling round */
+#define IPC_TX_WEIGHTS_PROPERTY	"ril.ipc.tx_weights"
+#define IPC_TX_WEIGHTS_DEFAULT	"8,4,1"
+/* Class overrides, "<cmd>[.<tapi service>]=<class>,..." */
+#define IPC_TX_CLASS_PROPERTY	"ril.ipc.tx_class"
+
+/* Frame capture, "<file name>[,<file size in KiB>[,<files>]]", empty for none */
+#define IPC_CAPTURE_PROPERTY	"ril.ipc.capture"
+/* Captures only ever go there, SRS clients can't name any other path */
+#define IPC_CAPTURE_DIR		"/data/radio"
+/* Capture truncation, "<cmd|all>=<bytes>,..." */
+#define IPC_CAPTURE_SNAP_PROPERTY	"ril.ipc.capture_snap"
+#define IPC_CAPTURE_SIZE_DEFAULT	4096
+#define IPC_CAPTURE_FILES_DEFAULT	4
+
+enum ipc_tx_class {
+	IPC_TX_CLASS_CALL = 0,
+	IPC_TX_CLASS_CONTROL,
+	IPC_TX_CLASS_BULK,
+	IPC_TX_CLASS_COUNT
+};
+
+struct ipc_tx_class_stats {
+	uint32_t queued;
+	uint32_t written;
+	uint32_t depth;
+	uint32_t max_depth;
+	uint32_t full_waits;
+	uint32_t last_latency_us;
+	uint32_t max_latency_us;
+	uint64_t total_latency_us;
+};
+
+struct ipc_tx_stats {
+	uint32_t batches;
+	struct ipc_tx_class_stats classes[IPC_TX_CLASS_COUNT];
+};
+
+/*
+ * The ril_client mutex only guards client->data. Receiving and sending
+ * each have their own lock so neither waits on the other's I/O, control
+ * operations (create, destroy) take both.
+ */
 struct ipc_client_data {
 	struct ipc_client *ipc_client;
 	int ipc_client_fd;
+
+	pthread_mutex_t rx_mutex;
+	pthread_mutex_t tx_mutex;
+
+	/* Set by ipc_destroy, with the client lock held: no new lockers */
+	int closing;
+
+	struct ril_event event;
 };
 
 extern struct ril_client_funcs ipc_client_funcs;
 
+struct ril_client;
+
+struct ipc_client *ipc_client_rx_lock(struct ril_client *client);
+void ipc_client_rx_unlock(struct ril_client *client);
+struct ipc_client *ipc_client_tx_lock(struct ril_client *client);
+void ipc_client_tx_unlock(struct ril_client *client);
+
 void ipc_send(struct modem_io *request);
+void ipc_sendv(uint32_t cmd, struct iovec *iov, int iovcnt);
+void ipc_send_frame(uint32_t cmd, struct modem_io *frame);
 
 int ipc_modem_io(void *data, uint32_t cmd);
+int ipc_capture_configure(const char *spec);
+
+int ipc_tx_start(void);
+int ipc_tx_queue_frame(uint32_t cmd, struct iovec *iov, int iovcnt);
+int ipc_tx_queue_buffer(uint32_t cmd, struct modem_io *frame);
+void ipc_tx_flush(void);
+void ipc_tx_get_stats(struct ipc_tx_stats *stats);
 
 #endif
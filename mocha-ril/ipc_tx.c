@@ -0,0 +1,517 @@
+/**
+ * This file is part of mocha-ril.
+ *
+ * mocha-ril is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * mocha-ril is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with mocha-ril.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <time.h>
+#include <errno.h>
+#include <sched.h>
+#include <semaphore.h>
+
+#include <cutils/properties.h>
+
+#define LOG_TAG "RIL-Mocha-IPC-TX"
+#include <utils/Log.h>
+
+#include "mocha-ril.h"
+#include <radio.h>
+#include <tapi.h>
+
+/*
+ * Outgoing frames are copied into bounded multi-producer rings (one
+ * sequence number per slot, producers claim positions with a CAS) and
+ * written by a single writer thread, so callers never block on the
+ * device while holding RIL_LOCK. The writer hands what it collects at
+ * wake-up to ipc_client_send_batch, which coalesces it on Jet.
+ *
+ * There is one ring per traffic class. The writer picks frames with a
+ * weighted round robin, call control first in every round, so a burst of
+ * GPRS uplink or FM data can't hold back a call answer or DTMF for long,
+ * while bulk traffic still gets its share.
+ *
+ * Frames built in a refcounted buffer (GPRS uplink) are queued by
+ * reference instead of being copied, and released once written.
+ */
+
+struct ipc_tx_entry {
+	uint32_t cmd;
+	uint32_t length;
+	uint8_t *data;
+	/* Holds the buffer reference of frames queued with ipc_tx_queue_buffer */
+	struct modem_io frame;
+	struct timespec queued;
+	uint8_t inline_data[IPC_TX_INLINE_SIZE];
+};
+
+struct ipc_tx_slot {
+	volatile uint32_t sequence;
+	struct ipc_tx_entry entry;
+};
+
+struct ipc_tx_lane {
+	struct ipc_tx_slot slots[IPC_TX_QUEUE_SIZE];
+	volatile uint32_t tail;
+	uint32_t head;
+	volatile uint32_t written;
+
+	sem_t free_slots;
+
+	int weight;
+	int credit;
+
+	struct ipc_tx_class_stats stats;
+};
+
+struct ipc_tx {
+	struct ipc_tx_lane lanes[IPC_TX_CLASS_COUNT];
+	sem_t queued;
+
+	pthread_t thread;
+	int running;
+
+	pthread_mutex_t flush_mutex;
+	pthread_cond_t flush_cond;
+
+	uint8_t cmd_class[256];
+	uint8_t tapi_class[IPC_TX_TAPI_SERVICES];
+
+	uint32_t batches;
+};
+
+static struct ipc_tx ipc_tx;
+
+static uint32_t ipc_tx_elapsed_us(struct timespec *start)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	return (now.tv_sec - start->tv_sec) * 1000000 +
+		(now.tv_nsec - start->tv_nsec) / 1000;
+}
+
+static void ipc_tx_sem_wait(sem_t *sem)
+{
+	while(sem_wait(sem) < 0 && errno == EINTR);
+}
+
+/**
+ * Traffic classes
+ */
+
+static void ipc_tx_classes_init(void)
+{
+	char value[PROPERTY_VALUE_MAX];
+	char *entry, *next;
+	int cmd, service, class;
+	int c;
+
+	memset(ipc_tx.cmd_class, IPC_TX_CLASS_CONTROL, sizeof(ipc_tx.cmd_class));
+	memset(ipc_tx.tapi_class, IPC_TX_CLASS_CONTROL, sizeof(ipc_tx.tapi_class));
+
+	ipc_tx.cmd_class[FIFO_PKT_SOUND] = IPC_TX_CLASS_CALL;
+	ipc_tx.tapi_class[TAPI_TYPE_CALL] = IPC_TX_CLASS_CALL;
+
+	ipc_tx.cmd_class[FIFO_PKT_PROTO] = IPC_TX_CLASS_BULK;
+	ipc_tx.cmd_class[FIFO_PKT_FILE] = IPC_TX_CLASS_BULK;
+	ipc_tx.cmd_class[FIFO_PKT_LBS] = IPC_TX_CLASS_BULK;
+	ipc_tx.cmd_class[FIFO_PKT_DEBUG] = IPC_TX_CLASS_BULK;
+
+	/* Overrides, "<cmd>[.<tapi service>]=<class>,..." */
+	property_get(IPC_TX_CLASS_PROPERTY, value, "");
+
+	for(entry = strtok_r(value, ",", &next) ; entry != NULL ; entry = strtok_r(NULL, ",", &next)) {
+		if(sscanf(entry, "%d.%d=%d", &cmd, &service, &class) == 3) {
+			if(cmd == FIFO_PKT_TAPI && service >= 0 && service < IPC_TX_TAPI_SERVICES &&
+			   class >= 0 && class < IPC_TX_CLASS_COUNT)
+				ipc_tx.tapi_class[service] = class;
+		} else if(sscanf(entry, "%d=%d", &cmd, &class) == 2) {
+			if(cmd >= 0 && cmd < 256 && class >= 0 && class < IPC_TX_CLASS_COUNT)
+				ipc_tx.cmd_class[cmd] = class;
+		} else {
+			LOGE("Ignoring bad %s entry: %s", IPC_TX_CLASS_PROPERTY, entry);
+		}
+	}
+
+	property_get(IPC_TX_WEIGHTS_PROPERTY, value, IPC_TX_WEIGHTS_DEFAULT);
+
+	if(sscanf(value, "%d,%d,%d", &ipc_tx.lanes[IPC_TX_CLASS_CALL].weight,
+		  &ipc_tx.lanes[IPC_TX_CLASS_CONTROL].weight,
+		  &ipc_tx.lanes[IPC_TX_CLASS_BULK].weight) != IPC_TX_CLASS_COUNT)
+		sscanf(IPC_TX_WEIGHTS_DEFAULT, "%d,%d,%d", &ipc_tx.lanes[IPC_TX_CLASS_CALL].weight,
+		       &ipc_tx.lanes[IPC_TX_CLASS_CONTROL].weight,
+		       &ipc_tx.lanes[IPC_TX_CLASS_BULK].weight);
+
+	for(c = 0 ; c < IPC_TX_CLASS_COUNT ; c++) {
+		if(ipc_tx.lanes[c].weight < 1)
+			ipc_tx.lanes[c].weight = 1;
+		ipc_tx.lanes[c].credit = ipc_tx.lanes[c].weight;
+	}
+
+	LOGD("TX class weights: call %d, control %d, bulk %d",
+		ipc_tx.lanes[IPC_TX_CLASS_CALL].weight,
+		ipc_tx.lanes[IPC_TX_CLASS_CONTROL].weight,
+		ipc_tx.lanes[IPC_TX_CLASS_BULK].weight);
+}
+
+static int ipc_tx_classify(uint32_t cmd, struct iovec *iov, int iovcnt)
+{
+	struct tapiPacketHeader *header;
+
+	if(cmd == FIFO_PKT_TAPI && iovcnt > 0 && iov[0].iov_len >= sizeof(header->tapiService)) {
+		header = (struct tapiPacketHeader *) iov[0].iov_base;
+		if(header->tapiService < IPC_TX_TAPI_SERVICES)
+			return ipc_tx.tapi_class[header->tapiService];
+	}
+
+	return ipc_tx.cmd_class[cmd & 0xff];
+}
+
+/**
+ * Queueing
+ */
+
+static void ipc_tx_wait_slot(struct ipc_tx_lane *lane)
+{
+	if(sem_trywait(&lane->free_slots) < 0) {
+		__sync_add_and_fetch(&lane->stats.full_waits, 1);
+		ipc_tx_sem_wait(&lane->free_slots);
+	}
+}
+
+/* A free slot is guaranteed by the semaphore, claim the next one */
+static struct ipc_tx_slot *ipc_tx_claim(struct ipc_tx_lane *lane, uint32_t *pos)
+{
+	struct ipc_tx_slot *slot;
+
+	do {
+		*pos = lane->tail;
+	} while(!__sync_bool_compare_and_swap(&lane->tail, *pos, *pos + 1));
+
+	slot = &lane->slots[*pos % IPC_TX_QUEUE_SIZE];
+
+	/* The writer may still be releasing it */
+	while(slot->sequence != *pos)
+		sched_yield();
+
+	return slot;
+}
+
+static void ipc_tx_publish(struct ipc_tx_lane *lane, struct ipc_tx_slot *slot, uint32_t pos)
+{
+	clock_gettime(CLOCK_MONOTONIC, &slot->entry.queued);
+
+	__sync_synchronize();
+	slot->sequence = pos + 1;
+
+	__sync_add_and_fetch(&lane->stats.queued, 1);
+	sem_post(&ipc_tx.queued);
+}
+
+int ipc_tx_queue_frame(uint32_t cmd, struct iovec *iov, int iovcnt)
+{
+	struct ipc_tx_lane *lane;
+	struct ipc_tx_slot *slot;
+	uint8_t *data;
+	uint32_t length;
+	uint32_t pos;
+
+	if(!ipc_tx.running)
+		return -1;
+
+	lane = &ipc_tx.lanes[ipc_tx_classify(cmd, iov, iovcnt)];
+	length = ipc_iov_length(iov, iovcnt);
+
+	ipc_tx_wait_slot(lane);
+
+	data = NULL;
+	if(length > IPC_TX_INLINE_SIZE) {
+		data = malloc(length);
+		if(data == NULL) {
+			sem_post(&lane->free_slots);
+			return -1;
+		}
+	}
+
+	slot = ipc_tx_claim(lane, &pos);
+
+	slot->entry.cmd = cmd;
+	slot->entry.length = length;
+	slot->entry.data = data != NULL ? data : slot->entry.inline_data;
+	ipc_iov_flatten(iov, iovcnt, slot->entry.data);
+
+	ipc_tx_publish(lane, slot, pos);
+
+	return 0;
+}
+
+/*
+ * Queues frame->datasize bytes at frame->data without copying them. The
+ * queue takes over the frame's buffer reference, and the FIFO header is
+ * written into the IPC_FRAME_HEADROOM bytes in front of frame->data.
+ */
+int ipc_tx_queue_buffer(uint32_t cmd, struct modem_io *frame)
+{
+	struct ipc_tx_lane *lane;
+	struct ipc_tx_slot *slot;
+	struct iovec iov;
+	uint32_t pos;
+
+	if(!ipc_tx.running)
+		return -1;
+
+	iov.iov_base = frame->data;
+	iov.iov_len = frame->datasize;
+
+	lane = &ipc_tx.lanes[ipc_tx_classify(cmd, &iov, 1)];
+
+	ipc_tx_wait_slot(lane);
+	slot = ipc_tx_claim(lane, &pos);
+
+	slot->entry.cmd = cmd;
+	slot->entry.length = frame->datasize;
+	slot->entry.data = frame->data;
+	slot->entry.frame = *frame;
+
+	frame->buf = NULL;
+	frame->data = NULL;
+
+	ipc_tx_publish(lane, slot, pos);
+
+	return 0;
+}
+
+static int ipc_tx_lane_ready(struct ipc_tx_lane *lane)
+{
+	return lane->slots[lane->head % IPC_TX_QUEUE_SIZE].sequence == lane->head + 1;
+}
+
+/*
+ * Weighted round robin: every class may send up to its weight per round,
+ * a new round starts once no class with credit left has anything ready.
+ */
+static int ipc_tx_next_lane(void)
+{
+	int ready;
+	int c;
+
+	while(1) {
+		ready = 0;
+
+		for(c = 0 ; c < IPC_TX_CLASS_COUNT ; c++) {
+			if(!ipc_tx_lane_ready(&ipc_tx.lanes[c]))
+				continue;
+
+			if(ipc_tx.lanes[c].credit > 0) {
+				ipc_tx.lanes[c].credit--;
+				return c;
+			}
+
+			ready = 1;
+		}
+
+		if(ready) {
+			for(c = 0 ; c < IPC_TX_CLASS_COUNT ; c++)
+				ipc_tx.lanes[c].credit = ipc_tx.lanes[c].weight;
+			continue;
+		}
+
+		/* Posted by a producer that hasn't published its slot yet */
+		sched_yield();
+	}
+}
+
+static struct ipc_tx_entry *ipc_tx_dequeue(struct ipc_tx_lane *lane, uint32_t *pos)
+{
+	struct ipc_tx_slot *slot;
+	uint32_t depth;
+
+	slot = &lane->slots[lane->head % IPC_TX_QUEUE_SIZE];
+
+	depth = lane->tail - lane->head;
+	if(depth > lane->stats.max_depth)
+		lane->stats.max_depth = depth;
+
+	__sync_synchronize();
+	*pos = lane->head++;
+
+	return &slot->entry;
+}
+
+static void ipc_tx_release(struct ipc_tx_lane *lane, struct ipc_tx_entry *entry, uint32_t pos)
+{
+	struct ipc_tx_slot *slot;
+	uint32_t latency;
+
+	latency = ipc_tx_elapsed_us(&entry->queued);
+	lane->stats.last_latency_us = latency;
+	lane->stats.total_latency_us += latency;
+	if(latency > lane->stats.max_latency_us)
+		lane->stats.max_latency_us = latency;
+
+	if(entry->frame.buf != NULL)
+		ipc_frame_unref(&entry->frame);
+	else if(entry->data != entry->inline_data)
+		free(entry->data);
+	entry->data = NULL;
+
+	slot = &lane->slots[pos % IPC_TX_QUEUE_SIZE];
+	__sync_synchronize();
+	slot->sequence = pos + IPC_TX_QUEUE_SIZE;
+
+	sem_post(&lane->free_slots);
+}
+
+static void ipc_tx_write(struct ipc_frame_iov *frames, int count)
+{
+	struct ipc_client *ipc_client;
+
+	ipc_client = ipc_client_tx_lock(ril_data.ipc_packet_client);
+
+	if(ipc_client == NULL) {
+		LOGE("ipc_packet_client is not ready, dropping %d frames", count);
+		return;
+	}
+
+	if(ipc_client_send_batch(ipc_client, frames, count) < count)
+		LOGE("IPC batch send failed");
+
+	ipc_client_tx_unlock(ril_data.ipc_packet_client);
+}
+
+static void *ipc_tx_thread(void *data)
+{
+	struct ipc_frame_iov frames[IPC_TX_BATCH];
+	struct iovec iov[IPC_TX_BATCH];
+	struct ipc_tx_entry *entries[IPC_TX_BATCH];
+	uint32_t positions[IPC_TX_BATCH];
+	int classes[IPC_TX_BATCH];
+	struct ipc_tx_lane *lane;
+	int count;
+	int i;
+
+	while(1) {
+		ipc_tx_sem_wait(&ipc_tx.queued);
+
+		count = 0;
+
+		do {
+			classes[count] = ipc_tx_next_lane();
+			entries[count] = ipc_tx_dequeue(&ipc_tx.lanes[classes[count]], &positions[count]);
+
+			iov[count].iov_base = entries[count]->data;
+			iov[count].iov_len = entries[count]->length;
+			frames[count].cmd = entries[count]->cmd;
+			frames[count].iov = &iov[count];
+			frames[count].iovcnt = 1;
+			frames[count].headroom = entries[count]->frame.buf != NULL;
+
+			count++;
+		} while(count < IPC_TX_BATCH && sem_trywait(&ipc_tx.queued) == 0);
+
+		ipc_tx_write(frames, count);
+
+		for(i = 0 ; i < count ; i++)
+			ipc_tx_release(&ipc_tx.lanes[classes[i]], entries[i], positions[i]);
+
+		ipc_tx.batches++;
+
+		pthread_mutex_lock(&ipc_tx.flush_mutex);
+		for(i = 0 ; i < count ; i++) {
+			lane = &ipc_tx.lanes[classes[i]];
+			lane->written = positions[i] + 1;
+			lane->stats.written++;
+		}
+		pthread_cond_broadcast(&ipc_tx.flush_cond);
+		pthread_mutex_unlock(&ipc_tx.flush_mutex);
+	}
+
+	return NULL;
+}
+
+int ipc_tx_start(void)
+{
+	pthread_attr_t attr;
+	uint32_t i;
+	int rc;
+	int c;
+
+	if(ipc_tx.running)
+		return 0;
+
+	memset(&ipc_tx, 0, sizeof(ipc_tx));
+
+	ipc_tx_classes_init();
+
+	for(c = 0 ; c < IPC_TX_CLASS_COUNT ; c++) {
+		for(i = 0 ; i < IPC_TX_QUEUE_SIZE ; i++)
+			ipc_tx.lanes[c].slots[i].sequence = i;
+
+		sem_init(&ipc_tx.lanes[c].free_slots, 0, IPC_TX_QUEUE_SIZE);
+	}
+
+	sem_init(&ipc_tx.queued, 0, 0);
+	pthread_mutex_init(&ipc_tx.flush_mutex, NULL);
+	pthread_cond_init(&ipc_tx.flush_cond, NULL);
+
+	pthread_attr_init(&attr);
+	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+
+	rc = pthread_create(&ipc_tx.thread, &attr, ipc_tx_thread, NULL);
+
+	if(rc != 0) {
+		LOGE("IPC writer thread creation failed, sending synchronously");
+		return -1;
+	}
+
+	ipc_tx.running = 1;
+
+	return 0;
+}
+
+/* Waits until every frame queued before the call has been written */
+void ipc_tx_flush(void)
+{
+	uint32_t tickets[IPC_TX_CLASS_COUNT];
+	int c;
+
+	if(!ipc_tx.running)
+		return;
+
+	for(c = 0 ; c < IPC_TX_CLASS_COUNT ; c++)
+		tickets[c] = ipc_tx.lanes[c].tail;
+
+	pthread_mutex_lock(&ipc_tx.flush_mutex);
+	for(c = 0 ; c < IPC_TX_CLASS_COUNT ; c++) {
+		while((int32_t) (ipc_tx.lanes[c].written - tickets[c]) < 0)
+			pthread_cond_wait(&ipc_tx.flush_cond, &ipc_tx.flush_mutex);
+	}
+	pthread_mutex_unlock(&ipc_tx.flush_mutex);
+}
+
+void ipc_tx_get_stats(struct ipc_tx_stats *stats)
+{
+	int c;
+
+	memset(stats, 0, sizeof(struct ipc_tx_stats));
+
+	stats->batches = ipc_tx.batches;
+
+	for(c = 0 ; c < IPC_TX_CLASS_COUNT ; c++) {
+		memcpy(&stats->classes[c], &ipc_tx.lanes[c].stats, sizeof(struct ipc_tx_class_stats));
+		stats->classes[c].depth = ipc_tx.lanes[c].tail - ipc_tx.lanes[c].written;
+	}
+}
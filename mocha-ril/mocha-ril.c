@@ -23,10 +23,12 @@
 
 #define LOG_TAG "RIL-Mocha"
 
+#include <stddef.h>
 #include <time.h>
 #include <pthread.h>
 
 #include <utils/Log.h>
+#include <cutils/properties.h>
 #include <telephony/ril.h>
 
 #include "mocha-ril.h"
@@ -55,193 +57,539 @@ struct ril_data ril_data;
  * RIL requests
  */
 
+static unsigned int ril_request_token_hash(RIL_Token t)
+{
+	return ((uint32_t) (uintptr_t) t * 2654435761U) >> (32 - RIL_REQUEST_HASH_BITS);
+}
+
+static unsigned int ril_request_id_hash(int id)
+{
+	return id & (RIL_REQUEST_HASH_SIZE - 1);
+}
+
+static struct ril_request_info *ril_request_info_alloc(void)
+{
+	struct ril_request_registry *registry = &ril_data.requests;
+	struct ril_request_chunk *chunk;
+	struct ril_request_info *request;
+	int i;
+
+	if(registry->free_list == NULL) {
+		chunk = calloc(1, sizeof(struct ril_request_chunk));
+		if(chunk == NULL)
+			return NULL;
+
+		chunk->next = registry->chunks;
+		registry->chunks = chunk;
+
+		for(i = 0 ; i < RIL_REQUEST_POOL_CHUNK ; i++) {
+			chunk->nodes[i].next = registry->free_list;
+			registry->free_list = &chunk->nodes[i];
+		}
+	}
+
+	request = registry->free_list;
+	registry->free_list = request->next;
+	memset(request, 0, sizeof(struct ril_request_info));
+
+	return request;
+}
+
+static void ril_request_id_link(struct ril_request_info *request)
+{
+	struct ril_request_info **bucket;
+
+	if(request->id < 0)
+		return;
+
+	bucket = &ril_data.requests.ids[ril_request_id_hash(request->id)];
+	request->id_next = *bucket;
+	*bucket = request;
+}
+
+static void ril_request_id_unlink(struct ril_request_info *request)
+{
+	struct ril_request_info **link;
+
+	if(request->id < 0)
+		return;
+
+	link = &ril_data.requests.ids[ril_request_id_hash(request->id)];
+	while(*link != NULL && *link != request)
+		link = &(*link)->id_next;
+
+	if(*link != NULL)
+		*link = request->id_next;
+}
+
+/* Called with the request lock held */
 int ril_request_id_get(void)
 {
-	ril_data.request_id++;
-	ril_data.request_id %= 0xff;
+	struct ril_request_registry *registry = &ril_data.requests;
+	int tries;
+
+	for(tries = 0 ; tries < RIL_REQUEST_ID_MAX ; tries++) {
+		registry->id++;
+		if(registry->id >= RIL_REQUEST_ID_MAX)
+			registry->id = 1;
 
-	return ril_data.request_id;
+		if(ril_request_info_find_id(registry->id) == NULL)
+			return registry->id;
+
+		registry->stats.id_skips++;
+	}
+
+	return -1;
 }
 
 int ril_request_id_set(int id)
 {
-	id %= 0xff;
+	id %= RIL_REQUEST_ID_MAX;
 
-	while(ril_data.request_id < id) {
-		ril_data.request_id++;
-		ril_data.request_id %= 0xff;
-	}
+	if(ril_data.requests.id < id)
+		ril_data.requests.id = id;
 
-	return ril_data.request_id;
+	return ril_data.requests.id;
 }
 
-int ril_request_register(RIL_Token t, int id)
+static struct ril_request_info *ril_request_info_new(RIL_Token t, int id)
 {
+	struct ril_request_registry *registry = &ril_data.requests;
+	struct ril_request_info **bucket;
 	struct ril_request_info *request;
-	struct list_head *list_end;
-	struct list_head *list;
 
-	request = calloc(1, sizeof(struct ril_request_info));
+	request = ril_request_info_alloc();
 	if(request == NULL)
-		return -1;
+		return NULL;
 
 	request->token = t;
 	request->id = id;
-	request->canceled = 0;
 
-	list_end = ril_data.requests;
-	while(list_end != NULL && list_end->next != NULL)
-		list_end = list_end->next;
+	bucket = &registry->tokens[ril_request_token_hash(t)];
+	request->token_next = *bucket;
+	*bucket = request;
 
-	list = list_head_alloc((void *) request, list_end, NULL);
+	ril_request_id_link(request);
 
-	if(ril_data.requests == NULL)
-		ril_data.requests = list;
+	registry->stats.pending++;
+	if(registry->stats.pending > registry->stats.max_pending)
+		registry->stats.max_pending = registry->stats.pending;
 
-	return 0;
+	return request;
+}
+
+int ril_request_register(RIL_Token t, int id)
+{
+	return ril_request_info_new(t, id) != NULL ? 0 : -1;
 }
 
 void ril_request_unregister(struct ril_request_info *request)
 {
-	struct list_head *list;
+	struct ril_request_registry *registry = &ril_data.requests;
+	struct ril_request_info **link;
 
 	if(request == NULL)
 		return;
 
-	list = ril_data.requests;
-	while(list != NULL) {
-		if(list->data == (void *) request) {
-			memset(request, 0, sizeof(struct ril_request_info));
-			free(request);
+	link = &registry->tokens[ril_request_token_hash(request->token)];
+	while(*link != NULL && *link != request)
+		link = &(*link)->token_next;
 
-			if(list == ril_data.requests)
-				ril_data.requests = list->next;
+	if(*link == NULL)
+		return;
 
-			list_head_free(list);
+	*link = request->token_next;
+	ril_request_id_unlink(request);
+	ril_timer_del(&registry->deadlines, &request->timer);
 
-			break;
-		}
-list_continue:
-		list = list->next;
-	}
+	memset(request, 0, sizeof(struct ril_request_info));
+	request->next = registry->free_list;
+	registry->free_list = request;
+
+	registry->stats.pending--;
 }
 
 struct ril_request_info *ril_request_info_find_id(int id)
 {
 	struct ril_request_info *request;
-	struct list_head *list;
 
-	list = ril_data.requests;
-	while(list != NULL) {
-		request = (struct ril_request_info *) list->data;
-		if(request == NULL)
-			goto list_continue;
-
-		if(request->id == id)
-			return request;
+	if(id < 0)
+		return NULL;
 
-list_continue:
-		list = list->next;
-	}
+	request = ril_data.requests.ids[ril_request_id_hash(id)];
+	while(request != NULL && request->id != id)
+		request = request->id_next;
 
-	return NULL;
+	return request;
 }
 
 struct ril_request_info *ril_request_info_find_token(RIL_Token t)
 {
 	struct ril_request_info *request;
-	struct list_head *list;
-
-	list = ril_data.requests;
-	while(list != NULL) {
-		request = (struct ril_request_info *) list->data;
-		if(request == NULL)
-			goto list_continue;
 
-		if(request->token == t)
-			return request;
-
-list_continue:
-		list = list->next;
-	}
+	request = ril_data.requests.tokens[ril_request_token_hash(t)];
+	while(request != NULL && request->token != t)
+		request = request->token_next;
 
-	return NULL;
+	return request;
 }
 
 int ril_request_set_canceled(RIL_Token t, int canceled)
 {
 	struct ril_request_info *request;
 
+	RIL_REQUEST_LOCK();
+
 	request = ril_request_info_find_token(t);
-	if(request == NULL)
-		return -1;
+	if(request != NULL)
+		request->canceled = canceled ? 1 : 0;
 
-	request->canceled = canceled ? 1 : 0;
+	RIL_REQUEST_UNLOCK();
 
-	return 0;
+	return request != NULL ? 0 : -1;
 }
 
 int ril_request_get_canceled(RIL_Token t)
 {
 	struct ril_request_info *request;
+	int canceled = -1;
+
+	RIL_REQUEST_LOCK();
 
 	request = ril_request_info_find_token(t);
-	if(request == NULL)
-		return -1;
+	if(request != NULL)
+		canceled = request->canceled;
 
-	return request->canceled;
+	RIL_REQUEST_UNLOCK();
+
+	return canceled;
 }
 
 RIL_Token ril_request_get_token(int id)
 {
 	struct ril_request_info *request;
+	RIL_Token t = (RIL_Token) 0x00;
+
+	RIL_REQUEST_LOCK();
 
 	request = ril_request_info_find_id(id);
-	if(request == NULL)
-		return (RIL_Token) 0x00;
+	if(request != NULL)
+		t = request->token;
 
-	return request->token;
+	RIL_REQUEST_UNLOCK();
+
+	return t;
 }
 
 int ril_request_get_id(RIL_Token t)
 {
 	struct ril_request_info *request;
-	int id, rc;
+	int id;
+
+	RIL_REQUEST_LOCK();
 
 	request = ril_request_info_find_token(t);
-	if(request != NULL)
-		return request->id;
+	if(request != NULL && request->id >= 0) {
+		id = request->id;
+		RIL_REQUEST_UNLOCK();
+		return id;
+	}
 
 	id = ril_request_id_get();
-	rc = ril_request_register(t, id);
-	if(rc < 0)
+
+	/* Tracked since ril_on_request, but without an id so far */
+	if(id >= 0 && request != NULL) {
+		request->id = id;
+		ril_request_id_link(request);
+	} else if(id >= 0 && ril_request_info_new(t, id) == NULL) {
+		id = -1;
+	}
+
+	RIL_REQUEST_UNLOCK();
+
+	return id;
+}
+
+/*
+ * Remembers which RIL request a token is for, the delivery queue needs it
+ * to know the layout of the response it copies.
+ */
+void ril_request_track(RIL_Token t, int request_number)
+{
+	struct ril_request_info *request;
+
+	RIL_REQUEST_LOCK();
+
+	request = ril_request_info_find_token(t);
+	if(request == NULL)
+		request = ril_request_info_new(t, -1);
+
+	if(request != NULL)
+		request->request = request_number;
+
+	RIL_REQUEST_UNLOCK();
+}
+
+void ril_request_get_stats(struct ril_request_stats *stats)
+{
+	RIL_REQUEST_LOCK();
+	ril_data.requests.stats.deadlines = ril_data.requests.deadlines.count;
+	memcpy(stats, &ril_data.requests.stats, sizeof(struct ril_request_stats));
+	RIL_REQUEST_UNLOCK();
+}
+
+struct ril_request_expiry {
+	RIL_Token token;
+	int request;
+	struct ril_request_expiry *next;
+};
+
+#define ril_request_info_from_timer(timer) \
+	((struct ril_request_info *) ((char *) (timer) - offsetof(struct ril_request_info, timer)))
+
+/* Points the timerfd at the next tick the wheel has work on, with RIL_REQUEST_LOCK held */
+static void ril_request_deadlines_arm(void)
+{
+	struct ril_request_registry *registry = &ril_data.requests;
+	uint64_t next, now;
+
+	next = ril_timer_next(&registry->deadlines);
+	if(next == registry->deadline_armed)
+		return;
+
+	registry->deadline_armed = next;
+
+	if(next == 0) {
+		ril_event_timer_set(&registry->deadline_event, 0, 0);
+		return;
+	}
+
+	now = ril_timer_tick_now();
+	ril_event_timer_set(&registry->deadline_event,
+		next > now ? (unsigned int) (next - now) * RIL_TIMER_TICK_MS : 1, 0);
+}
+
+/*
+ * Runs on the request's subsystem worker, with the subsystem lock held,
+ * which has to be taken before RIL_REQUEST_LOCK.
+ */
+static void ril_request_expire(void *data)
+{
+	struct ril_request_registry *registry = &ril_data.requests;
+	struct ril_request_expiry *expiry = (struct ril_request_expiry *) data;
+	struct ril_request_info *request;
+	RIL_Token *slot;
+	void (*expire)(RIL_Token t);
+	RIL_Errno error;
+	int request_number;
+	int canceled;
+
+	RIL_REQUEST_LOCK();
+
+	/* Completed or given a new deadline in the meantime */
+	request = ril_request_info_find_token(expiry->token);
+	if(request == NULL || !request->expired) {
+		RIL_REQUEST_UNLOCK();
+		free(expiry);
+		return;
+	}
+
+	request_number = request->request;
+	canceled = request->canceled;
+	error = request->timeout_error;
+	slot = request->slot;
+	expire = request->expire;
+	ril_request_unregister(request);
+
+	registry->stats.timeouts++;
+	registry->stats.timeouts_by_request[request_number > 0 &&
+		request_number < RIL_REQUEST_TIMEOUT_TYPES ? request_number : 0]++;
+
+	RIL_REQUEST_UNLOCK();
+
+	if(slot != NULL && *slot == expiry->token)
+		*slot = 0;
+
+	if(expire != NULL)
+		expire(expiry->token);
+
+	LOGE("Request %d timed out, completing with error %d", request_number, error);
+
+	if(!canceled)
+		ril_delivery_complete(expiry->token, error, request_number, NULL, 0);
+
+	free(expiry);
+}
+
+/*
+ * Called on the reactor thread, which takes no subsystem lock: each
+ * expired request is handed to the worker of its subsystem.
+ */
+static void ril_request_deadlines_expire(int fd, uint32_t events, void *data)
+{
+	struct ril_request_registry *registry = &ril_data.requests;
+	struct ril_request_expiry *expiries = NULL;
+	struct ril_request_expiry *expiry;
+	struct ril_request_info *request;
+	struct ril_timer *expired, *timer, *next;
+
+	RIL_REQUEST_LOCK();
+
+	expired = ril_timer_advance(&registry->deadlines, ril_timer_tick_now());
+
+	for(timer = expired ; timer != NULL ; timer = next) {
+		next = timer->next;
+		request = ril_request_info_from_timer(timer);
+
+		expiry = malloc(sizeof(struct ril_request_expiry));
+		if(expiry == NULL) {
+			/* Try again on the next tick */
+			ril_timer_add(&registry->deadlines, timer, registry->deadlines.now + 1);
+			continue;
+		}
+
+		request->expired = 1;
+		expiry->token = request->token;
+		expiry->request = request->request;
+		expiry->next = expiries;
+		expiries = expiry;
+	}
+
+	registry->deadline_armed = 0;
+	ril_request_deadlines_arm();
+
+	RIL_REQUEST_UNLOCK();
+
+	/* Queueing may wait for room on a worker that needs RIL_REQUEST_LOCK */
+	while(expiries != NULL) {
+		expiry = expiries;
+		expiries = expiry->next;
+
+		if(ril_worker_call(ril_request_subsystem(expiry->request), ril_request_expire, expiry) < 0) {
+			LOGE("No worker to time out request %d", expiry->request);
+			free(expiry);
+		}
+	}
+}
+
+int ril_request_deadlines_start(void)
+{
+	struct ril_request_registry *registry = &ril_data.requests;
+	int rc;
+
+	RIL_REQUEST_LOCK();
+
+	ril_timer_wheel_init(&registry->deadlines, ril_timer_tick_now());
+	rc = ril_event_timer_add(&ril_data.reactor, &registry->deadline_event,
+		RIL_EVENT_PRIORITY_LOW, ril_request_deadlines_expire, NULL);
+	if(rc == 0)
+		registry->deadlines_started = 1;
+
+	RIL_REQUEST_UNLOCK();
+
+	return rc;
+}
+
+static int ril_request_deadline_set(RIL_Token t, unsigned int timeout_ms, RIL_Errno error,
+	RIL_Token *slot, void (*expire)(RIL_Token t))
+{
+	struct ril_request_registry *registry = &ril_data.requests;
+	struct ril_request_info *request;
+	uint64_t now;
+
+	RIL_REQUEST_LOCK();
+
+	request = ril_request_info_find_token(t);
+	if(request == NULL || !registry->deadlines_started) {
+		RIL_REQUEST_UNLOCK();
 		return -1;
+	}
+
+	now = ril_timer_tick_now();
+
+	/* Nothing to expire, only catches the idle wheel up */
+	if(registry->deadlines.count == 0)
+		ril_timer_advance(&registry->deadlines, now);
 
-	return id;	
+	request->timeout_error = error;
+	request->slot = slot;
+	request->expire = expire;
+	request->expired = 0;
+
+	ril_timer_add(&registry->deadlines, &request->timer,
+		now + (timeout_ms + RIL_TIMER_TICK_MS - 1) / RIL_TIMER_TICK_MS);
+	ril_request_deadlines_arm();
+
+	RIL_REQUEST_UNLOCK();
+
+	return 0;
+}
+
+/*
+ * Gives a pending request a deadline: if it isn't completed within timeout_ms
+ * it is completed with error, and slot (a ril_data.tokens entry or NULL) is
+ * cleared if it still holds the token, under the request's subsystem lock.
+ * A completion arriving late is dropped. Setting it again moves the deadline.
+ */
+int ril_request_deadline(RIL_Token t, unsigned int timeout_ms, RIL_Errno error, RIL_Token *slot)
+{
+	return ril_request_deadline_set(t, timeout_ms, error, slot, NULL);
+}
+
+/*
+ * Same, but expire(t) is called on expiry instead, under the subsystem
+ * lock and before the request is completed, for requests that leave
+ * more than a token behind.
+ */
+int ril_request_deadline_call(RIL_Token t, unsigned int timeout_ms, RIL_Errno error, void (*expire)(RIL_Token t))
+{
+	return ril_request_deadline_set(t, timeout_ms, error, NULL, expire);
 }
 
 void ril_request_complete(RIL_Token t, RIL_Errno e, void *data, size_t length)
 {
 	struct ril_request_info *request;
+	int request_number = 0;
 	int canceled = 0;
 
+	RIL_REQUEST_LOCK();
+
 	request = ril_request_info_find_token(t);
-	if(request == NULL)
-		goto complete;
+	if(request == NULL) {
+		/* Already completed on its deadline */
+		RIL_REQUEST_UNLOCK();
+		LOGD("Dropping late completion of request token %p", t);
+		return;
+	}
 
-	canceled = ril_request_get_canceled(t);
+	request_number = request->request;
+	canceled = request->canceled;
 	ril_request_unregister(request);
 
+	RIL_REQUEST_UNLOCK();
+
 	if(canceled)
 		return;
 
-complete:
-	ril_data.env->OnRequestComplete(t, e, data, length);
+	ril_delivery_complete(t, e, request_number, data, length);
 }
 
 void ril_request_unsolicited(int request, void *data, size_t length)
 {
-	ril_data.env->OnUnsolicitedResponse(request, data, length);
+	/*
+	 * RILJ queries the state right back, these are all sent with RIL_LOCK
+	 * held so the change can be published before RIL_LOCK is released.
+	 */
+	switch(request) {
+		case RIL_UNSOL_RESPONSE_RADIO_STATE_CHANGED:
+		case RIL_UNSOL_RESPONSE_CALL_STATE_CHANGED:
+		case RIL_UNSOL_RESPONSE_VOICE_NETWORK_STATE_CHANGED:
+		case RIL_UNSOL_RESPONSE_SIM_STATUS_CHANGED:
+			ril_state_publish();
+			break;
+	}
+
+	ril_delivery_unsolicited(request, data, length);
 }
 
 void ril_request_timed_callback(RIL_TimedCallback callback, void *data, const struct timeval *time)
@@ -276,16 +624,14 @@ void ril_tokens_check(void)
 	}
 }
 
-void srs_dispatch(struct srs_message *message)
+/* On the misc worker, with its lock held */
+static void srs_dispatch_worker(void *data)
 {
-	if(message == NULL)
-		return;
-		
-	RIL_LOCK();
-	
+	struct srs_message *message = (struct srs_message *) data;
+
 	switch(message->command) {
-		case SRS_CONTROL_PING:
-			srs_control_ping(message);
+		case SRS_CONTROL_CAPTURE:
+			srs_control_capture(message);
 			break;
 		case SRS_SND_SET_VOLUME:
 			srs_snd_set_volume(message);
@@ -303,8 +649,41 @@ void srs_dispatch(struct srs_message *message)
 			LOGD("Unhandled command: (%04x)", message->command);
 			break;
 	}
-	
-	RIL_UNLOCK();
+
+	if(message->data != NULL)
+		free(message->data);
+	free(message);
+}
+
+/*
+ * Called on the reactor thread. Pings are answered right there, the rest
+ * goes to the misc worker, which takes over message->data.
+ */
+void srs_dispatch(struct srs_message *message)
+{
+	struct srs_message *queued;
+
+	if(message == NULL)
+		return;
+
+	if(message->command == SRS_CONTROL_PING) {
+		srs_control_ping(message);
+		return;
+	}
+
+	queued = malloc(sizeof(struct srs_message));
+	if(queued == NULL)
+		return;
+
+	memcpy(queued, message, sizeof(struct srs_message));
+
+	if(ril_worker_call(RIL_SUBSYSTEM_MISC, srs_dispatch_worker, queued) < 0) {
+		LOGE("No worker for SRS command %04x", message->command);
+		free(queued);
+		return;
+	}
+
+	message->data = NULL;
 }
 
 int ril_modem_check(void)
@@ -318,11 +697,45 @@ int ril_modem_check(void)
 	return 0;
 }
 
+/*
+ * Status queries only read the state snapshot, they are answered right
+ * away instead of queueing behind the subsystem lock and RIL_LOCK.
+ */
+static int ril_on_request_snapshot(int request, RIL_Token t)
+{
+	switch(request) {
+		case RIL_REQUEST_GET_SIM_STATUS:
+			ril_request_get_sim_status(t);
+			return 0;
+		case RIL_REQUEST_OPERATOR:
+			ril_request_operator(t);
+			return 0;
+		case RIL_REQUEST_VOICE_REGISTRATION_STATE:
+			ril_request_voice_registration_state(t);
+			return 0;
+		case RIL_REQUEST_DATA_REGISTRATION_STATE:
+			ril_request_data_registration_state(t);
+			return 0;
+		case RIL_REQUEST_GET_CURRENT_CALLS:
+			ril_request_get_current_calls(t);
+			return 0;
+		default:
+			return -1;
+	}
+}
+
 void ril_on_request(int request, void *data, size_t datalen, RIL_Token t)
 {
+	enum ril_subsystem subsystem;
 	int check;
 
-	RIL_LOCK();
+	ril_request_track(t, request);
+
+	if(ril_modem_check() == 0 && ril_on_request_snapshot(request, t) == 0)
+		return;
+
+	subsystem = ril_request_subsystem(request);
+	ril_subsystem_lock(subsystem);
 	LOGV("Request from RILD ID - %d", request);
 	check = ril_modem_check();
 	if(check < 0)
@@ -489,12 +902,16 @@ void ril_on_request(int request, void *data, size_t datalen, RIL_Token t)
 			break;
 	}
 	
-	RIL_UNLOCK();
+	ril_subsystem_unlock(subsystem);
 }
 
 RIL_RadioState ril_on_state_request(void)
 {
-	return ril_data.state.radio_state;
+	struct ril_state_snapshot snapshot;
+
+	ril_state_get(&snapshot);
+
+	return snapshot.radio_state;
 }
 
 int ril_on_supports(int request)
@@ -546,7 +963,6 @@ void ril_install_ipc_callbacks(void)
 	ipc_register_ril_cb(SS_ERROR, ipc_ss_error_response);
 	ipc_register_ril_cb(PROTO_START_NETWORK_CNF, ipc_proto_start_network_cnf);
 	ipc_register_ril_cb(PROTO_STOP_NETWORK_CNF, ipc_proto_stop_network_cnf);
-	ipc_register_ril_cb(PROTO_RECEIVE_DATA_IND, ipc_proto_receive_data_ind);
 }
  
 void ril_data_init(void)
@@ -554,10 +970,13 @@ void ril_data_init(void)
 	memset(&ril_data, 0, sizeof(ril_data));
 
 	pthread_mutex_init(&ril_data.mutex, NULL);
+	pthread_mutex_init(&ril_data.request_mutex, NULL);
 	ril_data.state.sim_state = SIM_STATE_NOT_READY;
 	ril_data.inDevice = SND_INPUT_MAIN_MIC;
 	ril_data.outDevice = SND_OUTPUT_EARPIECE;
 	load_ril_config();
+
+	ril_state_publish();
 }
 
 /**
@@ -577,6 +996,8 @@ const RIL_RadioFunctions *RIL_Init(const struct RIL_Env *env, int argc, char **a
 {
 	struct ril_client *ipc_packet_client;
 	struct ril_client *srs_client;
+	char log_levels[PROPERTY_VALUE_MAX];
+	char capture[PROPERTY_VALUE_MAX];
 	int rc;
     pthread_t networkInit;
 
@@ -586,6 +1007,35 @@ const RIL_RadioFunctions *RIL_Init(const struct RIL_Env *env, int argc, char **a
 	ril_data_init();
 	ril_data.env = (struct RIL_Env *) env;
 
+	property_get(RIL_LOG_LEVELS_PROPERTY, log_levels, "");
+	if(ipc_log_set_levels(log_levels) > 0)
+		LOGE("Ignoring bad %s entries: %s", RIL_LOG_LEVELS_PROPERTY, log_levels);
+
+	property_get(IPC_CAPTURE_SNAP_PROPERTY, capture, "");
+	if(ipc_capture_set_snaplens(capture) > 0)
+		LOGE("Ignoring bad %s entries: %s", IPC_CAPTURE_SNAP_PROPERTY, capture);
+
+	property_get(IPC_CAPTURE_PROPERTY, capture, "");
+	if(capture[0] != '\0')
+		ipc_capture_configure(capture);
+
+	if(ril_reactor_init(&ril_data.reactor) < 0 ||
+	   ril_reactor_start(&ril_data.reactor) < 0) {
+		LOGE("Event reactor creation failed.");
+		return NULL;
+	}
+
+	ril_delivery_start();
+
+	if(ril_workers_start() < 0) {
+		LOGE("Worker creation failed.");
+		ril_delivery_stop();
+		return NULL;
+	}
+
+	if(ril_request_deadlines_start() < 0)
+		LOGE("Request deadlines unavailable, requests may wait forever");
+
 	RIL_LOCK();
 	
 	ipc_init();
@@ -601,15 +1051,17 @@ const RIL_RadioFunctions *RIL_Init(const struct RIL_Env *env, int argc, char **a
 		goto srs;
 	}
 
-	rc = ril_client_thread_start(ipc_packet_client);
+	rc = ril_client_start(ipc_packet_client, &ril_data.reactor);
 
 	if(rc < 0) {
-		LOGE("IPC thread creation failed.");
+		LOGE("IPC client start failed.");
 		goto srs;
 	}
 
 	ril_data.ipc_packet_client = ipc_packet_client;
 	LOGI("IPC client ready");
+
+	ipc_tx_start();
 	
 srs:
 	LOGD("Creating SRS client");
@@ -622,10 +1074,10 @@ srs:
 		goto end;
 	}
 
-	rc = ril_client_thread_start(srs_client);
+	rc = ril_client_start(srs_client, &ril_data.reactor);
 
 	if(rc < 0) {
-		LOGE("SRS thread creation failed.");
+		LOGE("SRS client start failed.");
 		goto end;
 	}
 
@@ -636,6 +1088,7 @@ end:
 	ril_data.state.radio_state = RADIO_STATE_OFF;
 	ril_data.state.power_state = POWER_STATE_OFF;
 
+	ril_state_publish();
 	RIL_UNLOCK();
 
 	return &ril_ops;
@@ -30,8 +30,13 @@
 
 #include <radio.h>
 
+#include "event.h"
 #include "ipc.h"
+#include "worker.h"
+#include "delivery.h"
 #include "srs.h"
+#include "timer.h"
+#include "gso.h"
 
 #include <tapi_network.h>
 #include <tapi_call.h>
@@ -44,8 +49,17 @@
 
 #define RIL_VERSION_STRING "Samsung RIL"
 
+/* Runtime log levels, "<module|all>=<level>,..." with levels 0 (errors) to 4 */
+#define RIL_LOG_LEVELS_PROPERTY "ril.ipc.log"
+
+/* "1" opens the tun devices with IFF_VNET_HDR, for GSO and GRO */
+#define RIL_GPRS_VNET_HDR_PROPERTY "ril.gprs.vnet_hdr"
+
 #define RIL_LOCK() pthread_mutex_lock(&ril_data.mutex)
 #define RIL_UNLOCK() pthread_mutex_unlock(&ril_data.mutex)
+/* Guards ril_data.requests, subsystems complete requests concurrently */
+#define RIL_REQUEST_LOCK() pthread_mutex_lock(&ril_data.request_mutex)
+#define RIL_REQUEST_UNLOCK() pthread_mutex_unlock(&ril_data.request_mutex)
 #define RIL_CLIENT_LOCK(client) pthread_mutex_lock(&(client->mutex))
 #define RIL_CLIENT_UNLOCK(client) pthread_mutex_unlock(&(client->mutex))
 
@@ -67,10 +81,15 @@ struct ril_state;
 
 struct ril_client;
 
+/*
+ * Clients don't run a read loop of their own: attach registers their fds
+ * with the reactor, detach removes them again before destroy.
+ */
 struct ril_client_funcs {
 	int (*create)(struct ril_client *client);
 	int (*destroy)(struct ril_client *client);
-	int (*read_loop)(struct ril_client *client);
+	int (*attach)(struct ril_client *client, struct ril_reactor *reactor);
+	int (*detach)(struct ril_client *client);
 };
 
 typedef enum {
@@ -87,7 +106,9 @@ struct ril_client {
 
 	void *data;
 
-	pthread_t thread;
+	struct ril_reactor *reactor;
+	int failures;
+
 	pthread_mutex_t mutex;
 };
 
@@ -95,16 +116,86 @@ struct ril_client *ril_client_new(struct ril_client_funcs *client_funcs);
 int ril_client_free(struct ril_client *client);
 int ril_client_create(struct ril_client *client);
 int ril_client_destroy(struct ril_client *client);
-int ril_client_thread_start(struct ril_client *client);
+int ril_client_start(struct ril_client *client, struct ril_reactor *reactor);
+void ril_client_recover(struct ril_client *client);
 
 /**
  * RIL requests
  */
 
+/*
+ * Pending requests are hashed both by token and by id, nodes come from a
+ * pool that grows by RIL_REQUEST_POOL_CHUNK and never shrinks. Ids run
+ * from 1 to RIL_REQUEST_ID_MAX - 1 and skip the ones still pending when
+ * they wrap around.
+ */
+#define RIL_REQUEST_HASH_BITS	8
+#define RIL_REQUEST_HASH_SIZE	(1 << RIL_REQUEST_HASH_BITS)
+#define RIL_REQUEST_POOL_CHUNK	64
+#define RIL_REQUEST_ID_MAX	0x8000
+/* Timeouts are counted per request number below this, the rest in 0 */
+#define RIL_REQUEST_TIMEOUT_TYPES	128
+
+/* Deadlines of the requests waiting on a modem answer */
+#define RIL_TIMEOUT_SMS_MS		60000
+#define RIL_TIMEOUT_NETWORK_SEARCH_MS	180000
+#define RIL_TIMEOUT_NETWORK_SELECT_MS	60000
+#define RIL_TIMEOUT_DATA_CALL_MS	60000
+#define RIL_TIMEOUT_SIM_MS		30000
+#define RIL_TIMEOUT_DTMF_MS		10000
+
 struct ril_request_info {
 	RIL_Token token;
+	/* -1 until the request needs one */
 	int id;
+	/* RIL_REQUEST_*, 0 when unknown */
+	int request;
 	int canceled;
+
+	/* Deadline, completes the request with timeout_error when it expires */
+	struct ril_timer timer;
+	RIL_Errno timeout_error;
+	/* Cleared on expiry if it still holds the token */
+	RIL_Token *slot;
+	/* Or called on expiry, for more state than a token to clean up */
+	void (*expire)(RIL_Token t);
+	int expired;
+
+	/* Token and id hash chains, next is also the free list link */
+	struct ril_request_info *token_next;
+	struct ril_request_info *id_next;
+	struct ril_request_info *next;
+};
+
+struct ril_request_chunk {
+	struct ril_request_chunk *next;
+	struct ril_request_info nodes[RIL_REQUEST_POOL_CHUNK];
+};
+
+struct ril_request_stats {
+	uint32_t pending;
+	uint32_t max_pending;
+	/* Ids skipped because the request holding them was still pending */
+	uint32_t id_skips;
+	uint32_t deadlines;
+	uint32_t timeouts;
+	uint32_t timeouts_by_request[RIL_REQUEST_TIMEOUT_TYPES];
+};
+
+struct ril_request_registry {
+	struct ril_request_info *tokens[RIL_REQUEST_HASH_SIZE];
+	struct ril_request_info *ids[RIL_REQUEST_HASH_SIZE];
+	struct ril_request_info *free_list;
+	struct ril_request_chunk *chunks;
+	int id;
+
+	/* Driven by a timerfd on the reactor, armed for the next deadline */
+	struct ril_timer_wheel deadlines;
+	struct ril_event deadline_event;
+	uint64_t deadline_armed;
+	int deadlines_started;
+
+	struct ril_request_stats stats;
 };
 
 int ril_request_id_get(void);
@@ -117,6 +208,11 @@ int ril_request_set_canceled(RIL_Token t, int canceled);
 int ril_request_get_canceled(RIL_Token t);
 RIL_Token ril_request_get_token(int id);
 int ril_request_get_id(RIL_Token t);
+void ril_request_track(RIL_Token t, int request_number);
+void ril_request_get_stats(struct ril_request_stats *stats);
+int ril_request_deadlines_start(void);
+int ril_request_deadline(RIL_Token t, unsigned int timeout_ms, RIL_Errno error, RIL_Token *slot);
+int ril_request_deadline_call(RIL_Token t, unsigned int timeout_ms, RIL_Errno error, void (*expire)(RIL_Token t));
 
 void ril_request_complete(RIL_Token t, RIL_Errno e, void *data, size_t length);
 void ril_request_unsolicited(int request, void *data, size_t length);
@@ -179,7 +275,6 @@ struct ril_state {
 	uint32_t cell_id;
 	uint8_t rac_id;
 	uint16_t lac_id;
-	int gprs_last_failed_cid;
 	char proper_plmn[9];
 	char SPN[NET_MAX_SPN_LEN];
 	char name[NET_MAX_NAME_LEN];
@@ -192,6 +287,49 @@ typedef struct ril_config {
 
 void ril_state_lpm(void);
 
+/*
+ * Copy of the state status queries answer from, published with a seqlock
+ * whenever RIL_LOCK is released after a change. Readers retry instead of
+ * taking RIL_LOCK, so they never wait on a subsystem.
+ */
+struct ril_call_snapshot {
+	/* 0xFFFFFFFF for no call */
+	uint32_t callId;
+	uint32_t call_state;
+	uint8_t bMT;
+	char number[64];
+};
+
+struct ril_state_snapshot {
+	RIL_RadioState radio_state;
+	ril_sim_state sim_state;
+	int power_state;
+	int reg_state;
+	int act;
+	uint32_t cell_id;
+	uint16_t lac_id;
+	char proper_plmn[9];
+	char SPN[NET_MAX_SPN_LEN];
+	char name[NET_MAX_NAME_LEN];
+	struct ril_call_snapshot calls[MAX_CALLS];
+};
+
+struct ril_state_stats {
+	uint32_t publishes;
+	/* Reads that raced a publish and copied again */
+	uint32_t retries;
+};
+
+struct ril_state_seqlock {
+	volatile uint32_t sequence;
+	struct ril_state_snapshot snapshot;
+	struct ril_state_stats stats;
+};
+
+void ril_state_publish(void);
+void ril_state_get(struct ril_state_snapshot *snapshot);
+void ril_state_get_stats(struct ril_state_stats *stats);
+
 /**
  * RIL data
  */
@@ -218,11 +356,44 @@ typedef struct ril_gprs_connection {
 	RIL_Token token;
 	RIL_DataCallFailCause fail_cause;
 
-	pthread_t thread;
-	pthread_mutex_t mutex;
-	int thread_state;
+	struct ril_event event;
+	/* tun I/O through io_uring when available, downlink writes are batched */
+	struct ipc_uring *uring;
+	/* Taken by the packet paths, the tunnel's uplink and downlink can race */
+	pthread_mutex_t tunnel_lock;
+	/* Set while the uplink sends without the locks, gprs_tunnel_stop waits */
+	int uplink_busy;
+	pthread_cond_t uplink_done;
+	/* Holds a reference on the data plane thread */
+	int tunneling;
+
+	uint32_t up_bytes, down_bytes;
+	uint32_t syscalls;
+	long switches;
+	/* CPU time spent moving up_bytes, for CPU per MB */
+	uint64_t up_cpu_ns;
+	uint32_t up_packets, up_wakeups;
+
+	/* IFF_VNET_HDR tun, super packets are cut up and put back together here */
+	int vnet_hdr;
+	uint8_t *gso_buf;
+	struct gro gro;
+	uint32_t gso_packets, gso_segments;
+	uint32_t gro_packets, gro_segments;
 } ril_gprs_connection;
 
+struct gprs_downlink_stats {
+	uint32_t packets;
+	uint32_t dropped;
+	uint64_t bytes;
+	/* From the modem read to the tun write */
+	uint64_t total_latency_us;
+	uint32_t max_latency_us;
+	/* First and last batch, for packets per second */
+	uint64_t first_us;
+	uint64_t last_us;
+};
+
 typedef struct ril_net_select {
 	char * plmn;
 	tapiNetSearchCnf net_select_entry;
@@ -232,17 +403,17 @@ struct ril_data {
 	struct RIL_Env *env;
 
 	struct ril_state state;
+	struct ril_state_seqlock published;
 	struct ril_tokens tokens;
 	ril_config config;
 	struct list_head *gprs_connections;
 	struct list_head *net_select_list;
-	struct list_head *requests;
+	struct ril_request_registry requests;
 
 	char cached_sw_version[33];
 	uint8_t cached_bcd_imsi[14];
 	char cached_imsi[33];
 
-	int request_id;
 	char smsc_number[30];
 	int inDevice;
 	int outDevice;
@@ -251,7 +422,10 @@ struct ril_data {
 	struct ril_client *ipc_packet_client;
 	struct ril_client *srs_client;
 
+	struct ril_reactor reactor;
+
 	pthread_mutex_t mutex;
+	pthread_mutex_t request_mutex;
 };
 
 extern struct ril_data ril_data;
@@ -304,11 +478,13 @@ int ril_gprs_connection_register(int cid);
 void ril_gprs_connection_unregister(struct ril_gprs_connection *gprs_connection);
 struct ril_gprs_connection *ril_gprs_connection_find_cid(int cid);
 struct ril_gprs_connection *ril_gprs_connection_find_contextId(uint32_t contextId);
+struct ril_gprs_connection *ril_gprs_connection_find_token(RIL_Token t);
 struct ril_gprs_connection *ril_gprs_connection_start(void);
 void ril_gprs_connection_stop(struct ril_gprs_connection *gprs_connection);
+int gprs_downlink_queue(struct modem_io *frames, int count, uint64_t received_us);
+void gprs_downlink_get_stats(struct gprs_downlink_stats *stats);
 void ipc_proto_start_network_cnf(void* data);
 void ipc_proto_stop_network_cnf(void* data);
-void ipc_proto_receive_data_ind(void* data);
 void ril_request_setup_data_call(RIL_Token t, void *data, int length);
 void ril_request_deactivate_data_call(RIL_Token t, void *data, int length);
 void ril_request_last_data_call_fail_cause(RIL_Token t);
@@ -370,6 +546,7 @@ void ipc_ss_error_response(void* data);
 /* SND */
 void ril_request_set_mute(RIL_Token t, void *data, size_t datalen);
 void srs_control_ping(struct srs_message *message);
+void srs_control_capture(struct srs_message *message);
 void srs_snd_set_volume(struct srs_message *message);
 void srs_snd_set_audio_path(struct srs_message *message);
 void srs_snd_1mic_ns_ctrl(struct srs_message *message);
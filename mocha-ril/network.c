@@ -20,6 +20,8 @@
  */
  
 #define LOG_TAG "RIL-Mocha-NETWORK"
+#define IPC_LOG_MODULE	IPC_LOG_RIL
+
 #include <time.h>
 #include <utils/Log.h>
 
@@ -284,7 +286,7 @@ void ipc_network_nitz_info(void* data)
 	char str[128];
 	
 	LOGD("Received NITZ... dumping");
-	hex_dump(data, 0x70);
+	IPC_HEX_DUMP(data, 0x70);
 	
 	nitz = (tapiNitzInfo*) data;
 
@@ -428,27 +430,30 @@ void network_start(void)
 
 void ril_request_operator(RIL_Token t)
 {
+	struct ril_state_snapshot snapshot;
 	char *response[3];
 	char *plmn;
 	unsigned int mcc, mnc;
 	int plmn_entries;
 	unsigned int i;
 
-	if (ril_data.state.reg_state == 1) {
+	ril_state_get(&snapshot);
+
+	if (snapshot.reg_state == 1) {
 		memset(response, 0, sizeof(response));
 
-		if (ril_data.state.name[0] != 0)
+		if (snapshot.name[0] != 0)
 			{
-			asprintf(&response[0], "%s", ril_data.state.name);
-			asprintf(&response[1], "%s", ril_data.state.name);
+			asprintf(&response[0], "%s", snapshot.name);
+			asprintf(&response[1], "%s", snapshot.name);
 			}
-		else if (ril_data.state.SPN[0] != 0)
+		else if (snapshot.SPN[0] != 0)
 			{
-			asprintf(&response[0], "%s", ril_data.state.SPN);
-			asprintf(&response[1], "%s", ril_data.state.SPN);
+			asprintf(&response[0], "%s", snapshot.SPN);
+			asprintf(&response[1], "%s", snapshot.SPN);
 			}
 
-		asprintf(&response[2], "%s", ril_data.state.proper_plmn);
+		asprintf(&response[2], "%s", snapshot.proper_plmn);
 
 		ril_request_complete(t, RIL_E_SUCCESS, response, sizeof(response));
 		for (i = 0; i < sizeof(response) / sizeof(char *); i++) {
@@ -464,17 +469,20 @@ void ril_request_operator(RIL_Token t)
 
 void ril_request_voice_registration_state(RIL_Token t)
 {
+	struct ril_state_snapshot snapshot;
 	char *response[15];
 	unsigned int i;
 
+	ril_state_get(&snapshot);
+
 	memset(response, 0, sizeof(response));
 
-	asprintf(&response[0], "%d", ril_data.state.reg_state);
-	asprintf(&response[1], "%x", ril_data.state.lac_id);
-	asprintf(&response[2], "%x", ril_data.state.cell_id);
-	asprintf(&response[3], "%d", ril_data.state.act);
+	asprintf(&response[0], "%d", snapshot.reg_state);
+	asprintf(&response[1], "%x", snapshot.lac_id);
+	asprintf(&response[2], "%x", snapshot.cell_id);
+	asprintf(&response[3], "%d", snapshot.act);
 	
-	if(ril_data.state.reg_state == 3) /* If registration failed */
+	if(snapshot.reg_state == 3) /* If registration failed */
 		asprintf(&response[13], "%d", 0); /* Set "General" reason of failure - can we get real reason? Do we need to? */
 
 	ril_request_complete(t, RIL_E_SUCCESS, response, sizeof(response));
@@ -487,19 +495,22 @@ void ril_request_voice_registration_state(RIL_Token t)
 
 void ril_request_data_registration_state(RIL_Token t)
 {
+	struct ril_state_snapshot snapshot;
 	char *response[6];
 	unsigned int i;
 
+	ril_state_get(&snapshot);
+
 	memset(response, 0, sizeof(response));
 
-	if (ril_data.state.act == RADIO_TECH_UNKNOWN)
+	if (snapshot.act == RADIO_TECH_UNKNOWN)
 		asprintf(&response[0], "%d", 0);
 	else
-		asprintf(&response[0], "%d", ril_data.state.reg_state);
-	asprintf(&response[1], "%x", ril_data.state.lac_id);
-	asprintf(&response[2], "%x", ril_data.state.cell_id);
-	asprintf(&response[3], "%d", ril_data.state.act);
-	if(ril_data.state.reg_state == 3) /* If registration failed */
+		asprintf(&response[0], "%d", snapshot.reg_state);
+	asprintf(&response[1], "%x", snapshot.lac_id);
+	asprintf(&response[2], "%x", snapshot.cell_id);
+	asprintf(&response[3], "%d", snapshot.act);
+	if(snapshot.reg_state == 3) /* If registration failed */
 		asprintf(&response[4], "%d", 7); /* Set "GPRS services not allowed" reason of failure - can we get real reason? Do we need to? */
 	asprintf(&response[5], "%d", MAX_CONNECTIONS);
 
@@ -553,6 +564,7 @@ void ril_request_query_available_networks(RIL_Token t)
 	tapi_set_selection_mode(1);
 	tapi_network_search();
 	ril_data.tokens.query_avail_networks = t;
+	ril_request_deadline(t, RIL_TIMEOUT_NETWORK_SEARCH_MS, RIL_E_GENERIC_FAILURE, &ril_data.tokens.query_avail_networks);
 }
 
 void ril_request_query_network_selection_mode(RIL_Token t)
@@ -569,6 +581,7 @@ void ril_request_set_network_selection_automatic(RIL_Token t)
 	tapi_network_reselect(1);
 	tapi_set_selection_mode(0);
 	ril_data.tokens.network_selection = t;
+	ril_request_deadline(t, RIL_TIMEOUT_NETWORK_SELECT_MS, RIL_E_GENERIC_FAILURE, &ril_data.tokens.network_selection);
 
 	ril_data.config.bAutoAttach = TAPI_NETWORK_SELECTION_AUTO;
 	save_ril_config();
@@ -596,6 +609,7 @@ void ril_request_set_network_selection_manual(RIL_Token t, void *data, size_t da
 	tapi_network_select(&net_select->net_select_entry);
 
 	ril_data.tokens.network_selection = t;
+	ril_request_deadline(t, RIL_TIMEOUT_NETWORK_SELECT_MS, RIL_E_GENERIC_FAILURE, &ril_data.tokens.network_selection);
 
 	ril_data.config.bAutoAttach = TAPI_NETWORK_SELECTION_MANUAL;
 	save_ril_config();
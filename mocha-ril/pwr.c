@@ -21,6 +21,8 @@
  */
 
 #define LOG_TAG "RIL-Mocha-PWR"
+#define IPC_LOG_MODULE	IPC_LOG_RIL
+
 #include <time.h>
 #include <utils/Log.h>
 
@@ -53,7 +55,7 @@ void ipc_cp_system_start(void* data)
 	suffix_size = ipc_frame->datasize - desc_size - 1;
 	if(suffix_size > 0) {
 		DEBUG_I("dumping rest of data from IPC_SYSTEM packet");
-		hex_dump(ipc_frame->data+desc_size+1, suffix_size);
+		IPC_HEX_DUMP(ipc_frame->data+desc_size+1, suffix_size);
 	}
 
 	tapi_init();
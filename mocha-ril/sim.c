@@ -20,6 +20,8 @@
  */
 
 #define LOG_TAG "RIL-Mocha-SIM"
+#define IPC_LOG_MODULE	IPC_LOG_RIL
+
 #include <utils/Log.h>
 
 #include "mocha-ril.h"
@@ -226,6 +228,7 @@ void ril_request_get_sim_status(RIL_Token t)
 {
 	LOGE("%s: test me!", __func__);
 
+	struct ril_state_snapshot snapshot;
 	RIL_CardStatus_v6 card_status;
 	ril_sim_state sim_state;
 	int app_status_array_length;
@@ -265,10 +268,11 @@ void ril_request_get_sim_status(RIL_Token t)
 		NULL, NULL, 0, RIL_PINSTATE_ENABLED_NOT_VERIFIED, RIL_PINSTATE_UNKNOWN },
 		};
 
-	sim_state = ril_data.state.sim_state;
+	ril_state_get(&snapshot);
+	sim_state = snapshot.sim_state;
 
 	/* Card is assumed to be present if not explicitly absent */
-	if(ril_data.state.sim_state == SIM_STATE_ABSENT) {
+	if(sim_state == SIM_STATE_ABSENT) {
 		card_status.card_state = RIL_CARDSTATE_ABSENT;
 	} else {
 		card_status.card_state = RIL_CARDSTATE_PRESENT;
@@ -420,6 +424,7 @@ void ril_request_set_facility_lock(RIL_Token t, void *data, size_t datalen)
 		goto error;
 	}
 	ril_data.tokens.set_facility_lock = t;
+	ril_request_deadline(t, RIL_TIMEOUT_SIM_MS, RIL_E_GENERIC_FAILURE, &ril_data.tokens.set_facility_lock);
 	return;
 error:
 	ril_request_complete(t, RIL_E_GENERIC_FAILURE, NULL, 0);
@@ -440,6 +445,7 @@ void ril_request_change_sim_pin(RIL_Token t, void *data, size_t datalen)
 	sim_change_chv(0x4, 0x0, password_old, password_new);
 
 	ril_data.tokens.change_sim_pin = t;
+	ril_request_deadline(t, RIL_TIMEOUT_SIM_MS, RIL_E_GENERIC_FAILURE, &ril_data.tokens.change_sim_pin);
 
 	return;
 error:
@@ -21,6 +21,8 @@
  */
 
 #define LOG_TAG "RIL-Mocha-SMS"
+#define IPC_LOG_MODULE	IPC_LOG_RIL
+
 #include <utils/Log.h>
 
 #include "mocha-ril.h"
@@ -90,8 +92,11 @@ void ril_request_send_sms(RIL_Token t, void *data, size_t length)
 
 	/* We first need to get SMS SVC before sending the message */
 
+	/* Written by the SIM worker, under RIL_LOCK */
+	RIL_LOCK();
 	smsc_length = strlen((char *) ril_data.smsc_number);
 	smsc = (unsigned char *) strdup((char *) ril_data.smsc_number);
+	RIL_UNLOCK();
 
 	if (pdu == NULL || pdu_length <= 0 || smsc == NULL || smsc_length <= 0) {
 		LOGE("Provided PDU or SMSC is invalid! Aborting");
@@ -306,6 +311,7 @@ void ril_request_send_sms(RIL_Token t, void *data, size_t length)
 	tapi_nettext_send((uint8_t *)mess);
 	
 	ril_data.tokens.outgoing_sms = t;
+	ril_request_deadline(t, RIL_TIMEOUT_SMS_MS, RIL_E_SMS_SEND_FAIL_RETRY, &ril_data.tokens.outgoing_sms);
 
 	if (pdu != NULL)
 		free(pdu);
@@ -18,7 +18,10 @@
  *
  */
 
+#define IPC_LOG_MODULE	IPC_LOG_RIL
+
 #include <fcntl.h>
+#include <errno.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <sys/socket.h>
@@ -35,6 +38,8 @@
 #include "mocha-ril.h"
 #include "util.h"
 
+static void srs_client_event(int fd, uint32_t events, void *data);
+
 int srs_client_register(struct srs_client_data *client_data, int fd)
 {
 	struct srs_client_info *client;
@@ -50,6 +55,13 @@ int srs_client_register(struct srs_client_data *client_data, int fd)
 
 	client->fd = fd;
 
+	if (client_data->reactor != NULL &&
+	    ril_event_add(client_data->reactor, &client->event, fd, EPOLLIN,
+			RIL_EVENT_PRIORITY_NORMAL, srs_client_event, (void *) client_data) < 0) {
+		free(client);
+		return -1;
+	}
+
 	list_end = client_data->clients;
 	while (list_end != NULL && list_end->next != NULL)
 		list_end = list_end->next;
@@ -72,6 +84,7 @@ void srs_client_unregister(struct srs_client_data *client_data, struct srs_clien
 	list = client_data->clients;
 	while (list != NULL) {
 		if (list->data == (void *) client) {
+			ril_event_del(&client->event);
 			memset(client, 0, sizeof(struct srs_client_info));
 			free(client);
 
@@ -128,60 +141,6 @@ list_continue:
 	return NULL;
 }
 
-int srs_client_info_fill_fd_set(struct srs_client_data *client_data, fd_set *fds)
-{
-	struct srs_client_info *client;
-	struct list_head *list;
-	int fd_max;
-
-	if (client_data == NULL || fds == NULL)
-		return -1;
-
-	fd_max = -1;
-	list = client_data->clients;
-	while (list != NULL) {
-		client = (struct srs_client_info *) list->data;
-		if (client == NULL)
-			goto list_continue;
-
-		FD_SET(client->fd, fds);
-		if (client->fd > fd_max)
-			fd_max = client->fd;
-
-list_continue:
-		list = list->next;
-	}
-
-	return fd_max;
-}
-
-int srs_client_info_get_fd_set(struct srs_client_data *client_data, fd_set *fds)
-{
-	struct srs_client_info *client;
-	struct list_head *list;
-	int fd;
-
-	if (client_data == NULL || fds == NULL)
-		return -1;
-
-	list = client_data->clients;
-	while (list != NULL) {
-		client = (struct srs_client_info *) list->data;
-		if (client == NULL)
-			goto list_continue;
-
-		if (FD_ISSET(client->fd, fds)) {
-			FD_CLR(client->fd, fds);
-			return client->fd;
-		}
-
-list_continue:
-		list = list->next;
-	}
-
-	return -1;
-}
-
 int srs_client_send_message(struct srs_client_data *client_data, struct srs_message *message)
 {
 	struct srs_header header;
@@ -280,7 +239,7 @@ int srs_send(unsigned short command, void *data, int length)
 	LOGD("SEND SRS: fd=%d command=%d length=%d", client_data->client_fd, command, length);
 	if (data != NULL && length > 0) {
 		LOGD("==== SRS DATA DUMP ====");
-		hex_dump(data, length);
+		IPC_HEX_DUMP(data, length);
 		LOGD("=======================");
 	}
 
@@ -291,9 +250,6 @@ int srs_client_recv(struct srs_client_data *client_data, struct srs_message *mes
 {
 	struct srs_header *header;
 	void *data;
-
-	struct timeval timeout;
-	fd_set fds;
 	int rc;
 
 	if (client_data == NULL || message == NULL)
@@ -303,22 +259,10 @@ int srs_client_recv(struct srs_client_data *client_data, struct srs_message *mes
 	if (data == NULL)
 		return -1;
 
-	memset(&timeout, 0, sizeof(timeout));
-	timeout.tv_usec = 300;
-
+	/* Only called once the reactor saw the fd readable */
 	if (client_data->client_fd < 0)
 		goto error;
 
-	FD_ZERO(&fds);
-	FD_SET(client_data->client_fd, &fds);
-
-	rc = select(client_data->client_fd + 1, &fds, NULL, NULL, &timeout);
-
-	if (!FD_ISSET(client_data->client_fd, &fds)) {
-		LOGE("SRS read select failed on fd %d", client_data->client_fd);
-		goto error;
-	}
-
 	rc = read(client_data->client_fd, data, SRS_DATA_MAX_SIZE);
 	if (rc < (int) sizeof(struct srs_header)) {
 		LOGE("SRS read failed on fd %d with %d bytes", client_data->client_fd, rc);
@@ -359,6 +303,24 @@ void srs_control_ping(struct srs_message *message)
 	}
 }
 
+void srs_control_capture(struct srs_message *message)
+{
+	char spec[SRS_DATA_MAX_SIZE + 1];
+	int length;
+
+	if (message == NULL)
+		return;
+
+	length = message->data != NULL ? message->length : 0;
+	if (length > SRS_DATA_MAX_SIZE)
+		length = SRS_DATA_MAX_SIZE;
+
+	memcpy(spec, message->data, length);
+	spec[length] = '\0';
+
+	ipc_capture_configure(spec);
+}
+
 static int srs_server_open(void)
 {
 	int server_fd;
@@ -378,134 +340,129 @@ static int srs_server_open(void)
 	return -1;
 }
 
-void *srs_client_read_loop(void *data)
+static void srs_client_event(int fd, uint32_t events, void *data)
 {
 	struct srs_client_info *client;
 	struct srs_client_data *client_data;
 	struct srs_message message;
-	struct timeval timeout;
-	fd_set fds;
-	int fd_max;
-	int fd;
 	int rc;
 
-	if (data == NULL)
-		pthread_exit(NULL);
-
 	client_data = (struct srs_client_data *) data;
 
-	while (client_data->running) {
-		FD_ZERO(&fds);
+	SRS_CLIENT_LOCK();
 
-		SRS_CLIENT_LOCK();
-		fd_max = srs_client_info_fill_fd_set(client_data, &fds);
+	/* Unregistered since the event was queued */
+	client = srs_client_info_find_fd(client_data, fd);
+	if (client == NULL) {
 		SRS_CLIENT_UNLOCK();
+		return;
+	}
 
-		if (fd_max < 0) {
-			usleep(3000);
-			continue;
-		}
-
-		timeout.tv_sec = 0;
-		timeout.tv_usec = 3000;
-
-		select(fd_max + 1, &fds, NULL, NULL, &timeout);
-
-		SRS_CLIENT_LOCK();
-		while ((fd = srs_client_info_get_fd_set(client_data, &fds)) >= 0) {
-			client_data->client_fd = fd;
+	client_data->client_fd = fd;
 
-			RIL_CLIENT_LOCK(client_data->client);
-			rc = srs_client_recv(client_data, &message);
-			if (rc <= 0) {
-				LOGD("SRS client with fd %d terminated", fd);
+	RIL_CLIENT_LOCK(client_data->client);
+	rc = srs_client_recv(client_data, &message);
+	if (rc <= 0) {
+		LOGD("SRS client with fd %d terminated", fd);
 
-				client = srs_client_info_find_fd(client_data, fd);
-				if (client != NULL)
-					srs_client_unregister(client_data, client);
-				close(fd);
+		srs_client_unregister(client_data, client);
+		close(fd);
+		client_data->client_fd = -1;
 
-				RIL_CLIENT_UNLOCK(client_data->client);
-				continue;
-			}
-			RIL_CLIENT_UNLOCK(client_data->client);
+		RIL_CLIENT_UNLOCK(client_data->client);
+		SRS_CLIENT_UNLOCK();
+		return;
+	}
+	RIL_CLIENT_UNLOCK(client_data->client);
 
-			LOGD("RECV SRS: fd=%d command=%d length=%d", fd, message.command, message.length);
-			if (message.data != NULL && message.length > 0) {
-				LOGD("==== SRS DATA DUMP ====");
-				hex_dump(message.data, message.length);
-				LOGD("=======================");
-			}
+	LOGD("RECV SRS: fd=%d command=%d length=%d", fd, message.command, message.length);
+	if (message.data != NULL && message.length > 0) {
+		LOGD("==== SRS DATA DUMP ====");
+		IPC_HEX_DUMP(message.data, message.length);
+		LOGD("=======================");
+	}
 
-			srs_dispatch(&message);
+	srs_dispatch(&message);
 
-			if (message.data != NULL)
-				free(message.data);
+	if (message.data != NULL)
+		free(message.data);
 
-			client_data->client_fd = -1;
-		}
-		SRS_CLIENT_UNLOCK();
-	}
+	client_data->client_fd = -1;
 
-	pthread_exit(NULL);
-	return NULL;
+	SRS_CLIENT_UNLOCK();
 }
 
-int srs_read_loop(struct ril_client *client)
+static void srs_server_event(int fd, uint32_t events, void *data)
 {
 	struct srs_client_data *client_data;
-	struct sockaddr_un client_addr;
-	int client_addr_len;
-	pthread_attr_t attr;
 	int flags;
-	int fd;
+	int client_fd;
 	int rc;
 
-	if (client == NULL || client->data == NULL)
-		return -1;
+	client_data = (struct srs_client_data *) data;
 
-	client_data = (struct srs_client_data *) client->data;
+	client_fd = accept(fd, NULL, NULL);
+	if (client_fd < 0) {
+		if (errno == EINTR || errno == EAGAIN)
+			return;
+
+		LOGE("SRS server failure");
+		ril_client_recover(client_data->client);
+		return;
+	}
 
-	pthread_attr_init(&attr);
-	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+	flags = fcntl(client_fd, F_GETFL);
+	flags |= O_NONBLOCK;
+	fcntl(client_fd, F_SETFL, flags);
 
-	client_data->running = 1;
+	LOGD("Accepted new SRS client from fd %d", client_fd);
 
-	rc = pthread_create(&client_data->thread, &attr, srs_client_read_loop, (void *) client_data);
+	SRS_CLIENT_LOCK();
+	rc = srs_client_register(client_data, client_fd);
+	SRS_CLIENT_UNLOCK();
 	if (rc < 0) {
-		LOGE("Unable to create SRS client read loop thread");
-		return -1;
+		LOGE("Unable to register SRS client");
+		close(client_fd);
 	}
+}
 
-	while (client_data->server_fd >= 0) {
-		fd = accept(client_data->server_fd, (struct sockaddr *) &client_addr,
-			&client_addr_len);
-		if (fd < 0) {
-			LOGE("Unable to accept new SRS client");
-			break;
-		}
+int srs_attach(struct ril_client *client, struct ril_reactor *reactor)
+{
+	struct srs_client_data *client_data;
 
-		flags = fcntl(fd, F_GETFL);
-		flags |= O_NONBLOCK;
-		fcntl(fd, F_SETFL, flags);
+	if (client == NULL || client->data == NULL)
+		return -1;
 
-		LOGD("Accepted new SRS client from fd %d", fd);
+	client_data = (struct srs_client_data *) client->data;
+	client_data->reactor = reactor;
 
-		SRS_CLIENT_LOCK();
-		rc = srs_client_register(client_data, fd);
-		SRS_CLIENT_UNLOCK();
-		if (rc < 0) {
-			LOGE("Unable to register SRS client");
-			break;
-		}
-	}
+	return ril_event_add(reactor, &client_data->server_event, client_data->server_fd,
+		EPOLLIN, RIL_EVENT_PRIORITY_NORMAL, srs_server_event, (void *) client_data);
+}
 
-	LOGE("SRS server failure");
+int srs_detach(struct ril_client *client)
+{
+	struct srs_client_info *client_info;
+	struct srs_client_data *client_data;
+	struct list_head *list;
 
-	client_data->running = 0;
+	if (client == NULL || client->data == NULL)
+		return 0;
 
-	// Wait for the thread to finish
-	pthread_join(client_data->thread, NULL);
+	client_data = (struct srs_client_data *) client->data;
+
+	ril_event_del(&client_data->server_event);
+
+	SRS_CLIENT_LOCK();
+	list = client_data->clients;
+	while (list != NULL) {
+		client_info = (struct srs_client_info *) list->data;
+		if (client_info != NULL)
+			ril_event_del(&client_info->event);
+		list = list->next;
+	}
+	client_data->reactor = NULL;
+	SRS_CLIENT_UNLOCK();
 
 	return 0;
 }
@@ -580,5 +537,6 @@ int srs_destroy(struct ril_client *client)
 struct ril_client_funcs srs_client_funcs = {
 	.create = srs_create,
 	.destroy = srs_destroy,
-	.read_loop = srs_read_loop,
+	.attach = srs_attach,
+	.detach = srs_detach,
 };
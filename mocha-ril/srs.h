@@ -36,6 +36,7 @@
 
 struct srs_client_info {
 	int fd;
+	struct ril_event event;
 };
 
 struct srs_client_data {
@@ -46,9 +47,10 @@ struct srs_client_data {
 
 	struct list_head *clients;
 
-	pthread_t thread;
+	struct ril_reactor *reactor;
+	struct ril_event server_event;
+
 	pthread_mutex_t mutex;
-	int running;
 };
 
 extern struct ril_client_funcs srs_client_funcs;
@@ -21,6 +21,8 @@
  */
 
 #define LOG_TAG "RIL-Mocha-SS"
+#define IPC_LOG_MODULE	IPC_LOG_RIL
+
 #include <utils/Log.h>
 
 #include "mocha-ril.h"
@@ -0,0 +1,108 @@
+/**
+ * This file is part of mocha-ril.
+ *
+ * mocha-ril is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * mocha-ril is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with mocha-ril.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#define LOG_TAG "RIL-Mocha-State"
+
+#include <string.h>
+#include <sched.h>
+
+#include <utils/Log.h>
+
+#include "mocha-ril.h"
+
+/*
+ * Writers are serialized by RIL_LOCK, which every caller holds. The
+ * sequence is odd while the snapshot is being rewritten.
+ */
+void ril_state_publish(void)
+{
+	struct ril_state_seqlock *published = &ril_data.published;
+	struct ril_state_snapshot snapshot;
+	ril_call_context *call;
+	int i;
+
+	memset(&snapshot, 0, sizeof(snapshot));
+
+	snapshot.radio_state = ril_data.state.radio_state;
+	snapshot.sim_state = ril_data.state.sim_state;
+	snapshot.power_state = ril_data.state.power_state;
+	snapshot.reg_state = ril_data.state.reg_state;
+	snapshot.act = ril_data.state.act;
+	snapshot.cell_id = ril_data.state.cell_id;
+	snapshot.lac_id = ril_data.state.lac_id;
+	memcpy(snapshot.proper_plmn, ril_data.state.proper_plmn, sizeof(snapshot.proper_plmn));
+	memcpy(snapshot.SPN, ril_data.state.SPN, sizeof(snapshot.SPN));
+	memcpy(snapshot.name, ril_data.state.name, sizeof(snapshot.name));
+
+	for(i = 0 ; i < MAX_CALLS ; i++) {
+		call = ril_data.calls[i];
+		if(call == NULL) {
+			snapshot.calls[i].callId = 0xFFFFFFFF;
+			continue;
+		}
+
+		snapshot.calls[i].callId = call->callId;
+		snapshot.calls[i].call_state = call->call_state;
+		snapshot.calls[i].bMT = call->bMT;
+		memcpy(snapshot.calls[i].number, call->number, sizeof(snapshot.calls[i].number));
+	}
+
+	/* Only the writer changes it, no need for the sequence to compare */
+	if(memcmp(&snapshot, &published->snapshot, sizeof(snapshot)) == 0)
+		return;
+
+	published->sequence++;
+	__sync_synchronize();
+
+	memcpy(&published->snapshot, &snapshot, sizeof(snapshot));
+
+	__sync_synchronize();
+	published->sequence++;
+
+	published->stats.publishes++;
+}
+
+void ril_state_get(struct ril_state_snapshot *snapshot)
+{
+	struct ril_state_seqlock *published = &ril_data.published;
+	uint32_t sequence;
+
+	while(1) {
+		sequence = published->sequence;
+		__sync_synchronize();
+
+		if(!(sequence & 1)) {
+			memcpy(snapshot, &published->snapshot, sizeof(struct ril_state_snapshot));
+			__sync_synchronize();
+
+			if(published->sequence == sequence)
+				return;
+		}
+
+		__sync_fetch_and_add(&published->stats.retries, 1);
+
+		/* The writer holds RIL_LOCK, let it finish */
+		if(sequence & 1)
+			sched_yield();
+	}
+}
+
+void ril_state_get_stats(struct ril_state_stats *stats)
+{
+	memcpy(stats, &ril_data.published.stats, sizeof(struct ril_state_stats));
+}
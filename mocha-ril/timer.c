@@ -0,0 +1,211 @@
+/**
+ * This file is part of mocha-ril.
+ *
+ * mocha-ril is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * mocha-ril is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with mocha-ril.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <string.h>
+#include <time.h>
+
+#include "timer.h"
+
+#define RIL_TIMER_MASK	(RIL_TIMER_SLOTS - 1)
+/* Furthest a timer can be set, later ones are pulled in to this */
+#define RIL_TIMER_SPAN	((uint64_t) 1 << (RIL_TIMER_BITS * RIL_TIMER_LEVELS))
+
+uint64_t ril_timer_tick_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ((uint64_t) ts.tv_sec * 1000 + ts.tv_nsec / 1000000) / RIL_TIMER_TICK_MS;
+}
+
+void ril_timer_wheel_init(struct ril_timer_wheel *wheel, uint64_t now)
+{
+	memset(wheel, 0, sizeof(struct ril_timer_wheel));
+	wheel->now = now;
+}
+
+static void ril_timer_link(struct ril_timer_wheel *wheel, struct ril_timer *timer)
+{
+	struct ril_timer **slot;
+	uint64_t delta;
+	int level, index;
+
+	/* Cascaded timers may be due right now, the current slot is taken next */
+	delta = timer->expires - wheel->now;
+	if(delta >= RIL_TIMER_SPAN) {
+		timer->expires = wheel->now + RIL_TIMER_SPAN - 1;
+		delta = RIL_TIMER_SPAN - 1;
+	}
+
+	for(level = 0 ; level < RIL_TIMER_LEVELS - 1 ; level++)
+		if(delta < ((uint64_t) 1 << (RIL_TIMER_BITS * (level + 1))))
+			break;
+
+	index = (timer->expires >> (RIL_TIMER_BITS * level)) & RIL_TIMER_MASK;
+	slot = &wheel->slots[level][index];
+
+	timer->next = *slot;
+	timer->pprev = slot;
+	if(*slot != NULL)
+		(*slot)->pprev = &timer->next;
+	*slot = timer;
+
+	wheel->occupied[level] |= (uint64_t) 1 << index;
+}
+
+static void ril_timer_unlink(struct ril_timer_wheel *wheel, struct ril_timer *timer)
+{
+	int level, index;
+
+	*timer->pprev = timer->next;
+	if(timer->next != NULL)
+		timer->next->pprev = timer->pprev;
+
+	/* Find the slot the timer was in when it was the last one there */
+	for(level = 0 ; level < RIL_TIMER_LEVELS ; level++) {
+		if(timer->pprev < &wheel->slots[level][0] ||
+		   timer->pprev > &wheel->slots[level][RIL_TIMER_MASK])
+			continue;
+
+		index = timer->pprev - &wheel->slots[level][0];
+		if(wheel->slots[level][index] == NULL)
+			wheel->occupied[level] &= ~((uint64_t) 1 << index);
+		break;
+	}
+
+	timer->next = NULL;
+	timer->pprev = NULL;
+}
+
+void ril_timer_add(struct ril_timer_wheel *wheel, struct ril_timer *timer, uint64_t expires)
+{
+	if(timer->pprev != NULL)
+		ril_timer_unlink(wheel, timer);
+	else
+		wheel->count++;
+
+	timer->expires = expires > wheel->now ? expires : wheel->now + 1;
+	ril_timer_link(wheel, timer);
+}
+
+void ril_timer_del(struct ril_timer_wheel *wheel, struct ril_timer *timer)
+{
+	if(timer->pprev == NULL)
+		return;
+
+	ril_timer_unlink(wheel, timer);
+	wheel->count--;
+}
+
+int ril_timer_pending(struct ril_timer *timer)
+{
+	return timer->pprev != NULL;
+}
+
+/* Moves the timers of an upper level slot down to where they now belong */
+static void ril_timer_cascade(struct ril_timer_wheel *wheel, int level, int index)
+{
+	struct ril_timer *timer, *next;
+
+	timer = wheel->slots[level][index];
+	wheel->slots[level][index] = NULL;
+	wheel->occupied[level] &= ~((uint64_t) 1 << index);
+
+	for( ; timer != NULL ; timer = next) {
+		next = timer->next;
+		ril_timer_link(wheel, timer);
+	}
+}
+
+/*
+ * Turns the wheel up to now and returns the timers that expired on the
+ * way, linked through next. They are no longer pending and may be added
+ * again or freed by the caller.
+ */
+struct ril_timer *ril_timer_advance(struct ril_timer_wheel *wheel, uint64_t now)
+{
+	struct ril_timer *expired = NULL;
+	struct ril_timer *timer, *next;
+	int level, index;
+
+	while(wheel->now < now) {
+		/* Nothing in the wheel, just catch up */
+		if(wheel->count == 0) {
+			wheel->now = now;
+			break;
+		}
+
+		wheel->now++;
+		index = wheel->now & RIL_TIMER_MASK;
+
+		if(index == 0) {
+			for(level = 1 ; level < RIL_TIMER_LEVELS ; level++) {
+				ril_timer_cascade(wheel, level, (wheel->now >> (RIL_TIMER_BITS * level)) & RIL_TIMER_MASK);
+				if(((wheel->now >> (RIL_TIMER_BITS * level)) & RIL_TIMER_MASK) != 0)
+					break;
+			}
+		}
+
+		timer = wheel->slots[0][index];
+		wheel->slots[0][index] = NULL;
+		wheel->occupied[0] &= ~((uint64_t) 1 << index);
+
+		for( ; timer != NULL ; timer = next) {
+			next = timer->next;
+			timer->pprev = NULL;
+			timer->next = expired;
+			expired = timer;
+			wheel->count--;
+		}
+	}
+
+	return expired;
+}
+
+/* Tick the wheel next has to be turned to, 0 when it is empty */
+uint64_t ril_timer_next(struct ril_timer_wheel *wheel)
+{
+	uint64_t next = 0, boundary, bits;
+	int shift, level;
+
+	if(wheel->count == 0)
+		return 0;
+
+	if(wheel->occupied[0] != 0) {
+		/* Slots in the order the wheel reaches them, starting after now */
+		shift = (wheel->now + 1) & RIL_TIMER_MASK;
+		bits = wheel->occupied[0];
+		if(shift != 0)
+			bits = (bits >> shift) | (bits << (RIL_TIMER_SLOTS - shift));
+
+		next = wheel->now + 1 + __builtin_ctzll(bits);
+	}
+
+	for(level = 1 ; level < RIL_TIMER_LEVELS ; level++) {
+		if(wheel->occupied[level] == 0)
+			continue;
+
+		boundary = (wheel->now | RIL_TIMER_MASK) + 1;
+		if(next == 0 || boundary < next)
+			next = boundary;
+		break;
+	}
+
+	return next;
+}
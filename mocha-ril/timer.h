@@ -0,0 +1,58 @@
+/**
+ * This file is part of mocha-ril.
+ *
+ * mocha-ril is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * mocha-ril is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with mocha-ril.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef _SAMSUNG_RIL_TIMER_H_
+#define _SAMSUNG_RIL_TIMER_H_
+
+#include <stdint.h>
+
+/*
+ * Hierarchical timer wheel: level n has RIL_TIMER_SLOTS slots of
+ * RIL_TIMER_SLOTS^n ticks each, timers of the upper levels cascade down
+ * as the wheel turns. Adding, removing and expiring a timer are O(1), and
+ * a bitmap of the occupied slots per level gives the next tick anything
+ * happens at without walking the slots. Not locked, the owner does that.
+ */
+#define RIL_TIMER_BITS		6
+#define RIL_TIMER_SLOTS		(1 << RIL_TIMER_BITS)
+#define RIL_TIMER_LEVELS	4
+/* Milliseconds per tick */
+#define RIL_TIMER_TICK_MS	100
+
+struct ril_timer {
+	struct ril_timer *next;
+	struct ril_timer **pprev;
+	uint64_t expires;
+};
+
+struct ril_timer_wheel {
+	struct ril_timer *slots[RIL_TIMER_LEVELS][RIL_TIMER_SLOTS];
+	uint64_t occupied[RIL_TIMER_LEVELS];
+	uint64_t now;
+	uint32_t count;
+};
+
+uint64_t ril_timer_tick_now(void);
+void ril_timer_wheel_init(struct ril_timer_wheel *wheel, uint64_t now);
+void ril_timer_add(struct ril_timer_wheel *wheel, struct ril_timer *timer, uint64_t expires);
+void ril_timer_del(struct ril_timer_wheel *wheel, struct ril_timer *timer);
+int ril_timer_pending(struct ril_timer *timer);
+struct ril_timer *ril_timer_advance(struct ril_timer_wheel *wheel, uint64_t now);
+uint64_t ril_timer_next(struct ril_timer_wheel *wheel);
+
+#endif
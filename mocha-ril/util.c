@@ -245,55 +245,13 @@ int ascii2gsm7(char *data, unsigned char **data_enc, int length)
 
 void hex_dump(void *data, int size)
 {
-	/* dumps size bytes of *data to stdout. Looks like:
-	 * [0000] 75 6E 6B 6E 6F 77 6E 20
-	 *				  30 FF 00 00 00 00 39 00 unknown 0.....9.
-	 * (in a single line of course)
-	 */
-
-	unsigned char *p = data;
-	unsigned char c;
-	int n;
-	char bytestr[4] = {0};
-	char addrstr[10] = {0};
-	char hexstr[ 16*3 + 5] = {0};
-	char charstr[16*1 + 5] = {0};
-	for(n=1;n<=size;n++) {
-		if (n%16 == 1) {
-			/* store address for this line */
-			snprintf(addrstr, sizeof(addrstr), "%.4x",
-			   ((unsigned int)p-(unsigned int)data) );
-		}
-
-		c = *p;
-		if (isalnum(c) == 0) {
-			c = '.';
-		}
-
-		/* store hex str (for left side) */
-		snprintf(bytestr, sizeof(bytestr), "%02X ", *p);
-		strncat(hexstr, bytestr, sizeof(hexstr)-strlen(hexstr)-1);
-
-		/* store char str (for right side) */
-		snprintf(bytestr, sizeof(bytestr), "%c", c);
-		strncat(charstr, bytestr, sizeof(charstr)-strlen(charstr)-1);
-
-		if(n%16 == 0) {
-			/* line completed */
-			LOGD("[%4.4s]   %-50.50s  %s", addrstr, hexstr, charstr);
-			hexstr[0] = 0;
-			charstr[0] = 0;
-		} else if(n%8 == 0) {
-			/* half line: add whitespaces */
-			strncat(hexstr, "  ", sizeof(hexstr)-strlen(hexstr)-1);
-			strncat(charstr, " ", sizeof(charstr)-strlen(charstr)-1);
-		}
-		p++; /* next byte */
-	}
+	char line[IPC_HEX_LINE_SIZE];
+	uint8_t *p = data;
+	int offset;
 
-	if (strlen(hexstr) > 0) {
-		/* print rest of buffer if not empty */
-		LOGD("[%4.4s]   %-50.50s  %s\n", addrstr, hexstr, charstr);
+	for(offset = 0 ; offset < size ; offset += 16) {
+		ipc_hex_dump_line(line, p + offset, offset, size - offset);
+		LOGD("%s", line);
 	}
 }
 
@@ -0,0 +1,646 @@
+/**
+ * This file is part of mocha-ril.
+ *
+ * mocha-ril is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * mocha-ril is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with mocha-ril.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <time.h>
+#include <errno.h>
+
+#define LOG_TAG "RIL-Mocha-Worker"
+#include <utils/Log.h>
+#include <cutils/properties.h>
+
+#include "mocha-ril.h"
+#include <tapi.h>
+#include <proto.h>
+
+/*
+ * The reader only sorts received frames by subsystem, each subsystem
+ * worker dispatches its own under its own lock. An fsync in the FM code
+ * or a slow ifc_configure in GPRS no longer holds back call signalling.
+ *
+ * GPRS, FM and SMS own all of their state and never hold RIL_LOCK for a
+ * whole handler, SMS only takes it to copy the SMSC number SIM fills in.
+ * Call, network and SIM are what the state snapshot is published from,
+ * and misc tokens are completed from SIM and PWR handlers, so those
+ * still share ril_data.state and their lock also takes RIL_LOCK, but
+ * only for the time a handler runs. Lock order is always subsystem lock
+ * first, then RIL_LOCK.
+ *
+ * The reactor thread never takes a subsystem lock, nor RIL_LOCK: frames,
+ * SRS messages and request deadlines are all handed to the workers, so a
+ * long handler can't hold back the modem fd, SRS or the timers.
+ *
+ * Right after receive, frames are also sorted into priority classes by
+ * FIFO cmd and TAPI service. The reader queues a batch highest class
+ * first, so a subsystem pushing back on bulk data can't hold call frames
+ * received with it, and each worker drains its urgent queue before the
+ * others.
+ */
+
+static struct ril_worker ril_workers[RIL_SUBSYSTEM_COUNT] = {
+	[RIL_SUBSYSTEM_CALL] = { .name = "call", .shared = 1 },
+	[RIL_SUBSYSTEM_SMS] = { .name = "sms", .shared = 0 },
+	[RIL_SUBSYSTEM_NETWORK] = { .name = "network", .shared = 1 },
+	[RIL_SUBSYSTEM_SIM] = { .name = "sim", .shared = 1 },
+	[RIL_SUBSYSTEM_GPRS] = { .name = "gprs", .shared = 0 },
+	[RIL_SUBSYSTEM_FM] = { .name = "fm", .shared = 0 },
+	[RIL_SUBSYSTEM_MISC] = { .name = "misc", .shared = 1 },
+};
+
+static int ril_workers_initialized;
+
+static uint8_t ril_rx_cmd_class[256];
+static uint8_t ril_rx_tapi_class[RIL_RX_TAPI_SERVICES];
+
+static const char *ril_rx_class_names[RIL_RX_CLASS_COUNT] = {
+	[RIL_RX_CLASS_URGENT] = "urgent",
+	[RIL_RX_CLASS_CONTROL] = "control",
+	[RIL_RX_CLASS_BULK] = "bulk",
+};
+
+static uint64_t ril_worker_time_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/**
+ * Subsystem locks
+ */
+
+void ril_subsystem_lock(enum ril_subsystem subsystem)
+{
+	pthread_mutex_lock(&ril_workers[subsystem].lock);
+
+	if(ril_workers[subsystem].shared)
+		RIL_LOCK();
+}
+
+void ril_subsystem_unlock(enum ril_subsystem subsystem)
+{
+	if(ril_workers[subsystem].shared) {
+		ril_state_publish();
+		RIL_UNLOCK();
+	}
+
+	pthread_mutex_unlock(&ril_workers[subsystem].lock);
+}
+
+static enum ril_subsystem ril_frame_subsystem(struct modem_io *frame)
+{
+	struct tapiPacketHeader *header;
+
+	switch(frame->cmd) {
+		case FIFO_PKT_TAPI:
+			if(frame->datasize < sizeof(struct tapiPacketHeader))
+				return RIL_SUBSYSTEM_MISC;
+
+			header = (struct tapiPacketHeader *) frame->data;
+
+			switch(header->tapiService) {
+				case TAPI_TYPE_CALL:
+					return RIL_SUBSYSTEM_CALL;
+				case TAPI_TYPE_NETTEXT:
+					return RIL_SUBSYSTEM_SMS;
+				case TAPI_TYPE_NETWORK:
+					return RIL_SUBSYSTEM_NETWORK;
+				default:
+					return RIL_SUBSYSTEM_MISC;
+			}
+		case FIFO_PKT_SIM:
+			return RIL_SUBSYSTEM_SIM;
+		case FIFO_PKT_PROTO:
+			return RIL_SUBSYSTEM_GPRS;
+		case FIFO_PKT_FILE:
+			return RIL_SUBSYSTEM_FM;
+		default:
+			return RIL_SUBSYSTEM_MISC;
+	}
+}
+
+/**
+ * Priority classes
+ */
+
+static void ril_rx_classes_init(void)
+{
+	char value[PROPERTY_VALUE_MAX];
+	char *entry, *next;
+	int cmd, service, class;
+
+	memset(ril_rx_cmd_class, RIL_RX_CLASS_CONTROL, sizeof(ril_rx_cmd_class));
+	memset(ril_rx_tapi_class, RIL_RX_CLASS_CONTROL, sizeof(ril_rx_tapi_class));
+
+	ril_rx_cmd_class[FIFO_PKT_SIM] = RIL_RX_CLASS_URGENT;
+	ril_rx_cmd_class[FIFO_PKT_SOUND] = RIL_RX_CLASS_URGENT;
+	ril_rx_tapi_class[TAPI_TYPE_CALL] = RIL_RX_CLASS_URGENT;
+
+	ril_rx_cmd_class[FIFO_PKT_FILE] = RIL_RX_CLASS_BULK;
+	ril_rx_cmd_class[FIFO_PKT_LBS] = RIL_RX_CLASS_BULK;
+	ril_rx_cmd_class[FIFO_PKT_DEBUG] = RIL_RX_CLASS_BULK;
+
+	property_get(RIL_RX_CLASS_PROPERTY, value, "");
+
+	for(entry = strtok_r(value, ",", &next) ; entry != NULL ; entry = strtok_r(NULL, ",", &next)) {
+		if(sscanf(entry, "%d.%d=%d", &cmd, &service, &class) == 3) {
+			if(cmd == FIFO_PKT_TAPI && service >= 0 && service < RIL_RX_TAPI_SERVICES &&
+			   class >= 0 && class < RIL_RX_CLASS_COUNT)
+				ril_rx_tapi_class[service] = class;
+		} else if(sscanf(entry, "%d=%d", &cmd, &class) == 2) {
+			if(cmd >= 0 && cmd < 256 && class >= 0 && class < RIL_RX_CLASS_COUNT)
+				ril_rx_cmd_class[cmd] = class;
+		} else {
+			LOGE("Ignoring bad %s entry: %s", RIL_RX_CLASS_PROPERTY, entry);
+		}
+	}
+}
+
+/* Only packet data is bulk on FIFO_PKT_PROTO, the rest is connection control */
+static enum ril_rx_class ril_rx_classify(struct modem_io *frame)
+{
+	struct tapiPacketHeader *tapi_header;
+	struct protoPacketHeader *proto_header;
+
+	switch(frame->cmd) {
+		case FIFO_PKT_TAPI:
+			if(frame->datasize < sizeof(struct tapiPacketHeader))
+				break;
+
+			tapi_header = (struct tapiPacketHeader *) frame->data;
+			if(tapi_header->tapiService < RIL_RX_TAPI_SERVICES)
+				return ril_rx_tapi_class[tapi_header->tapiService];
+			break;
+		case FIFO_PKT_PROTO:
+			if(frame->datasize < sizeof(struct protoPacketHeader))
+				break;
+
+			proto_header = (struct protoPacketHeader *) frame->data;
+			if(proto_header->type == PROTO_PACKET_RECEIVE_DATA_IND)
+				return RIL_RX_CLASS_BULK;
+			break;
+	}
+
+	return ril_rx_cmd_class[frame->cmd & 0xff];
+}
+
+enum ril_subsystem ril_request_subsystem(int request)
+{
+	switch(request) {
+		case RIL_REQUEST_DIAL:
+		case RIL_REQUEST_GET_CURRENT_CALLS:
+		case RIL_REQUEST_HANGUP:
+		case RIL_REQUEST_HANGUP_WAITING_OR_BACKGROUND:
+		case RIL_REQUEST_HANGUP_FOREGROUND_RESUME_BACKGROUND:
+		case RIL_REQUEST_ANSWER:
+		case RIL_REQUEST_LAST_CALL_FAIL_CAUSE:
+		case RIL_REQUEST_DTMF:
+		case RIL_REQUEST_DTMF_START:
+		case RIL_REQUEST_DTMF_STOP:
+		case RIL_REQUEST_SWITCH_WAITING_OR_HOLDING_AND_ACTIVE:
+		case RIL_REQUEST_SET_MUTE:
+			return RIL_SUBSYSTEM_CALL;
+		case RIL_REQUEST_SEND_SMS:
+		case RIL_REQUEST_SEND_SMS_EXPECT_MORE:
+		case RIL_REQUEST_SMS_ACKNOWLEDGE:
+			return RIL_SUBSYSTEM_SMS;
+		case RIL_REQUEST_OPERATOR:
+		case RIL_REQUEST_VOICE_REGISTRATION_STATE:
+		case RIL_REQUEST_DATA_REGISTRATION_STATE:
+		case RIL_REQUEST_QUERY_AVAILABLE_NETWORKS:
+		case RIL_REQUEST_SET_NETWORK_SELECTION_AUTOMATIC:
+		case RIL_REQUEST_SET_NETWORK_SELECTION_MANUAL:
+		case RIL_REQUEST_QUERY_NETWORK_SELECTION_MODE:
+		case RIL_REQUEST_GET_PREFERRED_NETWORK_TYPE:
+		case RIL_REQUEST_SET_PREFERRED_NETWORK_TYPE:
+			return RIL_SUBSYSTEM_NETWORK;
+		case RIL_REQUEST_GET_SIM_STATUS:
+		case RIL_REQUEST_GET_IMSI:
+		case RIL_REQUEST_ENTER_SIM_PIN:
+		case RIL_REQUEST_ENTER_SIM_PUK:
+		case RIL_REQUEST_QUERY_FACILITY_LOCK:
+		case RIL_REQUEST_SET_FACILITY_LOCK:
+		case RIL_REQUEST_CHANGE_SIM_PIN:
+			return RIL_SUBSYSTEM_SIM;
+		case RIL_REQUEST_SETUP_DATA_CALL:
+		case RIL_REQUEST_DEACTIVATE_DATA_CALL:
+		case RIL_REQUEST_LAST_DATA_CALL_FAIL_CAUSE:
+		case RIL_REQUEST_DATA_CALL_LIST:
+			return RIL_SUBSYSTEM_GPRS;
+		default:
+			return RIL_SUBSYSTEM_MISC;
+	}
+}
+
+/**
+ * Workers
+ */
+
+static void ril_worker_account(struct ril_worker *worker, uint64_t queued_us, uint64_t now_us)
+{
+	uint32_t latency;
+	int bucket;
+
+	latency = (uint32_t) (now_us - queued_us);
+
+	for(bucket = 0 ; bucket < RIL_WORKER_BUCKETS - 1 && (latency >> (bucket + 1)) != 0 ; bucket++);
+
+	worker->stats.latency[bucket]++;
+	worker->stats.frames++;
+	if(latency > worker->stats.max_latency_us)
+		worker->stats.max_latency_us = latency;
+}
+
+/* Called with the worker mutex held */
+static int ril_worker_pending(struct ril_worker *worker)
+{
+	int c;
+
+	for(c = 0 ; c < RIL_RX_CLASS_COUNT ; c++)
+		if(worker->lanes[c].head != worker->lanes[c].tail)
+			return 1;
+
+	return 0;
+}
+
+/* Fills the batch highest class first, called with the worker mutex held */
+static int ril_worker_take(struct ril_worker *worker, struct ril_worker_frame *batch)
+{
+	struct ril_worker_lane *lane;
+	uint64_t now_us;
+	uint32_t wait;
+	int count = 0;
+	int c;
+
+	now_us = ril_worker_time_us();
+
+	for(c = 0 ; c < RIL_RX_CLASS_COUNT ; c++) {
+		lane = &worker->lanes[c];
+
+		while(count < RIL_WORKER_BATCH && lane->head != lane->tail) {
+			batch[count] = lane->queue[lane->head % RIL_WORKER_QUEUE_SIZE];
+			lane->head++;
+
+			wait = (uint32_t) (now_us - batch[count].queued_us);
+			lane->stats.total_wait_us += wait;
+			if(wait > lane->stats.max_wait_us)
+				lane->stats.max_wait_us = wait;
+			lane->stats.depth = lane->tail - lane->head;
+
+			count++;
+		}
+	}
+
+	return count;
+}
+
+static void *ril_worker_thread(void *data)
+{
+	struct ril_worker *worker = (struct ril_worker *) data;
+	enum ril_subsystem subsystem = (enum ril_subsystem) (worker - ril_workers);
+	struct ril_worker_frame batch[RIL_WORKER_BATCH];
+	uint64_t now_us;
+	int count;
+	int i;
+
+	while(1) {
+		pthread_mutex_lock(&worker->mutex);
+
+		while(worker->running && !ril_worker_pending(worker))
+			pthread_cond_wait(&worker->work, &worker->mutex);
+
+		if(!worker->running && !ril_worker_pending(worker)) {
+			pthread_mutex_unlock(&worker->mutex);
+			break;
+		}
+
+		count = ril_worker_take(worker, batch);
+
+		worker->busy = 1;
+		pthread_cond_broadcast(&worker->done);
+		pthread_mutex_unlock(&worker->mutex);
+
+		ril_subsystem_lock(subsystem);
+
+		for(i = 0 ; i < count ; i++) {
+			if(batch[i].call != NULL)
+				batch[i].call(batch[i].data);
+			else
+				ipc_dispatch(batch[i].client, &batch[i].frame);
+		}
+
+		ril_subsystem_unlock(subsystem);
+
+		now_us = ril_worker_time_us();
+
+		for(i = 0 ; i < count ; i++) {
+			ipc_frame_unref(&batch[i].frame);
+			ril_worker_account(worker, batch[i].queued_us, now_us);
+		}
+
+		pthread_mutex_lock(&worker->mutex);
+		worker->busy = 0;
+		pthread_cond_broadcast(&worker->done);
+		pthread_mutex_unlock(&worker->mutex);
+	}
+
+	return NULL;
+}
+
+/* Every subsystem needs its worker, nothing is handled on the reactor thread */
+int ril_workers_start(void)
+{
+	struct ril_worker *worker;
+	int i;
+
+	ril_rx_classes_init();
+
+	for(i = 0 ; i < RIL_SUBSYSTEM_COUNT ; i++) {
+		worker = &ril_workers[i];
+
+		pthread_mutex_init(&worker->lock, NULL);
+		pthread_mutex_init(&worker->mutex, NULL);
+		pthread_cond_init(&worker->work, NULL);
+		pthread_cond_init(&worker->done, NULL);
+		memset(worker->lanes, 0, sizeof(worker->lanes));
+		memset(&worker->stats, 0, sizeof(worker->stats));
+	}
+
+	ril_workers_initialized = 1;
+
+	for(i = 0 ; i < RIL_SUBSYSTEM_COUNT ; i++) {
+		worker = &ril_workers[i];
+		worker->running = 1;
+
+		if(pthread_create(&worker->thread, NULL, ril_worker_thread, (void *) worker) != 0) {
+			LOGE("Unable to start the %s worker", worker->name);
+			worker->running = 0;
+			ril_workers_stop();
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+void ril_workers_stop(void)
+{
+	struct ril_worker *worker;
+	int i;
+
+	for(i = 0 ; i < RIL_SUBSYSTEM_COUNT ; i++) {
+		worker = &ril_workers[i];
+
+		pthread_mutex_lock(&worker->mutex);
+		if(!worker->running) {
+			pthread_mutex_unlock(&worker->mutex);
+			continue;
+		}
+		worker->running = 0;
+		pthread_cond_broadcast(&worker->work);
+		pthread_mutex_unlock(&worker->mutex);
+
+		pthread_join(worker->thread, NULL);
+	}
+}
+
+/*
+ * Queues an entry for the worker of a subsystem, -1 if it has none (it
+ * failed to start or was stopped). Blocks while the lane is full.
+ */
+static int ril_worker_queue(enum ril_subsystem subsystem, enum ril_rx_class class,
+	struct ril_worker_frame *entry)
+{
+	struct ril_worker *worker;
+	struct ril_worker_lane *lane;
+
+	worker = &ril_workers[subsystem];
+
+	if(!ril_workers_initialized)
+		return -1;
+
+	pthread_mutex_lock(&worker->mutex);
+
+	if(!worker->running) {
+		pthread_mutex_unlock(&worker->mutex);
+		return -1;
+	}
+
+	lane = &worker->lanes[class];
+
+	if(lane->tail - lane->head == RIL_WORKER_QUEUE_SIZE) {
+		lane->stats.full_waits++;
+		while(worker->running && lane->tail - lane->head == RIL_WORKER_QUEUE_SIZE)
+			pthread_cond_wait(&worker->done, &worker->mutex);
+
+		/* Stopped while waiting, the lane is still full */
+		if(!worker->running) {
+			pthread_mutex_unlock(&worker->mutex);
+			return -1;
+		}
+	}
+
+	lane->queue[lane->tail % RIL_WORKER_QUEUE_SIZE] = *entry;
+	lane->tail++;
+
+	lane->stats.frames++;
+	lane->stats.depth = lane->tail - lane->head;
+	if(lane->stats.depth > lane->stats.max_depth)
+		lane->stats.max_depth = lane->stats.depth;
+
+	pthread_cond_signal(&worker->work);
+	pthread_mutex_unlock(&worker->mutex);
+
+	return 0;
+}
+
+/* Hands one frame to its worker, dropping it when there is none */
+static void ril_worker_queue_frame(struct ipc_client *client, struct modem_io *frame,
+	enum ril_rx_class class, uint64_t now_us)
+{
+	struct ril_worker_frame entry;
+	enum ril_subsystem subsystem;
+
+	subsystem = ril_frame_subsystem(frame);
+
+	memset(&entry, 0, sizeof(entry));
+	entry.client = client;
+	entry.frame = *frame;
+	entry.queued_us = now_us;
+
+	if(ril_worker_queue(subsystem, class, &entry) < 0) {
+		LOGE("No %s worker, dropping frame cmd %d", ril_workers[subsystem].name, frame->cmd);
+		ipc_frame_unref(frame);
+	}
+}
+
+/*
+ * Runs call(data) on the worker of subsystem, with the subsystem lock
+ * held, after the control frames queued before it. For the reactor
+ * thread, which must not take the lock itself. Returns -1, without
+ * calling it, when there is no worker.
+ */
+int ril_worker_call(enum ril_subsystem subsystem, void (*call)(void *data), void *data)
+{
+	struct ril_worker_frame entry;
+
+	memset(&entry, 0, sizeof(entry));
+	entry.call = call;
+	entry.data = data;
+	entry.queued_us = ril_worker_time_us();
+
+	return ril_worker_queue(subsystem, RIL_RX_CLASS_CONTROL, &entry);
+}
+
+/*
+ * Takes over the frames. Blocks while the target queue is full, so a
+ * stuck subsystem pushes back on the reader instead of growing without
+ * bound. The batch is queued one class at a time, urgent frames first.
+ * received_us is when the reader went for the batch.
+ */
+void ril_workers_queue(struct ipc_client *client, struct modem_io *frames, int count, uint64_t received_us)
+{
+	uint8_t classes[IPC_RECV_BATCH];
+	uint64_t now_us;
+	int c;
+	int i;
+
+	now_us = ril_worker_time_us();
+
+	/* Packet data goes straight to the tun, see gprs_downlink_queue */
+	count = gprs_downlink_queue(frames, count, received_us);
+
+	while(count > 0) {
+		for(i = 0 ; i < count && i < IPC_RECV_BATCH ; i++)
+			classes[i] = ril_rx_classify(&frames[i]);
+
+		for(c = 0 ; c < RIL_RX_CLASS_COUNT ; c++)
+			for(i = 0 ; i < count && i < IPC_RECV_BATCH ; i++)
+				if(classes[i] == c)
+					ril_worker_queue_frame(client, &frames[i], c, now_us);
+
+		frames += IPC_RECV_BATCH;
+		count -= IPC_RECV_BATCH;
+	}
+}
+
+/* Waits until every frame queued so far has been handled */
+void ril_workers_flush(void)
+{
+	struct ril_worker *worker;
+	int i;
+
+	if(!ril_workers_initialized)
+		return;
+
+	for(i = 0 ; i < RIL_SUBSYSTEM_COUNT ; i++) {
+		worker = &ril_workers[i];
+
+		if(pthread_equal(worker->thread, pthread_self()))
+			continue;
+
+		pthread_mutex_lock(&worker->mutex);
+		while(worker->running && (ril_worker_pending(worker) || worker->busy))
+			pthread_cond_wait(&worker->done, &worker->mutex);
+		pthread_mutex_unlock(&worker->mutex);
+	}
+}
+
+static uint32_t ril_worker_percentile_us(struct ril_worker_stats *stats, uint32_t percent)
+{
+	uint32_t wanted;
+	uint32_t seen = 0;
+	int i;
+
+	if(stats->frames == 0)
+		return 0;
+
+	wanted = (uint32_t) (((uint64_t) stats->frames * percent + 99) / 100);
+
+	for(i = 0 ; i < RIL_WORKER_BUCKETS ; i++) {
+		seen += stats->latency[i];
+		if(seen >= wanted)
+			return (2U << i) - 1;
+	}
+
+	return stats->max_latency_us;
+}
+
+/* Sums the class queues of all workers */
+void ril_rx_get_stats(struct ril_rx_class_stats *stats)
+{
+	struct ril_rx_class_stats *lane_stats;
+	struct ril_worker *worker;
+	int c;
+	int i;
+
+	memset(stats, 0, sizeof(struct ril_rx_class_stats) * RIL_RX_CLASS_COUNT);
+
+	for(i = 0 ; i < RIL_SUBSYSTEM_COUNT ; i++) {
+		worker = &ril_workers[i];
+
+		if(ril_workers_initialized)
+			pthread_mutex_lock(&worker->mutex);
+
+		for(c = 0 ; c < RIL_RX_CLASS_COUNT ; c++) {
+			lane_stats = &worker->lanes[c].stats;
+
+			stats[c].frames += lane_stats->frames;
+			stats[c].depth += lane_stats->depth;
+			stats[c].full_waits += lane_stats->full_waits;
+			stats[c].total_wait_us += lane_stats->total_wait_us;
+			if(lane_stats->max_depth > stats[c].max_depth)
+				stats[c].max_depth = lane_stats->max_depth;
+			if(lane_stats->max_wait_us > stats[c].max_wait_us)
+				stats[c].max_wait_us = lane_stats->max_wait_us;
+		}
+
+		if(ril_workers_initialized)
+			pthread_mutex_unlock(&worker->mutex);
+	}
+}
+
+void ril_workers_log_stats(void)
+{
+	struct ril_rx_class_stats classes[RIL_RX_CLASS_COUNT];
+	struct ril_worker_stats *stats;
+	int i;
+
+	for(i = 0 ; i < RIL_SUBSYSTEM_COUNT ; i++) {
+		stats = &ril_workers[i].stats;
+
+		if(stats->frames == 0)
+			continue;
+
+		LOGD("Worker %s: %d frames, p99 < %dus, max %dus", ril_workers[i].name,
+			stats->frames, ril_worker_percentile_us(stats, 99), stats->max_latency_us);
+	}
+
+	ril_rx_get_stats(classes);
+
+	for(i = 0 ; i < RIL_RX_CLASS_COUNT ; i++) {
+		if(classes[i].frames == 0)
+			continue;
+
+		LOGD("RX class %s: %d frames, backlog %d (max %d), %d full waits, wait avg %dus, max %dus",
+			ril_rx_class_names[i], classes[i].frames, classes[i].depth, classes[i].max_depth,
+			classes[i].full_waits, (uint32_t) (classes[i].total_wait_us / classes[i].frames),
+			classes[i].max_wait_us);
+	}
+}
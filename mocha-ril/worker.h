@@ -0,0 +1,130 @@
+/**
+ * This file is part of mocha-ril.
+ *
+ * mocha-ril is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * mocha-ril is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with mocha-ril.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef _SAMSUNG_RIL_WORKER_H_
+#define _SAMSUNG_RIL_WORKER_H_
+
+#include <stdint.h>
+#include <pthread.h>
+
+#include <radio.h>
+
+/*
+ * Inbound frames, RILJ requests and SRS messages are handled by the
+ * subsystem they belong to, each with its own worker thread and lock.
+ */
+enum ril_subsystem {
+	RIL_SUBSYSTEM_CALL,
+	RIL_SUBSYSTEM_SMS,
+	RIL_SUBSYSTEM_NETWORK,
+	RIL_SUBSYSTEM_SIM,
+	RIL_SUBSYSTEM_GPRS,
+	RIL_SUBSYSTEM_FM,
+	RIL_SUBSYSTEM_MISC,
+	RIL_SUBSYSTEM_COUNT,
+};
+
+/*
+ * Inbound priority classes. Each worker has a queue per class and always
+ * drains the higher classes first, order is only kept within a class.
+ */
+enum ril_rx_class {
+	RIL_RX_CLASS_URGENT = 0,	/* Call and SIM events */
+	RIL_RX_CLASS_CONTROL,
+	RIL_RX_CLASS_BULK,		/* File, debug and packet data */
+	RIL_RX_CLASS_COUNT
+};
+
+#define RIL_RX_TAPI_SERVICES	8
+/* Class overrides, "<cmd>[.<tapi service>]=<class>,..." */
+#define RIL_RX_CLASS_PROPERTY	"ril.ipc.rx_class"
+
+/* Frames queued per subsystem and class, must be a power of two */
+#define RIL_WORKER_QUEUE_SIZE	64
+/* Frames handled per wake-up */
+#define RIL_WORKER_BATCH	16
+/* Latency histogram, bucket n counts [2^n, 2^(n+1)) us */
+#define RIL_WORKER_BUCKETS	24
+
+/* Either a received frame or, with call set, work handed over by the reactor */
+struct ril_worker_frame {
+	struct ipc_client *client;
+	struct modem_io frame;
+	void (*call)(void *data);
+	void *data;
+	uint64_t queued_us;
+};
+
+struct ril_worker_stats {
+	uint32_t frames;
+	uint32_t max_latency_us;
+	uint32_t latency[RIL_WORKER_BUCKETS];
+};
+
+/* Wait is the time from the reader queueing a frame to a worker taking it */
+struct ril_rx_class_stats {
+	uint32_t frames;
+	uint32_t depth;
+	uint32_t max_depth;
+	uint32_t full_waits;
+	uint32_t max_wait_us;
+	uint64_t total_wait_us;
+};
+
+struct ril_worker_lane {
+	struct ril_worker_frame queue[RIL_WORKER_QUEUE_SIZE];
+	uint32_t head;
+	uint32_t tail;
+
+	struct ril_rx_class_stats stats;
+};
+
+struct ril_worker {
+	const char *name;
+	/* Handlers still reach ril_data.state, so they also need RIL_LOCK */
+	int shared;
+
+	pthread_t thread;
+	int running;
+
+	/* Subsystem state */
+	pthread_mutex_t lock;
+
+	/* Queues, busy is set while a batch is out of them */
+	pthread_mutex_t mutex;
+	pthread_cond_t work;
+	pthread_cond_t done;
+	struct ril_worker_lane lanes[RIL_RX_CLASS_COUNT];
+	int busy;
+
+	struct ril_worker_stats stats;
+};
+
+int ril_workers_start(void);
+void ril_workers_stop(void);
+void ril_workers_queue(struct ipc_client *client, struct modem_io *frames, int count, uint64_t received_us);
+int ril_worker_call(enum ril_subsystem subsystem, void (*call)(void *data), void *data);
+void ril_workers_flush(void);
+void ril_workers_log_stats(void);
+void ril_rx_get_stats(struct ril_rx_class_stats *stats);
+
+void ril_subsystem_lock(enum ril_subsystem subsystem);
+void ril_subsystem_unlock(enum ril_subsystem subsystem);
+enum ril_subsystem ril_request_subsystem(int request);
+
+#endif
@@ -0,0 +1,294 @@
+/**
+ * This file is part of libmocha-ipc.
+ *
+ * Converts the binary frame captures written by ipc_capture_start into the
+ * old ipc_log.txt text format or into pcap-ng (LINKTYPE_USER0, each packet
+ * being the 12 byte FIFO header followed by the captured payload).
+ *
+ * libmocha-ipc is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libmocha-ipc is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with libmocha-ipc.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <getopt.h>
+
+#include <radio.h>
+
+#define PCAPNG_SHB          0x0A0D0D0A
+#define PCAPNG_IDB          0x00000001
+#define PCAPNG_EPB          0x00000006
+#define PCAPNG_BYTE_ORDER   0x1A2B3C4D
+#define PCAPNG_LINKTYPE     147
+#define PCAPNG_IF_TSRESOL   9
+#define PCAPNG_EPB_FLAGS    2
+#define PCAPNG_INBOUND      1
+#define PCAPNG_OUTBOUND     2
+
+#define PAD4(n) (((n) + 3) & ~3)
+
+enum {
+    FORMAT_TEXT = 0,
+    FORMAT_PCAPNG,
+};
+
+int format = FORMAT_TEXT;
+
+static void write_u16(FILE *out, uint16_t value)
+{
+    fwrite(&value, sizeof(value), 1, out);
+}
+
+static void write_u32(FILE *out, uint32_t value)
+{
+    fwrite(&value, sizeof(value), 1, out);
+}
+
+static void write_pad(FILE *out, uint32_t length)
+{
+    static const uint8_t zero[4];
+
+    fwrite(zero, 1, PAD4(length) - length, out);
+}
+
+void pcapng_write_header(FILE *out)
+{
+    /* Section header, section length unknown */
+    write_u32(out, PCAPNG_SHB);
+    write_u32(out, 28);
+    write_u32(out, PCAPNG_BYTE_ORDER);
+    write_u16(out, 1);
+    write_u16(out, 0);
+    write_u32(out, 0xffffffff);
+    write_u32(out, 0xffffffff);
+    write_u32(out, 28);
+
+    /* Interface with nanosecond timestamps */
+    write_u32(out, PCAPNG_IDB);
+    write_u32(out, 32);
+    write_u16(out, PCAPNG_LINKTYPE);
+    write_u16(out, 0);
+    write_u32(out, 0);
+    write_u16(out, PCAPNG_IF_TSRESOL);
+    write_u16(out, 1);
+    write_u32(out, 9);
+    write_u32(out, 0);
+    write_u32(out, 32);
+}
+
+void pcapng_write_record(FILE *out, struct ipc_capture_record *record, uint8_t *data)
+{
+    uint32_t caplen = sizeof(struct fifoPacketHeader) + record->caplen;
+    uint32_t length = 44 + PAD4(caplen);
+
+    write_u32(out, PCAPNG_EPB);
+    write_u32(out, length);
+    write_u32(out, 0);
+    write_u32(out, (uint32_t) (record->time_ns >> 32));
+    write_u32(out, (uint32_t) record->time_ns);
+    write_u32(out, caplen);
+    write_u32(out, sizeof(struct fifoPacketHeader) + record->datasize);
+
+    write_u32(out, record->magic);
+    write_u32(out, record->cmd);
+    write_u32(out, record->datasize);
+    fwrite(data, 1, record->caplen, out);
+    write_pad(out, caplen);
+
+    write_u16(out, PCAPNG_EPB_FLAGS);
+    write_u16(out, 4);
+    write_u32(out, record->direction == IPC_CAPTURE_RX ? PCAPNG_INBOUND : PCAPNG_OUTBOUND);
+    write_u32(out, 0);
+    write_u32(out, length);
+}
+
+void text_write_header(FILE *out, struct ipc_capture_file_header *header)
+{
+    fprintf(out, "LOG START! Timestamp: %d\n", (int) (header->start_ns / 1000000000ULL));
+}
+
+void text_write_record(FILE *out, struct ipc_capture_record *record, uint8_t *data)
+{
+    struct fifoPacketHeader fifo;
+    uint8_t *p = (uint8_t *) &fifo;
+    uint32_t i;
+
+    fifo.magic = record->magic;
+    fifo.cmd = record->cmd;
+    fifo.datasize = record->datasize;
+
+    fputs(record->direction == IPC_CAPTURE_RX ? "rx_frame: " : "tx_frame: ", out);
+
+    for (i = 0; i < sizeof(fifo); i++)
+        fprintf(out, "%02X ", p[i]);
+    for (i = 0; i < record->caplen; i++)
+        fprintf(out, "%02X ", data[i]);
+
+    fputc('\n', out);
+}
+
+int capconv_file(const char *path, FILE *out)
+{
+    struct ipc_capture_file_header *header;
+    struct ipc_capture_record *record;
+    uint8_t *buffer;
+    uint32_t offset, end;
+    long size;
+    FILE *in;
+    int count = 0;
+
+    in = fopen(path, "rb");
+    if (in == NULL) {
+        fprintf(stderr, "[E] Could not open %s\n", path);
+        return -1;
+    }
+
+    fseek(in, 0, SEEK_END);
+    size = ftell(in);
+    fseek(in, 0, SEEK_SET);
+
+    if (size < (long) sizeof(struct ipc_capture_file_header)) {
+        fprintf(stderr, "[E] %s is too short\n", path);
+        fclose(in);
+        return -1;
+    }
+
+    buffer = malloc(size);
+    if (buffer == NULL || fread(buffer, 1, size, in) != (size_t) size) {
+        fprintf(stderr, "[E] Could not read %s\n", path);
+        free(buffer);
+        fclose(in);
+        return -1;
+    }
+
+    fclose(in);
+
+    header = (struct ipc_capture_file_header *) buffer;
+    if (memcmp(header->magic, IPC_CAPTURE_MAGIC, sizeof(header->magic)) != 0 ||
+        header->version != IPC_CAPTURE_VERSION ||
+        header->header_size < sizeof(struct ipc_capture_file_header)) {
+        fprintf(stderr, "[E] %s is not a capture file\n", path);
+        free(buffer);
+        return -1;
+    }
+
+    /* A capture still being written is cut short at the mapped size */
+    end = header->header_size + header->used;
+    if (end > (uint32_t) size)
+        end = size;
+
+    if (format == FORMAT_TEXT)
+        text_write_header(out, header);
+
+    for (offset = header->header_size; offset + sizeof(struct ipc_capture_record) <= end; offset += record->length) {
+        record = (struct ipc_capture_record *) (buffer + offset);
+
+        if (record->length < sizeof(struct ipc_capture_record) ||
+            record->length > end - offset ||
+            record->caplen > record->length - sizeof(struct ipc_capture_record)) {
+            fprintf(stderr, "[E] %s: bad record at offset %d\n", path, offset);
+            break;
+        }
+
+        if (format == FORMAT_PCAPNG)
+            pcapng_write_record(out, record, (uint8_t *) (record + 1));
+        else
+            text_write_record(out, record, (uint8_t *) (record + 1));
+
+        count++;
+    }
+
+    free(buffer);
+
+    return count;
+}
+
+void print_help()
+{
+    printf("usage: capconv [arguments] capture [capture...]\n");
+    printf("arguments:\n");
+    printf("\t--pcapng              write pcap-ng instead of ipc_log.txt text\n");
+    printf("\t--output=[PATH]       write to PATH instead of stdout\n");
+    printf("captures are converted in the order given, oldest first\n");
+}
+
+int main(int argc, char *argv[])
+{
+    const char *output = NULL;
+    FILE *out = stdout;
+    int c = 0;
+    int opt_i = 0;
+    int count = 0;
+    int rc;
+
+    struct option opt_l[] = {
+        {"help",    no_argument,        0,  0 },
+        {"pcapng",  no_argument,        0,  0 },
+        {"output",  required_argument,  0,  0 },
+        {0,         0,                  0,  0 }
+    };
+
+    while(c >= 0) {
+        c = getopt_long(argc, argv, "", opt_l, &opt_i);
+        if(c < 0)
+            break;
+
+        if(c != 0) {
+            print_help();
+            exit(1);
+        }
+
+        if(strcmp(opt_l[opt_i].name, "help") == 0) {
+            print_help();
+            exit(1);
+        } else if(strcmp(opt_l[opt_i].name, "pcapng") == 0) {
+            format = FORMAT_PCAPNG;
+        } else if(strcmp(opt_l[opt_i].name, "output") == 0) {
+            output = optarg;
+        }
+    }
+
+    if(optind >= argc) {
+        print_help();
+        exit(1);
+    }
+
+    if(output != NULL) {
+        out = fopen(output, format == FORMAT_PCAPNG ? "wb" : "w");
+        if(out == NULL) {
+            fprintf(stderr, "[E] Could not open %s\n", output);
+            return 1;
+        }
+    }
+
+    if(format == FORMAT_PCAPNG)
+        pcapng_write_header(out);
+
+    for(; optind < argc; optind++) {
+        rc = capconv_file(argv[optind], out);
+        if(rc < 0)
+            continue;
+
+        count += rc;
+    }
+
+    if(out != stdout)
+        fclose(out);
+
+    if(output != NULL)
+        fprintf(stderr, "[I] %d records written to %s\n", count, output);
+
+    return 0;
+}
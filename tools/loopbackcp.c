@@ -0,0 +1,185 @@
+/**
+ * This file is part of libmocha-ipc.
+ *
+ * Userspace CP stand-in for the loopback IPC device. Listens on a unix
+ * socket and either echoes every frame back to the AP side or swallows it,
+ * which is enough to drive ipc-modemctrl, mocha-ril or a benchmark
+ * without a handset.
+ *
+ * libmocha-ipc is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libmocha-ipc is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with libmocha-ipc.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <string.h>
+#include <getopt.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include <radio.h>
+
+#define LOOPBACK_SOCKET_DEFAULT "/tmp/mocha-ipc.sock"
+
+int sink = 0;
+
+void loopbackcp_log_handler(const char *message, void *user_data)
+{
+    printf("%s", message);
+}
+
+int32_t loopbackcp_listen(const char *path)
+{
+    struct sockaddr_un addr;
+    int32_t fd;
+
+    if(strlen(path) >= sizeof(addr.sun_path))
+        return -1;
+
+    fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if(fd < 0)
+        return -1;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+    unlink(path);
+
+    if(bind(fd, (struct sockaddr *) &addr, sizeof(addr)) < 0 || listen(fd, 1) < 0) {
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+int32_t loopbackcp_serve(struct ipc_client *client)
+{
+    struct ipc_transport_stats stats;
+    struct modem_io frame;
+    uint32_t frames = 0, bytes = 0;
+    int32_t rc;
+
+    while(1) {
+        rc = ipc_client_recv(client, &frame);
+
+        if(rc < 0)
+            break;
+        if(rc > 0)
+            continue;
+
+        frames++;
+        bytes += frame.datasize;
+
+        if(!sink)
+            ipc_client_send(client, &frame);
+
+        ipc_frame_unref(&frame);
+    }
+
+    printf("[I] AP side gone after %d frames, %d bytes\n", frames, bytes);
+
+    if(ipc_client_get_transport_stats(client, &stats) == 0)
+        printf("[I] %d reads, %d resyncs\n", stats.read_calls, stats.resyncs);
+
+    return 0;
+}
+
+void print_help()
+{
+    printf("usage: loopbackcp [arguments]\n");
+    printf("arguments:\n");
+    printf("\t--socket=[PATH]       unix socket to listen on (default %s)\n", LOOPBACK_SOCKET_DEFAULT);
+    printf("\t--sink                drop frames instead of echoing them back\n");
+    printf("\t--debug               enable debug messages\n");
+}
+
+int main(int argc, char *argv[])
+{
+    const char *path = LOOPBACK_SOCKET_DEFAULT;
+    int c = 0;
+    int opt_i = 0;
+    int debug = 0;
+    int32_t listen_fd, fd;
+
+    struct option opt_l[] = {
+        {"help",    no_argument,        0,  0 },
+        {"debug",   no_argument,        0,  0 },
+        {"sink",    no_argument,        0,  0 },
+        {"socket",  required_argument,  0,  0 },
+        {0,         0,                  0,  0 }
+    };
+
+    while(c >= 0) {
+        c = getopt_long(argc, argv, "", opt_l, &opt_i);
+        if(c < 0)
+            break;
+
+        if(c != 0) {
+            print_help();
+            exit(1);
+        }
+
+        if(strcmp(opt_l[opt_i].name, "help") == 0) {
+            print_help();
+            exit(1);
+        } else if(strcmp(opt_l[opt_i].name, "debug") == 0) {
+            debug = 1;
+        } else if(strcmp(opt_l[opt_i].name, "sink") == 0) {
+            sink = 1;
+        } else if(strcmp(opt_l[opt_i].name, "socket") == 0) {
+            path = optarg;
+        }
+    }
+
+    ipc_init();
+
+    listen_fd = loopbackcp_listen(path);
+    if(listen_fd < 0) {
+        printf("[E] Could not listen on %s\n", path);
+        return 1;
+    }
+
+    printf("[I] Waiting for AP side on %s\n", path);
+
+    while((fd = accept(listen_fd, NULL, NULL)) >= 0) {
+        client = ipc_client_new_for_device(IPC_DEVICE_LOOPBACK);
+
+        if(client == 0) {
+            printf("[E] Could not create IPC client; aborting ...\n");
+            close(fd);
+            break;
+        }
+
+        if(debug)
+            ipc_client_set_log_handler(client, loopbackcp_log_handler, NULL);
+
+        ipc_client_create_handlers_common_data(client);
+        ipc_client_set_handlers_common_data_fd(client, fd);
+
+        loopbackcp_serve(client);
+
+        ipc_client_close(client);
+        ipc_client_destroy_handlers_common_data(client);
+        ipc_client_free(client);
+        client = 0;
+    }
+
+    close(listen_fd);
+    unlink(path);
+    ipc_shutdown();
+
+    return 0;
+}
@@ -74,12 +74,19 @@ int32_t modem_read_loop(struct ipc_client *client)
     while(1) {
         //usleep(3000);
 
-        select(fd + 1, &fds, NULL, NULL, NULL);
+        if(!ipc_client_recv_pending(client)) {
+            FD_ZERO(&fds);
+            FD_SET(fd, &fds);
+            select(fd + 1, &fds, NULL, NULL, NULL);
+        }
 
-        if(FD_ISSET(fd, &fds))
+        if(ipc_client_recv_pending(client) || FD_ISSET(fd, &fds))
         {
             rc = ipc_client_recv(client, &resp);
 
+            if(rc > 0)
+                continue;
+
             if(rc != 0) {
                 DEBUG_E("Can't RECV from modem, please run this again\n");
                 break;
@@ -87,8 +94,7 @@ int32_t modem_read_loop(struct ipc_client *client)
 
             ipc_dispatch(client, &resp);
 
-            if(resp.data != NULL)
-                free(resp.data);
+            ipc_frame_unref(&resp);
         }
     }
 
@@ -137,7 +143,7 @@ int32_t modem_start(struct ipc_client *client)
     if(rc < 0)
         return -1;
 
-    client_fd = ipc_client_get_handlers_common_data_fd(client);
+    client_fd = ipc_client_get_poll_fd(client);
 
     //DEBUG_I("Power on modem\n");
 
@@ -251,7 +257,7 @@ int main(int argc, char *argv[])
                 printf("[E] Something went wrong\n");
                 return 1;
             }
-			client_fd = ipc_client_get_handlers_common_data_fd(client);
+			client_fd = ipc_client_get_poll_fd(client);
             if(rc < 0) {
                 printf("[E] Something went wrong\n");
                 return 1;
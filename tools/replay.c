@@ -0,0 +1,192 @@
+/**
+ * This file is part of libmocha-ipc.
+ *
+ * Feeds the CP to AP frames of ipc_capture files through ipc_dispatch, at
+ * full speed or at their recorded pace, and reports how fast the stack got
+ * through them and whether it sent what the capture says it sent.
+ *
+ * libmocha-ipc is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libmocha-ipc is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with libmocha-ipc.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <string.h>
+#include <getopt.h>
+
+#include <radio.h>
+
+#define REPLAY_HANDLER_STATS 16
+#define REPLAY_CAPTURE_SIZE (16 * 1024 * 1024)
+
+void replay_log_handler(const char *message, void *user_data)
+{
+    printf("%s", message);
+}
+
+int32_t replay_run(struct ipc_client *client)
+{
+    struct modem_io frame;
+    int32_t rc;
+
+    while(1) {
+        rc = ipc_client_recv(client, &frame);
+
+        if(rc < 0)
+            break;
+        if(rc > 0)
+            continue;
+
+        ipc_dispatch(client, &frame);
+        ipc_frame_unref(&frame);
+    }
+
+    return 0;
+}
+
+void replay_report(struct ipc_client *client)
+{
+    struct ipc_dispatch_stats dispatch_stats[REPLAY_HANDLER_STATS];
+    struct ipc_replay_stats stats;
+    double seconds;
+    int count;
+    int i;
+
+    if(ipc_replay_get_stats(client, &stats) < 0)
+        return;
+
+    seconds = stats.elapsed_ns / 1e9;
+
+    printf("[I] %d frames, %llu bytes in %.3fs", stats.frames,
+        (unsigned long long) stats.bytes, seconds);
+    if(seconds > 0)
+        printf(", %.0f frames/s", stats.frames / seconds);
+    printf("\n");
+
+    if(stats.skipped > 0)
+        printf("[I] %d truncated frames skipped\n", stats.skipped);
+    if(stats.max_lag_us > 0)
+        printf("[I] frames handed out up to %dus late\n", stats.max_lag_us);
+
+    printf("[I] sent %d frames: %d as captured, %d differing, %d extra, %d captured but not sent\n",
+        stats.tx_frames, stats.tx_matched, stats.tx_mismatched, stats.tx_extra, stats.tx_missing);
+
+    count = ipc_dispatch_get_stats(dispatch_stats, REPLAY_HANDLER_STATS);
+    for(i = 0; i < count; i++)
+        printf("[I] %-24s %8d packets %10lluus %8lluns/packet\n", dispatch_stats[i].name,
+            dispatch_stats[i].count, (unsigned long long) dispatch_stats[i].time_ns / 1000,
+            (unsigned long long) dispatch_stats[i].time_ns / dispatch_stats[i].count);
+}
+
+void print_help()
+{
+    printf("usage: replay [arguments] capture [capture...]\n");
+    printf("arguments:\n");
+    printf("\t--realtime            hand frames out at their recorded pace\n");
+    printf("\t--output=[PATH]       capture what the stack received and sent to PATH\n");
+    printf("\t--debug               enable debug messages\n");
+    printf("captures are replayed in the order given, oldest first\n");
+}
+
+int main(int argc, char *argv[])
+{
+    const char *output = NULL;
+    int flags = 0;
+    int c = 0;
+    int opt_i = 0;
+    int debug = 0;
+    int rc = 0;
+
+    struct option opt_l[] = {
+        {"help",     no_argument,        0,  0 },
+        {"debug",    no_argument,        0,  0 },
+        {"realtime", no_argument,        0,  0 },
+        {"output",   required_argument,  0,  0 },
+        {0,          0,                  0,  0 }
+    };
+
+    while(c >= 0) {
+        c = getopt_long(argc, argv, "", opt_l, &opt_i);
+        if(c < 0)
+            break;
+
+        if(c != 0) {
+            print_help();
+            exit(1);
+        }
+
+        if(strcmp(opt_l[opt_i].name, "help") == 0) {
+            print_help();
+            exit(1);
+        } else if(strcmp(opt_l[opt_i].name, "debug") == 0) {
+            debug = 1;
+        } else if(strcmp(opt_l[opt_i].name, "realtime") == 0) {
+            flags |= IPC_REPLAY_REALTIME;
+        } else if(strcmp(opt_l[opt_i].name, "output") == 0) {
+            output = optarg;
+        }
+    }
+
+    if(optind >= argc) {
+        print_help();
+        exit(1);
+    }
+
+    ipc_init();
+
+    if(!debug)
+        ipc_log_set_level(-1, IPC_LOG_ERROR);
+
+    client = ipc_client_new_for_device(IPC_DEVICE_REPLAY);
+    if(client == 0) {
+        printf("[E] Could not create IPC client; aborting ...\n");
+        return 1;
+    }
+
+    if(debug)
+        ipc_client_set_log_handler(client, replay_log_handler, NULL);
+
+    ipc_client_create_handlers_common_data(client);
+
+    for(; optind < argc; optind++) {
+        if(ipc_replay_add_trace(client, argv[optind]) < 0)
+            printf("[E] Could not load %s\n", argv[optind]);
+    }
+
+    ipc_replay_set_flags(client, flags);
+
+    if(ipc_client_open(client) < 0) {
+        printf("[E] Nothing to replay\n");
+        rc = 1;
+        goto end;
+    }
+
+    if(output != NULL && ipc_capture_start(output, REPLAY_CAPTURE_SIZE, 1) < 0)
+        printf("[E] Could not capture to %s\n", output);
+
+    replay_run(client);
+
+    ipc_capture_stop();
+    replay_report(client);
+
+    ipc_client_close(client);
+
+end:
+    ipc_client_destroy_handlers_common_data(client);
+    ipc_client_free(client);
+    ipc_shutdown();
+
+    return rc;
+}